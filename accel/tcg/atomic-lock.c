@@ -0,0 +1,83 @@
+/*
+ * Address-hashed locks for guest atomics the host cannot do natively
+ *
+ * When the host has no instruction for a guest atomic operation (e.g.
+ * a 16-byte compare-and-swap), the default is to restart the guest
+ * instruction inside an exclusive section, stopping every other vCPU.
+ * With "-accel tcg,atomic-lock=on" such operations instead take one of
+ * a fixed set of spinlocks, selected by hashing the host address of
+ * the 16-byte granule being accessed.  Host addresses of guest RAM are
+ * unique per physical address, so aliases of the same page share a
+ * lock.
+ *
+ * The locks only serialize the fallback paths against each other.  Any
+ * other concurrent access to the same bytes is not excluded: plain
+ * loads and stores as well as atomics the host does natively, of any
+ * size, run while the lock is held and can see a torn value or be
+ * overwritten by the fallback's store.  The exclusive section rules
+ * that out, which is why this is opt-in.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/thread.h"
+#include "qemu/stats64.h"
+#include "qemu/xxhash.h"
+#include "internal.h"
+
+#define TCG_ATOMIC_LOCK_BITS 10
+
+/* One lock per cache line, so that unrelated stripes do not bounce */
+typedef struct {
+    QemuSpin lock;
+} QEMU_ALIGNED(64) TCGAtomicLock;
+
+static TCGAtomicLock tcg_atomic_locks[1 << TCG_ATOMIC_LOCK_BITS];
+static Stat64 tcg_atomic_fallbacks[TCG_ATOMIC_FALLBACK__MAX];
+
+bool tcg_atomic_lock_enabled;
+
+static void __attribute__((constructor)) tcg_atomic_lock_init(void)
+{
+    int i;
+
+    for (i = 0; i < ARRAY_SIZE(tcg_atomic_locks); i++) {
+        qemu_spin_init(&tcg_atomic_locks[i].lock);
+    }
+}
+
+QemuSpin *tcg_atomic_lock(const void *haddr, TCGAtomicFallback site)
+{
+    uint64_t granule = (uintptr_t)haddr >> 4;
+    uint32_t h = qemu_xxhash2(granule);
+    QemuSpin *lock;
+
+    lock = &tcg_atomic_locks[h & (ARRAY_SIZE(tcg_atomic_locks) - 1)].lock;
+    qemu_spin_lock(lock);
+    tcg_atomic_fallback_count(site);
+    return lock;
+}
+
+void tcg_atomic_fallback_count(TCGAtomicFallback site)
+{
+    stat64_add(&tcg_atomic_fallbacks[site], 1);
+}
+
+void tcg_atomic_fallback_dump(GString *buf)
+{
+    static const char * const names[TCG_ATOMIC_FALLBACK__MAX] = {
+        [TCG_ATOMIC_FALLBACK_CMPXCHG16] = "locked cmpxchg16",
+        [TCG_ATOMIC_FALLBACK_LOAD16]    = "locked load16",
+        [TCG_ATOMIC_FALLBACK_STORE16]   = "locked store16",
+        [TCG_ATOMIC_FALLBACK_EXCLUSIVE] = "exclusive",
+    };
+    int i;
+
+    g_string_append_printf(buf, "\nAtomic fallbacks (atomic-lock=%s):\n",
+                           tcg_atomic_lock_enabled ? "on" : "off");
+    for (i = 0; i < TCG_ATOMIC_FALLBACK__MAX; i++) {
+        g_string_append_printf(buf, "%-19s %" PRIu64 "\n", names[i],
+                               stat64_get(&tcg_atomic_fallbacks[i]));
+    }
+}
@@ -28,6 +28,7 @@
 #include "tcg/tcg.h"
 #include "qemu/atomic.h"
 #include "qemu/rcu.h"
+#include "qemu/timer.h"
 #include "exec/log.h"
 #include "qemu/main-loop.h"
 #if defined(TARGET_I386) && !defined(CONFIG_USER_ONLY)
@@ -451,11 +452,16 @@ cpu_tb_exec(CPUState *cpu, TranslationBlock *itb, int *tb_exit)
     uintptr_t ret;
     TranslationBlock *last_tb;
     const void *tb_ptr = itb->tc.ptr;
+    int64_t tb_stats_start = 0;
 
     if (qemu_loglevel_mask(CPU_LOG_TB_CPU | CPU_LOG_EXEC)) {
         log_cpu_exec(log_pc(cpu, itb), cpu, itb);
     }
 
+    if (unlikely(itb->tb_stats)) {
+        tb_stats_start = get_clock();
+    }
+
     qemu_thread_jit_execute();
     ret = tcg_qemu_tb_exec(env, tb_ptr);
     cpu->can_do_io = 1;
@@ -473,6 +479,10 @@ cpu_tb_exec(CPUState *cpu, TranslationBlock *itb, int *tb_exit)
 
     trace_exec_tb_exit(last_tb, *tb_exit);
 
+    if (unlikely(itb->tb_stats)) {
+        tb_stats_exec(itb, last_tb, *tb_exit, get_clock() - tb_stats_start);
+    }
+
     if (*tb_exit > TB_EXIT_IDX1) {
         /* We didn't start executing this TB (eg because the instruction
          * counter hit zero); we must restore the guest PC to the address
@@ -544,6 +554,8 @@ void cpu_exec_step_atomic(CPUState *cpu)
         cpu->running = true;
 
         cpu_get_tb_cpu_state(env, &pc, &cs_base, &flags);
+        tcg_atomic_fallback_count(TCG_ATOMIC_FALLBACK_EXCLUSIVE);
+        trace_exec_step_atomic(pc);
 
         cflags = curr_cflags(cpu);
         /* Execute in a serial context. */
@@ -559,9 +571,7 @@ void cpu_exec_step_atomic(CPUState *cpu)
 
         tb = tb_lookup(cpu, pc, cs_base, flags, cflags);
         if (tb == NULL) {
-            mmap_lock();
             tb = tb_gen_code(cpu, pc, cs_base, flags, cflags);
-            mmap_unlock();
         }
 
         cpu_exec_enter(cpu);
@@ -575,6 +585,9 @@ void cpu_exec_step_atomic(CPUState *cpu)
         if (have_mmap_lock()) {
             mmap_unlock();
         }
+        if (tcg_have_gen_lock()) {
+            tcg_gen_unlock();
+        }
 #endif
         if (qemu_mutex_iothread_locked()) {
             qemu_mutex_unlock_iothread();
@@ -974,9 +987,7 @@ cpu_exec_loop(CPUState *cpu, SyncClocks *sc)
                 CPUJumpCache *jc;
                 uint32_t h;
 
-                mmap_lock();
                 tb = tb_gen_code(cpu, pc, cs_base, flags, cflags);
-                mmap_unlock();
 
                 /*
                  * We add the TB in the virtual pc hash table
@@ -1032,6 +1043,9 @@ static int cpu_exec_setjmp(CPUState *cpu, SyncClocks *sc)
         if (have_mmap_lock()) {
             mmap_unlock();
         }
+        if (tcg_have_gen_lock()) {
+            tcg_gen_unlock();
+        }
 #endif
         if (qemu_mutex_iothread_locked()) {
             qemu_mutex_unlock_iothread();
@@ -1085,6 +1099,9 @@ void tcg_exec_realizefn(CPUState *cpu, Error **errp)
     }
 
     cpu->tb_jmp_cache = g_new0(CPUJumpCache, 1);
+    if (qatomic_read(&tb_stats_enabled)) {
+        tb_stats_vcpu_init(cpu);
+    }
     tlb_init(cpu);
 #ifndef CONFIG_USER_ONLY
     tcg_iommu_init_notifier_list(cpu);
@@ -1100,5 +1117,6 @@ void tcg_exec_unrealizefn(CPUState *cpu)
 #endif /* !CONFIG_USER_ONLY */
 
     tlb_destroy(cpu);
+    tb_stats_vcpu_exit(cpu);
     g_free_rcu(cpu->tb_jmp_cache, rcu);
 }
@@ -338,6 +338,21 @@ void tlb_flush_counts(size_t *pfull, size_t *ppart, size_t *pelide)
     *pelide = elide;
 }
 
+void tlb_notdirty_counts(size_t *pwrites, size_t *pgranules)
+{
+    CPUState *cpu;
+    size_t writes = 0, granules = 0;
+
+    CPU_FOREACH(cpu) {
+        CPUArchState *env = cpu->env_ptr;
+
+        writes += qatomic_read(&env_tlb(env)->c.notdirty_write_count);
+        granules += qatomic_read(&env_tlb(env)->c.dirty_granule_count);
+    }
+    *pwrites = writes;
+    *pgranules = granules;
+}
+
 static void tlb_flush_by_mmuidx_async_work(CPUState *cpu, run_on_cpu_data data)
 {
     CPUArchState *env = cpu->env_ptr;
@@ -1474,22 +1489,48 @@ static bool victim_tlb_hit(CPUArchState *env, size_t mmu_idx, size_t index,
     return false;
 }
 
+/* "-accel tcg,dirty-granule=..."; up to TARGET_PAGE_SIZE means per page */
+uint64_t tcg_dirty_granule;
+
 static void notdirty_write(CPUState *cpu, vaddr mem_vaddr, unsigned size,
                            CPUTLBEntryFull *full, uintptr_t retaddr)
 {
     ram_addr_t ram_addr = mem_vaddr + full->xlat_section;
+    CPUTLBCommon *c = &env_tlb(cpu->env_ptr)->c;
+    uint64_t granule = tcg_dirty_granule;
 
     trace_memory_notdirty_write_access(mem_vaddr, ram_addr, size);
+    qatomic_set(&c->notdirty_write_count, c->notdirty_write_count + 1);
 
     if (!cpu_physical_memory_get_dirty_flag(ram_addr, DIRTY_MEMORY_CODE)) {
         tb_invalidate_phys_range_fast(ram_addr, size, retaddr);
     }
 
+    /*
+     * With a dirty granule larger than a page, the first write that
+     * migration sees in a granule marks all of it dirty at once, so
+     * that writes to the rest of it neither trap again once their TLB
+     * entries are refilled, nor have to update the bitmap if they do.
+     * Migration may then send pages that were not actually written.
+     */
+    if (granule > TARGET_PAGE_SIZE &&
+        !cpu_physical_memory_get_dirty_flag(ram_addr,
+                                            DIRTY_MEMORY_MIGRATION)) {
+        cpu_physical_memory_set_dirty_granule(ram_addr, granule,
+                                              1 << DIRTY_MEMORY_MIGRATION);
+        qatomic_set(&c->dirty_granule_count, c->dirty_granule_count + 1);
+    }
+
     /*
      * Set both VGA and migration bits for simplicity and to remove
-     * the notdirty callback faster.
+     * the notdirty callback faster.  Nothing to do if they already are
+     * set and there is no code on the page, e.g. for the other pages
+     * of a dirty granule.
      */
-    cpu_physical_memory_set_dirty_range(ram_addr, size, DIRTY_CLIENTS_NOCODE);
+    if (cpu_physical_memory_is_clean(ram_addr)) {
+        cpu_physical_memory_set_dirty_range(ram_addr, size,
+                                            DIRTY_CLIENTS_NOCODE);
+    }
 
     /* We remove the notdirty callback only if the code has been flushed. */
     if (!cpu_physical_memory_is_clean(ram_addr)) {
@@ -10,6 +10,7 @@
 #define ACCEL_TCG_INTERNAL_H
 
 #include "exec/exec-all.h"
+#include "qemu/stats64.h"
 
 /*
  * Access to the various translations structures need to be serialised
@@ -31,6 +32,15 @@ static inline void assert_no_pages_locked(void) { }
 
 #ifdef CONFIG_USER_ONLY
 static inline void page_table_config_init(void) { }
+/*
+ * Return the invalidation count of the guest page containing @addr.
+ * Counts are bumped by every TB invalidation of the page, and are
+ * hashed, so unrelated pages may share one.  tb_gen_code() translates
+ * without the mmap_lock and uses them to detect that the guest code it
+ * read may have changed before the TB was linked.
+ * Called with mmap_lock held.
+ */
+unsigned int tb_invalidate_seq_read(tb_page_addr_t addr);
 #else
 void page_table_config_init(void);
 #endif
@@ -40,6 +50,9 @@ void tb_invalidate_phys_range_fast(ram_addr_t ram_addr,
                                    unsigned size,
                                    uintptr_t retaddr);
 G_NORETURN void cpu_io_recompile(CPUState *cpu, uintptr_t retaddr);
+
+/* Granule, in bytes, of dirty tracking for migration of guest writes */
+extern uint64_t tcg_dirty_granule;
 #endif /* CONFIG_SOFTMMU */
 
 TranslationBlock *tb_gen_code(CPUState *cpu, target_ulong pc,
@@ -78,4 +91,91 @@ extern int64_t max_advance;
 
 extern bool one_insn_per_tb;
 
+/* Kinds of guest atomics that could not be done with host atomics */
+typedef enum {
+    TCG_ATOMIC_FALLBACK_CMPXCHG16,
+    TCG_ATOMIC_FALLBACK_LOAD16,
+    TCG_ATOMIC_FALLBACK_STORE16,
+    TCG_ATOMIC_FALLBACK_EXCLUSIVE,
+    TCG_ATOMIC_FALLBACK__MAX,
+} TCGAtomicFallback;
+
+extern bool tcg_atomic_lock_enabled;
+
+/*
+ * Take the lock that serializes fallback atomics on the 16-byte
+ * granule containing @haddr, counting one fallback of kind @site.
+ * Release it with qemu_spin_unlock().
+ */
+QemuSpin *tcg_atomic_lock(const void *haddr, TCGAtomicFallback site);
+void tcg_atomic_fallback_count(TCGAtomicFallback site);
+void tcg_atomic_fallback_dump(GString *buf);
+
+/* Why execution returned to the main loop, for TB statistics */
+typedef enum {
+    TB_STATS_EXIT_NOCHAIN,      /* goto_tb not (yet) chained */
+    TB_STATS_EXIT_REQUESTED,    /* exit request or icount expiry */
+    TB_STATS_EXIT_LOOKUP,       /* exit_tb(0), e.g. goto_ptr lookup miss */
+    TB_STATS_EXIT__MAX,
+} TBStatsExit;
+
+typedef enum {
+    TB_STATS_SORT_EXECUTIONS,
+    TB_STATS_SORT_ENTRIES,
+    TB_STATS_SORT_TRANSLATIONS,
+    TB_STATS_SORT_TIME,
+} TBStatsSort;
+
+/*
+ * Execution counters are per vCPU, in chunks of TB_STATS_CHUNK_SIZE, so
+ * that the generated code can bump them without atomics or lost counts.
+ */
+#define TB_STATS_CHUNK_BITS     12
+#define TB_STATS_CHUNK_SIZE     (1u << TB_STATS_CHUNK_BITS)
+#define TB_STATS_MAX_CHUNKS     4096
+#define TB_STATS_NO_SLOT        UINT32_MAX
+
+/*
+ * Statistics for the guest code at one (phys_pc, pc, flags), which
+ * survive retranslation and tb_flush.  Allocated on first translation
+ * with "-accel tcg,tb-stats=on" and never freed.
+ */
+struct TBStatistics {
+    uint64_t phys_pc;
+    uint64_t pc;
+    uint32_t flags;
+
+    /* Of the latest translation */
+    uint32_t insns;
+    uint32_t helpers;
+    uint32_t code_size;
+
+    /*
+     * Index of the execution counter in every vCPU's tb_stats_counters,
+     * or TB_STATS_NO_SLOT once they have all been handed out.
+     */
+    uint32_t slot;
+    /* Sum of the counters at the last reset, protected by tb_stats_lock */
+    uint64_t executions_base;
+
+    /* Entered from the main loop, rather than chained into */
+    Stat64 entries;
+    Stat64 translations;
+    /* Attributed to the block that exited, or for LOOKUP to the entry */
+    Stat64 exits[TB_STATS_EXIT__MAX];
+    /* Time from entering this block until returning to the main loop */
+    Stat64 exec_ns;
+};
+
+extern bool tb_stats_enabled;
+
+TBStatistics *tb_stats_get(uint64_t phys_pc, uint64_t pc, uint32_t flags);
+void tb_stats_translated(TBStatistics *s, const TranslationBlock *tb);
+void tb_stats_exec(TranslationBlock *itb, TranslationBlock *last_tb,
+                   int tb_exit, int64_t ns);
+void tb_stats_reset(void);
+void tb_stats_vcpu_init(CPUState *cpu);
+void tb_stats_vcpu_exit(CPUState *cpu);
+void tb_stats_dump(GString *buf, int max, TBStatsSort sort);
+
 #endif /* ACCEL_TCG_INTERNAL_H */
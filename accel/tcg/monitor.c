@@ -11,6 +11,8 @@
 #include "qapi/error.h"
 #include "qapi/type-helpers.h"
 #include "qapi/qapi-commands-machine.h"
+#include "qapi/qmp/qdict.h"
+#include "monitor/hmp.h"
 #include "monitor/monitor.h"
 #include "sysemu/cpus.h"
 #include "sysemu/cpu-timers.h"
@@ -80,6 +82,66 @@ HumanReadableText *qmp_x_query_opcount(Error **errp)
     return human_readable_text_from_str(buf);
 }
 
+HumanReadableText *qmp_x_query_tb_stats(bool has_count, int64_t count,
+                                        bool has_sort_by,
+                                        TbStatsSortBy sort_by,
+                                        bool has_reset, bool reset,
+                                        Error **errp)
+{
+    static const TBStatsSort sort_keys[TB_STATS_SORT_BY__MAX] = {
+        [TB_STATS_SORT_BY_EXECUTIONS] = TB_STATS_SORT_EXECUTIONS,
+        [TB_STATS_SORT_BY_ENTRIES] = TB_STATS_SORT_ENTRIES,
+        [TB_STATS_SORT_BY_TRANSLATIONS] = TB_STATS_SORT_TRANSLATIONS,
+        [TB_STATS_SORT_BY_TIME] = TB_STATS_SORT_TIME,
+    };
+    g_autoptr(GString) buf = g_string_new("");
+
+    if (!tcg_enabled()) {
+        error_setg(errp,
+                   "TB statistics are only available with accel=tcg");
+        return NULL;
+    }
+    if (has_count && (count < 0 || count > INT_MAX)) {
+        error_setg(errp, "Parameter 'count' expects a non-negative integer");
+        return NULL;
+    }
+
+    tb_stats_dump(buf, has_count ? count : 10,
+                  sort_keys[has_sort_by ? sort_by
+                                        : TB_STATS_SORT_BY_EXECUTIONS]);
+    if (has_reset && reset) {
+        tb_stats_reset();
+    }
+
+    return human_readable_text_from_str(buf);
+}
+
+void hmp_info_tb_stats(Monitor *mon, const QDict *qdict)
+{
+    const char *sort = qdict_get_try_str(qdict, "sort");
+    Error *err = NULL;
+    g_autoptr(HumanReadableText) info = NULL;
+    TbStatsSortBy sort_by = TB_STATS_SORT_BY_EXECUTIONS;
+
+    if (sort) {
+        sort_by = qapi_enum_parse(&TbStatsSortBy_lookup, sort, -1, &err);
+        if (err) {
+            hmp_handle_error(mon, err);
+            return;
+        }
+    }
+
+    info = qmp_x_query_tb_stats(qdict_haskey(qdict, "count"),
+                                qdict_get_try_int(qdict, "count", 10),
+                                true, sort_by,
+                                true, qdict_get_try_bool(qdict, "reset", false),
+                                &err);
+    if (hmp_handle_error(mon, err)) {
+        return;
+    }
+    monitor_puts(mon, info->human_readable_text);
+}
+
 #ifdef CONFIG_PROFILER
 
 int64_t dev_time;
@@ -74,6 +74,7 @@ enum plugin_gen_from {
 enum plugin_gen_cb {
     PLUGIN_GEN_CB_UDATA,
     PLUGIN_GEN_CB_INLINE,
+    PLUGIN_GEN_CB_INLINE_PER_VCPU,
     PLUGIN_GEN_CB_MEM,
     PLUGIN_GEN_ENABLE_MEM_HELPER,
     PLUGIN_GEN_DISABLE_MEM_HELPER,
@@ -124,6 +125,26 @@ static void gen_empty_inline_cb(void)
     tcg_temp_free_i64(val);
 }
 
+/*
+ * Same as above, but on the vCPU's own copy of a scoreboard entry: the
+ * base pointer is loaded from CPUState.plugin_scoreboard and the entry
+ * offset is patched into the ld/st ops, so no atomics are needed.
+ */
+static void gen_empty_inline_per_vcpu_cb(void)
+{
+    TCGv_i64 val = tcg_temp_ebb_new_i64();
+    TCGv_ptr ptr = tcg_temp_ebb_new_ptr();
+
+    tcg_gen_ld_ptr(ptr, cpu_env, offsetof(CPUState, plugin_scoreboard) -
+                                 offsetof(ArchCPU, env));
+    tcg_gen_ld_i64(val, ptr, 0);
+    /* pass an immediate != 0 so that it doesn't get optimized away */
+    tcg_gen_addi_i64(val, val, 0xdeadface);
+    tcg_gen_st_i64(val, ptr, 0);
+    tcg_temp_free_ptr(ptr);
+    tcg_temp_free_i64(val);
+}
+
 static void gen_empty_mem_cb(TCGv_i64 addr, uint32_t info)
 {
     TCGv_i32 cpu_index = tcg_temp_ebb_new_i32();
@@ -188,6 +209,8 @@ static void plugin_gen_empty_callback(enum plugin_gen_from from)
     case PLUGIN_GEN_FROM_TB:
         gen_wrapped(from, PLUGIN_GEN_CB_UDATA, gen_empty_udata_cb);
         gen_wrapped(from, PLUGIN_GEN_CB_INLINE, gen_empty_inline_cb);
+        gen_wrapped(from, PLUGIN_GEN_CB_INLINE_PER_VCPU,
+                    gen_empty_inline_per_vcpu_cb);
         break;
     default:
         g_assert_not_reached();
@@ -205,6 +228,10 @@ void plugin_gen_empty_mem_callback(TCGv_i64 addr, uint32_t info)
     gen_plugin_cb_start(PLUGIN_GEN_FROM_MEM, PLUGIN_GEN_CB_INLINE, rw);
     gen_empty_inline_cb();
     tcg_gen_plugin_cb_end();
+
+    gen_plugin_cb_start(PLUGIN_GEN_FROM_MEM, PLUGIN_GEN_CB_INLINE_PER_VCPU, rw);
+    gen_empty_inline_per_vcpu_cb();
+    tcg_gen_plugin_cb_end();
 }
 
 static TCGOp *find_op(TCGOp *op, TCGOpcode opc)
@@ -254,6 +281,13 @@ static TCGOp *copy_op(TCGOp **begin_op, TCGOp *op, TCGOpcode opc)
     return op;
 }
 
+/* advance past an empty callback op that is not needed in the copy */
+static void skip_op(TCGOp **begin_op, TCGOpcode opc)
+{
+    *begin_op = QTAILQ_NEXT(*begin_op, link);
+    tcg_debug_assert(*begin_op && (*begin_op)->opc == opc);
+}
+
 static TCGOp *copy_extu_i32_i64(TCGOp **begin_op, TCGOp *op)
 {
     if (TCG_TARGET_REG_BITS == 32) {
@@ -307,28 +341,80 @@ static TCGOp *copy_extu_tl_i64(TCGOp **begin_op, TCGOp *op)
     return op;
 }
 
-static TCGOp *copy_ld_i64(TCGOp **begin_op, TCGOp *op)
+static TCGOp *copy_ld_ptr(TCGOp **begin_op, TCGOp *op)
+{
+    if (UINTPTR_MAX == UINT32_MAX) {
+        /* ld_i32 */
+        op = copy_op(begin_op, op, INDEX_op_ld_i32);
+    } else {
+        /* ld_i64 */
+        op = copy_op(begin_op, op, INDEX_op_ld_i64);
+    }
+    return op;
+}
+
+static TCGOp *copy_ld_i64(TCGOp **begin_op, TCGOp *op, intptr_t offset)
 {
     if (TCG_TARGET_REG_BITS == 32) {
         /* 2x ld_i32 */
         op = copy_op(begin_op, op, INDEX_op_ld_i32);
+        op->args[2] += offset;
         op = copy_op(begin_op, op, INDEX_op_ld_i32);
+        op->args[2] += offset;
     } else {
         /* ld_i64 */
         op = copy_op(begin_op, op, INDEX_op_ld_i64);
+        op->args[2] += offset;
     }
     return op;
 }
 
-static TCGOp *copy_st_i64(TCGOp **begin_op, TCGOp *op)
+static void skip_ld_i64(TCGOp **begin_op)
+{
+    if (TCG_TARGET_REG_BITS == 32) {
+        skip_op(begin_op, INDEX_op_ld_i32);
+        skip_op(begin_op, INDEX_op_ld_i32);
+    } else {
+        skip_op(begin_op, INDEX_op_ld_i64);
+    }
+}
+
+static TCGOp *copy_st_i64(TCGOp **begin_op, TCGOp *op, intptr_t offset)
 {
     if (TCG_TARGET_REG_BITS == 32) {
         /* 2x st_i32 */
         op = copy_op(begin_op, op, INDEX_op_st_i32);
+        op->args[2] += offset;
         op = copy_op(begin_op, op, INDEX_op_st_i32);
+        op->args[2] += offset;
     } else {
         /* st_i64 */
         op = copy_op(begin_op, op, INDEX_op_st_i64);
+        op->args[2] += offset;
+    }
+    return op;
+}
+
+/* st_i64 of the constant @v instead of the template's value */
+static TCGOp *copy_st_i64_const(TCGOp **begin_op, TCGOp *op,
+                                intptr_t offset, uint64_t v)
+{
+    if (TCG_TARGET_REG_BITS == 32) {
+        /* 2x st_i32, ordered as in tcg_gen_st_i64() */
+        uint32_t first = HOST_BIG_ENDIAN ? v >> 32 : v;
+        uint32_t second = HOST_BIG_ENDIAN ? v : v >> 32;
+
+        op = copy_op(begin_op, op, INDEX_op_st_i32);
+        op->args[0] = tcgv_i32_arg(tcg_constant_i32(first));
+        op->args[2] += offset;
+        op = copy_op(begin_op, op, INDEX_op_st_i32);
+        op->args[0] = tcgv_i32_arg(tcg_constant_i32(second));
+        op->args[2] += offset;
+    } else {
+        /* st_i64 */
+        op = copy_op(begin_op, op, INDEX_op_st_i64);
+        op->args[0] = tcgv_i64_arg(tcg_constant_i64(v));
+        op->args[2] += offset;
     }
     return op;
 }
@@ -348,6 +434,15 @@ static TCGOp *copy_add_i64(TCGOp **begin_op, TCGOp *op, uint64_t v)
     return op;
 }
 
+static void skip_add_i64(TCGOp **begin_op)
+{
+    if (TCG_TARGET_REG_BITS == 32) {
+        skip_op(begin_op, INDEX_op_add2_i32);
+    } else {
+        skip_op(begin_op, INDEX_op_add_i64);
+    }
+}
+
 static TCGOp *copy_st_ptr(TCGOp **begin_op, TCGOp *op)
 {
     if (UINTPTR_MAX == UINT32_MAX) {
@@ -355,7 +450,7 @@ static TCGOp *copy_st_ptr(TCGOp **begin_op, TCGOp *op)
         op = copy_op(begin_op, op, INDEX_op_st_i32);
     } else {
         /* st_i64 */
-        op = copy_st_i64(begin_op, op);
+        op = copy_st_i64(begin_op, op, 0);
     }
     return op;
 }
@@ -415,17 +510,37 @@ static TCGOp *append_inline_cb(const struct qemu_plugin_dyn_cb *cb,
                                TCGOp *begin_op, TCGOp *op,
                                int *unused)
 {
-    /* const_ptr */
-    op = copy_const_ptr(&begin_op, op, cb->userp);
+    intptr_t offset = 0;
 
-    /* ld_i64 */
-    op = copy_ld_i64(&begin_op, op);
+    if (cb->type == PLUGIN_CB_INLINE_PER_VCPU) {
+        /* ld_ptr of CPUState.plugin_scoreboard */
+        op = copy_ld_ptr(&begin_op, op);
+        offset = cb->inline_insn.offset;
+    } else {
+        /* const_ptr */
+        op = copy_const_ptr(&begin_op, op, cb->userp);
+    }
 
-    /* add_i64 */
-    op = copy_add_i64(&begin_op, op, cb->inline_insn.imm);
+    switch (cb->inline_insn.op) {
+    case QEMU_PLUGIN_INLINE_ADD_U64:
+        /* ld_i64 */
+        op = copy_ld_i64(&begin_op, op, offset);
 
-    /* st_i64 */
-    op = copy_st_i64(&begin_op, op);
+        /* add_i64 */
+        op = copy_add_i64(&begin_op, op, cb->inline_insn.imm);
+
+        /* st_i64 */
+        op = copy_st_i64(&begin_op, op, offset);
+        break;
+    case QEMU_PLUGIN_INLINE_STORE_U64:
+        /* the old value is not needed: store the immediate directly */
+        skip_ld_i64(&begin_op);
+        skip_add_i64(&begin_op);
+        op = copy_st_i64_const(&begin_op, op, offset, cb->inline_insn.imm);
+        break;
+    default:
+        g_assert_not_reached();
+    }
 
     return op;
 }
@@ -562,12 +677,13 @@ static void inject_mem_enable_helper(struct qemu_plugin_tb *ptb,
                                      struct qemu_plugin_insn *plugin_insn,
                                      TCGOp *begin_op)
 {
-    GArray *cbs[2];
+    GArray *cbs[3];
     GArray *arr;
     size_t n_cbs, i;
 
     cbs[0] = plugin_insn->cbs[PLUGIN_CB_MEM][PLUGIN_CB_REGULAR];
     cbs[1] = plugin_insn->cbs[PLUGIN_CB_MEM][PLUGIN_CB_INLINE];
+    cbs[2] = plugin_insn->cbs[PLUGIN_CB_MEM][PLUGIN_CB_INLINE_PER_VCPU];
 
     n_cbs = 0;
     for (i = 0; i < ARRAY_SIZE(cbs); i++) {
@@ -628,9 +744,10 @@ static void plugin_gen_tb_udata(const struct qemu_plugin_tb *ptb,
 }
 
 static void plugin_gen_tb_inline(const struct qemu_plugin_tb *ptb,
-                                 TCGOp *begin_op)
+                                 TCGOp *begin_op,
+                                 enum plugin_dyn_cb_subtype subtype)
 {
-    inject_inline_cb(ptb->cbs[PLUGIN_CB_INLINE], begin_op, op_ok);
+    inject_inline_cb(ptb->cbs[subtype], begin_op, op_ok);
 }
 
 static void plugin_gen_insn_udata(const struct qemu_plugin_tb *ptb,
@@ -642,11 +759,11 @@ static void plugin_gen_insn_udata(const struct qemu_plugin_tb *ptb,
 }
 
 static void plugin_gen_insn_inline(const struct qemu_plugin_tb *ptb,
-                                   TCGOp *begin_op, int insn_idx)
+                                   TCGOp *begin_op, int insn_idx,
+                                   enum plugin_dyn_cb_subtype subtype)
 {
     struct qemu_plugin_insn *insn = g_ptr_array_index(ptb->insns, insn_idx);
-    inject_inline_cb(insn->cbs[PLUGIN_CB_INSN][PLUGIN_CB_INLINE],
-                     begin_op, op_ok);
+    inject_inline_cb(insn->cbs[PLUGIN_CB_INSN][subtype], begin_op, op_ok);
 }
 
 static void plugin_gen_mem_regular(const struct qemu_plugin_tb *ptb,
@@ -657,12 +774,13 @@ static void plugin_gen_mem_regular(const struct qemu_plugin_tb *ptb,
 }
 
 static void plugin_gen_mem_inline(const struct qemu_plugin_tb *ptb,
-                                  TCGOp *begin_op, int insn_idx)
+                                  TCGOp *begin_op, int insn_idx,
+                                  enum plugin_dyn_cb_subtype subtype)
 {
     const GArray *cbs;
     struct qemu_plugin_insn *insn = g_ptr_array_index(ptb->insns, insn_idx);
 
-    cbs = insn->cbs[PLUGIN_CB_MEM][PLUGIN_CB_INLINE];
+    cbs = insn->cbs[PLUGIN_CB_MEM][subtype];
     inject_inline_cb(cbs, begin_op, op_rw);
 }
 
@@ -715,6 +833,9 @@ static void pr_ops(void)
             case PLUGIN_GEN_CB_INLINE:
                 type = "inline";
                 break;
+            case PLUGIN_GEN_CB_INLINE_PER_VCPU:
+                type = "inline per vcpu";
+                break;
             case PLUGIN_GEN_CB_MEM:
                 type = "mem";
                 break;
@@ -761,7 +882,11 @@ static void plugin_gen_inject(struct qemu_plugin_tb *plugin_tb)
                     plugin_gen_tb_udata(plugin_tb, op);
                     break;
                 case PLUGIN_GEN_CB_INLINE:
-                    plugin_gen_tb_inline(plugin_tb, op);
+                    plugin_gen_tb_inline(plugin_tb, op, PLUGIN_CB_INLINE);
+                    break;
+                case PLUGIN_GEN_CB_INLINE_PER_VCPU:
+                    plugin_gen_tb_inline(plugin_tb, op,
+                                         PLUGIN_CB_INLINE_PER_VCPU);
                     break;
                 default:
                     g_assert_not_reached();
@@ -777,7 +902,12 @@ static void plugin_gen_inject(struct qemu_plugin_tb *plugin_tb)
                     plugin_gen_insn_udata(plugin_tb, op, insn_idx);
                     break;
                 case PLUGIN_GEN_CB_INLINE:
-                    plugin_gen_insn_inline(plugin_tb, op, insn_idx);
+                    plugin_gen_insn_inline(plugin_tb, op, insn_idx,
+                                           PLUGIN_CB_INLINE);
+                    break;
+                case PLUGIN_GEN_CB_INLINE_PER_VCPU:
+                    plugin_gen_insn_inline(plugin_tb, op, insn_idx,
+                                           PLUGIN_CB_INLINE_PER_VCPU);
                     break;
                 case PLUGIN_GEN_ENABLE_MEM_HELPER:
                     plugin_gen_enable_mem_helper(plugin_tb, op, insn_idx);
@@ -796,7 +926,12 @@ static void plugin_gen_inject(struct qemu_plugin_tb *plugin_tb)
                     plugin_gen_mem_regular(plugin_tb, op, insn_idx);
                     break;
                 case PLUGIN_GEN_CB_INLINE:
-                    plugin_gen_mem_inline(plugin_tb, op, insn_idx);
+                    plugin_gen_mem_inline(plugin_tb, op, insn_idx,
+                                          PLUGIN_CB_INLINE);
+                    break;
+                case PLUGIN_GEN_CB_INLINE_PER_VCPU:
+                    plugin_gen_mem_inline(plugin_tb, op, insn_idx,
+                                          PLUGIN_CB_INLINE_PER_VCPU);
                     break;
                 default:
                     g_assert_not_reached();
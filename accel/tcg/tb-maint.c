@@ -986,6 +986,31 @@ TranslationBlock *tb_link_page(TranslationBlock *tb, tb_page_addr_t phys_pc,
 }
 
 #ifdef CONFIG_USER_ONLY
+/* Per-page invalidation counts, hashed.  Protected by mmap_lock. */
+#define TB_INVALIDATE_SEQ_SIZE 1024
+static unsigned int tb_invalidate_seq[TB_INVALIDATE_SEQ_SIZE];
+
+static void tb_invalidate_seq_bump(tb_page_addr_t start, tb_page_addr_t last)
+{
+    tb_page_addr_t index = start >> TARGET_PAGE_BITS;
+    tb_page_addr_t last_index = last >> TARGET_PAGE_BITS;
+
+    if (last_index - index >= TB_INVALIDATE_SEQ_SIZE) {
+        index = 0;
+        last_index = TB_INVALIDATE_SEQ_SIZE - 1;
+    }
+    for (; index <= last_index; index++) {
+        tb_invalidate_seq[index % TB_INVALIDATE_SEQ_SIZE]++;
+    }
+}
+
+unsigned int tb_invalidate_seq_read(tb_page_addr_t addr)
+{
+    assert_memory_lock();
+    return tb_invalidate_seq[(addr >> TARGET_PAGE_BITS) %
+                             TB_INVALIDATE_SEQ_SIZE];
+}
+
 /*
  * Invalidate all TBs which intersect with the target address range.
  * Called with mmap_lock held for user-mode emulation.
@@ -997,6 +1022,7 @@ void tb_invalidate_phys_range(tb_page_addr_t start, tb_page_addr_t last)
     PageForEachNext n;
 
     assert_memory_lock();
+    tb_invalidate_seq_bump(start, last);
 
     PAGE_FOR_EACH_TB(start, last, unused, tb, n) {
         tb_phys_invalidate__locked(tb);
@@ -1049,6 +1075,7 @@ bool tb_invalidate_phys_page_unwind(tb_page_addr_t addr, uintptr_t pc)
 
     last = addr | ~TARGET_PAGE_MASK;
     addr &= TARGET_PAGE_MASK;
+    tb_invalidate_seq_bump(addr, last);
     current_tb_modified = false;
 
     PAGE_FOR_EACH_TB(addr, last, unused, tb, n) {
@@ -0,0 +1,337 @@
+/*
+ * Translation block execution statistics
+ *
+ * With "-accel tcg,tb-stats=on", every TB is generated with a counter of
+ * its executions, and the main loop accounts the blocks it enters and
+ * the reasons execution comes back to it.  Statistics are kept per guest
+ * code location rather than per TB, so that blocks that are invalidated
+ * and retranslated (e.g. by self-modifying code or tb_flush) keep
+ * accumulating, and retranslations are counted as well.  They are
+ * reported as the top blocks by "info tb-stats" and x-query-tb-stats.
+ *
+ * The execution counters are bumped by the generated code without
+ * atomics.  Like plugin scoreboards, every vCPU has its own copy of each
+ * counter, so no count is lost, and readers add up the copies.  They
+ * are kept in chunks that never move rather than in plugin scoreboards,
+ * which only exist with plugins enabled and rely on mmap().
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/thread.h"
+#include "qemu/lockable.h"
+#include "qemu/timer.h"
+#include "qemu/xxhash.h"
+#include "disas/disas.h"
+#include "tcg/tcg.h"
+#include "internal.h"
+
+bool tb_stats_enabled;
+
+/* Protects everything below, and TBStatistics.executions_base */
+static QemuMutex tb_stats_lock;
+static GHashTable *tb_stats_table;
+/* Counter slots handed out so far */
+static uint32_t tb_stats_nr_slots;
+/* The tb_stats_counters of every vCPU, and of those that went away */
+static GPtrArray *tb_stats_counters;
+static GPtrArray *tb_stats_counters_spare;
+
+static void __attribute__((constructor)) tb_stats_init(void)
+{
+    qemu_mutex_init(&tb_stats_lock);
+}
+
+static guint tb_stats_hash(gconstpointer key)
+{
+    const TBStatistics *s = key;
+
+    return qemu_xxhash5(s->phys_pc, s->pc, s->flags);
+}
+
+static gboolean tb_stats_equal(gconstpointer a, gconstpointer b)
+{
+    const TBStatistics *sa = a, *sb = b;
+
+    return sa->phys_pc == sb->phys_pc && sa->pc == sb->pc &&
+           sa->flags == sb->flags;
+}
+
+static void tb_stats_counters_add_chunk(gpointer data, gpointer chunk)
+{
+    uint64_t **counters = data;
+
+    qatomic_set(&counters[GPOINTER_TO_UINT(chunk)],
+                g_new0(uint64_t, TB_STATS_CHUNK_SIZE));
+}
+
+/*
+ * Find a counter for new statistics.  Every vCPU gets the chunk before
+ * any code using the slot is published.
+ */
+static uint32_t tb_stats_new_slot__locked(void)
+{
+    uint32_t slot = tb_stats_nr_slots;
+
+    if (slot == TB_STATS_MAX_CHUNKS * TB_STATS_CHUNK_SIZE) {
+        return TB_STATS_NO_SLOT;
+    }
+    if (!(slot & (TB_STATS_CHUNK_SIZE - 1)) && tb_stats_counters) {
+        g_ptr_array_foreach(tb_stats_counters, tb_stats_counters_add_chunk,
+                            GUINT_TO_POINTER(slot >> TB_STATS_CHUNK_BITS));
+    }
+    tb_stats_nr_slots++;
+    return slot;
+}
+
+/*
+ * Called before @cpu can run code with statistics: when it is created
+ * while they are on, and for all vCPUs when they are turned on.
+ */
+void tb_stats_vcpu_init(CPUState *cpu)
+{
+    uint64_t **counters;
+    uint32_t i, nr_chunks;
+
+    if (cpu->tb_stats_counters) {
+        return;
+    }
+
+    QEMU_LOCK_GUARD(&tb_stats_lock);
+    if (!tb_stats_counters) {
+        tb_stats_counters = g_ptr_array_new();
+        tb_stats_counters_spare = g_ptr_array_new();
+    }
+
+    /* Counts of a vCPU that went away keep adding up */
+    if (tb_stats_counters_spare->len) {
+        counters = g_ptr_array_steal_index_fast(tb_stats_counters_spare, 0);
+    } else {
+        counters = g_new0(uint64_t *, TB_STATS_MAX_CHUNKS);
+        g_ptr_array_add(tb_stats_counters, counters);
+    }
+    nr_chunks = DIV_ROUND_UP(tb_stats_nr_slots, TB_STATS_CHUNK_SIZE);
+    for (i = 0; i < nr_chunks; i++) {
+        if (!counters[i]) {
+            counters[i] = g_new0(uint64_t, TB_STATS_CHUNK_SIZE);
+        }
+    }
+    cpu->tb_stats_counters = counters;
+}
+
+void tb_stats_vcpu_exit(CPUState *cpu)
+{
+    if (!cpu->tb_stats_counters) {
+        return;
+    }
+
+    QEMU_LOCK_GUARD(&tb_stats_lock);
+    g_ptr_array_add(tb_stats_counters_spare, cpu->tb_stats_counters);
+    cpu->tb_stats_counters = NULL;
+}
+
+TBStatistics *tb_stats_get(uint64_t phys_pc, uint64_t pc, uint32_t flags)
+{
+    TBStatistics key = { .phys_pc = phys_pc, .pc = pc, .flags = flags };
+    TBStatistics *s;
+
+    QEMU_LOCK_GUARD(&tb_stats_lock);
+    if (!tb_stats_table) {
+        tb_stats_table = g_hash_table_new(tb_stats_hash, tb_stats_equal);
+    }
+    s = g_hash_table_lookup(tb_stats_table, &key);
+    if (!s) {
+        s = g_new0(TBStatistics, 1);
+        s->phys_pc = phys_pc;
+        s->pc = pc;
+        s->flags = flags;
+        s->slot = tb_stats_new_slot__locked();
+        g_hash_table_add(tb_stats_table, s);
+    }
+    return s;
+}
+
+/* Called right after code generation, while tcg_ctx->ops is still valid. */
+void tb_stats_translated(TBStatistics *s, const TranslationBlock *tb)
+{
+    const TCGOp *op;
+    uint32_t helpers = 0;
+
+    QTAILQ_FOREACH(op, &tcg_ctx->ops, link) {
+        helpers += op->opc == INDEX_op_call;
+    }
+    qatomic_set(&s->insns, tb->icount);
+    qatomic_set(&s->helpers, helpers);
+    qatomic_set(&s->code_size, tb->tc.size);
+    stat64_add(&s->translations, 1);
+}
+
+void tb_stats_exec(TranslationBlock *itb, TranslationBlock *last_tb,
+                   int tb_exit, int64_t ns)
+{
+    TBStatistics *s = itb->tb_stats;
+
+    stat64_add(&s->entries, 1);
+    stat64_add(&s->exec_ns, ns);
+
+    if (!last_tb) {
+        stat64_add(&s->exits[TB_STATS_EXIT_LOOKUP], 1);
+    } else if (last_tb->tb_stats) {
+        TBStatsExit why = tb_exit > TB_EXIT_IDX1 ? TB_STATS_EXIT_REQUESTED
+                                                 : TB_STATS_EXIT_NOCHAIN;
+        stat64_add(&last_tb->tb_stats->exits[why], 1);
+    }
+}
+
+/*
+ * The generated code updates a counter with plain 64-bit loads and
+ * stores, which are split in two on 32-bit hosts, so a copy may be read
+ * torn there: access it atomically only where that is free.
+ */
+static uint64_t tb_stats_read_counter(uint64_t *counter)
+{
+#ifdef CONFIG_ATOMIC64
+    return qatomic_read__nocheck(counter);
+#else
+    return *(volatile uint64_t *)counter;
+#endif
+}
+
+/* Sum of the vCPUs' counters, the caller holds tb_stats_lock. */
+static uint64_t tb_stats_sum_executions__locked(const TBStatistics *s)
+{
+    uint64_t sum = 0;
+    guint i;
+
+    if (s->slot == TB_STATS_NO_SLOT || !tb_stats_counters) {
+        return 0;
+    }
+    for (i = 0; i < tb_stats_counters->len; i++) {
+        uint64_t **counters = g_ptr_array_index(tb_stats_counters, i);
+
+        sum += tb_stats_read_counter(
+            &counters[s->slot >> TB_STATS_CHUNK_BITS]
+                     [s->slot & (TB_STATS_CHUNK_SIZE - 1)]);
+    }
+    return sum;
+}
+
+static uint64_t tb_stats_executions__locked(const TBStatistics *s)
+{
+    return tb_stats_sum_executions__locked(s) - s->executions_base;
+}
+
+/*
+ * The counters belong to the vCPUs, so a reset only moves the base the
+ * executions are counted from.
+ */
+static void tb_stats_reset_one(gpointer key, gpointer value, gpointer opaque)
+{
+    TBStatistics *s = value;
+    int i;
+
+    s->executions_base = tb_stats_sum_executions__locked(s);
+    stat64_set(&s->entries, 0);
+    stat64_set(&s->translations, 0);
+    for (i = 0; i < TB_STATS_EXIT__MAX; i++) {
+        stat64_set(&s->exits[i], 0);
+    }
+    stat64_set(&s->exec_ns, 0);
+}
+
+/* TBs keep pointing to their statistics, so only clear the counters. */
+void tb_stats_reset(void)
+{
+    QEMU_LOCK_GUARD(&tb_stats_lock);
+    if (tb_stats_table) {
+        g_hash_table_foreach(tb_stats_table, tb_stats_reset_one, NULL);
+    }
+}
+
+static uint64_t tb_stats_sort_key(const TBStatistics *s, uint64_t executions,
+                                  TBStatsSort sort)
+{
+    switch (sort) {
+    case TB_STATS_SORT_EXECUTIONS:
+        return executions;
+    case TB_STATS_SORT_ENTRIES:
+        return stat64_get(&s->entries);
+    case TB_STATS_SORT_TRANSLATIONS:
+        return stat64_get(&s->translations);
+    case TB_STATS_SORT_TIME:
+        return stat64_get(&s->exec_ns);
+    default:
+        g_assert_not_reached();
+    }
+}
+
+typedef struct {
+    TBStatistics *s;
+    uint64_t executions;
+    uint64_t key;
+} TBStatsSortEntry;
+
+static gint tb_stats_cmp(gconstpointer a, gconstpointer b)
+{
+    const TBStatsSortEntry *ea = a, *eb = b;
+
+    return ea->key > eb->key ? -1 : ea->key < eb->key;
+}
+
+void tb_stats_dump(GString *buf, int max, TBStatsSort sort)
+{
+    g_autoptr(GArray) entries = NULL;
+    GHashTableIter iter;
+    gpointer value;
+    guint i;
+
+    g_string_append_printf(buf, "TB statistics (tb-stats=%s):\n",
+                           qatomic_read(&tb_stats_enabled) ? "on" : "off");
+
+    WITH_QEMU_LOCK_GUARD(&tb_stats_lock) {
+        if (!tb_stats_table) {
+            return;
+        }
+        entries = g_array_sized_new(false, false, sizeof(TBStatsSortEntry),
+                                    g_hash_table_size(tb_stats_table));
+        g_hash_table_iter_init(&iter, tb_stats_table);
+        while (g_hash_table_iter_next(&iter, NULL, &value)) {
+            TBStatsSortEntry e = {
+                .s = value,
+                .executions = tb_stats_executions__locked(value),
+            };
+
+            e.key = tb_stats_sort_key(value, e.executions, sort);
+            g_array_append_val(entries, e);
+        }
+    }
+    g_array_sort(entries, tb_stats_cmp);
+
+    g_string_append_printf(buf, "%u blocks\n\n", entries->len);
+    g_string_append_printf(buf, "%-18s %-18s %14s %12s %8s %5s %4s "
+                           "%10s %10s %10s %10s  %s\n",
+                           "pc", "phys_pc", "executions", "entries", "trans",
+                           "insns", "hlp", "nochain", "requested", "lookup",
+                           "time (us)", "symbol");
+    for (i = 0; i < entries->len && i < max; i++) {
+        TBStatsSortEntry *e = &g_array_index(entries, TBStatsSortEntry, i);
+        TBStatistics *s = e->s;
+
+        g_string_append_printf(buf, "0x%016" PRIx64 " 0x%016" PRIx64
+                               " %14" PRIu64 " %12" PRIu64 " %8" PRIu64
+                               " %5u %4u %10" PRIu64 " %10" PRIu64
+                               " %10" PRIu64 " %10" PRIu64 "  %s\n",
+                               s->pc, s->phys_pc,
+                               e->executions,
+                               stat64_get(&s->entries),
+                               stat64_get(&s->translations),
+                               qatomic_read(&s->insns),
+                               qatomic_read(&s->helpers),
+                               stat64_get(&s->exits[TB_STATS_EXIT_NOCHAIN]),
+                               stat64_get(&s->exits[TB_STATS_EXIT_REQUESTED]),
+                               stat64_get(&s->exits[TB_STATS_EXIT_LOOKUP]),
+                               stat64_get(&s->exec_ns) / SCALE_US,
+                               lookup_symbol(s->pc));
+    }
+}
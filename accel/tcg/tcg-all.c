@@ -34,6 +34,9 @@
 #include "qemu/atomic.h"
 #include "qapi/qapi-builtin-visit.h"
 #include "qemu/units.h"
+#include "qemu/host-utils.h"
+#include "hw/core/cpu.h"
+#include "exec/tb-flush.h"
 #if !defined(CONFIG_USER_ONLY)
 #include "hw/boards.h"
 #endif
@@ -225,6 +228,65 @@ static void tcg_set_one_insn_per_tb(Object *obj, bool value, Error **errp)
     qatomic_set(&one_insn_per_tb, value);
 }
 
+#ifndef CONFIG_USER_ONLY
+static void tcg_get_dirty_granule(Object *obj, Visitor *v,
+                                  const char *name, void *opaque,
+                                  Error **errp)
+{
+    uint64_t value = MAX(tcg_dirty_granule, TARGET_PAGE_SIZE);
+
+    visit_type_size(v, name, &value, errp);
+}
+
+static void tcg_set_dirty_granule(Object *obj, Visitor *v,
+                                  const char *name, void *opaque,
+                                  Error **errp)
+{
+    uint64_t value;
+
+    if (!visit_type_size(v, name, &value, errp)) {
+        return;
+    }
+    if (!is_power_of_2(value) || value > 1 * GiB) {
+        error_setg(errp, "Invalid 'dirty-granule' %" PRIu64
+                   ": must be a power of two, at most 1G", value);
+        return;
+    }
+    tcg_dirty_granule = value;
+}
+#endif
+
+static bool tcg_get_atomic_lock(Object *obj, Error **errp)
+{
+    return qatomic_read(&tcg_atomic_lock_enabled);
+}
+
+static void tcg_set_atomic_lock(Object *obj, bool value, Error **errp)
+{
+    qatomic_set(&tcg_atomic_lock_enabled, value);
+}
+
+static bool tcg_get_tb_stats(Object *obj, Error **errp)
+{
+    return qatomic_read(&tb_stats_enabled);
+}
+
+static void tcg_set_tb_stats(Object *obj, bool value, Error **errp)
+{
+    CPUState *cpu;
+
+    if (value) {
+        /* vCPUs need their counters before any code uses them */
+        CPU_FOREACH(cpu) {
+            tb_stats_vcpu_init(cpu);
+        }
+    }
+    if (qatomic_xchg(&tb_stats_enabled, value) != value && first_cpu) {
+        /* Regenerate code with, or without, the counters */
+        tb_flush(first_cpu);
+    }
+}
+
 static int tcg_gdbstub_supported_sstep_flags(void)
 {
     /*
@@ -268,6 +330,27 @@ static void tcg_accel_class_init(ObjectClass *oc, void *data)
                                    tcg_set_one_insn_per_tb);
     object_class_property_set_description(oc, "one-insn-per-tb",
         "Only put one guest insn in each translation block");
+
+#ifndef CONFIG_USER_ONLY
+    object_class_property_add(oc, "dirty-granule", "size",
+        tcg_get_dirty_granule, tcg_set_dirty_granule,
+        NULL, NULL);
+    object_class_property_set_description(oc, "dirty-granule",
+        "Granularity of migration dirty tracking for guest writes");
+#endif
+
+    object_class_property_add_bool(oc, "atomic-lock",
+                                   tcg_get_atomic_lock,
+                                   tcg_set_atomic_lock);
+    object_class_property_set_description(oc, "atomic-lock",
+        "Use address-hashed locks instead of stopping all vCPUs "
+        "for atomics the host cannot do");
+
+    object_class_property_add_bool(oc, "tb-stats",
+                                   tcg_get_tb_stats,
+                                   tcg_set_tb_stats);
+    object_class_property_set_description(oc, "tb-stats",
+        "Gather per translation block execution statistics");
 }
 
 static const TypeInfo tcg_accel_type = {
@@ -301,7 +301,11 @@ static int setjmp_gen_code(CPUArchState *env, TranslationBlock *tb,
     return tcg_gen_code(tcg_ctx, tb, pc);
 }
 
-/* Called with mmap_lock held for user mode emulation.  */
+/*
+ * In user mode, called without mmap_lock: translation runs under the
+ * per-context gen_lock, and mmap_lock is only taken to look up and
+ * protect the guest pages and to link the new TB.
+ */
 TranslationBlock *tb_gen_code(CPUState *cpu,
                               target_ulong pc, target_ulong cs_base,
                               uint32_t flags, int cflags)
@@ -316,11 +320,33 @@ TranslationBlock *tb_gen_code(CPUState *cpu,
 #endif
     int64_t ti;
     void *host_pc;
+#ifdef CONFIG_USER_ONLY
+    bool retry = false;
 
+    tcg_gen_lock();
+#else
     assert_memory_lock();
+#endif
     qemu_thread_jit_write();
 
+ retranslate:
+#ifdef CONFIG_USER_ONLY
+    /*
+     * Sample the page's invalidation count with the lookup, so that an
+     * munmap or mprotect that races with the translation is noticed.
+     * A retry keeps the mmap_lock until the TB is linked.
+     */
+    if (!have_mmap_lock()) {
+        mmap_lock();
+    }
     phys_pc = get_page_addr_code_hostp(env, pc, &host_pc);
+    tcg_ctx->gen_page_seq[0] = tb_invalidate_seq_read(phys_pc);
+    if (!retry) {
+        mmap_unlock();
+    }
+#else
+    phys_pc = get_page_addr_code_hostp(env, pc, &host_pc);
+#endif
 
     if (phys_pc == -1) {
         /* Generate a one-shot TB with 1 insn in it */
@@ -338,7 +364,12 @@ TranslationBlock *tb_gen_code(CPUState *cpu,
     if (unlikely(!tb)) {
         /* flush must be done */
         tb_flush(cpu);
-        mmap_unlock();
+#ifdef CONFIG_USER_ONLY
+        if (have_mmap_lock()) {
+            mmap_unlock();
+        }
+        tcg_gen_unlock();
+#endif
         /* Make the execution loop process the flush as soon as possible.  */
         cpu->exception_index = EXCP_INTERRUPT;
         cpu_loop_exit(cpu);
@@ -353,6 +384,8 @@ TranslationBlock *tb_gen_code(CPUState *cpu,
     tb->flags = flags;
     tb->cflags = cflags;
     tb->trace_vcpu_dstate = *cpu->trace_dstate;
+    tb->tb_stats = qatomic_read(&tb_stats_enabled)
+                   ? tb_stats_get(phys_pc, pc, flags) : NULL;
     tb_set_page_addr0(tb, phys_pc);
     tb_set_page_addr1(tb, -1);
     tcg_ctx->gen_tb = tb;
@@ -418,6 +451,9 @@ TranslationBlock *tb_gen_code(CPUState *cpu,
         goto buffer_overflow;
     }
     tb->tc.size = gen_code_size;
+    if (tb->tb_stats) {
+        tb_stats_translated(tb->tb_stats, tb);
+    }
 
     /*
      * For CF_PCREL, attribute all executions of the generated code
@@ -533,9 +569,39 @@ TranslationBlock *tb_gen_code(CPUState *cpu,
      * before attempting to link to other TBs or add to the lookup table.
      */
     if (tb_page_addr0(tb) == -1) {
+#ifdef CONFIG_USER_ONLY
+        if (have_mmap_lock()) {
+            mmap_unlock();
+        }
+        tcg_gen_unlock();
+#endif
         return tb;
     }
 
+#ifdef CONFIG_USER_ONLY
+    if (!have_mmap_lock()) {
+        mmap_lock();
+    }
+    if (unlikely(tb_invalidate_seq_read(tb_page_addr0(tb)) !=
+                 tcg_ctx->gen_page_seq[0] ||
+                 (tb_page_addr1(tb) != -1 &&
+                  tb_invalidate_seq_read(tb_page_addr1(tb)) !=
+                  tcg_ctx->gen_page_seq[1]))) {
+        /*
+         * One of the TB's pages was invalidated while we were translating:
+         * its code may have changed, or it may no longer be mapped or
+         * executable.  Discard the translation and redo it from the page
+         * lookup with the mmap_lock held, which keeps invalidations out.
+         */
+        uintptr_t orig_aligned = (uintptr_t)gen_code_buf;
+
+        orig_aligned -= ROUND_UP(sizeof(*tb), qemu_icache_linesize);
+        qatomic_set(&tcg_ctx->code_gen_ptr, (void *)orig_aligned);
+        retry = true;
+        goto retranslate;
+    }
+#endif
+
     /*
      * Insert TB into the corresponding region tree before publishing it
      * through QHT. Otherwise rewinding happened in the TB might fail to
@@ -555,8 +621,12 @@ TranslationBlock *tb_gen_code(CPUState *cpu,
         orig_aligned -= ROUND_UP(sizeof(*tb), qemu_icache_linesize);
         qatomic_set(&tcg_ctx->code_gen_ptr, (void *)orig_aligned);
         tcg_tb_remove(tb);
-        return existing_tb;
+        tb = existing_tb;
     }
+#ifdef CONFIG_USER_ONLY
+    mmap_unlock();
+    tcg_gen_unlock();
+#endif
     return tb;
 }
 
@@ -654,6 +724,15 @@ static void print_qht_statistics(struct qht_stats hst, GString *buf)
                            hst.used_head_buckets, hst.head_buckets,
                            (double)hst.used_head_buckets /
                            hst.head_buckets * 100);
+    g_string_append_printf(buf, "TB hash load        %0.2f%% of head "
+                           "bucket entries\n", hst.load * 100);
+    g_string_append_printf(buf, "TB hash resizes     %zu, last took %0.1f us",
+                           hst.resizes, hst.resize_ns / 1e3);
+    if (hst.resize_pending) {
+        g_string_append_printf(buf, " (%zu buckets left to move)",
+                               hst.resize_pending);
+    }
+    g_string_append_c(buf, '\n');
 
     hgram_opts =  QDIST_PR_BORDER | QDIST_PR_LABELS;
     hgram_opts |= QDIST_PR_100X   | QDIST_PR_PERCENT;
@@ -719,6 +798,7 @@ void dump_exec_info(GString *buf)
     struct tb_tree_stats tst = {};
     struct qht_stats hst;
     size_t nb_tbs, flush_full, flush_part, flush_elide;
+    size_t notdirty_writes, dirty_granules;
 
     tcg_tb_foreach(tb_tree_stats_iter, &tst);
     nb_tbs = tst.nb_tbs;
@@ -764,6 +844,10 @@ void dump_exec_info(GString *buf)
     g_string_append_printf(buf, "TLB full flushes    %zu\n", flush_full);
     g_string_append_printf(buf, "TLB partial flushes %zu\n", flush_part);
     g_string_append_printf(buf, "TLB elided flushes  %zu\n", flush_elide);
+    tlb_notdirty_counts(&notdirty_writes, &dirty_granules);
+    g_string_append_printf(buf, "TLB notdirty writes %zu\n", notdirty_writes);
+    g_string_append_printf(buf, "TLB dirty granules  %zu\n", dirty_granules);
+    tcg_atomic_fallback_dump(buf);
     tcg_dump_info(buf);
 }
 
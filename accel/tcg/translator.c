@@ -17,6 +17,8 @@
 #include "exec/translator.h"
 #include "exec/plugin-gen.h"
 #include "exec/replay-core.h"
+#include "tb-hash.h"
+#include "internal.h"
 
 bool translator_use_goto_tb(DisasContextBase *db, target_ulong dest)
 {
@@ -29,6 +31,185 @@ bool translator_use_goto_tb(DisasContextBase *db, target_ulong dest)
     return ((db->pc_first ^ dest) & TARGET_PAGE_MASK) == 0;
 }
 
+#define CPU_ENV_OFFSET(field) \
+    (offsetof(ArchCPU, parent_obj.field) - offsetof(ArchCPU, env))
+#define TB_JMP_CACHE_ENTRY_SIZE \
+    sizeof(((CPUJumpCache *)NULL)->array[0])
+
+/* Same as tb_jmp_cache_hash_func(). */
+static void gen_tb_jmp_cache_hash(TCGv ret, TCGv pc)
+{
+#ifdef CONFIG_SOFTMMU
+    TCGv page = tcg_temp_new();
+
+    tcg_gen_shri_tl(ret, pc, TARGET_PAGE_BITS - TB_JMP_PAGE_BITS);
+    tcg_gen_xor_tl(ret, ret, pc);
+    tcg_gen_shri_tl(page, ret, TARGET_PAGE_BITS - TB_JMP_PAGE_BITS);
+    tcg_gen_andi_tl(page, page, TB_JMP_PAGE_MASK);
+    tcg_gen_andi_tl(ret, ret, TB_JMP_ADDR_MASK);
+    tcg_gen_or_tl(ret, ret, page);
+#else
+    tcg_gen_shri_tl(ret, pc, TB_JMP_CACHE_BITS);
+    tcg_gen_xor_tl(ret, ret, pc);
+    tcg_gen_andi_tl(ret, ret, TB_JMP_CACHE_SIZE - 1);
+#endif
+}
+
+/* Count one execution, non-atomically, see tb-stats.c. */
+/* Bump this vCPU's counter, only it writes there. */
+static void gen_tb_stats_exec(TBStatistics *s)
+{
+    TCGv_ptr ptr;
+    TCGv_i64 count;
+
+    if (s->slot == TB_STATS_NO_SLOT) {
+        return;
+    }
+
+    ptr = tcg_temp_new_ptr();
+    count = tcg_temp_new_i64();
+    tcg_gen_ld_ptr(ptr, cpu_env, offsetof(CPUState, tb_stats_counters) -
+                                 offsetof(ArchCPU, env));
+    tcg_gen_ld_ptr(ptr, ptr,
+                   (s->slot >> TB_STATS_CHUNK_BITS) * sizeof(uint64_t *));
+    tcg_gen_ld_i64(count, ptr,
+                   (s->slot & (TB_STATS_CHUNK_SIZE - 1)) * sizeof(uint64_t));
+    tcg_gen_addi_i64(count, count, 1);
+    tcg_gen_st_i64(count, ptr,
+                   (s->slot & (TB_STATS_CHUNK_SIZE - 1)) * sizeof(uint64_t));
+}
+
+void translator_lookup_and_goto_ptr(DisasContextBase *db, TCGv pc)
+{
+    TranslationBlock *tb = db->tb;
+    uint32_t cflags = tb_cflags(tb);
+    TCGLabel *miss;
+    TCGv_ptr entry, next;
+    TCGv_i32 t32;
+    TCGv t;
+
+    /*
+     * TBs with special cflags are not found by a normal lookup,
+     * and helper_lookup_tb_ptr takes care of logging.
+     */
+    if ((cflags & (CF_NO_GOTO_PTR | CF_COUNT_MASK | CF_LAST_IO | CF_NOIRQ)) ||
+        qemu_loglevel_mask(CPU_LOG_TB_CPU | CPU_LOG_EXEC)) {
+        tcg_gen_lookup_and_goto_ptr();
+        return;
+    }
+
+    plugin_gen_disable_mem_helpers();
+    miss = gen_new_label();
+    entry = tcg_temp_new_ptr();
+    next = tcg_temp_new_ptr();
+    t32 = tcg_temp_new_i32();
+    t = tcg_temp_new();
+
+    /* Breakpoints are checked by helper_lookup_tb_ptr. */
+    tcg_gen_ld_ptr(next, cpu_env, CPU_ENV_OFFSET(breakpoints.tqh_first));
+    tcg_gen_brcondi_ptr(TCG_COND_NE, next, 0, miss);
+
+    gen_tb_jmp_cache_hash(t, pc);
+    tcg_gen_muli_tl(t, t, TB_JMP_CACHE_ENTRY_SIZE);
+#if TARGET_LONG_BITS == 32
+    tcg_gen_ext_i32_ptr(entry, t);
+#else
+    tcg_gen_trunc_i64_ptr(entry, t);
+#endif
+    tcg_gen_ld_ptr(next, cpu_env, CPU_ENV_OFFSET(tb_jmp_cache));
+    tcg_gen_add_ptr(entry, entry, next);
+
+    tcg_gen_ld_ptr(next, entry, offsetof(CPUJumpCache, array[0].tb));
+    tcg_gen_brcondi_ptr(TCG_COND_EQ, next, 0, miss);
+    if (cflags & CF_PCREL) {
+        /* Pairs with the store_release in tb_lookup(). */
+        tcg_gen_mb(TCG_MO_LD_LD | TCG_BAR_LDAQ);
+        tcg_gen_ld_tl(t, entry, offsetof(CPUJumpCache, array[0].pc));
+    } else {
+        tcg_gen_ld_tl(t, next, offsetof(TranslationBlock, pc));
+    }
+    tcg_gen_brcond_tl(TCG_COND_NE, t, pc, miss);
+
+    /* The comparisons of tb_lookup(), against this TB's values. */
+    tcg_gen_ld_tl(t, next, offsetof(TranslationBlock, cs_base));
+    tcg_gen_brcondi_tl(TCG_COND_NE, t, tb->cs_base, miss);
+    tcg_gen_ld_i32(t32, next, offsetof(TranslationBlock, flags));
+    tcg_gen_brcondi_i32(TCG_COND_NE, t32, tb->flags, miss);
+    tcg_gen_ld_i32(t32, next, offsetof(TranslationBlock, trace_vcpu_dstate));
+    tcg_gen_brcondi_i32(TCG_COND_NE, t32, tb->trace_vcpu_dstate, miss);
+    tcg_gen_ld_i32(t32, next, offsetof(TranslationBlock, cflags));
+    tcg_gen_brcondi_i32(TCG_COND_NE, t32, cflags, miss);
+
+    tcg_gen_ld_ptr(next, next, offsetof(TranslationBlock, tc.ptr));
+    tcg_gen_op1i(INDEX_op_goto_ptr, tcgv_ptr_arg(next));
+
+    gen_set_label(miss);
+    tcg_gen_lookup_and_goto_ptr();
+}
+
+#ifdef CONFIG_USER_ONLY
+/*
+ * tb_gen_code() translates without the mmap_lock, so take it just to
+ * write-protect a page.  This must happen before guest code is read
+ * from it: any later store then faults and invalidates the page, which
+ * makes tb_gen_code() retranslate.
+ */
+static void translator_page_protect(target_ulong addr)
+{
+    if (have_mmap_lock()) {
+        page_protect(addr);
+    } else {
+        mmap_lock();
+        page_protect(addr);
+        mmap_unlock();
+    }
+}
+
+/*
+ * Look up the second page of the TB, sample its invalidation count and
+ * write-protect it under the mmap_lock, as tb_gen_code() and
+ * translator_loop() do for the first page.
+ * A concurrent munmap, mprotect or store after this invalidates the page
+ * and makes tb_gen_code() retranslate.
+ */
+static tb_page_addr_t translator_get_page1(CPUArchState *env,
+                                          target_ulong addr, void **hostp)
+{
+    bool locked = have_mmap_lock();
+    tb_page_addr_t phys_page;
+
+    if (!locked) {
+        mmap_lock();
+    }
+    phys_page = get_page_addr_code_hostp(env, addr, hostp);
+    tcg_ctx->gen_page_seq[1] = tb_invalidate_seq_read(phys_page);
+    page_protect(addr);
+    if (!locked) {
+        mmap_unlock();
+    }
+    return phys_page;
+}
+
+/*
+ * Guest code is read from the host mapping without the mmap_lock, so a
+ * concurrent munmap can make the read fault.  Mark the read as being for
+ * translation, as cpu_ld*_code() do, so that the fault is raised as a
+ * guest fault on execution and not taken as a fault in generated code.
+ */
+static inline void translator_host_read_begin(void)
+{
+    set_helper_retaddr(1);
+}
+
+static inline void translator_host_read_end(void)
+{
+    clear_helper_retaddr();
+}
+#else
+static inline void translator_host_read_begin(void) { }
+static inline void translator_host_read_end(void) { }
+#endif
+
 void translator_loop(CPUState *cpu, TranslationBlock *tb, int *max_insns,
                      target_ulong pc, void *host_pc,
                      const TranslatorOps *ops, DisasContextBase *db)
@@ -48,7 +229,7 @@ void translator_loop(CPUState *cpu, TranslationBlock *tb, int *max_insns,
     db->host_addr[1] = NULL;
 
 #ifdef CONFIG_USER_ONLY
-    page_protect(pc);
+    translator_page_protect(pc);
 #endif
 
     ops->init_disas_context(db, cpu);
@@ -56,6 +237,9 @@ void translator_loop(CPUState *cpu, TranslationBlock *tb, int *max_insns,
 
     /* Start translating.  */
     gen_tb_start(db->tb);
+    if (tb->tb_stats) {
+        gen_tb_stats_exec(tb->tb_stats);
+    }
     ops->tb_start(db, cpu);
     tcg_debug_assert(db->is_jmp == DISAS_NEXT);  /* no early exit */
 
@@ -158,8 +342,13 @@ static void *translator_access(CPUArchState *env, DisasContextBase *db,
         host = db->host_addr[1];
         base = TARGET_PAGE_ALIGN(db->pc_first);
         if (host == NULL) {
+#ifdef CONFIG_USER_ONLY
+            tb_page_addr_t phys_page =
+                translator_get_page1(env, base, &db->host_addr[1]);
+#else
             tb_page_addr_t phys_page =
                 get_page_addr_code_hostp(env, base, &db->host_addr[1]);
+#endif
 
             /*
              * If the second page is MMIO, treat as if the first page
@@ -171,9 +360,6 @@ static void *translator_access(CPUArchState *env, DisasContextBase *db,
             }
 
             tb_set_page_addr1(tb, phys_page);
-#ifdef CONFIG_USER_ONLY
-            page_protect(end);
-#endif
             host = db->host_addr[1];
         }
 
@@ -193,10 +379,12 @@ uint8_t translator_ldub(CPUArchState *env, DisasContextBase *db, abi_ptr pc)
     void *p = translator_access(env, db, pc, sizeof(ret));
 
     if (p) {
-        plugin_insn_append(pc, p, sizeof(ret));
-        return ldub_p(p);
+        translator_host_read_begin();
+        ret = ldub_p(p);
+        translator_host_read_end();
+    } else {
+        ret = cpu_ldub_code(env, pc);
     }
-    ret = cpu_ldub_code(env, pc);
     plugin_insn_append(pc, &ret, sizeof(ret));
     return ret;
 }
@@ -207,10 +395,12 @@ uint16_t translator_lduw(CPUArchState *env, DisasContextBase *db, abi_ptr pc)
     void *p = translator_access(env, db, pc, sizeof(ret));
 
     if (p) {
-        plugin_insn_append(pc, p, sizeof(ret));
-        return lduw_p(p);
+        translator_host_read_begin();
+        ret = lduw_p(p);
+        translator_host_read_end();
+    } else {
+        ret = cpu_lduw_code(env, pc);
     }
-    ret = cpu_lduw_code(env, pc);
     plug = tswap16(ret);
     plugin_insn_append(pc, &plug, sizeof(ret));
     return ret;
@@ -222,10 +412,12 @@ uint32_t translator_ldl(CPUArchState *env, DisasContextBase *db, abi_ptr pc)
     void *p = translator_access(env, db, pc, sizeof(ret));
 
     if (p) {
-        plugin_insn_append(pc, p, sizeof(ret));
-        return ldl_p(p);
+        translator_host_read_begin();
+        ret = ldl_p(p);
+        translator_host_read_end();
+    } else {
+        ret = cpu_ldl_code(env, pc);
     }
-    ret = cpu_ldl_code(env, pc);
     plug = tswap32(ret);
     plugin_insn_append(pc, &plug, sizeof(ret));
     return ret;
@@ -237,10 +429,12 @@ uint64_t translator_ldq(CPUArchState *env, DisasContextBase *db, abi_ptr pc)
     void *p = translator_access(env, db, pc, sizeof(ret));
 
     if (p) {
-        plugin_insn_append(pc, p, sizeof(ret));
-        return ldq_p(p);
+        translator_host_read_begin();
+        ret = ldq_p(p);
+        translator_host_read_end();
+    } else {
+        ret = cpu_ldq_code(env, pc);
     }
-    ret = cpu_ldq_code(env, pc);
     plug = tswap64(ret);
     plugin_insn_append(pc, &plug, sizeof(ret));
     return ret;
@@ -1502,6 +1502,8 @@ static void *atomic_mmu_lookup(CPUArchState *env, target_ulong addr,
     return ret;
 }
 
+#define ATOMIC_MMU_CLEANUP do { clear_helper_retaddr(); } while (0)
+
 #include "atomic_common.c.inc"
 
 /*
@@ -1511,7 +1513,6 @@ static void *atomic_mmu_lookup(CPUArchState *env, target_ulong addr,
 
 #define ATOMIC_NAME(X) \
     glue(glue(glue(cpu_atomic_ ## X, SUFFIX), END), _mmu)
-#define ATOMIC_MMU_CLEANUP do { clear_helper_retaddr(); } while (0)
 
 #define DATA_SIZE 1
 #include "atomic_template.h"
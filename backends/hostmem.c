@@ -237,8 +237,9 @@ static void host_memory_backend_set_prealloc(Object *obj, bool value,
         void *ptr = memory_region_get_ram_ptr(&backend->mr);
         uint64_t sz = memory_region_size(&backend->mr);
 
-        qemu_prealloc_mem(fd, ptr, sz, backend->prealloc_threads,
-                          backend->prealloc_context, &local_err);
+        qemu_prealloc_mem_nodes(fd, ptr, sz, backend->prealloc_threads,
+                                backend->prealloc_context,
+                                backend->host_nodes, MAX_NODES, &local_err);
         if (local_err) {
             error_propagate(errp, local_err);
             return;
@@ -396,12 +397,15 @@ host_memory_backend_memory_complete(UserCreatable *uc, Error **errp)
 #endif
         /* Preallocate memory after the NUMA policy has been instantiated.
          * This is necessary to guarantee memory is allocated with
-         * specified NUMA policy in place.
+         * specified NUMA policy in place.  Without a prealloc-context,
+         * the threads are placed on the CPUs of the host-nodes.
          */
         if (backend->prealloc) {
-            qemu_prealloc_mem(memory_region_get_fd(&backend->mr), ptr, sz,
-                              backend->prealloc_threads,
-                              backend->prealloc_context, &local_err);
+            qemu_prealloc_mem_nodes(memory_region_get_fd(&backend->mr), ptr,
+                                    sz, backend->prealloc_threads,
+                                    backend->prealloc_context,
+                                    backend->host_nodes, MAX_NODES,
+                                    &local_err);
             if (local_err) {
                 goto out;
             }
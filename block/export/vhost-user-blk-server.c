@@ -23,12 +23,18 @@
 
 enum {
     VHOST_USER_BLK_NUM_QUEUES_DEFAULT = 1,
+    /* Requests taken from the virtqueue per available index read */
+    VU_BLK_POP_BATCH = 32,
+    /* Completed requests returned per used index update */
+    VU_BLK_PUSH_BATCH = 64,
 };
 
 typedef struct VuBlkReq {
     VuVirtqElement elem;
     VuServer *server;
     struct VuVirtq *vq;
+    unsigned int in_len;
+    QSIMPLEQ_ENTRY(VuBlkReq) next;
 } VuBlkReq;
 
 /* vhost user block device */
@@ -38,19 +44,77 @@ typedef struct {
     VirtioBlkHandler handler;
     QIOChannelSocket *sioc;
     struct virtio_blk_config blkcfg;
+
+    /* Completed requests not yet in the used ring, see vu_blk_flush_bh() */
+    QSIMPLEQ_HEAD(, VuBlkReq) done_reqs;
+    bool flush_scheduled;
 } VuBlkExport;
 
+/*
+ * Return the requests completed since the last flush to the driver, one
+ * used index update and one notification per batch of each virtqueue.
+ * Every queued request still holds its server reference and the export
+ * holds an in-flight reference on the BlockBackend, so neither a
+ * disconnect nor a drain can get past a pending flush.
+ */
+static void vu_blk_flush_bh(void *opaque)
+{
+    VuBlkExport *vexp = opaque;
+    VuServer *server = &vexp->vu_server;
+    VuDev *vu_dev = &server->vu_dev;
+
+    vexp->flush_scheduled = false;
+
+    while (!QSIMPLEQ_EMPTY(&vexp->done_reqs)) {
+        VuVirtqElement *elems[VU_BLK_PUSH_BATCH];
+        unsigned int len[VU_BLK_PUSH_BATCH];
+        VuBlkReq *req, *next_req;
+        VuVirtq *vq = QSIMPLEQ_FIRST(&vexp->done_reqs)->vq;
+        unsigned int n = 0, i;
+
+        QSIMPLEQ_FOREACH_SAFE(req, &vexp->done_reqs, next, next_req) {
+            if (req->vq != vq) {
+                continue;
+            }
+            QSIMPLEQ_REMOVE(&vexp->done_reqs, req, VuBlkReq, next);
+            elems[n] = &req->elem;
+            len[n] = req->in_len;
+            if (++n == VU_BLK_PUSH_BATCH) {
+                break;
+            }
+        }
+
+        vu_queue_push_batch(vu_dev, vq, elems, len, n);
+        vu_queue_notify(vu_dev, vq);
+
+        for (i = 0; i < n; i++) {
+            vu_queue_element_free(vu_dev, vq, elems[i]);
+            vhost_user_server_unref(server);
+        }
+    }
+
+    blk_dec_in_flight(vexp->export.blk);
+}
+
+/* Takes over the server reference of @req, dropped by vu_blk_flush_bh() */
 static void vu_blk_req_complete(VuBlkReq *req, size_t in_len)
 {
-    VuDev *vu_dev = &req->server->vu_dev;
+    VuBlkExport *vexp = container_of(req->server, VuBlkExport, vu_server);
 
-    vu_queue_push(vu_dev, req->vq, &req->elem, in_len);
-    vu_queue_notify(vu_dev, req->vq);
+    req->in_len = in_len;
+    QSIMPLEQ_INSERT_TAIL(&vexp->done_reqs, req, next);
 
-    free(req);
+    if (!vexp->flush_scheduled) {
+        vexp->flush_scheduled = true;
+        blk_inc_in_flight(vexp->export.blk);
+        aio_bh_schedule_oneshot(vexp->export.ctx, vu_blk_flush_bh, vexp);
+    }
 }
 
-/* Called with server refcount increased, must decrease before returning */
+/*
+ * Called with server refcount increased, must decrease it or hand it to
+ * vu_blk_req_complete() before returning
+ */
 static void coroutine_fn vu_blk_virtio_process_req(void *opaque)
 {
     VuBlkReq *req = opaque;
@@ -67,13 +131,12 @@ static void coroutine_fn vu_blk_virtio_process_req(void *opaque)
     in_len = virtio_blk_process_req(handler, in_iov, out_iov,
                                     in_num, out_num);
     if (in_len < 0) {
-        free(req);
+        vu_queue_element_free(&server->vu_dev, req->vq, &req->elem);
         vhost_user_server_unref(server);
         return;
     }
 
     vu_blk_req_complete(req, in_len);
-    vhost_user_server_unref(server);
 }
 
 static void vu_blk_process_vq(VuDev *vu_dev, int idx)
@@ -82,21 +145,26 @@ static void vu_blk_process_vq(VuDev *vu_dev, int idx)
     VuVirtq *vq = vu_get_queue(vu_dev, idx);
 
     while (1) {
-        VuBlkReq *req;
+        VuBlkReq *reqs[VU_BLK_POP_BATCH];
+        unsigned int n, i;
 
-        req = vu_queue_pop(vu_dev, vq, sizeof(VuBlkReq));
-        if (!req) {
+        n = vu_queue_pop_batch(vu_dev, vq, sizeof(VuBlkReq),
+                               (void **)reqs, ARRAY_SIZE(reqs));
+        if (!n) {
             break;
         }
 
-        req->server = server;
-        req->vq = vq;
+        for (i = 0; i < n; i++) {
+            VuBlkReq *req = reqs[i];
+            Coroutine *co;
 
-        Coroutine *co =
-            qemu_coroutine_create(vu_blk_virtio_process_req, req);
+            req->server = server;
+            req->vq = vq;
 
-        vhost_user_server_ref(server);
-        qemu_coroutine_enter(co);
+            co = qemu_coroutine_create(vu_blk_virtio_process_req, req);
+            vhost_user_server_ref(server);
+            qemu_coroutine_enter(co);
+        }
     }
 }
 
@@ -283,6 +351,7 @@ static int vu_blk_exp_create(BlockExport *exp, BlockExportOptions *opts,
     uint16_t num_queues = VHOST_USER_BLK_NUM_QUEUES_DEFAULT;
 
     vexp->blkcfg.wce = 0;
+    QSIMPLEQ_INIT(&vexp->done_reqs);
 
     if (vu_opts->has_logical_block_size) {
         logical_block_size = vu_opts->logical_block_size;
@@ -38,6 +38,7 @@ static void qcow2_free_single_snapshot(BlockDriverState *bs, int i)
     assert(i >= 0 && i < s->nb_snapshots);
     g_free(s->snapshots[i].name);
     g_free(s->snapshots[i].id_str);
+    g_free(s->snapshots[i].parent_id_str);
     g_free(s->snapshots[i].unknown_extra_data);
     memset(&s->snapshots[i], 0, sizeof(s->snapshots[i]));
 }
@@ -103,6 +104,7 @@ int qcow2_do_read_snapshots(BlockDriverState *bs, bool repair,
 
     for(i = 0; i < s->nb_snapshots; i++) {
         bool truncate_unknown_extra_data = false;
+        size_t parent_size = 0;
 
         pre_sn_offset = offset;
         table_length = ROUND_UP(table_length, 8);
@@ -181,16 +183,74 @@ int qcow2_do_read_snapshots(BlockDriverState *bs, bool repair,
             if (truncate_unknown_extra_data) {
                 sn->extra_data_size = QCOW_MAX_SNAPSHOT_EXTRA_DATA;
             }
+            unknown_extra_data_size = sn->extra_data_size - sizeof(extra);
+
+            /* The parent snapshot ID comes first, if the feature bit says so */
+            if (s->autoclear_features & QCOW2_AUTOCLEAR_SNAPSHOT_PARENTS) {
+                uint16_t parent_id_size = 0;
+
+                if (unknown_extra_data_size >= sizeof(parent_id_size)) {
+                    ret = bdrv_co_pread(bs->file, offset,
+                                        sizeof(parent_id_size),
+                                        &parent_id_size, 0);
+                    if (ret < 0) {
+                        error_setg_errno(errp, -ret,
+                                         "Failed to read snapshot table");
+                        goto fail;
+                    }
+                    parent_id_size = be16_to_cpu(parent_id_size);
+                    parent_size = sizeof(parent_id_size) + parent_id_size;
+                }
+
+                if (parent_size == 0 ||
+                    parent_size > unknown_extra_data_size) {
+                    if (!repair) {
+                        ret = -EINVAL;
+                        error_setg(errp, "Invalid parent snapshot ID in "
+                                   "snapshot table entry %i", i);
+                        error_append_hint(errp, "You can force-remove this "
+                                          "extra metadata with qemu-img "
+                                          "check -r all\n");
+                        goto fail;
+                    }
+
+                    fprintf(stderr, "Discarding invalid parent snapshot ID "
+                            "in snapshot table entry %i\n", i);
+
+                    (*extra_data_dropped)++;
+                    parent_size = unknown_extra_data_size;
+                    parent_id_size = 0;
+                }
+
+                if (parent_id_size) {
+                    sn->parent_id_str = g_malloc(parent_id_size + 1);
+                    ret = bdrv_co_pread(bs->file,
+                                        offset + sizeof(parent_id_size),
+                                        parent_id_size, sn->parent_id_str, 0);
+                    if (ret < 0) {
+                        error_setg_errno(errp, -ret,
+                                         "Failed to read snapshot table");
+                        goto fail;
+                    }
+                    sn->parent_id_str[parent_id_size] = '\0';
+                }
+
+                /* Only count the rest of the extra data */
+                offset += parent_size;
+                unknown_extra_data_size -= parent_size;
+                sn->extra_data_size -= parent_size;
+            }
 
             /* Store unknown extra data */
-            unknown_extra_data_size = sn->extra_data_size - sizeof(extra);
-            sn->unknown_extra_data = g_malloc(unknown_extra_data_size);
-            ret = bdrv_co_pread(bs->file, offset, unknown_extra_data_size,
-                                sn->unknown_extra_data, 0);
-            if (ret < 0) {
-                error_setg_errno(errp, -ret,
-                                 "Failed to read snapshot table");
-                goto fail;
+            if (unknown_extra_data_size) {
+                sn->unknown_extra_data = g_malloc(unknown_extra_data_size);
+                ret = bdrv_co_pread(bs->file, offset, unknown_extra_data_size,
+                                    sn->unknown_extra_data, 0);
+                if (ret < 0) {
+                    error_setg_errno(errp, -ret,
+                                     "Failed to read snapshot table");
+                    goto fail;
+                }
             }
             offset = extra_data_end;
         }
@@ -216,8 +276,8 @@ int qcow2_do_read_snapshots(BlockDriverState *bs, bool repair,
         sn->name[name_size] = '\0';
 
         /* Note that the extra data may have been truncated */
-        table_length += sizeof(h) + sn->extra_data_size + id_str_size +
-                        name_size;
+        table_length += sizeof(h) + sn->extra_data_size + parent_size +
+                        id_str_size + name_size;
         if (!repair) {
             assert(table_length == offset - s->snapshots_offset);
         }
@@ -267,6 +327,26 @@ int coroutine_fn qcow2_read_snapshots(BlockDriverState *bs, Error **errp)
     return qcow2_do_read_snapshots(bs, false, NULL, NULL, errp);
 }
 
+/*
+ * Size of the parent snapshot ID record of @sn in the snapshot table.
+ * With QCOW2_AUTOCLEAR_SNAPSHOT_PARENTS, it precedes any extra data
+ * beyond QCowSnapshotExtraData, even if @sn has no parent.
+ */
+static size_t qcow2_snapshot_parent_size(BDRVQcow2State *s,
+                                         QCowSnapshot *sn)
+{
+    if (!(s->autoclear_features & QCOW2_AUTOCLEAR_SNAPSHOT_PARENTS)) {
+        return 0;
+    }
+    if (sn->parent_id_str) {
+        return sizeof(uint16_t) + strlen(sn->parent_id_str);
+    }
+    if (sn->extra_data_size > sizeof(QCowSnapshotExtraData)) {
+        return sizeof(uint16_t);
+    }
+    return 0;
+}
+
 /* add at the end of the file a new list of snapshots */
 int qcow2_write_snapshots(BlockDriverState *bs)
 {
@@ -275,6 +355,7 @@ int qcow2_write_snapshots(BlockDriverState *bs)
     QCowSnapshotHeader h;
     QCowSnapshotExtraData extra;
     int i, name_size, id_str_size, snapshots_size;
+    size_t parent_size;
     struct {
         uint32_t nb_snapshots;
         uint64_t snapshots_offset;
@@ -289,6 +370,7 @@ int qcow2_write_snapshots(BlockDriverState *bs)
         offset = ROUND_UP(offset, 8);
         offset += sizeof(h);
         offset += MAX(sizeof(extra), sn->extra_data_size);
+        offset += qcow2_snapshot_parent_size(s, sn);
         offset += strlen(sn->id_str);
         offset += strlen(sn->name);
 
@@ -335,8 +417,10 @@ int qcow2_write_snapshots(BlockDriverState *bs)
         h.date_sec = cpu_to_be32(sn->date_sec);
         h.date_nsec = cpu_to_be32(sn->date_nsec);
         h.vm_clock_nsec = cpu_to_be64(sn->vm_clock_nsec);
+        parent_size = qcow2_snapshot_parent_size(s, sn);
         h.extra_data_size = cpu_to_be32(MAX(sizeof(extra),
-                                            sn->extra_data_size));
+                                            sn->extra_data_size) +
+                                        parent_size);
 
         memset(&extra, 0, sizeof(extra));
         extra.vm_state_size_large = cpu_to_be64(sn->vm_state_size);
@@ -362,6 +446,28 @@ int qcow2_write_snapshots(BlockDriverState *bs)
         }
         offset += sizeof(extra);
 
+        if (parent_size) {
+            uint16_t parent_id_size = cpu_to_be16(parent_size -
+                                                  sizeof(parent_id_size));
+
+            ret = bdrv_pwrite(bs->file, offset, sizeof(parent_id_size),
+                              &parent_id_size, 0);
+            if (ret < 0) {
+                goto fail;
+            }
+            offset += sizeof(parent_id_size);
+
+            if (sn->parent_id_str) {
+                ret = bdrv_pwrite(bs->file, offset,
+                                  parent_size - sizeof(parent_id_size),
+                                  sn->parent_id_str, 0);
+                if (ret < 0) {
+                    goto fail;
+                }
+                offset += parent_size - sizeof(parent_id_size);
+            }
+        }
+
         if (sn->extra_data_size > sizeof(extra)) {
             size_t unknown_extra_data_size =
                 sn->extra_data_size - sizeof(extra);
@@ -643,6 +749,7 @@ int qcow2_snapshot_create(BlockDriverState *bs, QEMUSnapshotInfo *sn_info)
     int i, ret;
     uint64_t *l1_table = NULL;
     int64_t l1_table_offset;
+    bool set_parents;
 
     if (s->nb_snapshots >= QCOW_MAX_SNAPSHOTS) {
         return -EFBIG;
@@ -669,6 +776,17 @@ int qcow2_snapshot_create(BlockDriverState *bs, QEMUSnapshotInfo *sn_info)
     sn->icount = sn_info->icount;
     sn->extra_data_size = sizeof(QCowSnapshotExtraData);
 
+    /* Only the VM state can depend on a parent, disks are always complete */
+    if (sn_info->vm_state_size && sn_info->parent_id_str[0]) {
+        if (s->qcow_version < 3) {
+            ret = -ENOTSUP;
+            goto fail;
+        }
+        sn->parent_id_str = g_strdup(sn_info->parent_id_str);
+    }
+    set_parents = sn->parent_id_str &&
+        !(s->autoclear_features & QCOW2_AUTOCLEAR_SNAPSHOT_PARENTS);
+
     /* Allocate the L1 table of the snapshot and copy the current one there. */
     l1_table_offset = qcow2_alloc_clusters(bs, s->l1_size * L1E_SIZE);
     if (l1_table_offset < 0) {
@@ -724,8 +842,30 @@ int qcow2_snapshot_create(BlockDriverState *bs, QEMUSnapshotInfo *sn_info)
     s->snapshots = new_snapshot_list;
     s->snapshots[s->nb_snapshots++] = *sn;
 
+    /*
+     * Whatever follows the known extra data of entries that were written
+     * without the parents feature bit cannot be told apart from a parent
+     * ID.  Drop it before setting the bit; the header is only updated once
+     * the table is valid under the new format.
+     */
+    if (set_parents) {
+        for (i = 0; i < s->nb_snapshots; i++) {
+            if (s->snapshots[i].extra_data_size >
+                sizeof(QCowSnapshotExtraData)) {
+                s->snapshots[i].extra_data_size =
+                    sizeof(QCowSnapshotExtraData);
+                g_free(s->snapshots[i].unknown_extra_data);
+                s->snapshots[i].unknown_extra_data = NULL;
+            }
+        }
+        s->autoclear_features |= QCOW2_AUTOCLEAR_SNAPSHOT_PARENTS;
+    }
+
     ret = qcow2_write_snapshots(bs);
     if (ret < 0) {
+        if (set_parents) {
+            s->autoclear_features &= ~QCOW2_AUTOCLEAR_SNAPSHOT_PARENTS;
+        }
         g_free(s->snapshots);
         s->snapshots = old_snapshot_list;
         s->nb_snapshots--;
@@ -734,6 +874,15 @@ int qcow2_snapshot_create(BlockDriverState *bs, QEMUSnapshotInfo *sn_info)
 
     g_free(old_snapshot_list);
 
+    if (set_parents) {
+        ret = qcow2_update_header(bs);
+        if (ret < 0) {
+            /* The entry stays, but without its parent on disk */
+            s->autoclear_features &= ~QCOW2_AUTOCLEAR_SNAPSHOT_PARENTS;
+            return ret;
+        }
+    }
+
     /* The VM state isn't needed any more in the active L1 table; in fact, it
      * hurts by causing expensive COW for the next snapshot. */
     qcow2_cluster_discard(bs, qcow2_vm_state_offset(s),
@@ -751,6 +900,7 @@ int qcow2_snapshot_create(BlockDriverState *bs, QEMUSnapshotInfo *sn_info)
 fail:
     g_free(sn->id_str);
     g_free(sn->name);
+    g_free(sn->parent_id_str);
     g_free(l1_table);
 
     return ret;
@@ -913,7 +1063,7 @@ int qcow2_snapshot_delete(BlockDriverState *bs,
 {
     BDRVQcow2State *s = bs->opaque;
     QCowSnapshot sn;
-    int snapshot_index, ret;
+    int snapshot_index, i, ret;
 
     if (has_data_file(bs)) {
         return -ENOTSUP;
@@ -927,6 +1077,16 @@ int qcow2_snapshot_delete(BlockDriverState *bs,
     }
     sn = s->snapshots[snapshot_index];
 
+    /* The VM state of an incremental snapshot needs the one of its parent */
+    for (i = 0; i < s->nb_snapshots; i++) {
+        if (s->snapshots[i].parent_id_str &&
+            !strcmp(s->snapshots[i].parent_id_str, sn.id_str)) {
+            error_setg(errp, "Snapshot '%s' is the parent of incremental "
+                       "snapshot '%s'", sn.name, s->snapshots[i].name);
+            return -EBUSY;
+        }
+    }
+
     ret = qcow2_validate_table(bs, sn.l1_table_offset, sn.l1_size,
                                L1E_SIZE, QCOW_MAX_L1_SIZE,
                                "Snapshot L1 table", errp);
@@ -952,6 +1112,7 @@ int qcow2_snapshot_delete(BlockDriverState *bs,
      */
     g_free(sn.unknown_extra_data);
     g_free(sn.id_str);
+    g_free(sn.parent_id_str);
     g_free(sn.name);
 
     /*
@@ -984,6 +1145,164 @@ int qcow2_snapshot_delete(BlockDriverState *bs,
     return 0;
 }
 
+/*
+ * Give the disk-only snapshot @snapshot_id the VM state that was written to
+ * the active vmstate area after the snapshot was taken.  The snapshot gets
+ * a new L1 table that combines its own guest disk part with the vmstate
+ * part of the active L1 table, so guest writes since then are not included.
+ */
+int qcow2_snapshot_attach_vmstate(BlockDriverState *bs,
+                                  const char *snapshot_id,
+                                  uint64_t vm_state_size,
+                                  Error **errp)
+{
+    BDRVQcow2State *s = bs->opaque;
+    QCowSnapshot *sn;
+    uint64_t *l1_table = NULL;
+    int64_t l1_table_offset, old_l1_table_offset;
+    int snapshot_index, old_l1_size, sn_l1_size, i, ret;
+
+    if (has_data_file(bs)) {
+        return -ENOTSUP;
+    }
+
+    snapshot_index = find_snapshot_by_id_and_name(bs, snapshot_id, NULL);
+    if (snapshot_index < 0) {
+        error_setg(errp, "Can't find the snapshot");
+        return -ENOENT;
+    }
+    sn = &s->snapshots[snapshot_index];
+
+    if (sn->vm_state_size) {
+        error_setg(errp, "Snapshot '%s' already has VM state", sn->name);
+        return -EEXIST;
+    }
+    /* The VM state was written after the guest part of the current image */
+    if (sn->disk_size != bs->total_sectors * BDRV_SECTOR_SIZE) {
+        error_setg(errp, "Disk was resized after snapshot '%s' was taken",
+                   sn->name);
+        return -EINVAL;
+    }
+
+    ret = qcow2_validate_table(bs, sn->l1_table_offset, sn->l1_size,
+                               L1E_SIZE, QCOW_MAX_L1_SIZE,
+                               "Snapshot L1 table", errp);
+    if (ret < 0) {
+        return ret;
+    }
+
+    l1_table = g_try_new0(uint64_t, s->l1_size);
+    if (s->l1_size && l1_table == NULL) {
+        error_setg(errp, "Failed to allocate L1 table");
+        return -ENOMEM;
+    }
+
+    /* Guest disk part from the snapshot, VM state part from the image */
+    sn_l1_size = MIN(sn->l1_size, s->l1_vm_state_index);
+    ret = bdrv_pread(bs->file, sn->l1_table_offset, sn_l1_size * L1E_SIZE,
+                     l1_table, 0);
+    if (ret < 0) {
+        error_setg_errno(errp, -ret, "Failed to read snapshot L1 table");
+        goto fail;
+    }
+    for (i = s->l1_vm_state_index; i < s->l1_size; i++) {
+        l1_table[i] = cpu_to_be64(s->l1_table[i]);
+    }
+
+    l1_table_offset = qcow2_alloc_clusters(bs, s->l1_size * L1E_SIZE);
+    if (l1_table_offset < 0) {
+        ret = l1_table_offset;
+        error_setg_errno(errp, -ret, "Failed to allocate L1 table");
+        goto fail;
+    }
+
+    ret = qcow2_pre_write_overlap_check(bs, 0, l1_table_offset,
+                                        s->l1_size * L1E_SIZE, false);
+    if (ret < 0) {
+        error_setg_errno(errp, -ret, "Failed to write L1 table");
+        goto fail;
+    }
+
+    ret = bdrv_pwrite(bs->file, l1_table_offset, s->l1_size * L1E_SIZE,
+                      l1_table, 0);
+    if (ret < 0) {
+        error_setg_errno(errp, -ret, "Failed to write L1 table");
+        goto fail;
+    }
+
+    g_free(l1_table);
+    l1_table = NULL;
+
+    ret = qcow2_update_snapshot_refcount(bs, l1_table_offset, s->l1_size, 1);
+    if (ret < 0) {
+        error_setg_errno(errp, -ret, "Failed to update refcounts");
+        goto fail;
+    }
+
+    old_l1_table_offset = sn->l1_table_offset;
+    old_l1_size = sn->l1_size;
+    sn->l1_table_offset = l1_table_offset;
+    sn->l1_size = s->l1_size;
+    sn->vm_state_size = vm_state_size;
+
+    ret = qcow2_write_snapshots(bs);
+    if (ret < 0) {
+        sn->l1_table_offset = old_l1_table_offset;
+        sn->l1_size = old_l1_size;
+        sn->vm_state_size = 0;
+        error_setg_errno(errp, -ret, "Failed to update snapshot list");
+        /* Leaks the new L1 table's clusters if this fails */
+        if (qcow2_update_snapshot_refcount(bs, l1_table_offset,
+                                           s->l1_size, -1) == 0) {
+            qcow2_free_clusters(bs, l1_table_offset, s->l1_size * L1E_SIZE,
+                                QCOW2_DISCARD_SNAPSHOT);
+        }
+        return ret;
+    }
+
+    /*
+     * The snapshot now points to the new L1 table.  If we fail after this
+     * point, we won't recover but just leak clusters.
+     */
+    ret = qcow2_update_snapshot_refcount(bs, old_l1_table_offset,
+                                         old_l1_size, -1);
+    if (ret < 0) {
+        error_setg_errno(errp, -ret, "Failed to free the old L1 table");
+        return ret;
+    }
+    qcow2_free_clusters(bs, old_l1_table_offset, old_l1_size * L1E_SIZE,
+                        QCOW2_DISCARD_SNAPSHOT);
+
+    /*
+     * The VM state clusters are shared with the snapshot now; fix up the
+     * copied flags before discarding them from the active L1 table, so that
+     * the discard does not modify the now shared L2 tables in place.
+     */
+    ret = qcow2_update_snapshot_refcount(bs, s->l1_table_offset, s->l1_size, 0);
+    if (ret < 0) {
+        error_setg_errno(errp, -ret,
+                         "Failed to update snapshot status in disk");
+        return ret;
+    }
+
+    /* As in qcow2_snapshot_create(), the active VM state is not needed */
+    qcow2_cluster_discard(bs, qcow2_vm_state_offset(s),
+                          ROUND_UP(vm_state_size, s->cluster_size),
+                          QCOW2_DISCARD_NEVER, false);
+
+#ifdef DEBUG_ALLOC
+    {
+        BdrvCheckResult result = {0};
+        qcow2_check_refcounts(bs, &result, 0);
+    }
+#endif
+    return 0;
+
+fail:
+    g_free(l1_table);
+    return ret;
+}
+
 int qcow2_snapshot_list(BlockDriverState *bs, QEMUSnapshotInfo **psn_tab)
 {
     BDRVQcow2State *s = bs->opaque;
@@ -1012,6 +1331,10 @@ int qcow2_snapshot_list(BlockDriverState *bs, QEMUSnapshotInfo **psn_tab)
         sn_info->date_nsec = sn->date_nsec;
         sn_info->vm_clock_nsec = sn->vm_clock_nsec;
         sn_info->icount = sn->icount;
+        if (sn->parent_id_str) {
+            pstrcpy(sn_info->parent_id_str, sizeof(sn_info->parent_id_str),
+                    sn->parent_id_str);
+        }
     }
     *psn_tab = sn_tab;
     return s->nb_snapshots;
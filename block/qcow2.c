@@ -3030,6 +3030,11 @@ int qcow2_update_header(BlockDriverState *bs)
                 .bit  = QCOW2_AUTOCLEAR_DATA_FILE_RAW_BITNR,
                 .name = "raw external data",
             },
+            {
+                .type = QCOW2_FEAT_TYPE_AUTOCLEAR,
+                .bit  = QCOW2_AUTOCLEAR_SNAPSHOT_PARENTS_BITNR,
+                .name = "snapshot parents",
+            },
         };
 
         ret = header_ext_add(buf, QCOW2_EXT_MAGIC_FEATURE_TABLE,
@@ -5391,7 +5396,8 @@ static int qcow2_downgrade(BlockDriverState *bs, int target_version,
      */
     for (i = 0; i < s->nb_snapshots; i++) {
         if (s->snapshots[i].vm_state_size > UINT32_MAX ||
-            s->snapshots[i].disk_size != bs->total_sectors * BDRV_SECTOR_SIZE) {
+            s->snapshots[i].disk_size != bs->total_sectors * BDRV_SECTOR_SIZE ||
+            s->snapshots[i].parent_id_str) {
             error_setg(errp, "Internal snapshots prevent downgrade of image");
             return -ENOTSUP;
         }
@@ -6085,6 +6091,7 @@ BlockDriver bdrv_qcow2 = {
     .bdrv_snapshot_create   = qcow2_snapshot_create,
     .bdrv_snapshot_goto     = qcow2_snapshot_goto,
     .bdrv_snapshot_delete   = qcow2_snapshot_delete,
+    .bdrv_snapshot_attach_vmstate = qcow2_snapshot_attach_vmstate,
     .bdrv_snapshot_list     = qcow2_snapshot_list,
     .bdrv_snapshot_load_tmp = qcow2_snapshot_load_tmp,
     .bdrv_measure           = qcow2_measure,
@@ -221,9 +221,17 @@ typedef struct QCowSnapshot {
     uint64_t vm_clock_nsec;
     /* icount value for the moment when snapshot was taken */
     uint64_t icount;
-    /* Size of all extra data, including QCowSnapshotExtraData if available */
+    /*
+     * ID of the snapshot that an incremental VM state applies on top of,
+     * NULL if the VM state is self-contained
+     */
+    char *parent_id_str;
+    /*
+     * Size of all extra data, including QCowSnapshotExtraData and the
+     * parent snapshot ID if available
+     */
     uint32_t extra_data_size;
-    /* Data beyond QCowSnapshotExtraData, if any */
+    /* Data beyond QCowSnapshotExtraData and the parent ID, if any */
     void *unknown_extra_data;
 } QCowSnapshot;
 
@@ -280,11 +288,15 @@ enum {
 enum {
     QCOW2_AUTOCLEAR_BITMAPS_BITNR       = 0,
     QCOW2_AUTOCLEAR_DATA_FILE_RAW_BITNR = 1,
+    QCOW2_AUTOCLEAR_SNAPSHOT_PARENTS_BITNR = 2,
     QCOW2_AUTOCLEAR_BITMAPS             = 1 << QCOW2_AUTOCLEAR_BITMAPS_BITNR,
     QCOW2_AUTOCLEAR_DATA_FILE_RAW       = 1 << QCOW2_AUTOCLEAR_DATA_FILE_RAW_BITNR,
+    QCOW2_AUTOCLEAR_SNAPSHOT_PARENTS    =
+        1 << QCOW2_AUTOCLEAR_SNAPSHOT_PARENTS_BITNR,
 
     QCOW2_AUTOCLEAR_MASK                = QCOW2_AUTOCLEAR_BITMAPS
-                                        | QCOW2_AUTOCLEAR_DATA_FILE_RAW,
+                                        | QCOW2_AUTOCLEAR_DATA_FILE_RAW
+                                        | QCOW2_AUTOCLEAR_SNAPSHOT_PARENTS,
 };
 
 enum qcow2_discard_type {
@@ -946,6 +958,10 @@ int qcow2_snapshot_delete(BlockDriverState *bs,
                           const char *snapshot_id,
                           const char *name,
                           Error **errp);
+int qcow2_snapshot_attach_vmstate(BlockDriverState *bs,
+                                  const char *snapshot_id,
+                                  uint64_t vm_state_size,
+                                  Error **errp);
 int qcow2_snapshot_list(BlockDriverState *bs, QEMUSnapshotInfo **psn_tab);
 int qcow2_snapshot_load_tmp(BlockDriverState *bs,
                             const char *snapshot_id,
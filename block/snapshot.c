@@ -369,6 +369,55 @@ int bdrv_snapshot_delete(BlockDriverState *bs,
     return ret;
 }
 
+/**
+ * Move the VM state currently saved in @bs into the internal snapshot
+ * @snapshot_id, which must have been created without one.
+ * @bs: block device used in the operation
+ * @snapshot_id: unique snapshot ID
+ * @vm_state_size: size of the VM state saved with bdrv_save_vmstate()
+ * @errp: location to store error
+ *
+ * This lets the VM state be written after the disk snapshot was taken,
+ * while the guest keeps using the disk, without changing the snapshot ID.
+ *
+ * Returns: 0 on success, -errno on failure. If @bs does not support
+ * attaching VM state, return -ENOTSUP.
+ */
+int bdrv_snapshot_attach_vmstate(BlockDriverState *bs,
+                                 const char *snapshot_id,
+                                 uint64_t vm_state_size,
+                                 Error **errp)
+{
+    BlockDriver *drv = bs->drv;
+    BlockDriverState *fallback_bs = bdrv_snapshot_fallback(bs);
+    int ret;
+
+    GLOBAL_STATE_CODE();
+
+    if (!drv) {
+        error_setg(errp, QERR_DEVICE_HAS_NO_MEDIUM, bdrv_get_device_name(bs));
+        return -ENOMEDIUM;
+    }
+
+    bdrv_drained_begin(bs);
+
+    if (drv->bdrv_snapshot_attach_vmstate) {
+        ret = drv->bdrv_snapshot_attach_vmstate(bs, snapshot_id,
+                                                vm_state_size, errp);
+    } else if (fallback_bs) {
+        ret = bdrv_snapshot_attach_vmstate(fallback_bs, snapshot_id,
+                                           vm_state_size, errp);
+    } else {
+        error_setg(errp, "Block format '%s' used by device '%s' "
+                   "does not support adding VM state to a snapshot",
+                   drv->format_name, bdrv_get_device_name(bs));
+        ret = -ENOTSUP;
+    }
+
+    bdrv_drained_end(bs);
+    return ret;
+}
+
 int bdrv_snapshot_list(BlockDriverState *bs,
                        QEMUSnapshotInfo **psn_info)
 {
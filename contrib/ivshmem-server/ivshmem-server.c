@@ -11,6 +11,9 @@
 
 #include <sys/socket.h>
 #include <sys/un.h>
+#ifdef CONFIG_EPOLL
+#include <sys/epoll.h>
+#endif
 
 #include "ivshmem-server.h"
 
@@ -25,7 +28,40 @@
 #define IVSHMEM_SERVER_MAX_HUGEPAGE_SIZE (1024 * 1024 * 1024)
 
 /** default listen backlog (number of sockets not accepted) */
-#define IVSHMEM_SERVER_LISTEN_BACKLOG 10
+#define IVSHMEM_SERVER_LISTEN_BACKLOG SOMAXCONN
+
+/** maximum number of events handled by one ivshmem_server_wait_events() */
+#define IVSHMEM_SERVER_MAX_EVENTS 64
+
+/* watch a socket in the epoll instance; @peer is NULL for the listening one */
+static int
+ivshmem_server_epoll_add(IvshmemServer *server, int fd,
+                         IvshmemServerPeer *peer)
+{
+#ifdef CONFIG_EPOLL
+    struct epoll_event ev = {
+        .events = EPOLLIN,
+        .data.ptr = peer,
+    };
+
+    if (server->epoll_fd < 0) {
+        return 0;
+    }
+    return epoll_ctl(server->epoll_fd, EPOLL_CTL_ADD, fd, &ev);
+#else
+    return 0;
+#endif
+}
+
+static void
+ivshmem_server_epoll_del(IvshmemServer *server, int fd)
+{
+#ifdef CONFIG_EPOLL
+    if (server->epoll_fd >= 0) {
+        epoll_ctl(server->epoll_fd, EPOLL_CTL_DEL, fd, NULL);
+    }
+#endif
+}
 
 /* send message to a client unix socket */
 static int
@@ -77,6 +113,7 @@ ivshmem_server_free_peer(IvshmemServer *server, IvshmemServerPeer *peer)
     IvshmemServerPeer *other_peer;
 
     IVSHMEM_SERVER_DEBUG(server, "free peer %" PRId64 "\n", peer->id);
+    ivshmem_server_epoll_del(server, peer->sock_fd);
     close(peer->sock_fd);
     QTAILQ_REMOVE(&server->peer_list, peer, next);
 
@@ -179,6 +216,13 @@ ivshmem_server_handle_new_conn(IvshmemServer *server)
         }
     }
 
+    /* closing newfd on failure below also removes it from epoll */
+    if (ivshmem_server_epoll_add(server, newfd, peer) < 0) {
+        IVSHMEM_SERVER_DEBUG(server, "cannot watch peer socket: %s\n",
+                             strerror(errno));
+        goto fail;
+    }
+
     /* send peer id and shm fd */
     if (ivshmem_server_send_initial_info(server, peer) < 0) {
         IVSHMEM_SERVER_DEBUG(server, "cannot send initial info\n");
@@ -261,6 +305,7 @@ ivshmem_server_init(IvshmemServer *server, const char *unix_sock_path,
 
     memset(server, 0, sizeof(*server));
     server->verbose = verbose;
+    server->epoll_fd = -1;
 
     ret = snprintf(server->unix_sock_path, sizeof(server->unix_sock_path),
                    "%s", unix_sock_path);
@@ -345,6 +390,22 @@ ivshmem_server_start(IvshmemServer *server)
         goto err_close_sock;
     }
 
+#ifdef CONFIG_EPOLL
+    server->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (server->epoll_fd < 0) {
+        IVSHMEM_SERVER_DEBUG(server, "epoll_create1() failed: %s\n",
+                             strerror(errno));
+        goto err_close_sock;
+    }
+    if (ivshmem_server_epoll_add(server, sock_fd, NULL) < 0) {
+        IVSHMEM_SERVER_DEBUG(server, "cannot watch socket: %s\n",
+                             strerror(errno));
+        close(server->epoll_fd);
+        server->epoll_fd = -1;
+        goto err_close_sock;
+    }
+#endif
+
     server->sock_fd = sock_fd;
     server->shm_fd = shm_fd;
 
@@ -376,8 +437,12 @@ ivshmem_server_close(IvshmemServer *server)
     if (server->use_shm_open) {
         shm_unlink(server->shm_path);
     }
+    if (server->epoll_fd >= 0) {
+        close(server->epoll_fd);
+    }
     close(server->sock_fd);
     close(server->shm_fd);
+    server->epoll_fd = -1;
     server->sock_fd = -1;
     server->shm_fd = -1;
 }
@@ -429,6 +494,50 @@ ivshmem_server_handle_fds(IvshmemServer *server, fd_set *fds, int maxfd)
     return 0;
 }
 
+/* wait for messages with epoll and process them */
+int
+ivshmem_server_wait_events(IvshmemServer *server, int timeout)
+{
+#ifdef CONFIG_EPOLL
+    struct epoll_event events[IVSHMEM_SERVER_MAX_EVENTS];
+    int i, n;
+
+    if (server->epoll_fd < 0) {
+        return -ENOTSUP;
+    }
+
+    n = epoll_wait(server->epoll_fd, events, ARRAY_SIZE(events), timeout);
+    if (n < 0) {
+        return errno == EINTR ? 0 : -errno;
+    }
+
+    /*
+     * Each socket is reported at most once, so freeing a peer cannot
+     * invalidate another entry of events[].
+     */
+    for (i = 0; i < n; i++) {
+        IvshmemServerPeer *peer = events[i].data.ptr;
+
+        if (peer == NULL) {
+            if (ivshmem_server_handle_new_conn(server) < 0 &&
+                errno != EINTR) {
+                IVSHMEM_SERVER_DEBUG(server, "ivshmem_server_handle_new_conn() "
+                                     "failed\n");
+                return -1;
+            }
+        } else {
+            /* any message from a peer socket result in a close() */
+            IVSHMEM_SERVER_DEBUG(server, "peer->sock_fd=%d\n", peer->sock_fd);
+            ivshmem_server_free_peer(server, peer);
+        }
+    }
+
+    return 0;
+#else
+    return -ENOTSUP;
+#endif
+}
+
 /* lookup peer from its id */
 IvshmemServerPeer *
 ivshmem_server_search_peer(IvshmemServer *server, int64_t peer_id)
@@ -62,6 +62,7 @@ typedef struct IvshmemServerPeer {
 typedef struct IvshmemServer {
     char unix_sock_path[PATH_MAX];   /**< path to unix socket */
     int sock_fd;                     /**< unix sock file descriptor */
+    int epoll_fd;                    /**< epoll instance, or -1 */
     char shm_path[PATH_MAX];         /**< path to shm */
     bool use_shm_open;
     size_t shm_size;                 /**< size of shm */
@@ -142,6 +143,24 @@ ivshmem_server_get_fds(const IvshmemServer *server, fd_set *fds, int *maxfd);
  */
 int ivshmem_server_handle_fds(IvshmemServer *server, fd_set *fds, int maxfd);
 
+/**
+ * Wait for and handle new messages
+ *
+ * This is an alternative to ivshmem_server_get_fds() and
+ * ivshmem_server_handle_fds() that uses epoll (see EPOLL(7)) on the
+ * sockets.  Its cost does not grow with the number of connected peers,
+ * and it is not limited to file descriptors below FD_SETSIZE, which a
+ * server with a few hundred peers and their eventfds quickly exceeds.
+ *
+ * @server:  The ivshmem server
+ * @timeout: Maximum time to wait in milliseconds, or -1 to wait forever
+ *
+ * Returns:  0 on success, including when interrupted by a signal or when
+ *           the timeout expires, -ENOTSUP if epoll is not available on
+ *           this host, or another negative value on error
+ */
+int ivshmem_server_wait_events(IvshmemServer *server, int timeout);
+
 /**
  * Search a peer from its identifier
  *
@@ -149,6 +149,18 @@ ivshmem_server_poll_events(IvshmemServer *server)
     fd_set fds;
     int ret = 0, maxfd;
 
+    while (!ivshmem_server_quit) {
+        ret = ivshmem_server_wait_events(server, -1);
+        if (ret == -ENOTSUP) {
+            break;
+        }
+        if (ret < 0) {
+            fprintf(stderr, "ivshmem_server_wait_events() failed\n");
+            return ret;
+        }
+    }
+
+    /* no epoll on this host, fall back to select() */
     while (!ivshmem_server_quit) {
 
         FD_ZERO(&fds);
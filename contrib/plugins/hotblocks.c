@@ -35,6 +35,8 @@ static guint64 limit = 20;
 typedef struct {
     uint64_t start_addr;
     uint64_t exec_count;
+    /* Executions per vCPU, counted inline */
+    struct qemu_plugin_scoreboard *score;
     int      trans_count;
     unsigned long insns;
 } ExecCount;
@@ -46,6 +48,18 @@ static gint cmp_exec_count(gconstpointer a, gconstpointer b)
     return ea->exec_count > eb->exec_count ? -1 : 1;
 }
 
+static void fold_exec_count(gpointer key, gpointer value, gpointer user_data)
+{
+    ExecCount *cnt = value;
+
+    if (cnt->score) {
+        cnt->exec_count +=
+            qemu_plugin_u64_sum(qemu_plugin_scoreboard_u64(cnt->score));
+        qemu_plugin_scoreboard_free(cnt->score);
+        cnt->score = NULL;
+    }
+}
+
 static void plugin_exit(qemu_plugin_id_t id, void *p)
 {
     g_autoptr(GString) report = g_string_new("collected ");
@@ -53,6 +67,7 @@ static void plugin_exit(qemu_plugin_id_t id, void *p)
     int i;
 
     g_mutex_lock(&lock);
+    g_hash_table_foreach(hotblocks, fold_exec_count, NULL);
     g_string_append_printf(report, "%d entries in the hash table\n",
                            g_hash_table_size(hotblocks));
     counts = g_hash_table_get_values(hotblocks);
@@ -94,8 +109,9 @@ static void vcpu_tb_exec(unsigned int cpu_index, void *udata)
 }
 
 /*
- * When do_inline we ask the plugin to increment the counter for us.
- * Otherwise a helper is inserted which calls the vcpu_tb_exec
+ * When do_inline we ask the plugin to increment the vCPU's entry of
+ * the block's scoreboard for us.  Otherwise, or if no scoreboard could
+ * be allocated, a helper is inserted which calls the vcpu_tb_exec
  * callback.
  */
 static void vcpu_tb_trans(qemu_plugin_id_t id, struct qemu_plugin_tb *tb)
@@ -114,14 +130,18 @@ static void vcpu_tb_trans(qemu_plugin_id_t id, struct qemu_plugin_tb *tb)
         cnt->start_addr = pc;
         cnt->trans_count = 1;
         cnt->insns = insns;
+        if (do_inline) {
+            cnt->score = qemu_plugin_scoreboard_new(sizeof(uint64_t));
+        }
         g_hash_table_insert(hotblocks, (gpointer) hash, (gpointer) cnt);
     }
 
     g_mutex_unlock(&lock);
 
-    if (do_inline) {
-        qemu_plugin_register_vcpu_tb_exec_inline(tb, QEMU_PLUGIN_INLINE_ADD_U64,
-                                                 &cnt->exec_count, 1);
+    if (cnt->score) {
+        qemu_plugin_register_vcpu_tb_exec_inline_per_vcpu(
+            tb, QEMU_PLUGIN_INLINE_ADD_U64,
+            qemu_plugin_scoreboard_u64(cnt->score), 1);
     } else {
         qemu_plugin_register_vcpu_tb_exec_cb(tb, vcpu_tb_exec,
                                              QEMU_PLUGIN_CB_NO_REGS,
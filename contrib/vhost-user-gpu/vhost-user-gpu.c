@@ -967,29 +967,38 @@ vg_handle_cursor(VuDev *dev, int qidx)
 {
     VuGpu *g = container_of(dev, VuGpu, dev.parent);
     VuVirtq *vq = vu_get_queue(dev, qidx);
-    VuVirtqElement *elem;
+    VuVirtqElement *elems[16];
+    unsigned int lens[G_N_ELEMENTS(elems)] = { 0 };
+    unsigned int n, i;
     size_t len;
     struct virtio_gpu_update_cursor cursor;
 
     for (;;) {
-        elem = vu_queue_pop(dev, vq, sizeof(VuVirtqElement));
-        if (!elem) {
+        n = vu_queue_pop_batch(dev, vq, sizeof(VuVirtqElement),
+                               (void **)elems, G_N_ELEMENTS(elems));
+        if (!n) {
             break;
         }
-        g_debug("cursor out:%d in:%d\n", elem->out_num, elem->in_num);
-
-        len = iov_to_buf(elem->out_sg, elem->out_num,
-                         0, &cursor, sizeof(cursor));
-        if (len != sizeof(cursor)) {
-            g_warning("%s: cursor size incorrect %zu vs %zu\n",
-                      __func__, len, sizeof(cursor));
-        } else {
-            virtio_gpu_bswap_32(&cursor, sizeof(cursor));
-            vg_process_cursor_cmd(g, &cursor);
+        for (i = 0; i < n; i++) {
+            VuVirtqElement *elem = elems[i];
+
+            g_debug("cursor out:%d in:%d\n", elem->out_num, elem->in_num);
+
+            len = iov_to_buf(elem->out_sg, elem->out_num,
+                             0, &cursor, sizeof(cursor));
+            if (len != sizeof(cursor)) {
+                g_warning("%s: cursor size incorrect %zu vs %zu\n",
+                          __func__, len, sizeof(cursor));
+            } else {
+                virtio_gpu_bswap_32(&cursor, sizeof(cursor));
+                vg_process_cursor_cmd(g, &cursor);
+            }
         }
-        vu_queue_push(dev, vq, elem, 0);
+        vu_queue_push_batch(dev, vq, elems, lens, n);
         vu_queue_notify(dev, vq);
-        free(elem);
+        for (i = 0; i < n; i++) {
+            vu_queue_element_free(dev, vq, elems[i]);
+        }
     }
 }
 
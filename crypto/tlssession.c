@@ -33,6 +33,18 @@
 
 #include <gnutls/x509.h>
 
+#ifdef CONFIG_LINUX_TLS_H
+#include <netinet/tcp.h>
+#include <linux/tls.h>
+
+#ifndef TCP_ULP
+#define TCP_ULP 31
+#endif
+#ifndef SOL_TLS
+#define SOL_TLS 282
+#endif
+#endif
+
 
 struct QCryptoTLSSession {
     QCryptoTLSCreds *creds;
@@ -482,6 +494,14 @@ qcrypto_tls_session_read(QCryptoTLSSession *session,
         case GNUTLS_E_PREMATURE_TERMINATION:
             errno = ECONNABORTED;
             break;
+        case GNUTLS_E_REHANDSHAKE:
+        case GNUTLS_E_UNIMPLEMENTED_FEATURE:
+            /*
+             * The peer asked for renegotiation, or for a key update
+             * that qcrypto_tls_session_key_update_hook() refused.
+             */
+            errno = ENOTSUP;
+            break;
         default:
             errno = EIO;
             break;
@@ -562,6 +582,197 @@ qcrypto_tls_session_get_peer_name(QCryptoTLSSession *session)
 }
 
 
+#ifdef CONFIG_LINUX_TLS_H
+#if GNUTLS_VERSION_NUMBER >= 0x030603 && defined(TLS_1_3_VERSION)
+/*
+ * Once the kernel encrypts what we send, GnuTLS cannot send records of
+ * its own, and the kernel cannot change the send keys.  Refuse a TLS 1.3
+ * key update from the peer that asks for ours to be updated as well,
+ * rather than leave the peer waiting for an answer that never comes.
+ */
+static int
+qcrypto_tls_session_key_update_hook(gnutls_session_t handle,
+                                    unsigned int htype,
+                                    unsigned int when,
+                                    unsigned int incoming,
+                                    const gnutls_datum_t *msg)
+{
+    QCryptoTLSSession *session = gnutls_transport_get_ptr(handle);
+
+    /* The body is the request_update field: update_requested is 1 */
+    if (incoming && msg->size >= 1 && msg->data[0] != 0) {
+        trace_qcrypto_tls_session_ktls_refuse_key_update(session);
+        return GNUTLS_E_UNIMPLEMENTED_FEATURE;
+    }
+    return 0;
+}
+#endif
+
+int
+qcrypto_tls_session_enable_ktls_send(QCryptoTLSSession *session,
+                                     int fd,
+                                     Error **errp)
+{
+    union {
+        struct tls12_crypto_info_aes_gcm_128 aes_gcm_128;
+#ifdef TLS_CIPHER_AES_GCM_256
+        struct tls12_crypto_info_aes_gcm_256 aes_gcm_256;
+#endif
+#ifdef TLS_CIPHER_CHACHA20_POLY1305
+        struct tls12_crypto_info_chacha20_poly1305 chacha20_poly1305;
+#endif
+    } info;
+    gnutls_cipher_algorithm_t cipher;
+    gnutls_datum_t iv, key;
+    unsigned char seq[8];
+    uint16_t version;
+    bool tls13 = false;
+    size_t len;
+    int ret;
+
+    if (!session->creds->kernelTLS) {
+        error_setg(errp, "Kernel TLS is not enabled for the credentials");
+        return -1;
+    }
+
+    if (!session->handshakeComplete) {
+        error_setg(errp, "TLS handshake is not complete");
+        return -1;
+    }
+
+    switch (gnutls_protocol_get_version(session->handle)) {
+    case GNUTLS_TLS1_2:
+        version = TLS_1_2_VERSION;
+        break;
+#if GNUTLS_VERSION_NUMBER >= 0x030603 && defined(TLS_1_3_VERSION)
+    case GNUTLS_TLS1_3:
+        version = TLS_1_3_VERSION;
+        tls13 = true;
+        break;
+#endif
+    default:
+        error_setg(errp, "Kernel TLS does not support the TLS version");
+        return -1;
+    }
+
+    ret = gnutls_record_get_state(session->handle, 0, NULL, &iv, &key, seq);
+    if (ret < 0) {
+        error_setg(errp, "Cannot get TLS record state: %s",
+                   gnutls_strerror(ret));
+        return -1;
+    }
+    ret = -1;
+
+    /*
+     * The record nonce is the implicit part (the salt) followed by an
+     * explicit part.  With TLS 1.2 GCM the latter is the record sequence
+     * number, as GnuTLS sends it; otherwise all of it is in the IV.
+     */
+    memset(&info, 0, sizeof(info));
+    cipher = gnutls_cipher_get(session->handle);
+    switch (cipher) {
+    case GNUTLS_CIPHER_AES_128_GCM: {
+        struct tls12_crypto_info_aes_gcm_128 *ci = &info.aes_gcm_128;
+
+        if (key.size != sizeof(ci->key) ||
+            iv.size < sizeof(ci->salt) + (tls13 ? sizeof(ci->iv) : 0)) {
+            goto bad_state;
+        }
+        ci->info.version = version;
+        ci->info.cipher_type = TLS_CIPHER_AES_GCM_128;
+        memcpy(ci->salt, iv.data, sizeof(ci->salt));
+        memcpy(ci->iv, tls13 ? iv.data + sizeof(ci->salt) : seq,
+               sizeof(ci->iv));
+        memcpy(ci->key, key.data, sizeof(ci->key));
+        memcpy(ci->rec_seq, seq, sizeof(ci->rec_seq));
+        len = sizeof(*ci);
+        break;
+    }
+#ifdef TLS_CIPHER_AES_GCM_256
+    case GNUTLS_CIPHER_AES_256_GCM: {
+        struct tls12_crypto_info_aes_gcm_256 *ci = &info.aes_gcm_256;
+
+        if (key.size != sizeof(ci->key) ||
+            iv.size < sizeof(ci->salt) + (tls13 ? sizeof(ci->iv) : 0)) {
+            goto bad_state;
+        }
+        ci->info.version = version;
+        ci->info.cipher_type = TLS_CIPHER_AES_GCM_256;
+        memcpy(ci->salt, iv.data, sizeof(ci->salt));
+        memcpy(ci->iv, tls13 ? iv.data + sizeof(ci->salt) : seq,
+               sizeof(ci->iv));
+        memcpy(ci->key, key.data, sizeof(ci->key));
+        memcpy(ci->rec_seq, seq, sizeof(ci->rec_seq));
+        len = sizeof(*ci);
+        break;
+    }
+#endif
+#ifdef TLS_CIPHER_CHACHA20_POLY1305
+    case GNUTLS_CIPHER_CHACHA20_POLY1305: {
+        struct tls12_crypto_info_chacha20_poly1305 *ci =
+            &info.chacha20_poly1305;
+
+        if (key.size != sizeof(ci->key) || iv.size != sizeof(ci->iv)) {
+            goto bad_state;
+        }
+        ci->info.version = version;
+        ci->info.cipher_type = TLS_CIPHER_CHACHA20_POLY1305;
+        memcpy(ci->iv, iv.data, sizeof(ci->iv));
+        memcpy(ci->key, key.data, sizeof(ci->key));
+        memcpy(ci->rec_seq, seq, sizeof(ci->rec_seq));
+        len = sizeof(*ci);
+        break;
+    }
+#endif
+    default:
+        error_setg(errp, "Kernel TLS does not support cipher %s",
+                   gnutls_cipher_get_name(cipher));
+        return -1;
+    }
+
+    if (setsockopt(fd, IPPROTO_TCP, TCP_ULP, "tls", sizeof("tls")) < 0) {
+        error_setg_errno(errp, errno, "Cannot enable kernel TLS");
+        goto out;
+    }
+    if (setsockopt(fd, SOL_TLS, TLS_TX, &info, len) < 0) {
+        error_setg_errno(errp, errno,
+                         "Kernel TLS does not support cipher %s",
+                         gnutls_cipher_get_name(cipher));
+        goto out;
+    }
+    ret = 0;
+#if GNUTLS_VERSION_NUMBER >= 0x030603 && defined(TLS_1_3_VERSION)
+    if (tls13) {
+        gnutls_handshake_set_hook_function(session->handle,
+                                           GNUTLS_HANDSHAKE_KEY_UPDATE,
+                                           GNUTLS_HOOK_PRE,
+                                           qcrypto_tls_session_key_update_hook);
+    }
+#endif
+    trace_qcrypto_tls_session_ktls_send(session,
+                                        gnutls_cipher_get_name(cipher));
+    goto out;
+
+ bad_state:
+    error_setg(errp, "Unexpected TLS record state for cipher %s",
+               gnutls_cipher_get_name(cipher));
+ out:
+    /* Do not leave key material on the stack */
+    gnutls_memset(&info, 0, sizeof(info));
+    return ret;
+}
+#else /* ! CONFIG_LINUX_TLS_H */
+int
+qcrypto_tls_session_enable_ktls_send(QCryptoTLSSession *session,
+                                     int fd,
+                                     Error **errp)
+{
+    error_setg(errp, "Kernel TLS is not supported on this host");
+    return -1;
+}
+#endif /* ! CONFIG_LINUX_TLS_H */
+
+
 #else /* ! CONFIG_GNUTLS */
 
 
@@ -660,4 +871,14 @@ qcrypto_tls_session_get_peer_name(QCryptoTLSSession *sess)
     return NULL;
 }
 
+
+int
+qcrypto_tls_session_enable_ktls_send(QCryptoTLSSession *sess,
+                                     int fd,
+                                     Error **errp)
+{
+    error_setg(errp, "TLS requires GNUTLS support");
+    return -1;
+}
+
 #endif
@@ -241,6 +241,47 @@ static inline bool can_use_fpu(const float_status *s)
                   s->float_rounding_mode == float_round_nearest_even);
 }
 
+/*
+ * floatx80 hardfloat uses the x87 unit of x86_64 hosts, whose long double
+ * is the same 80-bit format.  The op is bracketed by fnclex/fnstsw, so the
+ * inexact flag is computed exactly and need not already be set; that
+ * matters for x87 guests, which clear the flags before every insn.
+ *
+ * Both control words must be the x87 default: round to nearest, 64-bit
+ * precision and, for the host, all exceptions masked.  Targets mirror the
+ * guest one in float_status (e.g. the i386 FPUC in update_fp_status());
+ * the host one is read back each time, as nothing stops a library from
+ * changing it.  Anything else goes to software.
+ */
+#if defined(__x86_64__)
+# define QEMU_HARDFLOAT_FLOATX80    1
+#else
+# define QEMU_HARDFLOAT_FLOATX80    0
+#endif
+
+/* x87 control word: exception masks, precision and rounding control */
+#define X87_CW_CHECK        0x0f3f
+#define X87_CW_DEFAULT      0x033f
+
+static inline bool can_use_fpu_floatx80(const float_status *s)
+{
+#if QEMU_HARDFLOAT_FLOATX80
+    uint16_t cw;
+
+    if (QEMU_NO_HARDFLOAT) {
+        return false;
+    }
+    if (unlikely(s->float_rounding_mode != float_round_nearest_even ||
+                 s->floatx80_rounding_precision != floatx80_precision_x)) {
+        return false;
+    }
+    asm volatile("fnstcw %0" : "=m"(cw));
+    return likely((cw & X87_CW_CHECK) == X87_CW_DEFAULT);
+#else
+    return false;
+#endif
+}
+
 /*
  * Hardfloat generation functions. Each operation can have two flavors:
  * either using softfloat primitives (e.g. float32_is_zero_or_normal) for
@@ -401,6 +442,128 @@ float64_gen2(float64 xa, float64 xb, float_status *s,
     return soft(ua.s, ub.s, s);
 }
 
+typedef union {
+    floatx80 s;
+    long double h;
+} union_floatx80;
+
+typedef floatx80 (*soft_fx80_op1_fn)(floatx80 a, float_status *s);
+typedef floatx80 (*soft_fx80_op2_fn)(floatx80 a, floatx80 b, float_status *s);
+typedef long double (*hard_fx80_op1_fn)(long double a, uint16_t *sw);
+typedef long double (*hard_fx80_op2_fn)(long double a, long double b,
+                                        uint16_t *sw);
+
+/* x87 status word exception bits, other than PE (precision, i.e. inexact) */
+#define X87_SW_PE           0x20
+#define X87_SW_NOT_PE       0x1f
+
+#if QEMU_HARDFLOAT_FLOATX80
+#define GEN_HARD_FX80_OP2(name, insn)                                   \
+static long double name(long double a, long double b, uint16_t *sw)    \
+{                                                                       \
+    long double r;                                                      \
+                                                                        \
+    asm("fnclex\n\t" insn " %%st(1), %%st\n\tfnstsw %%ax"              \
+        : "=t"(r), "=a"(*sw) : "0"(a), "u"(b));                        \
+    return r;                                                           \
+}
+
+GEN_HARD_FX80_OP2(hard_fx80_add, "fadd")
+GEN_HARD_FX80_OP2(hard_fx80_sub, "fsub")
+GEN_HARD_FX80_OP2(hard_fx80_mul, "fmul")
+GEN_HARD_FX80_OP2(hard_fx80_div, "fdiv")
+#undef GEN_HARD_FX80_OP2
+
+static long double hard_fx80_sqrt(long double a, uint16_t *sw)
+{
+    long double r;
+
+    asm("fnclex\n\tfsqrt\n\tfnstsw %%ax" : "=t"(r), "=a"(*sw) : "0"(a));
+    return r;
+}
+#else
+/* never called: can_use_fpu_floatx80() is constant false */
+#define hard_fx80_add   NULL
+#define hard_fx80_sub   NULL
+#define hard_fx80_mul   NULL
+#define hard_fx80_div   NULL
+#define hard_fx80_sqrt  NULL
+#endif
+
+static inline bool fx80_is_zon(floatx80 a)
+{
+    int exp = a.high & 0x7fff;
+
+    if (exp == 0) {
+        return a.low == 0;
+    }
+    /* the explicit integer bit must be set, as for a normal number */
+    return exp != 0x7fff && (a.low >> 63);
+}
+
+/*
+ * Inputs need no checks: NaNs, infinities, denormals and the invalid
+ * encodings either raise an x87 exception other than PE or produce a
+ * result that is not zero or normal, and are then redone in software.
+ */
+static inline bool floatx80_hard_result(union_floatx80 ur, uint16_t sw,
+                                        float_status *s)
+{
+    if (unlikely(sw & X87_SW_NOT_PE) || unlikely(!fx80_is_zon(ur.s))) {
+        return false;
+    }
+    if (sw & X87_SW_PE) {
+        float_raise(float_flag_inexact, s);
+    }
+    return true;
+}
+
+static inline floatx80
+floatx80_gen2(floatx80 xa, floatx80 xb, float_status *s,
+              hard_fx80_op2_fn hard, soft_fx80_op2_fn soft)
+{
+    union_floatx80 ua, ub, ur;
+    uint16_t sw;
+
+    if (unlikely(!can_use_fpu_floatx80(s))) {
+        goto soft;
+    }
+
+    ua.s = xa;
+    ub.s = xb;
+    ur.h = hard(ua.h, ub.h, &sw);
+    if (unlikely(!floatx80_hard_result(ur, sw, s))) {
+        goto soft;
+    }
+    /* the padding after the 80 bits of a long double is undefined */
+    return make_floatx80(ur.s.high, ur.s.low);
+
+ soft:
+    return soft(xa, xb, s);
+}
+
+static inline floatx80
+floatx80_gen1(floatx80 xa, float_status *s,
+              hard_fx80_op1_fn hard, soft_fx80_op1_fn soft)
+{
+    union_floatx80 ua, ur;
+    uint16_t sw;
+
+    if (unlikely(!can_use_fpu_floatx80(s))) {
+        goto soft;
+    }
+
+    ua.s = xa;
+    ur.h = hard(ua.h, &sw);
+    if (unlikely(!floatx80_hard_result(ur, sw, s))) {
+        goto soft;
+    }
+    return make_floatx80(ur.s.high, ur.s.low);
+
+ soft:
+    return soft(xa, s);
+}
+
 /*
  * Classify a floating point number. Everything above float_class_qnan
  * is a NaN so cls >= float_class_qnan is any NaN.
@@ -2066,16 +2229,30 @@ floatx80_addsub(floatx80 a, floatx80 b, float_status *status, bool subtract)
     return floatx80_round_pack_canonical(pr, status);
 }
 
-floatx80 floatx80_add(floatx80 a, floatx80 b, float_status *status)
+static floatx80 soft_floatx80_add(floatx80 a, floatx80 b,
+                                  float_status *status)
 {
     return floatx80_addsub(a, b, status, false);
 }
 
-floatx80 floatx80_sub(floatx80 a, floatx80 b, float_status *status)
+static floatx80 soft_floatx80_sub(floatx80 a, floatx80 b,
+                                  float_status *status)
 {
     return floatx80_addsub(a, b, status, true);
 }
 
+floatx80 QEMU_FLATTEN
+floatx80_add(floatx80 a, floatx80 b, float_status *status)
+{
+    return floatx80_gen2(a, b, status, hard_fx80_add, soft_floatx80_add);
+}
+
+floatx80 QEMU_FLATTEN
+floatx80_sub(floatx80 a, floatx80 b, float_status *status)
+{
+    return floatx80_gen2(a, b, status, hard_fx80_sub, soft_floatx80_sub);
+}
+
 /*
  * Multiplication
  */
@@ -2174,8 +2351,8 @@ float128_mul(float128 a, float128 b, float_status *status)
     return float128_round_pack_canonical(pr, status);
 }
 
-floatx80 QEMU_FLATTEN
-floatx80_mul(floatx80 a, floatx80 b, float_status *status)
+static floatx80 QEMU_SOFTFLOAT_ATTR
+soft_floatx80_mul(floatx80 a, floatx80 b, float_status *status)
 {
     FloatParts128 pa, pb, *pr;
 
@@ -2188,6 +2365,12 @@ floatx80_mul(floatx80 a, floatx80 b, float_status *status)
     return floatx80_round_pack_canonical(pr, status);
 }
 
+floatx80 QEMU_FLATTEN
+floatx80_mul(floatx80 a, floatx80 b, float_status *status)
+{
+    return floatx80_gen2(a, b, status, hard_fx80_mul, soft_floatx80_mul);
+}
+
 /*
  * Fused multiply-add
  */
@@ -2247,9 +2430,6 @@ float32_muladd(float32 xa, float32 xb, float32 xc, int flags, float_status *s)
     if (unlikely(!can_use_fpu(s))) {
         goto soft;
     }
-    if (unlikely(flags & float_muladd_halve_result)) {
-        goto soft;
-    }
 
     float32_input_flush3(&ua.s, &ub.s, &uc.s, s);
     if (unlikely(!f32_is_zon3(ua, ub, uc))) {
@@ -2272,6 +2452,11 @@ float32_muladd(float32 xa, float32 xb, float32 xc, int flags, float_status *s)
         prod_sign ^= !!(flags & float_muladd_negate_product);
         up.s = float32_set_sign(float32_zero, prod_sign);
 
+        /* the sum is c; halving it is exact unless it becomes denormal */
+        if (unlikely(flags & float_muladd_halve_result) &&
+            !float32_is_zero(uc.s) && fabsf(uc.h) <= 2 * FLT_MIN) {
+            goto soft;
+        }
         if (flags & float_muladd_negate_c) {
             uc.h = -uc.h;
         }
@@ -2289,7 +2474,17 @@ float32_muladd(float32 xa, float32 xb, float32 xc, int flags, float_status *s)
 
         ur.h = fmaf(ua.h, ub.h, uc.h);
 
-        if (unlikely(f32_is_inf(ur))) {
+        if (flags & float_muladd_halve_result) {
+            /*
+             * Halving after rounding matches rounding the halved value
+             * only if both are normal; an overflow may also be undone.
+             */
+            if (unlikely(f32_is_inf(ur) || fabsf(ur.h) <= 2 * FLT_MIN)) {
+                ua = ua_orig;
+                uc = uc_orig;
+                goto soft;
+            }
+        } else if (unlikely(f32_is_inf(ur))) {
             float_raise(float_flag_overflow, s);
         } else if (unlikely(fabsf(ur.h) <= FLT_MIN)) {
             ua = ua_orig;
@@ -2297,6 +2492,9 @@ float32_muladd(float32 xa, float32 xb, float32 xc, int flags, float_status *s)
             goto soft;
         }
     }
+    if (flags & float_muladd_halve_result) {
+        ur.h *= 0.5f;
+    }
     if (flags & float_muladd_negate_result) {
         return float32_chs(ur.s);
     }
@@ -2318,9 +2516,6 @@ float64_muladd(float64 xa, float64 xb, float64 xc, int flags, float_status *s)
     if (unlikely(!can_use_fpu(s))) {
         goto soft;
     }
-    if (unlikely(flags & float_muladd_halve_result)) {
-        goto soft;
-    }
 
     float64_input_flush3(&ua.s, &ub.s, &uc.s, s);
     if (unlikely(!f64_is_zon3(ua, ub, uc))) {
@@ -2343,6 +2538,11 @@ float64_muladd(float64 xa, float64 xb, float64 xc, int flags, float_status *s)
         prod_sign ^= !!(flags & float_muladd_negate_product);
         up.s = float64_set_sign(float64_zero, prod_sign);
 
+        /* the sum is c; halving it is exact unless it becomes denormal */
+        if (unlikely(flags & float_muladd_halve_result) &&
+            !float64_is_zero(uc.s) && fabs(uc.h) <= 2 * DBL_MIN) {
+            goto soft;
+        }
         if (flags & float_muladd_negate_c) {
             uc.h = -uc.h;
         }
@@ -2360,7 +2560,14 @@ float64_muladd(float64 xa, float64 xb, float64 xc, int flags, float_status *s)
 
         ur.h = fma(ua.h, ub.h, uc.h);
 
-        if (unlikely(f64_is_inf(ur))) {
+        if (flags & float_muladd_halve_result) {
+            /* See float32_muladd */
+            if (unlikely(f64_is_inf(ur) || fabs(ur.h) <= 2 * DBL_MIN)) {
+                ua = ua_orig;
+                uc = uc_orig;
+                goto soft;
+            }
+        } else if (unlikely(f64_is_inf(ur))) {
             float_raise(float_flag_overflow, s);
         } else if (unlikely(fabs(ur.h) <= FLT_MIN)) {
             ua = ua_orig;
@@ -2368,6 +2575,9 @@ float64_muladd(float64 xa, float64 xb, float64 xc, int flags, float_status *s)
             goto soft;
         }
     }
+    if (flags & float_muladd_halve_result) {
+        ur.h *= 0.5;
+    }
     if (flags & float_muladd_negate_result) {
         return float64_chs(ur.s);
     }
@@ -2548,7 +2758,8 @@ float128_div(float128 a, float128 b, float_status *status)
     return float128_round_pack_canonical(pr, status);
 }
 
-floatx80 floatx80_div(floatx80 a, floatx80 b, float_status *status)
+static floatx80 QEMU_SOFTFLOAT_ATTR
+soft_floatx80_div(floatx80 a, floatx80 b, float_status *status)
 {
     FloatParts128 pa, pb, *pr;
 
@@ -2561,6 +2772,12 @@ floatx80 floatx80_div(floatx80 a, floatx80 b, float_status *status)
     return floatx80_round_pack_canonical(pr, status);
 }
 
+floatx80 QEMU_FLATTEN
+floatx80_div(floatx80 a, floatx80 b, float_status *status)
+{
+    return floatx80_gen2(a, b, status, hard_fx80_div, soft_floatx80_div);
+}
+
 /*
  * Remainder
  */
@@ -4600,7 +4817,8 @@ float128 QEMU_FLATTEN float128_sqrt(float128 a, float_status *status)
     return float128_round_pack_canonical(&p, status);
 }
 
-floatx80 floatx80_sqrt(floatx80 a, float_status *s)
+static floatx80 QEMU_SOFTFLOAT_ATTR
+soft_floatx80_sqrt(floatx80 a, float_status *s)
 {
     FloatParts128 p;
 
@@ -4611,6 +4829,11 @@ floatx80 floatx80_sqrt(floatx80 a, float_status *s)
     return floatx80_round_pack_canonical(&p, s);
 }
 
+floatx80 QEMU_FLATTEN floatx80_sqrt(floatx80 a, float_status *s)
+{
+    return floatx80_gen1(a, s, hard_fx80_sqrt, soft_floatx80_sqrt);
+}
+
 /*
  * log2
  */
@@ -283,6 +283,24 @@ SRST
     Show dynamic compiler opcode counters
 ERST
 
+#if defined(CONFIG_TCG)
+    {
+        .name       = "tb-stats",
+        .args_type  = "reset:-r,count:i?,sort:s?",
+        .params     = "[-r] [count] [executions|entries|translations|time]",
+        .help       = "show the most executed translation blocks, up to "
+                      "count entries (default: 10) (-r: reset the counters)",
+        .cmd        = hmp_info_tb_stats,
+    },
+#endif
+
+SRST
+  ``info tb-stats [-r]`` [*count*] [*sort*]
+    Show the *count* hottest translation blocks, by number of
+    executions, entries from the main loop, translations or time.
+    Statistics are gathered with ``-accel tcg,tb-stats=on``.
+ERST
+
     {
         .name       = "sync-profile",
         .args_type  = "mean:-m,no_coalesce:-n,max:i?",
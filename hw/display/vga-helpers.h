@@ -22,6 +22,85 @@
  * THE SOFTWARE.
  */
 
+/*
+ * The linear (8 bpp and up) line converters first try to get a pointer to
+ * the whole scanline, which works unless the line wraps around the end of
+ * video memory.  Their inner loops are then free of the per-pixel masking
+ * done by vga_read_*(), and the 15/16/32 bpp ones convert four pixels at
+ * a time in a vector register (SSE2, NEON, ...) when the host has one.
+ */
+typedef uint32_t VGAVec32 __attribute__((vector_size(16)));
+#define VGA_VEC_PIXELS ((int)(sizeof(VGAVec32) / sizeof(uint32_t)))
+
+static inline const uint8_t *vga_line_ptr(VGACommonState *vga,
+                                          uint32_t addr, uint32_t len,
+                                          uint32_t align)
+{
+    if ((addr & (align - 1)) || addr > vga->vbe_size_mask ||
+        len > vga->vbe_size - addr) {
+        return NULL;
+    }
+    return vga->vram_ptr + addr;
+}
+
+/* 15/16 bpp to xRGB8888, @v holds one 16-bit pixel per lane */
+#define VGA_CONVERT_15(v) \
+    ((((v) << 9) & 0xf80000) | (((v) << 6) & 0xf800) | (((v) << 3) & 0xf8))
+#define VGA_CONVERT_16(v) \
+    ((((v) << 8) & 0xf80000) | (((v) << 5) & 0xfc00) | (((v) << 3) & 0xf8))
+
+static inline void vga_convert_line16(uint8_t *d, const uint8_t *s,
+                                      int width, bool be, bool is15)
+{
+    int x = 0;
+
+    for (; x + VGA_VEC_PIXELS <= width; x += VGA_VEC_PIXELS) {
+        VGAVec32 v = {
+            be ? lduw_be_p(s + 0) : lduw_le_p(s + 0),
+            be ? lduw_be_p(s + 2) : lduw_le_p(s + 2),
+            be ? lduw_be_p(s + 4) : lduw_le_p(s + 4),
+            be ? lduw_be_p(s + 6) : lduw_le_p(s + 6),
+        };
+
+        v = is15 ? VGA_CONVERT_15(v) : VGA_CONVERT_16(v);
+        memcpy(d, &v, sizeof(v));
+        s += 2 * VGA_VEC_PIXELS;
+        d += sizeof(v);
+    }
+    for (; x < width; x++) {
+        uint32_t v = be ? lduw_be_p(s) : lduw_le_p(s);
+
+        ((uint32_t *)d)[0] = is15 ? VGA_CONVERT_15(v) : VGA_CONVERT_16(v);
+        s += 2;
+        d += 4;
+    }
+}
+
+static inline void vga_convert_line32(uint8_t *d, const uint8_t *s,
+                                      int width, bool be)
+{
+    int x = 0;
+
+    for (; x + VGA_VEC_PIXELS <= width; x += VGA_VEC_PIXELS) {
+        VGAVec32 v = {
+            be ? ldl_be_p(s + 0) : ldl_le_p(s + 0),
+            be ? ldl_be_p(s + 4) : ldl_le_p(s + 4),
+            be ? ldl_be_p(s + 8) : ldl_le_p(s + 8),
+            be ? ldl_be_p(s + 12) : ldl_le_p(s + 12),
+        };
+
+        v &= 0xffffff;
+        memcpy(d, &v, sizeof(v));
+        s += 4 * VGA_VEC_PIXELS;
+        d += sizeof(v);
+    }
+    for (; x < width; x++) {
+        ((uint32_t *)d)[0] = (be ? ldl_be_p(s) : ldl_le_p(s)) & 0xffffff;
+        s += 4;
+        d += 4;
+    }
+}
+
 static inline void vga_draw_glyph_line(uint8_t *d, uint32_t font_data,
                                        uint32_t xorcol, uint32_t bgcol)
 {
@@ -260,9 +339,18 @@ static void vga_draw_line8(VGACommonState *vga, uint8_t *d,
                            uint32_t addr, int width)
 {
     uint32_t *palette;
+    const uint8_t *s;
     int x;
 
     palette = vga->last_palette;
+    width &= ~7;
+    s = vga_line_ptr(vga, addr, width, 1);
+    if (s) {
+        for (x = 0; x < width; x++) {
+            ((uint32_t *)d)[x] = palette[s[x]];
+        }
+        return;
+    }
     width >>= 3;
     for(x = 0; x < width; x++) {
         ((uint32_t *)d)[0] = palette[vga_read_byte(vga, addr + 0)];
@@ -285,8 +373,14 @@ static void vga_draw_line15_le(VGACommonState *vga, uint8_t *d,
                                uint32_t addr, int width)
 {
     int w;
+    const uint8_t *s;
     uint32_t v, r, g, b;
 
+    s = vga_line_ptr(vga, addr, width * 2, 2);
+    if (s) {
+        vga_convert_line16(d, s, width, false, true);
+        return;
+    }
     w = width;
     do {
         v = vga_read_word_le(vga, addr);
@@ -303,8 +397,14 @@ static void vga_draw_line15_be(VGACommonState *vga, uint8_t *d,
                                uint32_t addr, int width)
 {
     int w;
+    const uint8_t *s;
     uint32_t v, r, g, b;
 
+    s = vga_line_ptr(vga, addr, width * 2, 2);
+    if (s) {
+        vga_convert_line16(d, s, width, true, true);
+        return;
+    }
     w = width;
     do {
         v = vga_read_word_be(vga, addr);
@@ -324,8 +424,14 @@ static void vga_draw_line16_le(VGACommonState *vga, uint8_t *d,
                                uint32_t addr, int width)
 {
     int w;
+    const uint8_t *s;
     uint32_t v, r, g, b;
 
+    s = vga_line_ptr(vga, addr, width * 2, 2);
+    if (s) {
+        vga_convert_line16(d, s, width, false, false);
+        return;
+    }
     w = width;
     do {
         v = vga_read_word_le(vga, addr);
@@ -342,8 +448,14 @@ static void vga_draw_line16_be(VGACommonState *vga, uint8_t *d,
                                uint32_t addr, int width)
 {
     int w;
+    const uint8_t *s;
     uint32_t v, r, g, b;
 
+    s = vga_line_ptr(vga, addr, width * 2, 2);
+    if (s) {
+        vga_convert_line16(d, s, width, true, false);
+        return;
+    }
     w = width;
     do {
         v = vga_read_word_be(vga, addr);
@@ -363,8 +475,16 @@ static void vga_draw_line24_le(VGACommonState *vga, uint8_t *d,
                                uint32_t addr, int width)
 {
     int w;
+    const uint8_t *s;
     uint32_t r, g, b;
 
+    s = vga_line_ptr(vga, addr, width * 3, 1);
+    if (s) {
+        for (w = 0; w < width; w++, s += 3) {
+            ((uint32_t *)d)[w] = rgb_to_pixel32(s[2], s[1], s[0]);
+        }
+        return;
+    }
     w = width;
     do {
         b = vga_read_byte(vga, addr + 0);
@@ -380,8 +500,16 @@ static void vga_draw_line24_be(VGACommonState *vga, uint8_t *d,
                                uint32_t addr, int width)
 {
     int w;
+    const uint8_t *s;
     uint32_t r, g, b;
 
+    s = vga_line_ptr(vga, addr, width * 3, 1);
+    if (s) {
+        for (w = 0; w < width; w++, s += 3) {
+            ((uint32_t *)d)[w] = rgb_to_pixel32(s[0], s[1], s[2]);
+        }
+        return;
+    }
     w = width;
     do {
         r = vga_read_byte(vga, addr + 0);
@@ -400,8 +528,14 @@ static void vga_draw_line32_le(VGACommonState *vga, uint8_t *d,
                                uint32_t addr, int width)
 {
     int w;
+    const uint8_t *s;
     uint32_t r, g, b;
 
+    s = vga_line_ptr(vga, addr, width * 4, 1);
+    if (s) {
+        vga_convert_line32(d, s, width, false);
+        return;
+    }
     w = width;
     do {
         b = vga_read_byte(vga, addr + 0);
@@ -417,8 +551,14 @@ static void vga_draw_line32_be(VGACommonState *vga, uint8_t *d,
                                uint32_t addr, int width)
 {
     int w;
+    const uint8_t *s;
     uint32_t r, g, b;
 
+    s = vga_line_ptr(vga, addr, width * 4, 1);
+    if (s) {
+        vga_convert_line32(d, s, width, true);
+        return;
+    }
     w = width;
     do {
         r = vga_read_byte(vga, addr + 1);
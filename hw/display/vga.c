@@ -24,6 +24,7 @@
 
 #include "qemu/osdep.h"
 #include "qemu/units.h"
+#include "qemu/cutils.h"
 #include "sysemu/reset.h"
 #include "qapi/error.h"
 #include "hw/core/cpu.h"
@@ -1454,6 +1455,12 @@ static bool vga_scanline_invalidated(VGACommonState *s, int y)
     return s->invalidated_y_table[y >> 5] & (1 << (y & 0x1f));
 }
 
+static bool vga_any_scanline_invalidated(VGACommonState *s)
+{
+    return !buffer_is_zero(s->invalidated_y_table,
+                           sizeof(s->invalidated_y_table));
+}
+
 void vga_dirty_log_start(VGACommonState *s)
 {
     memory_region_set_log(&s->vram, true, DIRTY_MEMORY_VGA);
@@ -1668,6 +1675,14 @@ static void vga_draw_graphic(VGACommonState *s, int full_update)
         snap = memory_region_snapshot_and_clear_dirty(&s->vram, region_start,
                                                       region_end - region_start,
                                                       DIRTY_MEMORY_VGA);
+
+        /* idle display: nothing to convert or to send to the UI */
+        if (!memory_region_snapshot_get_dirty(&s->vram, snap, region_start,
+                                              region_end - region_start) &&
+            !vga_any_scanline_invalidated(s)) {
+            g_free(snap);
+            return;
+        }
     }
 
     for(y = 0; y < height; y++) {
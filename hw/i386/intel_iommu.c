@@ -282,6 +282,82 @@ static gboolean vtd_hash_remove_by_page(gpointer key, gpointer value,
              (entry->gfn == gfn_tlb));
 }
 
+/*
+ * Drop the MRU translations of all VTDAddressSpaces by moving to a new
+ * IOTLB generation.  Must be called with IOMMU lock held.
+ */
+static void vtd_iotlb_mru_invalidate_locked(IntelIOMMUState *s)
+{
+    VTDAddressSpace *vtd_as;
+    GHashTableIter as_it;
+    uint32_t gen = s->iotlb_gen + 1;
+
+    if (gen == 0) {
+        /* Wrapped around: make sure no stale entry can match again */
+        g_hash_table_iter_init(&as_it, s->vtd_address_spaces);
+        while (g_hash_table_iter_next(&as_it, NULL, (void **)&vtd_as)) {
+            seqlock_write_begin(&vtd_as->iotlb_mru_seq);
+            memset(vtd_as->iotlb_mru, 0, sizeof(vtd_as->iotlb_mru));
+            seqlock_write_end(&vtd_as->iotlb_mru_seq);
+        }
+        gen = 1;
+    }
+    qatomic_set(&s->iotlb_gen, gen);
+}
+
+/*
+ * Lookup @addr in the MRU translations of @vtd_as.  This is done
+ * without the IOMMU lock; the seqlock only protects against a
+ * concurrent update of the entries, whose writers are serialized by
+ * the IOMMU lock.
+ */
+static bool vtd_iotlb_mru_lookup(VTDAddressSpace *vtd_as, hwaddr addr,
+                                 IOMMUTLBEntry *entry)
+{
+    IntelIOMMUState *s = vtd_as->iommu_state;
+    VTDIOTLBMRUEntry *mru;
+    unsigned seq;
+    uint32_t gen;
+    bool hit;
+    int i;
+
+    do {
+        seq = seqlock_read_begin(&vtd_as->iotlb_mru_seq);
+        gen = qatomic_read(&s->iotlb_gen);
+        hit = false;
+        for (i = 0; i < VTD_IOTLB_MRU_SIZE; i++) {
+            mru = &vtd_as->iotlb_mru[i];
+            if (mru->gen == gen && (addr & ~mru->addr_mask) == mru->iova) {
+                entry->iova = mru->iova;
+                entry->translated_addr = mru->translated_addr;
+                entry->addr_mask = mru->addr_mask;
+                entry->perm = mru->perm;
+                hit = true;
+                break;
+            }
+        }
+    } while (seqlock_read_retry(&vtd_as->iotlb_mru_seq, seq));
+
+    return hit;
+}
+
+/* Must be called with IOMMU lock held. */
+static void vtd_iotlb_mru_update_locked(VTDAddressSpace *vtd_as,
+                                        IOMMUTLBEntry *entry)
+{
+    VTDIOTLBMRUEntry *mru = &vtd_as->iotlb_mru[vtd_as->iotlb_mru_next];
+
+    seqlock_write_begin(&vtd_as->iotlb_mru_seq);
+    mru->gen = vtd_as->iommu_state->iotlb_gen;
+    mru->iova = entry->iova;
+    mru->translated_addr = entry->translated_addr;
+    mru->addr_mask = entry->addr_mask;
+    mru->perm = entry->perm;
+    seqlock_write_end(&vtd_as->iotlb_mru_seq);
+
+    vtd_as->iotlb_mru_next = (vtd_as->iotlb_mru_next + 1) % VTD_IOTLB_MRU_SIZE;
+}
+
 /* Reset all the gen of VTDAddressSpace to zero and set the gen of
  * IntelIOMMUState to 1.  Must be called with IOMMU lock held.
  */
@@ -298,6 +374,7 @@ static void vtd_reset_context_cache_locked(IntelIOMMUState *s)
         vtd_as->context_cache_entry.context_cache_gen = 0;
     }
     s->context_cache_gen = 1;
+    vtd_iotlb_mru_invalidate_locked(s);
 }
 
 /* Must be called with IOMMU lock held. */
@@ -305,6 +382,8 @@ static void vtd_reset_iotlb_locked(IntelIOMMUState *s)
 {
     assert(s->iotlb);
     g_hash_table_remove_all(s->iotlb);
+    s->iotlb_levels = 0;
+    vtd_iotlb_mru_invalidate_locked(s);
 }
 
 static void vtd_reset_iotlb(IntelIOMMUState *s)
@@ -332,10 +411,17 @@ static VTDIOTLBEntry *vtd_lookup_iotlb(IntelIOMMUState *s, uint16_t source_id,
                                        uint32_t pasid, hwaddr addr)
 {
     struct vtd_iotlb_key key;
-    VTDIOTLBEntry *entry;
+    VTDIOTLBEntry *entry = NULL;
     int level;
 
     for (level = VTD_SL_PT_LEVEL; level < VTD_SL_PML4_LEVEL; level++) {
+        /*
+         * Only probe the page sizes that have been cached, so that a
+         * guest using a single page size needs a single lookup.
+         */
+        if (!(s->iotlb_levels & (1 << level))) {
+            continue;
+        }
         key.gfn = vtd_get_iotlb_gfn(addr, level);
         key.level = level;
         key.sid = source_id;
@@ -379,6 +465,7 @@ static void vtd_update_iotlb(IntelIOMMUState *s, uint16_t source_id,
     key->pasid = pasid;
 
     g_hash_table_replace(s->iotlb, key, entry);
+    s->iotlb_levels |= 1 << level;
 }
 
 /* Given the reg addr of both the message data and address, generate an
@@ -1846,6 +1933,15 @@ static bool vtd_do_iommu_translate(VTDAddressSpace *vtd_as, PCIBus *bus,
      */
     assert(!vtd_is_interrupt_addr(addr));
 
+    /*
+     * Like IOTLB hits, MRU hits skip the context entry and leave the
+     * permission check to the caller.
+     */
+    if (vtd_iotlb_mru_lookup(vtd_as, addr, entry)) {
+        trace_vtd_iotlb_mru_hit(source_id, addr, entry->translated_addr);
+        return true;
+    }
+
     vtd_iommu_lock(s);
 
     cc_entry = &vtd_as->context_cache_entry;
@@ -1954,11 +2050,12 @@ static bool vtd_do_iommu_translate(VTDAddressSpace *vtd_as, PCIBus *bus,
     vtd_update_iotlb(s, source_id, vtd_get_domain_id(s, &ce, pasid),
                      addr, slpte, access_flags, level, pasid);
 out:
-    vtd_iommu_unlock(s);
     entry->iova = addr & page_mask;
     entry->translated_addr = vtd_get_slpte_addr(slpte, s->aw_bits) & page_mask;
     entry->addr_mask = ~page_mask;
     entry->perm = access_flags;
+    vtd_iotlb_mru_update_locked(vtd_as, entry);
+    vtd_iommu_unlock(s);
     return true;
 
 error:
@@ -2017,6 +2114,8 @@ static void vtd_context_global_invalidate(IntelIOMMUState *s)
     s->context_cache_gen++;
     if (s->context_cache_gen == VTD_CONTEXT_CACHE_GEN_MAX) {
         vtd_reset_context_cache_locked(s);
+    } else {
+        vtd_iotlb_mru_invalidate_locked(s);
     }
     vtd_iommu_unlock(s);
     vtd_address_space_refresh_all(s);
@@ -2073,6 +2172,7 @@ static void vtd_context_device_invalidate(IntelIOMMUState *s,
                                          VTD_PCI_FUNC(vtd_as->devfn));
             vtd_iommu_lock(s);
             vtd_as->context_cache_entry.context_cache_gen = 0;
+            vtd_iotlb_mru_invalidate_locked(s);
             vtd_iommu_unlock(s);
             /*
              * Do switch address space when needed, in case if the
@@ -2139,6 +2239,7 @@ static void vtd_iotlb_domain_invalidate(IntelIOMMUState *s, uint16_t domain_id)
     vtd_iommu_lock(s);
     g_hash_table_foreach_remove(s->iotlb, vtd_hash_remove_by_domain,
                                 &domain_id);
+    vtd_iotlb_mru_invalidate_locked(s);
     vtd_iommu_unlock(s);
 
     QLIST_FOREACH(vtd_as, &s->vtd_as_with_notifiers, next) {
@@ -2208,6 +2309,7 @@ static void vtd_iotlb_page_invalidate(IntelIOMMUState *s, uint16_t domain_id,
     info.mask = ~((1 << am) - 1);
     vtd_iommu_lock(s);
     g_hash_table_foreach_remove(s->iotlb, vtd_hash_remove_by_page, &info);
+    vtd_iotlb_mru_invalidate_locked(s);
     vtd_iommu_unlock(s);
     vtd_iotlb_page_invalidate_notify(s, domain_id, addr, am, PCI_NO_PASID);
 }
@@ -3662,6 +3764,7 @@ VTDAddressSpace *vtd_find_add_as(IntelIOMMUState *s, PCIBus *bus,
         vtd_dev_as->pasid = pasid;
         vtd_dev_as->iommu_state = s;
         vtd_dev_as->context_cache_entry.context_cache_gen = 0;
+        seqlock_init(&vtd_dev_as->iotlb_mru_seq);
         vtd_dev_as->iova_tree = iova_tree_new();
 
         memory_region_init(&vtd_dev_as->root, OBJECT(s), name, UINT64_MAX);
@@ -4151,6 +4254,7 @@ static void vtd_realize(DeviceState *dev, Error **errp)
     /* No corresponding destroy */
     s->iotlb = g_hash_table_new_full(vtd_iotlb_hash, vtd_iotlb_equal,
                                      g_free, g_free);
+    s->iotlb_gen = 1;
     s->vtd_address_spaces = g_hash_table_new_full(vtd_as_hash, vtd_as_equal,
                                       g_free, g_free);
     vtd_init(s);
@@ -28,7 +28,9 @@
 #include "hw/qdev-properties.h"
 #include "migration/vmstate.h"
 
+#include "qapi/error.h"
 #include "qemu/error-report.h"
+#include "qemu/host-utils.h"
 #include "qemu/log.h"
 #include "qemu/main-loop.h"
 #include "qemu/module.h"
@@ -50,6 +52,7 @@ static bool ahci_map_clb_address(AHCIDevice *ad);
 static bool ahci_map_fis_address(AHCIDevice *ad);
 static void ahci_unmap_clb_address(AHCIDevice *ad);
 static void ahci_unmap_fis_address(AHCIDevice *ad);
+static void ahci_ncq_complete_pending(AHCIDevice *ad);
 
 static const char *AHCIHostReg_lookup[AHCI_HOST_REG__COUNT] = {
     [AHCI_HOST_REG_CAP]        = "CAP",
@@ -641,6 +644,59 @@ static void ahci_set_signature(AHCIDevice *ad, uint32_t sig)
                              s->lcyl, s->hcyl, sig);
 }
 
+/*
+ * NCQ commands in a row after which a port moves to the iothread.  Moving
+ * there and back drains the drive twice, so guests that mix in non-NCQ
+ * commands often, such as FLUSH CACHE after every few writes, keep running
+ * NCQ in the main loop; this bounds the moves to one round trip for every
+ * AHCI_NCQ_IOTHREAD_STREAK NCQ commands.
+ */
+#define AHCI_NCQ_IOTHREAD_STREAK 32
+
+/*
+ * With an iothread, NCQ commands run with the drive's BlockBackend in the
+ * iothread's AioContext, while all other commands go through the IDE core
+ * and need it in the main loop.  A host may not mix the two on a port
+ * (SATA 3.2 section 13.6.3), so the BlockBackend moves when the kind of
+ * command changes, which drains whatever the previous kind left in flight.
+ */
+static void ahci_port_set_aio_context(AHCIDevice *ad, AioContext *ctx)
+{
+    BlockBackend *blk = ad->port.ifs[0].blk;
+    AioContext *old_ctx;
+    Error *local_err = NULL;
+    int64_t start;
+
+    if (!blk || blk_get_aio_context(blk) == ctx) {
+        return;
+    }
+    if (ad->iothread_failed && ctx != qemu_get_aio_context()) {
+        return;
+    }
+
+    start = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
+    old_ctx = blk_get_aio_context(blk);
+    aio_context_acquire(old_ctx);
+    blk_set_aio_context(blk, ctx, &local_err);
+    aio_context_release(old_ctx);
+    if (local_err) {
+        /* Don't retry on every command, NCQ stays in the main loop */
+        ad->iothread_failed = true;
+        error_prepend(&local_err, "ahci: port %d: NCQ stays in the main "
+                      "loop: ", ad->port_no);
+        warn_report_err(local_err);
+        return;
+    }
+    trace_ahci_port_set_aio_context(ad->hba, ad->port_no,
+                                    ctx == qemu_get_aio_context() ?
+                                    "main loop" : "iothread",
+                                    qemu_clock_get_ns(QEMU_CLOCK_REALTIME) -
+                                    start);
+
+    /* Retire what completed in the iothread while draining */
+    ahci_ncq_complete_pending(ad);
+}
+
 static void ahci_reset_port(AHCIState *s, int port)
 {
     AHCIDevice *d = &s->dev[port];
@@ -650,6 +706,8 @@ static void ahci_reset_port(AHCIState *s, int port)
 
     trace_ahci_reset_port(s, port);
 
+    ahci_port_set_aio_context(d, qemu_get_aio_context());
+    d->ncq_streak = 0;
     ide_bus_reset(&d->port);
     ide_state->ncq_queues = AHCI_MAX_CMDS;
 
@@ -1003,7 +1061,8 @@ static void ncq_err(NCQTransferState *ncq_tfs)
     ncq_tfs->used = 0;
 }
 
-static void ncq_finish(NCQTransferState *ncq_tfs)
+/* Release @ncq_tfs; the caller sends the SDB FIS that reports it */
+static void ncq_retire(NCQTransferState *ncq_tfs)
 {
     /* If we didn't error out, set our finished bit. Errored commands
      * do not get a bit set for the SDB FIS ACT register, nor do they
@@ -1012,8 +1071,6 @@ static void ncq_finish(NCQTransferState *ncq_tfs)
         ncq_tfs->drive->finished |= (1 << ncq_tfs->tag);
     }
 
-    ahci_write_fis_sdb(ncq_tfs->drive->hba, ncq_tfs);
-
     trace_ncq_finish(ncq_tfs->drive->hba, ncq_tfs->drive->port_no,
                      ncq_tfs->tag);
 
@@ -1023,13 +1080,11 @@ static void ncq_finish(NCQTransferState *ncq_tfs)
     ncq_tfs->used = 0;
 }
 
-static void ncq_cb(void *opaque, int ret)
+/* Returns true if @ncq_tfs was retired, false if it is halted for retry */
+static bool ncq_complete(NCQTransferState *ncq_tfs, int ret)
 {
-    NCQTransferState *ncq_tfs = (NCQTransferState *)opaque;
     IDEState *ide_state = &ncq_tfs->drive->port.ifs[0];
 
-    ncq_tfs->aiocb = NULL;
-
     if (ret < 0) {
         bool is_read = ncq_tfs->cmd == READ_FPDMA_QUEUED;
         BlockErrorAction action = blk_get_error_action(ide_state->blk,
@@ -1045,8 +1100,73 @@ static void ncq_cb(void *opaque, int ret)
         ide_state->status = READY_STAT | SEEK_STAT;
     }
 
-    if (!ncq_tfs->halt) {
-        ncq_finish(ncq_tfs);
+    if (ncq_tfs->halt) {
+        return false;
+    }
+    ncq_retire(ncq_tfs);
+    return true;
+}
+
+/*
+ * Retire the NCQ commands that completed in the iothread.  Device state
+ * and interrupts belong to the main loop, and doing them here for a whole
+ * batch also means one SDB FIS and one interrupt for all of its commands.
+ * A failed command still gets an SDB FIS of its own: it carries the error
+ * status, which retiring a later command would overwrite.
+ */
+static void ahci_ncq_complete_pending(AHCIDevice *ad)
+{
+    uint32_t done = qatomic_xchg(&ad->ncq_done, 0);
+    NCQTransferState *last = NULL;
+
+    if (!done) {
+        return;
+    }
+
+    trace_ahci_ncq_complete_pending(ad->hba, ad->port_no, done);
+    while (done) {
+        NCQTransferState *ncq_tfs = &ad->ncq_tfs[ctz32(done)];
+
+        done &= done - 1;
+        if (ncq_tfs->ret < 0 && last) {
+            ahci_write_fis_sdb(ad->hba, last);
+            last = NULL;
+        }
+        if (!ncq_complete(ncq_tfs, ncq_tfs->ret)) {
+            continue;
+        }
+        if (ncq_tfs->ret < 0) {
+            ahci_write_fis_sdb(ad->hba, ncq_tfs);
+        } else {
+            last = ncq_tfs;
+        }
+    }
+    if (last) {
+        ahci_write_fis_sdb(ad->hba, last);
+    }
+}
+
+static void ahci_ncq_bh(void *opaque)
+{
+    ahci_ncq_complete_pending(opaque);
+}
+
+static void ncq_cb(void *opaque, int ret)
+{
+    NCQTransferState *ncq_tfs = (NCQTransferState *)opaque;
+    AHCIDevice *ad = ncq_tfs->drive;
+
+    ncq_tfs->aiocb = NULL;
+
+    if (blk_get_aio_context(ad->port.ifs[0].blk) != qemu_get_aio_context()) {
+        ncq_tfs->ret = ret;
+        qatomic_or(&ad->ncq_done, 1U << ncq_tfs->tag);
+        qemu_bh_schedule(ad->ncq_bh);
+        return;
+    }
+
+    if (ncq_complete(ncq_tfs, ret)) {
+        ahci_write_fis_sdb(ad->hba, ncq_tfs);
     }
 }
 
@@ -1070,10 +1190,12 @@ static void execute_ncq_command(NCQTransferState *ncq_tfs)
     AHCIDevice *ad = ncq_tfs->drive;
     IDEState *ide_state = &ad->port.ifs[0];
     int port = ad->port_no;
+    AioContext *ctx = blk_get_aio_context(ide_state->blk);
 
     g_assert(is_ncq(ncq_tfs->cmd));
     ncq_tfs->halt = false;
 
+    aio_context_acquire(ctx);
     switch (ncq_tfs->cmd) {
     case READ_FPDMA_QUEUED:
         trace_execute_ncq_command_read(ad->hba, port, ncq_tfs->tag,
@@ -1100,6 +1222,7 @@ static void execute_ncq_command(NCQTransferState *ncq_tfs)
                                         ncq_tfs->tag, ncq_tfs->cmd);
         ncq_err(ncq_tfs);
     }
+    aio_context_release(ctx);
 }
 
 
@@ -1175,6 +1298,14 @@ static void process_ncq_command(AHCIState *s, int port, const uint8_t *cmd_fis,
                               ncq_fis->command,
                               ncq_tfs->lba,
                               ncq_tfs->lba + ncq_tfs->sector_count - 1);
+    if (s->iothread) {
+        if (ad->ncq_streak < AHCI_NCQ_IOTHREAD_STREAK) {
+            ad->ncq_streak++;
+        } else {
+            ahci_port_set_aio_context(ad,
+                                      iothread_get_aio_context(s->iothread));
+        }
+    }
     execute_ncq_command(ncq_tfs);
 }
 
@@ -1228,6 +1359,10 @@ static void handle_reg_h2d_fis(AHCIState *s, int port,
         return;
     }
 
+    /* Everything else goes through the IDE core, in the main loop */
+    s->dev[port].ncq_streak = 0;
+    ahci_port_set_aio_context(&s->dev[port], qemu_get_aio_context());
+
     /* Decompose the FIS:
      * AHCI does not interpret FIS packets, it only forwards them.
      * SATA 1.0 describes how to decode LBA28 and CHS FIS packets.
@@ -1561,6 +1696,8 @@ void ahci_realize(AHCIState *s, DeviceState *qdev, AddressSpace *as, int ports)
         ad->port_no = i;
         ad->port.dma = &ad->dma;
         ad->port.dma->ops = &ahci_dma_ops;
+        ad->ncq_bh = qemu_bh_new_guarded(ahci_ncq_bh, ad,
+                                         &ad->mem_reentrancy_guard);
         ide_bus_register_restart_cb(&ad->port);
     }
     g_free(irqs);
@@ -1573,6 +1710,9 @@ void ahci_uninit(AHCIState *s)
     for (i = 0; i < s->ports; i++) {
         AHCIDevice *ad = &s->dev[i];
 
+        ahci_port_set_aio_context(ad, qemu_get_aio_context());
+        qemu_bh_delete(ad->ncq_bh);
+
         for (j = 0; j < 2; j++) {
             IDEState *s = &ad->port.ifs[j];
 
@@ -1658,6 +1798,18 @@ static const VMStateDescription vmstate_ahci_device = {
     },
 };
 
+static int ahci_state_pre_save(void *opaque)
+{
+    AHCIState *s = opaque;
+    int i;
+
+    /* Requests were drained, but their completion may still be queued */
+    for (i = 0; i < s->ports; i++) {
+        ahci_ncq_complete_pending(&s->dev[i]);
+    }
+    return 0;
+}
+
 static int ahci_state_post_load(void *opaque, int version_id)
 {
     int i, j;
@@ -1746,6 +1898,7 @@ static int ahci_state_post_load(void *opaque, int version_id)
 const VMStateDescription vmstate_ahci = {
     .name = "ahci",
     .version_id = 1,
+    .pre_save = ahci_state_pre_save,
     .post_load = ahci_state_post_load,
     .fields = (VMStateField[]) {
         VMSTATE_STRUCT_VARRAY_POINTER_INT32(dev, AHCIState, ports,
@@ -303,6 +303,7 @@ typedef struct NCQTransferState {
     uint8_t slot;
     bool used;
     bool halt;
+    int ret;                /* result handed from the iothread */
 } NCQTransferState;
 
 struct AHCIDevice {
@@ -321,6 +322,10 @@ struct AHCIDevice {
     bool init_d2h_sent;
     AHCICmdHdr *cur_cmd;
     NCQTransferState ncq_tfs[AHCI_MAX_CMDS];
+    uint32_t ncq_done;      /* tags completed in the iothread, atomic */
+    QEMUBH *ncq_bh;
+    uint32_t ncq_streak;    /* NCQ commands since the last non-NCQ one */
+    bool iothread_failed;   /* drive could not move, NCQ stays in main loop */
     MemReentrancyGuard mem_reentrancy_guard;
 };
 
@@ -35,6 +35,8 @@
 #include "qom/object_interfaces.h"
 #include "chardev/char-fe.h"
 #include "sysemu/hostmem.h"
+#include "sysemu/iothread.h"
+#include "qemu/main-loop.h"
 #include "qapi/visitor.h"
 
 #include "hw/misc/ivshmem.h"
@@ -85,6 +87,17 @@ typedef struct MSIVector {
     bool unmasked;
 } MSIVector;
 
+/*
+ * One of our own doorbell eventfds, watched in an IOThread.  It holds a
+ * duplicate of the peer's file descriptor, so that it can outlive the
+ * device until the IOThread is guaranteed not to be looking at it.
+ */
+typedef struct IVShmemDoorbell {
+    IVShmemState *s;            /* NULL once the device is gone */
+    EventNotifier notifier;
+    int vector;
+} IVShmemDoorbell;
+
 struct IVShmemState {
     /*< private >*/
     PCIDevice parent_obj;
@@ -111,6 +124,8 @@ struct IVShmemState {
     int nb_peers;               /* space in @peers[] */
     uint32_t vectors;
     MSIVector *msi_vectors;
+    IOThread *iothread;         /* watch our doorbells here, if set */
+    IVShmemDoorbell **doorbells; /* [vectors], used with @iothread */
     uint64_t msg_buf;           /* buffer for receiving server messages */
     int msg_buffered_bytes;     /* #bytes in @msg_buf */
 
@@ -250,6 +265,20 @@ static const MemoryRegionOps ivshmem_mmio_ops = {
     },
 };
 
+static void ivshmem_vector_inject(IVShmemState *s, int vector)
+{
+    PCIDevice *pdev = PCI_DEVICE(s);
+
+    IVSHMEM_DPRINTF("interrupt on vector %p %d\n", pdev, vector);
+    if (ivshmem_has_feature(s, IVSHMEM_MSI)) {
+        if (msix_enabled(pdev)) {
+            msix_notify(pdev, vector);
+        }
+    } else {
+        ivshmem_IntrStatus_write(s, 1);
+    }
+}
+
 static void ivshmem_vector_notify(void *opaque)
 {
     MSIVector *entry = opaque;
@@ -262,14 +291,96 @@ static void ivshmem_vector_notify(void *opaque)
         return;
     }
 
-    IVSHMEM_DPRINTF("interrupt on vector %p %d\n", pdev, vector);
-    if (ivshmem_has_feature(s, IVSHMEM_MSI)) {
-        if (msix_enabled(pdev)) {
-            msix_notify(pdev, vector);
+    ivshmem_vector_inject(s, vector);
+}
+
+/*
+ * Runs in the IOThread.  Without KVM irqfds, this is the closest we get
+ * to one: the interrupt is delivered right away instead of waiting for
+ * the main loop to get around to the eventfd, which may be busy with
+ * other devices or the monitor.
+ */
+static void ivshmem_doorbell_notify(void *opaque)
+{
+    IVShmemDoorbell *db = opaque;
+
+    if (!event_notifier_test_and_clear(&db->notifier)) {
+        return;
+    }
+
+    qemu_mutex_lock_iothread();
+    if (db->s) {
+        ivshmem_vector_inject(db->s, db->vector);
+    }
+    qemu_mutex_unlock_iothread();
+}
+
+static void ivshmem_doorbell_free_bh(void *opaque)
+{
+    IVShmemDoorbell *db = opaque;
+
+    event_notifier_cleanup(&db->notifier);
+    g_free(db);
+}
+
+static bool ivshmem_watch_doorbell(IVShmemState *s, EventNotifier *n,
+                                   int vector)
+{
+    AioContext *ctx = iothread_get_aio_context(s->iothread);
+    IVShmemDoorbell *db;
+    int fd;
+
+    fd = qemu_dup(event_notifier_get_fd(n));
+    if (fd < 0) {
+        error_report("ivshmem: cannot watch vector %d in iothread: %s",
+                     vector, strerror(errno));
+        return false;
+    }
+
+    db = g_new0(IVShmemDoorbell, 1);
+    db->s = s;
+    db->vector = vector;
+    event_notifier_init_fd(&db->notifier, fd);
+    s->doorbells[vector] = db;
+
+    aio_context_acquire(ctx);
+    aio_set_fd_handler(ctx, fd, false, ivshmem_doorbell_notify, NULL, NULL,
+                       NULL, db);
+    aio_context_release(ctx);
+    return true;
+}
+
+/*
+ * A doorbell handler may already be waiting for the BQL, so the
+ * notifiers are only freed by a bottom half that runs in the IOThread
+ * once the handler has returned.
+ */
+static void ivshmem_unwatch_doorbells(IVShmemState *s)
+{
+    AioContext *ctx;
+    int i;
+
+    if (!s->doorbells) {
+        return;
+    }
+
+    ctx = iothread_get_aio_context(s->iothread);
+    aio_context_acquire(ctx);
+    for (i = 0; i < s->vectors; i++) {
+        IVShmemDoorbell *db = s->doorbells[i];
+
+        if (!db) {
+            continue;
         }
-    } else {
-        ivshmem_IntrStatus_write(s, 1);
+        db->s = NULL;
+        aio_set_fd_handler(ctx, event_notifier_get_fd(&db->notifier), false,
+                           NULL, NULL, NULL, NULL, NULL);
+        aio_bh_schedule_oneshot(ctx, ivshmem_doorbell_free_bh, db);
     }
+    aio_context_release(ctx);
+
+    g_free(s->doorbells);
+    s->doorbells = NULL;
 }
 
 static int ivshmem_vector_unmask(PCIDevice *dev, unsigned vector,
@@ -356,6 +467,9 @@ static void watch_vector_notifier(IVShmemState *s, EventNotifier *n,
     assert(!s->msi_vectors[vector].pdev);
     s->msi_vectors[vector].pdev = PCI_DEVICE(s);
 
+    if (s->iothread && ivshmem_watch_doorbell(s, n, vector)) {
+        return;
+    }
     qemu_set_fd_handler(eventfd, ivshmem_vector_notify,
                         NULL, &s->msi_vectors[vector]);
 }
@@ -732,6 +846,9 @@ static int ivshmem_setup_interrupts(IVShmemState *s, Error **errp)
 {
     /* allocate QEMU callback data for receiving interrupts */
     s->msi_vectors = g_new0(MSIVector, s->vectors);
+    if (s->iothread) {
+        s->doorbells = g_new0(IVShmemDoorbell *, s->vectors);
+    }
 
     if (ivshmem_has_feature(s, IVSHMEM_MSI)) {
         if (msix_init_exclusive_bar(PCI_DEVICE(s), s->vectors, 1, errp)) {
@@ -948,6 +1065,8 @@ static void ivshmem_exit(PCIDevice *dev)
         host_memory_backend_set_mapped(s->hostmem, false);
     }
 
+    ivshmem_unwatch_doorbells(s);
+
     if (s->peers) {
         for (i = 0; i < s->nb_peers; i++) {
             close_peer_eventfds(s, i);
@@ -1088,6 +1207,8 @@ static Property ivshmem_doorbell_properties[] = {
     DEFINE_PROP_BIT("ioeventfd", IVShmemState, features, IVSHMEM_IOEVENTFD,
                     true),
     DEFINE_PROP_ON_OFF_AUTO("master", IVShmemState, master, ON_OFF_AUTO_OFF),
+    DEFINE_PROP_LINK("iothread", IVShmemState, iothread, TYPE_IOTHREAD,
+                     IOThread *),
     DEFINE_PROP_END_OF_LIST(),
 };
 
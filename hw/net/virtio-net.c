@@ -1278,7 +1278,7 @@ static void rss_data_to_rss_config(struct VirtioNetRssData *data,
     config->default_queue = data->default_queue;
 }
 
-static bool virtio_net_attach_epbf_rss(VirtIONet *n)
+static bool virtio_net_set_epbf_rss_maps(VirtIONet *n)
 {
     struct EBPFRSSConfig config = {};
 
@@ -1288,8 +1288,13 @@ static bool virtio_net_attach_epbf_rss(VirtIONet *n)
 
     rss_data_to_rss_config(&n->rss_data, &config);
 
-    if (!ebpf_rss_set_all(&n->ebpf_rss, &config,
-                          n->rss_data.indirections_table, n->rss_data.key)) {
+    return ebpf_rss_set_all(&n->ebpf_rss, &config,
+                            n->rss_data.indirections_table, n->rss_data.key);
+}
+
+static bool virtio_net_attach_epbf_rss(VirtIONet *n)
+{
+    if (!virtio_net_set_epbf_rss_maps(n)) {
         return false;
     }
 
@@ -3050,10 +3055,32 @@ static int virtio_net_post_load_device(void *opaque, int version_id)
         }
     }
 
+    return 0;
+}
+
+/*
+ * Filling the eBPF RSS maps takes a few bpf() syscalls on file descriptors
+ * owned by this device, so it runs as post_load_async.  The peer may be
+ * changed under the BQL, so the ioctl that attaches the program to the tap
+ * device, and the vhost check, take it.  The receive path does not look at
+ * the RSS state before the VM is started.
+ */
+static int virtio_net_post_load_rss(void *opaque, int version_id)
+{
+    VirtIONet *n = opaque;
+    bool attached;
+
     if (n->rss_data.enabled) {
         n->rss_data.enabled_software_rss = n->rss_data.populate_hash;
         if (!n->rss_data.populate_hash) {
-            if (!virtio_net_attach_epbf_rss(n)) {
+            attached = virtio_net_set_epbf_rss_maps(n);
+
+            qemu_mutex_lock_iothread();
+            if (attached) {
+                attached = virtio_net_attach_ebpf_to_backend(
+                    n->nic, n->ebpf_rss.program_fd);
+            }
+            if (!attached) {
                 if (get_vhost_net(qemu_get_queue(n->nic)->peer)) {
                     warn_report("Can't post-load eBPF RSS for vhost");
                 } else {
@@ -3062,6 +3089,7 @@ static int virtio_net_post_load_device(void *opaque, int version_id)
                     n->rss_data.enabled_software_rss = true;
                 }
             }
+            qemu_mutex_unlock_iothread();
         }
 
         trace_virtio_net_rss_enable(n->rss_data.hash_types,
@@ -3852,6 +3880,7 @@ static const VMStateDescription vmstate_virtio_net = {
         VMSTATE_VIRTIO_DEVICE,
         VMSTATE_END_OF_LIST()
     },
+    .post_load_async = virtio_net_post_load_rss,
     .pre_save = virtio_net_pre_save,
     .dev_unplug_pending = dev_unplug_pending,
 };
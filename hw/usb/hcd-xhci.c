@@ -128,6 +128,8 @@
 #define ERDP_EHB        (1<<3)
 
 #define TRB_SIZE 16
+/* TRBs are fetched through a mapping of this much guest memory */
+#define XHCI_TRB_CACHE_SIZE 4096
 typedef struct XHCITRB {
     uint64_t parameter;
     uint32_t status;
@@ -646,6 +648,68 @@ static void xhci_write_event(XHCIState *xhci, XHCIEvent *event, int v)
     }
 }
 
+/*
+ * Processing a transfer or command ring can post many events in a row.
+ * While it runs, interrupts are held back and raised once per interrupter
+ * at the end, and TRBs are read through a MemoryRegionCache of the ring
+ * page instead of a full address space lookup for each of them.  The
+ * cache is dropped at the end too, so that it never outlives a change
+ * to the memory map.
+ */
+static void xhci_event_batch_begin(XHCIState *xhci)
+{
+    xhci->event_batch++;
+}
+
+static void xhci_trb_cache_release(XHCIState *xhci)
+{
+    address_space_cache_destroy(&xhci->trb_cache);
+    xhci->trb_cache = MEMORY_REGION_CACHE_INVALID;
+}
+
+static void xhci_event_batch_end(XHCIState *xhci)
+{
+    assert(xhci->event_batch > 0);
+    if (--xhci->event_batch) {
+        return;
+    }
+
+    xhci_trb_cache_release(xhci);
+    while (xhci->intr_deferred) {
+        int v = ctz32(xhci->intr_deferred);
+
+        xhci->intr_deferred &= ~(1U << v);
+        xhci_intr_raise(xhci, v);
+    }
+}
+
+static MemTxResult xhci_read_trb(XHCIState *xhci, dma_addr_t addr,
+                                 XHCITRB *trb)
+{
+    dma_addr_t base = addr & ~(dma_addr_t)(XHCI_TRB_CACHE_SIZE - 1);
+
+    if (!xhci->event_batch) {
+        return dma_memory_read(xhci->as, addr, trb, TRB_SIZE,
+                               MEMTXATTRS_UNSPECIFIED);
+    }
+
+    RCU_READ_LOCK_GUARD();
+    if (!xhci->trb_cache.mrs.mr || xhci->trb_cache_base != base) {
+        xhci_trb_cache_release(xhci);
+        if (address_space_cache_init(&xhci->trb_cache, xhci->as, base,
+                                     XHCI_TRB_CACHE_SIZE, false) <
+            XHCI_TRB_CACHE_SIZE) {
+            /* not all in one MemoryRegion, take the slow path */
+            xhci_trb_cache_release(xhci);
+            return dma_memory_read(xhci->as, addr, trb, TRB_SIZE,
+                                   MEMTXATTRS_UNSPECIFIED);
+        }
+        xhci->trb_cache_base = base;
+    }
+    return address_space_read_cached(&xhci->trb_cache, addr - base,
+                                     trb, TRB_SIZE);
+}
+
 static void xhci_event(XHCIState *xhci, XHCIEvent *event, int v)
 {
     XHCIInterrupter *intr;
@@ -681,6 +745,10 @@ static void xhci_event(XHCIState *xhci, XHCIEvent *event, int v)
         xhci_write_event(xhci, event, v);
     }
 
+    if (xhci->event_batch) {
+        xhci->intr_deferred |= 1U << v;
+        return;
+    }
     xhci_intr_raise(xhci, v);
 }
 
@@ -698,8 +766,7 @@ static TRBType xhci_ring_fetch(XHCIState *xhci, XHCIRing *ring, XHCITRB *trb,
 
     while (1) {
         TRBType type;
-        if (dma_memory_read(xhci->as, ring->dequeue, trb, TRB_SIZE,
-                            MEMTXATTRS_UNSPECIFIED) != MEMTX_OK) {
+        if (xhci_read_trb(xhci, ring->dequeue, trb) != MEMTX_OK) {
             qemu_log_mask(LOG_GUEST_ERROR, "%s: DMA memory access failed!\n",
                           __func__);
             return 0;
@@ -750,8 +817,7 @@ static int xhci_ring_chain_length(XHCIState *xhci, const XHCIRing *ring)
 
     do {
         TRBType type;
-        if (dma_memory_read(xhci->as, dequeue, &trb, TRB_SIZE,
-                        MEMTXATTRS_UNSPECIFIED) != MEMTX_OK) {
+        if (xhci_read_trb(xhci, dequeue, &trb) != MEMTX_OK) {
             qemu_log_mask(LOG_GUEST_ERROR, "%s: DMA memory access failed!\n",
                           __func__);
             return -1;
@@ -1872,7 +1938,7 @@ static bool xhci_slot_ok(XHCIState *xhci, int slotid)
             xhci->slots[slotid - 1].uport->dev->attached);
 }
 
-static void xhci_kick_epctx(XHCIEPContext *epctx, unsigned int streamid)
+static void xhci_run_epctx(XHCIEPContext *epctx, unsigned int streamid)
 {
     XHCIState *xhci = epctx->xhci;
     XHCIStreamContext *stctx = NULL;
@@ -2031,6 +2097,15 @@ static void xhci_kick_epctx(XHCIEPContext *epctx, unsigned int streamid)
     }
 }
 
+static void xhci_kick_epctx(XHCIEPContext *epctx, unsigned int streamid)
+{
+    XHCIState *xhci = epctx->xhci;
+
+    xhci_event_batch_begin(xhci);
+    xhci_run_epctx(epctx, streamid);
+    xhci_event_batch_end(xhci);
+}
+
 static TRBCCode xhci_enable_slot(XHCIState *xhci, unsigned int slotid)
 {
     trace_usb_xhci_slot_enable(slotid);
@@ -2706,6 +2781,7 @@ static void xhci_reset(DeviceState *dev)
 
     xhci->usbcmd = 0;
     xhci->usbsts = USBSTS_HCH;
+    xhci->intr_deferred = 0;
     xhci->dnctrl = 0;
     xhci->crcr_low = 0;
     xhci->crcr_high = 0;
@@ -3154,7 +3230,9 @@ static void xhci_doorbell_write(void *ptr, hwaddr reg,
 
     if (reg == 0) {
         if (val == 0) {
+            xhci_event_batch_begin(xhci);
             xhci_process_commands(xhci);
+            xhci_event_batch_end(xhci);
         } else {
             DPRINTF("xhci: bad doorbell 0 write: 0x%x\n",
                     (uint32_t)val);
@@ -3415,6 +3493,7 @@ static void usb_xhci_realize(DeviceState *dev, Error **errp)
 
     usb_xhci_init(xhci);
     xhci->mfwrap_timer = timer_new_ns(QEMU_CLOCK_VIRTUAL, xhci_mfwrap_timer, xhci);
+    xhci->trb_cache = MEMORY_REGION_CACHE_INVALID;
 
     memory_region_init(&xhci->mem, OBJECT(dev), "xhci", XHCI_LEN_REGS);
     memory_region_init_io(&xhci->mem_cap, OBJECT(dev), &xhci_cap_ops, xhci,
@@ -219,6 +219,13 @@ typedef struct XHCIState {
 
     XHCIRing cmd_ring;
 
+    /* Mapping of the guest page TRBs are being fetched from */
+    MemoryRegionCache trb_cache;
+    dma_addr_t trb_cache_base;
+    /* Nesting of ring processing, and interrupts it has held back */
+    unsigned int event_batch;
+    uint32_t intr_deferred;
+
     bool nec_quirks;
 } XHCIState;
 
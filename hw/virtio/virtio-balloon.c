@@ -36,6 +36,7 @@
 
 #include "hw/virtio/virtio-bus.h"
 #include "hw/virtio/virtio-access.h"
+#include "block/aio-wait.h"
 
 #define BALLOON_PAGE_SIZE  (1 << VIRTIO_BALLOON_PFN_SHIFT)
 
@@ -325,13 +326,212 @@ static void balloon_stats_set_poll_interval(Object *obj, Visitor *v,
     balloon_stats_change_timer(s, 0);
 }
 
+typedef struct VirtIOBalloonReportRange {
+    RAMBlock *rb;
+    ram_addr_t offset;
+    size_t size;
+} VirtIOBalloonReportRange;
+
+/*
+ * Free page reports popped from the reporting queue in one go.  The
+ * reported ranges are coalesced per RAMBlock and discarded together,
+ * in the iothread if one is set, before the elements are returned to
+ * the guest with a single notification.
+ */
+typedef struct VirtIOBalloonReportBatch {
+    VirtIOBalloon *dev;
+    GPtrArray *elems;
+    GArray *ranges;
+    uint64_t bytes;
+    uint64_t discards;
+    int64_t ns;
+} VirtIOBalloonReportBatch;
+
+static void virtio_balloon_handle_report(VirtIODevice *vdev, VirtQueue *vq);
+
+static void virtio_balloon_report_add(VirtIOBalloonReportBatch *batch,
+                                      VirtQueueElement *elem)
+{
+    unsigned int i;
+
+    for (i = 0; i < elem->in_num; i++) {
+        VirtIOBalloonReportRange range = {
+            .size = elem->in_sg[i].iov_len,
+        };
+
+        /*
+         * There is no need to check the memory section to see if
+         * it is ram/readonly/romd like there is for handle_output
+         * below. If the region is not meant to be written to then
+         * address_space_map will have allocated a bounce buffer
+         * and it will be freed in address_space_unmap and trigger
+         * and unassigned_mem_write before failing to copy over the
+         * buffer. If more than one bad descriptor is provided it
+         * will return NULL after the first bounce buffer and fail
+         * to map any resources.
+         *
+         * The mapping holds a reference to the memory region until
+         * the element is pushed, which keeps the RAMBlock alive while
+         * the batch is being discarded.
+         */
+        range.rb = qemu_ram_block_from_host(elem->in_sg[i].iov_base, false,
+                                            &range.offset);
+        if (!range.rb) {
+            trace_virtio_balloon_bad_addr(elem->in_addr[i]);
+            continue;
+        }
+
+        /*
+         * For now we will simply ignore unaligned memory regions, or
+         * regions that overrun the end of the RAMBlock.
+         */
+        if (!QEMU_IS_ALIGNED(range.offset | range.size,
+                             qemu_ram_pagesize(range.rb)) ||
+            (range.offset + range.size) >
+            qemu_ram_get_used_length(range.rb)) {
+            continue;
+        }
+
+        g_array_append_val(batch->ranges, range);
+    }
+}
+
+static gint virtio_balloon_report_range_cmp(gconstpointer a, gconstpointer b)
+{
+    const VirtIOBalloonReportRange *ra = a, *rb = b;
+
+    if (ra->rb != rb->rb) {
+        return (uintptr_t)ra->rb < (uintptr_t)rb->rb ? -1 : 1;
+    }
+    return ra->offset < rb->offset ? -1 : ra->offset > rb->offset;
+}
+
+/*
+ * Runs in the iothread if there is one, without the BQL.  RAM discards may
+ * have been disabled since the reports were checked, so that is checked
+ * again for every discard.  The migration checks need not be repeated:
+ * incoming postcopy is entered before the VM runs, and a background
+ * snapshot only starts tracking writes once the VM is stopped, which waits
+ * for the batch.
+ */
+static void virtio_balloon_report_discard(VirtIOBalloonReportBatch *batch)
+{
+    int64_t start = get_clock();
+    VirtIOBalloonReportRange cur = {};
+    guint i;
+
+    g_array_sort(batch->ranges, virtio_balloon_report_range_cmp);
+    for (i = 0; i <= batch->ranges->len; i++) {
+        VirtIOBalloonReportRange *range = NULL;
+
+        if (i < batch->ranges->len) {
+            range = &g_array_index(batch->ranges, VirtIOBalloonReportRange, i);
+            if (range->rb == cur.rb && range->offset <= cur.offset + cur.size) {
+                cur.size = MAX(cur.size,
+                               range->offset + range->size - cur.offset);
+                continue;
+            }
+        }
+        if (cur.rb &&
+            !ram_block_discard_range_if_enabled(cur.rb, cur.offset,
+                                                cur.size)) {
+            batch->bytes += cur.size;
+            batch->discards++;
+        }
+        if (range) {
+            cur = *range;
+        }
+    }
+    batch->ns = get_clock() - start;
+}
+
+static void virtio_balloon_report_complete(VirtIOBalloonReportBatch *batch)
+{
+    VirtIOBalloon *dev = batch->dev;
+    VirtIODevice *vdev = VIRTIO_DEVICE(dev);
+    guint i;
+
+    for (i = 0; i < batch->elems->len; i++) {
+        VirtQueueElement *elem = g_ptr_array_index(batch->elems, i);
+
+        virtqueue_push(dev->reporting_vq, elem, 0);
+        g_free(elem);
+    }
+    virtio_notify(vdev, dev->reporting_vq);
+
+    dev->report_bytes += batch->bytes;
+    dev->report_discards += batch->discards;
+    dev->report_ns += batch->ns;
+    trace_virtio_balloon_report_batch(dev, batch->elems->len,
+                                      batch->ranges->len, batch->discards,
+                                      batch->bytes, batch->ns);
+
+    g_ptr_array_free(batch->elems, true);
+    g_array_free(batch->ranges, true);
+    g_free(batch);
+}
+
+static void virtio_balloon_report_complete_bh(void *opaque)
+{
+    VirtIOBalloonReportBatch *batch = opaque;
+    VirtIOBalloon *dev = batch->dev;
+
+    dev->report_batch = NULL;
+    virtio_balloon_report_complete(batch);
+
+    /* Pick up the reports that arrived while this batch was running. */
+    if (dev->report_kick && !dev->report_stopping) {
+        dev->report_kick = false;
+        virtio_balloon_handle_report(VIRTIO_DEVICE(dev), dev->reporting_vq);
+    }
+}
+
+static void virtio_balloon_report_bh(void *opaque)
+{
+    VirtIOBalloonReportBatch *batch = opaque;
+
+    virtio_balloon_report_discard(batch);
+    aio_bh_schedule_oneshot(qemu_get_aio_context(),
+                            virtio_balloon_report_complete_bh, batch);
+}
+
+/*
+ * Wait for the batch running in the iothread, if any, and keep new ones
+ * from starting until virtio_balloon_report_resume().
+ */
+static void virtio_balloon_report_drain(VirtIOBalloon *dev)
+{
+    dev->report_stopping = true;
+    AIO_WAIT_WHILE(NULL, dev->report_batch);
+}
+
+static void virtio_balloon_report_resume(VirtIOBalloon *dev)
+{
+    dev->report_stopping = false;
+    if (dev->report_kick) {
+        dev->report_kick = false;
+        virtio_balloon_handle_report(VIRTIO_DEVICE(dev), dev->reporting_vq);
+    }
+}
+
 static void virtio_balloon_handle_report(VirtIODevice *vdev, VirtQueue *vq)
 {
     VirtIOBalloon *dev = VIRTIO_BALLOON(vdev);
+    VirtIOBalloonReportBatch *batch;
     VirtQueueElement *elem;
 
+    if (dev->report_batch || dev->report_stopping) {
+        dev->report_kick = true;
+        return;
+    }
+
+    batch = g_new0(VirtIOBalloonReportBatch, 1);
+    batch->dev = dev;
+    batch->elems = g_ptr_array_new();
+    batch->ranges = g_array_new(false, false, sizeof(VirtIOBalloonReportRange));
+
     while ((elem = virtqueue_pop(vq, sizeof(VirtQueueElement)))) {
-        unsigned int i;
+        g_ptr_array_add(batch->elems, elem);
 
         /*
          * When we discard the page it has the effect of removing the page
@@ -340,50 +540,27 @@ static void virtio_balloon_handle_report(VirtIODevice *vdev, VirtQueue *vq)
          * accessible by another device or process, or if the guest is
          * expecting it to retain a non-zero value.
          */
-        if (virtio_balloon_inhibited() || dev->poison_val) {
-            goto skip_element;
+        if (!virtio_balloon_inhibited() && !dev->poison_val) {
+            virtio_balloon_report_add(batch, elem);
         }
+    }
 
-        for (i = 0; i < elem->in_num; i++) {
-            void *addr = elem->in_sg[i].iov_base;
-            size_t size = elem->in_sg[i].iov_len;
-            ram_addr_t ram_offset;
-            RAMBlock *rb;
-
-            /*
-             * There is no need to check the memory section to see if
-             * it is ram/readonly/romd like there is for handle_output
-             * below. If the region is not meant to be written to then
-             * address_space_map will have allocated a bounce buffer
-             * and it will be freed in address_space_unmap and trigger
-             * and unassigned_mem_write before failing to copy over the
-             * buffer. If more than one bad descriptor is provided it
-             * will return NULL after the first bounce buffer and fail
-             * to map any resources.
-             */
-            rb = qemu_ram_block_from_host(addr, false, &ram_offset);
-            if (!rb) {
-                trace_virtio_balloon_bad_addr(elem->in_addr[i]);
-                continue;
-            }
-
-            /*
-             * For now we will simply ignore unaligned memory regions, or
-             * regions that overrun the end of the RAMBlock.
-             */
-            if (!QEMU_IS_ALIGNED(ram_offset | size, qemu_ram_pagesize(rb)) ||
-                (ram_offset + size) > qemu_ram_get_used_length(rb)) {
-                continue;
-            }
-
-            ram_block_discard_range(rb, ram_offset, size);
-        }
+    if (!batch->elems->len) {
+        g_ptr_array_free(batch->elems, true);
+        g_array_free(batch->ranges, true);
+        g_free(batch);
+        return;
+    }
 
-skip_element:
-        virtqueue_push(vq, elem, 0);
-        virtio_notify(vdev, vq);
-        g_free(elem);
+    if (!dev->iothread || !batch->ranges->len) {
+        virtio_balloon_report_discard(batch);
+        virtio_balloon_report_complete(batch);
+        return;
     }
+
+    dev->report_batch = batch;
+    aio_bh_schedule_oneshot(iothread_get_aio_context(dev->iothread),
+                            virtio_balloon_report_bh, batch);
 }
 
 static void virtio_balloon_handle_output(VirtIODevice *vdev, VirtQueue *vq)
@@ -538,10 +715,20 @@ static bool get_free_page_hints(VirtIOBalloon *dev)
     }
 
     if (elem->in_num && dev->free_page_hint_status == FREE_PAGE_HINT_S_START) {
-        for (i = 0; i < elem->in_num; i++) {
-            qemu_guest_free_page_hint(elem->in_sg[i].iov_base,
-                                      elem->in_sg[i].iov_len);
+        void *addr = elem->in_sg[0].iov_base;
+        size_t len = elem->in_sg[0].iov_len;
+
+        /* Hint host-contiguous buffers as one range. */
+        for (i = 1; i < elem->in_num; i++) {
+            if (elem->in_sg[i].iov_base == (uint8_t *)addr + len) {
+                len += elem->in_sg[i].iov_len;
+                continue;
+            }
+            qemu_guest_free_page_hint(addr, len);
+            addr = elem->in_sg[i].iov_base;
+            len = elem->in_sg[i].iov_len;
         }
+        qemu_guest_free_page_hint(addr, len);
     }
 
 out:
@@ -894,6 +1081,9 @@ static void virtio_balloon_device_realize(DeviceState *dev, Error **errp)
     if (virtio_has_feature(s->host_features, VIRTIO_BALLOON_F_REPORTING)) {
         s->reporting_vq = virtio_add_queue(vdev, 32,
                                            virtio_balloon_handle_report);
+        if (s->iothread) {
+            object_ref(OBJECT(s->iothread));
+        }
     }
 
     reset_stats(s);
@@ -920,7 +1110,11 @@ static void virtio_balloon_device_unrealize(DeviceState *dev)
         virtio_delete_queue(s->free_page_vq);
     }
     if (s->reporting_vq) {
+        virtio_balloon_report_drain(s);
         virtio_delete_queue(s->reporting_vq);
+        if (s->iothread) {
+            object_unref(OBJECT(s->iothread));
+        }
     }
     virtio_cleanup(vdev);
 }
@@ -933,6 +1127,13 @@ static void virtio_balloon_device_reset(VirtIODevice *vdev)
         virtio_balloon_free_page_stop(s);
     }
 
+    if (s->reporting_vq) {
+        /* The queue is reset, there is nothing left to pick up. */
+        virtio_balloon_report_drain(s);
+        s->report_kick = false;
+        s->report_stopping = false;
+    }
+
     if (s->stats_vq_elem != NULL) {
         virtqueue_unpop(s->svq, s->stats_vq_elem, 0);
         g_free(s->stats_vq_elem);
@@ -972,6 +1173,15 @@ static void virtio_balloon_set_status(VirtIODevice *vdev, uint8_t status)
             qemu_mutex_unlock(&s->free_page_lock);
         }
     }
+
+    /* Don't hold on to reporting elements while the VM is stopped. */
+    if (s->reporting_vq) {
+        if (vdev->vm_running) {
+            virtio_balloon_report_resume(s);
+        } else {
+            virtio_balloon_report_drain(s);
+        }
+    }
 }
 
 static void virtio_balloon_instance_init(Object *obj)
@@ -990,6 +1200,13 @@ static void virtio_balloon_instance_init(Object *obj)
                         balloon_stats_get_poll_interval,
                         balloon_stats_set_poll_interval,
                         NULL, NULL);
+
+    object_property_add_uint64_ptr(obj, "free-page-reporting-bytes",
+                                   &s->report_bytes, OBJ_PROP_FLAG_READ);
+    object_property_add_uint64_ptr(obj, "free-page-reporting-discards",
+                                   &s->report_discards, OBJ_PROP_FLAG_READ);
+    object_property_add_uint64_ptr(obj, "free-page-reporting-ns",
+                                   &s->report_ns, OBJ_PROP_FLAG_READ);
 }
 
 static const VMStateDescription vmstate_virtio_balloon = {
@@ -59,6 +59,12 @@ QmpVirtIODeviceList virtio_list;
  */
 #define VIRTIO_PCI_VRING_ALIGN         4096
 
+/*
+ * Extra handle_output rounds run for a busy queue per host notifier
+ * wakeup, see virtio_queue_notify_vq_batch().
+ */
+#define VIRTIO_NOTIFY_BATCH_DEFAULT    16
+
 typedef struct VRingDesc
 {
     uint64_t addr;
@@ -142,6 +148,9 @@ struct VirtQueue
     /* Notification enabled? */
     bool notification;
 
+    /* Notification disabled by virtio_queue_notify_vq_batch()? */
+    bool notification_batched;
+
     uint16_t queue_index;
 
     unsigned int inuse;
@@ -153,6 +162,11 @@ struct VirtQueue
     EventNotifier host_notifier;
     bool host_notifier_enabled;
     QLIST_ENTRY(VirtQueue) node;
+
+    /* Counters for x-query-virtio-queue-status */
+    uint64_t kicks;
+    uint64_t poll_hits;
+    uint64_t notifications;
 };
 
 const char *virtio_device_names[] = {
@@ -562,7 +576,7 @@ bool virtio_queue_get_notification(VirtQueue *vq)
     return vq->notification;
 }
 
-void virtio_queue_set_notification(VirtQueue *vq, int enable)
+static void virtio_queue_do_set_notification(VirtQueue *vq, int enable)
 {
     vq->notification = enable;
 
@@ -577,6 +591,13 @@ void virtio_queue_set_notification(VirtQueue *vq, int enable)
     }
 }
 
+void virtio_queue_set_notification(VirtQueue *vq, int enable)
+{
+    /* The device now owns the notification state again */
+    vq->notification_batched = false;
+    virtio_queue_do_set_notification(vq, enable);
+}
+
 int virtio_queue_ready(VirtQueue *vq)
 {
     return vq->vring.avail != 0;
@@ -2069,6 +2090,7 @@ static void __virtio_queue_reset(VirtIODevice *vdev, uint32_t i)
     vdev->vq[i].signalled_used = 0;
     vdev->vq[i].signalled_used_valid = false;
     vdev->vq[i].notification = true;
+    vdev->vq[i].notification_batched = false;
     vdev->vq[i].vring.num = vdev->vq[i].vring.num_default;
     vdev->vq[i].inuse = 0;
     virtio_virtqueue_reset_region_cache(&vdev->vq[i]);
@@ -2265,6 +2287,7 @@ void virtio_queue_notify(VirtIODevice *vdev, int n)
     if (vq->host_notifier_enabled) {
         event_notifier_set(&vq->host_notifier);
     } else if (vq->handle_output) {
+        vq->kicks++;
         vq->handle_output(vdev, vq);
 
         if (unlikely(vdev->start_on_kick)) {
@@ -2435,6 +2458,7 @@ void virtio_notify_irqfd(VirtIODevice *vdev, VirtQueue *vq)
     }
 
     trace_virtio_notify_irqfd(vdev, vq);
+    vq->notifications++;
 
     /*
      * virtio spec 1.0 says ISR bit 0 should be ignored with MSI, but
@@ -2470,6 +2494,7 @@ void virtio_notify(VirtIODevice *vdev, VirtQueue *vq)
     }
 
     trace_virtio_notify(vdev, vq);
+    vq->notifications++;
     virtio_irq(vq);
 }
 
@@ -2976,6 +3001,7 @@ int virtio_load(VirtIODevice *vdev, QEMUFile *f, int version_id)
         qemu_get_be16s(f, &vdev->vq[i].last_avail_idx);
         vdev->vq[i].signalled_used_valid = false;
         vdev->vq[i].notification = true;
+        vdev->vq[i].notification_batched = false;
 
         if (!vdev->vq[i].vring.desc && vdev->vq[i].last_avail_idx) {
             error_report("VQ %d address 0x0 "
@@ -3478,6 +3504,7 @@ static void virtio_queue_host_notifier_aio_poll_ready(EventNotifier *n)
 {
     VirtQueue *vq = container_of(n, VirtQueue, host_notifier);
 
+    vq->poll_hits++;
     virtio_queue_notify_vq(vq);
 }
 
@@ -3521,11 +3548,83 @@ void virtio_queue_aio_detach_host_notifier(VirtQueue *vq, AioContext *ctx)
     virtio_queue_host_notifier_read(&vq->host_notifier);
 }
 
+/*
+ * Run handle_output for a queue woken up by its host notifier.  As long
+ * as the guest keeps adding buffers while the handler runs, turn guest
+ * notifications off and run it again, up to vdev->notify_batch extra
+ * rounds.  If the queue is still busy after that, re-arm the host
+ * notifier so that processing continues on the next event loop
+ * iteration with notifications still off; this is the same polling
+ * that aio_poll() does for dataplane devices, but available to every
+ * device and every event loop.
+ *
+ * Whenever notifications are turned back on, buffers that the guest
+ * added while they were off get no kick, so the handler is run once
+ * more if the queue is not empty.
+ *
+ * A handler that makes no progress (e.g. an rx queue waiting for the
+ * backend) ends the batch, as does one that manages notifications
+ * itself by calling virtio_queue_set_notification().
+ */
+static void virtio_queue_notify_vq_batch(VirtQueue *vq)
+{
+    VirtIODevice *vdev = vq->vdev;
+    uint32_t round;
+
+    for (round = 0; ; round++) {
+        uint16_t last_avail_idx = vq->last_avail_idx;
+        bool progress;
+
+        virtio_queue_notify_vq(vq);
+
+        if (!vq->vring.desc || vdev->broken) {
+            return;
+        }
+        progress = vq->last_avail_idx != last_avail_idx;
+
+        if (!vq->notification_batched) {
+            /*
+             * Either the first round, or the handler took over the
+             * notification state: only start a batch on a busy queue
+             * whose notifications are on.
+             */
+            if (round > 0 || !vdev->notify_batch || !progress ||
+                !vq->notification || virtio_queue_empty(vq)) {
+                return;
+            }
+            virtio_queue_do_set_notification(vq, 0);
+            vq->notification_batched = true;
+        } else if (!progress || virtio_queue_empty(vq)) {
+            break;
+        } else if (round >= vdev->notify_batch) {
+            if (vq->host_notifier_enabled) {
+                trace_virtio_queue_notify_batch(vdev, vq - vdev->vq, vq,
+                                                round);
+                event_notifier_set(&vq->host_notifier);
+                return;
+            }
+            break;
+        }
+        vq->poll_hits++;
+    }
+
+    virtio_queue_set_notification(vq, 1);
+    if (!virtio_queue_empty(vq)) {
+        virtio_queue_notify_vq(vq);
+    }
+}
+
 void virtio_queue_host_notifier_read(EventNotifier *n)
 {
     VirtQueue *vq = container_of(n, VirtQueue, host_notifier);
     if (event_notifier_test_and_clear(n)) {
-        virtio_queue_notify_vq(vq);
+        /* A wakeup we scheduled ourselves is not a guest kick */
+        if (vq->notification_batched) {
+            vq->poll_hits++;
+        } else {
+            vq->kicks++;
+        }
+        virtio_queue_notify_vq_batch(vq);
     }
 }
 
@@ -3671,6 +3770,8 @@ static Property virtio_properties[] = {
     DEFINE_PROP_BOOL("use-disabled-flag", VirtIODevice, use_disabled_flag, true),
     DEFINE_PROP_BOOL("x-disable-legacy-check", VirtIODevice,
                      disable_legacy_check, false),
+    DEFINE_PROP_UINT32("x-notify-batch", VirtIODevice, notify_batch,
+                       VIRTIO_NOTIFY_BATCH_DEFAULT),
     DEFINE_PROP_END_OF_LIST(),
 };
 
@@ -3851,6 +3952,9 @@ VirtQueueStatus *qmp_x_query_virtio_queue_status(const char *path,
     status->used_idx = vdev->vq[queue].used_idx;
     status->signalled_used = vdev->vq[queue].signalled_used;
     status->signalled_used_valid = vdev->vq[queue].signalled_used_valid;
+    status->kicks = vdev->vq[queue].kicks;
+    status->poll_hits = vdev->vq[queue].poll_hits;
+    status->notifications = vdev->vq[queue].notifications;
 
     if (vdev->vhost_started) {
         VirtioDeviceClass *vdc = VIRTIO_DEVICE_GET_CLASS(vdev);
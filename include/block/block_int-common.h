@@ -321,6 +321,10 @@ struct BlockDriver {
                                 const char *snapshot_id,
                                 const char *name,
                                 Error **errp);
+    int (*bdrv_snapshot_attach_vmstate)(BlockDriverState *bs,
+                                        const char *snapshot_id,
+                                        uint64_t vm_state_size,
+                                        Error **errp);
     int (*bdrv_snapshot_list)(BlockDriverState *bs,
                               QEMUSnapshotInfo **psn_info);
     int (*bdrv_snapshot_load_tmp)(BlockDriverState *bs,
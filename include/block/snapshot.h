@@ -43,6 +43,12 @@ typedef struct QEMUSnapshotInfo {
     uint32_t date_nsec;
     uint64_t vm_clock_nsec; /* VM clock relative to boot */
     uint64_t icount; /* record/replay step */
+    /*
+     * ID of the snapshot that the VM state was saved on top of, if it
+     * only holds the RAM changed since then (incremental snapshots).
+     * Empty for a self-contained VM state.
+     */
+    char parent_id_str[128];
 } QEMUSnapshotInfo;
 
 /*
@@ -69,6 +75,10 @@ int bdrv_snapshot_delete(BlockDriverState *bs,
                          const char *snapshot_id,
                          const char *name,
                          Error **errp);
+int bdrv_snapshot_attach_vmstate(BlockDriverState *bs,
+                                 const char *snapshot_id,
+                                 uint64_t vm_state_size,
+                                 Error **errp);
 int bdrv_snapshot_list(BlockDriverState *bs,
                        QEMUSnapshotInfo **psn_info);
 int bdrv_snapshot_load_tmp(BlockDriverState *bs,
@@ -332,4 +332,30 @@ int qcrypto_tls_session_get_key_size(QCryptoTLSSession *sess,
  */
 char *qcrypto_tls_session_get_peer_name(QCryptoTLSSession *sess);
 
+/**
+ * qcrypto_tls_session_enable_ktls_send:
+ * @sess: the TLS session object
+ * @fd: the TCP socket that carries the session
+ * @errp: pointer to a NULL-initialized error object
+ *
+ * Hand the encryption of outgoing records over to the
+ * kernel (kTLS), if the credentials have the kernel-tls
+ * property set and the kernel supports the negotiated
+ * protocol version and cipher. This must be called after
+ * the handshake is complete and before any payload data
+ * is sent. Since GnuTLS cannot send records anymore
+ * afterwards, a TLS 1.3 key update requested by the peer
+ * makes qcrypto_tls_session_read() fail with ENOTSUP.
+ *
+ * On success, plain text written to @fd is sent as TLS
+ * application data records, and qcrypto_tls_session_write()
+ * must not be used anymore. Incoming data must still be
+ * read with qcrypto_tls_session_read().
+ *
+ * Returns: 0 on success, -1 if kernel TLS cannot be used
+ */
+int qcrypto_tls_session_enable_ktls_send(QCryptoTLSSession *sess,
+                                         int fd,
+                                         Error **errp);
+
 #endif /* QCRYPTO_TLSSESSION_H */
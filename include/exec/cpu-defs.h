@@ -226,6 +226,8 @@ typedef struct CPUTLBCommon {
     size_t full_flush_count;
     size_t part_flush_count;
     size_t elide_flush_count;
+    size_t notdirty_write_count;
+    size_t dirty_granule_count;
 } CPUTLBCommon;
 
 /*
@@ -72,7 +72,10 @@ static inline void fuzz_dma_read_cb(size_t addr,
 /* Dirty tracking enabled because dirty limit */
 #define GLOBAL_DIRTY_LIMIT      (1U << 2)
 
-#define GLOBAL_DIRTY_MASK  (0x7)
+/* Dirty tracking enabled for incremental snapshots */
+#define GLOBAL_DIRTY_SNAPSHOT   (1U << 3)
+
+#define GLOBAL_DIRTY_MASK  (0xf)
 
 extern unsigned int global_dirty_tracking;
 
@@ -3044,6 +3047,17 @@ int ram_block_discard_require(bool state);
  */
 int ram_block_coordinated_discard_require(bool state);
 
+/*
+ * Like ram_block_discard_range(), but only if discarding is not disabled.
+ * The check and the discard are atomic with respect to
+ * ram_block_discard_disable(), so this can be used by code that decided to
+ * discard without holding the BQL.
+ *
+ * Returns -EBUSY if discarding is disabled.
+ */
+int ram_block_discard_range_if_enabled(RAMBlock *rb, uint64_t start,
+                                       size_t length);
+
 /*
  * Test if any discarding of memory in ram blocks is disabled.
  */
@@ -430,6 +430,15 @@ bool cpu_physical_memory_test_and_clear_dirty(ram_addr_t start,
                                               ram_addr_t length,
                                               unsigned client);
 
+/*
+ * Mark dirty for the clients in @mask the @granule-aligned range of
+ * RAM around @addr, clipped to the RAMBlock containing @addr.
+ * @granule must be a power of two multiple of TARGET_PAGE_SIZE.
+ */
+void cpu_physical_memory_set_dirty_granule(ram_addr_t addr,
+                                           ram_addr_t granule,
+                                           uint8_t mask);
+
 DirtyBitmapSnapshot *cpu_physical_memory_snapshot_and_clear_dirty
     (MemoryRegion *mr, hwaddr offset, hwaddr length, unsigned client);
 
@@ -160,6 +160,21 @@ void translator_loop(CPUState *cpu, TranslationBlock *tb, int *max_insns,
  */
 bool translator_use_goto_tb(DisasContextBase *db, target_ulong dest);
 
+/**
+ * translator_lookup_and_goto_ptr
+ * @db: Disassembly context
+ * @pc: guest pc of the target, as computed by cpu_get_tb_cpu_state()
+ *
+ * Like tcg_gen_lookup_and_goto_ptr(), but first probe the vCPU's
+ * jump cache inline, so that a hit does not leave generated code.
+ *
+ * The inline probe only matches TBs with the same cs_base and flags
+ * as the current TB, so this may only be used for indirect jumps that
+ * cannot change any of the state that cpu_get_tb_cpu_state() folds
+ * into them.
+ */
+void translator_lookup_and_goto_ptr(DisasContextBase *db, TCGv pc);
+
 /*
  * Translator Load Functions
  *
@@ -316,6 +316,8 @@ struct qemu_work_item;
  *                        to @trace_dstate).
  * @trace_dstate: Dynamic tracing state of events for this vCPU (bitmask).
  * @plugin_mask: Plugin event bitmap. Modified only via async work.
+ * @plugin_scoreboard: Storage of this vCPU's entries in plugin scoreboards.
+ * @tb_stats_counters: This vCPU's TB execution counters, by chunk.
  * @ignore_memory_transaction_failures: Cached copy of the MachineState
  *    flag of the same name: allows the board to suppress calling of the
  *    CPU do_transaction_failed hook function.
@@ -377,6 +379,7 @@ struct CPUState {
     IcountDecr *icount_decr_ptr;
 
     CPUJumpCache *tb_jmp_cache;
+    uint64_t **tb_stats_counters;
 
     struct GDBRegisterState *gdb_regs;
     int gdb_num_regs;
@@ -415,6 +418,7 @@ struct CPUState {
 
 #ifdef CONFIG_PLUGIN
     GArray *plugin_mem_cbs;
+    void *plugin_scoreboard;
     /* saved iotlb data from io_writex */
     SavedIOTLB saved_iotlb;
 #endif
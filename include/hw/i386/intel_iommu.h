@@ -24,6 +24,7 @@
 
 #include "hw/i386/x86-iommu.h"
 #include "qemu/iova-tree.h"
+#include "qemu/seqlock.h"
 #include "qom/object.h"
 
 #define TYPE_INTEL_IOMMU_DEVICE "intel-iommu"
@@ -94,6 +95,22 @@ struct VTDPASIDEntry {
     uint64_t val[8];
 };
 
+/*
+ * Most recently used translations of a VTDAddressSpace.  They are
+ * filled with the IOMMU lock held and looked up without it; an entry
+ * is only valid while @gen matches IntelIOMMUState.iotlb_gen, which
+ * is bumped whenever the IOTLB or the context cache is invalidated.
+ */
+#define VTD_IOTLB_MRU_SIZE 4
+
+typedef struct VTDIOTLBMRUEntry {
+    uint32_t gen;
+    hwaddr iova;
+    hwaddr translated_addr;
+    hwaddr addr_mask;
+    IOMMUAccessFlags perm;
+} VTDIOTLBMRUEntry;
+
 struct VTDAddressSpace {
     PCIBus *bus;
     uint8_t devfn;
@@ -106,6 +123,9 @@ struct VTDAddressSpace {
     MemoryRegion iommu_ir_fault; /* Interrupt region for catching fault */
     IntelIOMMUState *iommu_state;
     VTDContextCacheEntry context_cache_entry;
+    QemuSeqLock iotlb_mru_seq;
+    VTDIOTLBMRUEntry iotlb_mru[VTD_IOTLB_MRU_SIZE];
+    unsigned iotlb_mru_next;    /* Next entry to replace */
     QLIST_ENTRY(VTDAddressSpace) next;
     /* Superset of notifier flags that this address space has */
     IOMMUNotifierFlag notifier_flags;
@@ -284,6 +304,8 @@ struct IntelIOMMUState {
 
     uint32_t context_cache_gen;     /* Should be in [1,MAX] */
     GHashTable *iotlb;              /* IOTLB */
+    uint32_t iotlb_gen;             /* Should be in [1,MAX] */
+    uint32_t iotlb_levels;          /* Page levels present in the IOTLB */
 
     GHashTable *vtd_address_spaces;             /* VTD address spaces */
     VTDAddressSpace *vtd_as_cache[VTD_PCI_BUS_MAX]; /* VTD address space cache */
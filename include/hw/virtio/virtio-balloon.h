@@ -71,6 +71,17 @@ struct VirtIOBalloon {
 
     bool qemu_4_0_config_size;
     uint32_t poison_val;
+
+    /* Free page reports being discarded in the iothread, if any. */
+    struct VirtIOBalloonReportBatch *report_batch;
+    /* The reporting queue was kicked while a batch was running. */
+    bool report_kick;
+    /* Set while draining, no new batches are started. */
+    bool report_stopping;
+    /* Free page reporting statistics, see the corresponding properties. */
+    uint64_t report_bytes;
+    uint64_t report_discards;
+    uint64_t report_ns;
 };
 
 #endif
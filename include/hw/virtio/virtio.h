@@ -147,6 +147,12 @@ struct VirtIODevice
     bool start_on_kick; /* when virtio 1.0 feature has not been negotiated */
     bool disable_legacy_check;
     bool vhost_started;
+    /*
+     * @notify_batch: how many times handle_output is re-run without
+     * guest notifications while a queue woken up by its host notifier
+     * keeps getting new buffers (0 disables batching).
+     */
+    uint32_t notify_batch;
     VMChangeStateEntry *vmstate;
     char *bus_name;
     uint8_t device_endian;
@@ -201,6 +201,16 @@ struct VMStateDescription {
     MigrationPriority priority;
     int (*pre_load)(void *opaque);
     int (*post_load)(void *opaque, int version_id);
+    /*
+     * Only honoured for the top-level VMSD of a section.  Called in a
+     * worker thread after post_load, concurrently with the loading of
+     * other sections, and without the BQL.  It must only touch state
+     * owned by this device, and take the BQL around anything else (for
+     * example its backend).  All such handlers have completed before the
+     * incoming VM is started.  Use it for expensive, self-contained work
+     * that would otherwise delay switchover.
+     */
+    int (*post_load_async)(void *opaque, int version_id);
     int (*pre_save)(void *opaque);
     int (*post_save)(void *opaque);
     bool (*needed)(void *opaque);
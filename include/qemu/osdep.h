@@ -655,6 +655,28 @@ typedef struct ThreadContext ThreadContext;
 void qemu_prealloc_mem(int fd, char *area, size_t sz, int max_threads,
                        ThreadContext *tc, Error **errp);
 
+/**
+ * qemu_prealloc_mem_nodes:
+ * @fd: the fd mapped into the area, -1 for anonymous memory
+ * @area: start address of the are to preallocate
+ * @sz: the size of the area to preallocate
+ * @max_threads: maximum number of threads to use
+ * @tc: thread context to create the threads in, or NULL
+ * @host_nodes: bitmap of the host NUMA nodes the area is bound to, or NULL
+ * @nbits: number of bits in @host_nodes
+ * @errp: returns an error if this function fails
+ *
+ * Like qemu_prealloc_mem(), but if @tc is NULL the area is split into one
+ * slice per node in @host_nodes that has CPUs, and each slice is
+ * preallocated by threads running on the CPUs of its node.  Falls back to
+ * qemu_prealloc_mem() if there are fewer threads than such nodes, or if
+ * the host has no NUMA support.
+ */
+void qemu_prealloc_mem_nodes(int fd, char *area, size_t sz, int max_threads,
+                             ThreadContext *tc,
+                             const unsigned long *host_nodes,
+                             unsigned long nbits, Error **errp);
+
 /**
  * qemu_get_pid_name:
  * @pid: pid of a process
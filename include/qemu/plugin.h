@@ -74,6 +74,7 @@ enum plugin_dyn_cb_type {
 enum plugin_dyn_cb_subtype {
     PLUGIN_CB_REGULAR,
     PLUGIN_CB_INLINE,
+    PLUGIN_CB_INLINE_PER_VCPU,
     PLUGIN_N_CB_SUBTYPES,
 };
 
@@ -93,6 +94,8 @@ struct qemu_plugin_dyn_cb {
         struct {
             enum qemu_plugin_op op;
             uint64_t imm;
+            /* offset in CPUState.plugin_scoreboard, for per-vCPU ops */
+            size_t offset;
         } inline_insn;
     };
 };
@@ -10,6 +10,7 @@
 #include "qemu/seqlock.h"
 #include "qemu/thread.h"
 #include "qemu/qdist.h"
+#include "qemu/stats64.h"
 
 typedef bool (*qht_cmp_func_t)(const void *a, const void *b);
 
@@ -18,6 +19,8 @@ struct qht {
     qht_cmp_func_t cmp;
     QemuMutex lock; /* serializes setters of ht->map */
     unsigned int mode;
+    size_t n_resizes; /* completed resizes, for statistics */
+    Stat64 resize_ns; /* duration of the last resize, for statistics */
 };
 
 /**
@@ -29,10 +32,17 @@ struct qht {
  *         chain, excluding empty chains.
  * @occupancy: frequency distribution representing chain occupancy rate.
  *             Valid range: from 0.0 (empty) to 1.0 (full occupancy).
+ * @load: @entries divided by the number of entries that fit in head buckets.
+ * @resizes: number of resizes completed since the QHT was initialized.
+ * @resize_ns: how long the last resize took, from start to end.
+ * @resize_pending: head buckets of the previous map that an ongoing
+ *                  auto-resize still has to move, or 0.
  *
  * An entry is a pointer-hash pair.
  * Each bucket can host several entries.
  * Chains are chains of buckets, whose first link is always a head bucket.
+ * While an auto-resize is in progress, @chain and @occupancy only
+ * describe the new map, but @entries counts those of both maps.
  */
 struct qht_stats {
     size_t head_buckets;
@@ -40,6 +50,10 @@ struct qht_stats {
     size_t entries;
     struct qdist chain;
     struct qdist occupancy;
+    double load;
+    size_t resizes;
+    int64_t resize_ns;
+    size_t resize_pending;
 };
 
 typedef bool (*qht_lookup_func_t)(const void *obj, const void *userp);
@@ -169,6 +183,10 @@ bool qht_reset_size(struct qht *ht, size_t n_elems);
  * Returns true on success.
  * Returns false if the resize was not necessary and therefore not performed.
  * See also: qht_reset_size().
+ *
+ * Unlike the automatic resizes of QHT_MODE_AUTO_RESIZE, which are spread
+ * over the insertions and removals that follow them, this moves all the
+ * entries at once while blocking writers.
  */
 bool qht_resize(struct qht *ht, size_t n_elems);
 
@@ -31,6 +31,7 @@
 #include "qemu/bitops.h"
 #include "qemu/plugin.h"
 #include "qemu/queue.h"
+#include "qemu/thread.h"
 #include "tcg/tcg-mo.h"
 #include "tcg-target.h"
 #include "tcg/tcg-cond.h"
@@ -600,6 +601,13 @@ struct TCGContext {
     /* Track which vCPU triggers events */
     CPUState *cpu;                      /* *_trans */
 
+#ifdef CONFIG_USER_ONLY
+    /* Serializes the threads that share this context for translation. */
+    QemuMutex gen_lock;
+    /* Invalidation counts of the TB's pages, sampled before reading them. */
+    unsigned int gen_page_seq[2];
+#endif
+
     /* These structures are private to tcg-target.c.inc.  */
 #ifdef TCG_TARGET_NEED_LDST_LABELS
     QSIMPLEQ_HEAD(, TCGLabelQemuLdst) ldst_labels;
@@ -856,6 +864,11 @@ static inline void *tcg_malloc(int size)
 
 void tcg_init(size_t tb_size, int splitwx, unsigned max_cpus);
 void tcg_register_thread(void);
+#ifdef CONFIG_USER_ONLY
+void tcg_gen_lock(void);
+void tcg_gen_unlock(void);
+bool tcg_have_gen_lock(void);
+#endif
 void tcg_prologue_init(TCGContext *s);
 void tcg_func_start(TCGContext *s);
 
@@ -22,6 +22,7 @@
 #include "qapi/error.h"
 #include "qemu/module.h"
 #include "io/channel-tls.h"
+#include "io/channel-socket.h"
 #include "trace.h"
 #include "qemu/atomic.h"
 
@@ -33,6 +34,12 @@ static ssize_t qio_channel_tls_write_handler(const char *buf,
     QIOChannelTLS *tioc = QIO_CHANNEL_TLS(opaque);
     ssize_t ret;
 
+    if (tioc->ktls_send) {
+        /* The kernel owns the send state: a record from GnuTLS is bogus */
+        errno = EIO;
+        return -1;
+    }
+
     ret = qio_channel_write(tioc->master, buf, len, NULL);
     if (ret == QIO_CHANNEL_ERR_BLOCK) {
         errno = EAGAIN;
@@ -155,6 +162,31 @@ static gboolean qio_channel_tls_handshake_io(QIOChannel *ioc,
                                              GIOCondition condition,
                                              gpointer user_data);
 
+/*
+ * Once the handshake is done, let the kernel encrypt what we send if
+ * the credentials have kernel-tls set and it can, which saves a copy and
+ * the userspace encryption of all the payload.  Reception stays in GnuTLS.
+ */
+static void qio_channel_tls_enable_ktls(QIOChannelTLS *ioc)
+{
+    QIOChannelSocket *sioc = (QIOChannelSocket *)
+        object_dynamic_cast(OBJECT(ioc->master), TYPE_QIO_CHANNEL_SOCKET);
+    Error *err = NULL;
+
+    if (!sioc) {
+        return;
+    }
+    if (qcrypto_tls_session_enable_ktls_send(ioc->session, sioc->fd,
+                                             &err) < 0) {
+        trace_qio_channel_tls_ktls_send_unavailable(ioc,
+                                                    error_get_pretty(err));
+        error_free(err);
+        return;
+    }
+    ioc->ktls_send = true;
+    trace_qio_channel_tls_ktls_send_enabled(ioc);
+}
+
 static void qio_channel_tls_handshake_task(QIOChannelTLS *ioc,
                                            QIOTask *task,
                                            GMainContext *context)
@@ -178,6 +210,7 @@ static void qio_channel_tls_handshake_task(QIOChannelTLS *ioc,
             qio_task_set_error(task, err);
         } else {
             trace_qio_channel_tls_credentials_allow(ioc);
+            qio_channel_tls_enable_ktls(ioc);
         }
         qio_task_complete(task);
     } else {
@@ -312,6 +345,11 @@ static ssize_t qio_channel_tls_writev(QIOChannel *ioc,
     size_t i;
     ssize_t done = 0;
 
+    if (tioc->ktls_send) {
+        return qio_channel_writev_full(tioc->master, iov, niov,
+                                       NULL, 0, flags, errp);
+    }
+
     for (i = 0 ; i < niov ; i++) {
         ssize_t ret = qcrypto_tls_session_write(tioc->session,
                                                 iov[i].iov_base,
@@ -141,6 +141,17 @@ struct QEMU_PACKED QIOChannelWebsockHeader {
     } u;
 };
 
+typedef union QIOChannelWebsockHeaderBuf {
+    char buf[QIO_CHANNEL_WEBSOCK_HEADER_LEN_64_BIT];
+    QIOChannelWebsockHeader ws;
+} QIOChannelWebsockHeaderBuf;
+
+/*
+ * 16 bytes of payload; GCC and clang map this onto SSE2, NEON, etc.
+ * registers where the host has them, and onto scalar code otherwise.
+ */
+typedef uint32_t QIOChannelWebsockVec __attribute__((vector_size(16)));
+
 typedef struct QIOChannelWebsockHTTPHeader QIOChannelWebsockHTTPHeader;
 
 struct QIOChannelWebsockHTTPHeader {
@@ -607,36 +618,42 @@ static gboolean qio_channel_websock_handshake_io(QIOChannel *ioc,
 }
 
 
-static void qio_channel_websock_encode(QIOChannelWebsock *ioc,
-                                       uint8_t opcode,
-                                       const struct iovec *iov,
-                                       size_t niov,
-                                       size_t size)
+static size_t qio_channel_websock_encode_header(
+    QIOChannelWebsockHeaderBuf *header, uint8_t opcode, size_t size)
 {
     size_t header_size;
-    size_t i;
-    union {
-        char buf[QIO_CHANNEL_WEBSOCK_HEADER_LEN_64_BIT];
-        QIOChannelWebsockHeader ws;
-    } header;
-
-    assert(size <= iov_size(iov, niov));
 
-    header.ws.b0 = QIO_CHANNEL_WEBSOCK_HEADER_FIELD_FIN |
+    header->ws.b0 = QIO_CHANNEL_WEBSOCK_HEADER_FIELD_FIN |
         (opcode & QIO_CHANNEL_WEBSOCK_HEADER_FIELD_OPCODE);
     if (size < QIO_CHANNEL_WEBSOCK_PAYLOAD_LEN_THRESHOLD_7_BIT) {
-        header.ws.b1 = (uint8_t)size;
+        header->ws.b1 = (uint8_t)size;
         header_size = QIO_CHANNEL_WEBSOCK_HEADER_LEN_7_BIT;
     } else if (size < QIO_CHANNEL_WEBSOCK_PAYLOAD_LEN_THRESHOLD_16_BIT) {
-        header.ws.b1 = QIO_CHANNEL_WEBSOCK_PAYLOAD_LEN_MAGIC_16_BIT;
-        header.ws.u.s16.l16 = cpu_to_be16((uint16_t)size);
+        header->ws.b1 = QIO_CHANNEL_WEBSOCK_PAYLOAD_LEN_MAGIC_16_BIT;
+        header->ws.u.s16.l16 = cpu_to_be16((uint16_t)size);
         header_size = QIO_CHANNEL_WEBSOCK_HEADER_LEN_16_BIT;
     } else {
-        header.ws.b1 = QIO_CHANNEL_WEBSOCK_PAYLOAD_LEN_MAGIC_64_BIT;
-        header.ws.u.s64.l64 = cpu_to_be64(size);
+        header->ws.b1 = QIO_CHANNEL_WEBSOCK_PAYLOAD_LEN_MAGIC_64_BIT;
+        header->ws.u.s64.l64 = cpu_to_be64(size);
         header_size = QIO_CHANNEL_WEBSOCK_HEADER_LEN_64_BIT;
     }
-    header_size -= QIO_CHANNEL_WEBSOCK_HEADER_LEN_MASK;
+    return header_size - QIO_CHANNEL_WEBSOCK_HEADER_LEN_MASK;
+}
+
+
+static void qio_channel_websock_encode(QIOChannelWebsock *ioc,
+                                       uint8_t opcode,
+                                       const struct iovec *iov,
+                                       size_t niov,
+                                       size_t size)
+{
+    size_t header_size;
+    size_t i;
+    QIOChannelWebsockHeaderBuf header;
+
+    assert(size <= iov_size(iov, niov));
+
+    header_size = qio_channel_websock_encode_header(&header, opcode, size);
 
     trace_qio_channel_websock_encode(ioc, opcode, header_size, size);
     buffer_reserve(&ioc->encoutput, header_size + size);
@@ -652,6 +669,62 @@ static void qio_channel_websock_encode(QIOChannelWebsock *ioc,
 }
 
 
+/*
+ * Send a frame straight from the caller's iovec, with the header in
+ * front of it, instead of copying the payload into encoutput first.
+ * Only valid while encoutput is empty, so that frames stay in order.
+ * Whatever the master channel does not take right away is queued in
+ * encoutput, to be flushed by qio_channel_websock_write_wire().
+ */
+static int qio_channel_websock_encode_direct(QIOChannelWebsock *ioc,
+                                             uint8_t opcode,
+                                             const struct iovec *iov,
+                                             size_t niov,
+                                             size_t size,
+                                             Error **errp)
+{
+    g_autofree struct iovec *wiov = g_new(struct iovec, niov + 1);
+    QIOChannelWebsockHeaderBuf header;
+    size_t header_size;
+    size_t wniov;
+    ssize_t ret;
+    size_t done;
+
+    assert(ioc->encoutput.offset == 0);
+    assert(size <= iov_size(iov, niov));
+
+    header_size = qio_channel_websock_encode_header(&header, opcode, size);
+
+    trace_qio_channel_websock_encode(ioc, opcode, header_size, size);
+    wiov[0].iov_base = header.buf;
+    wiov[0].iov_len = header_size;
+    wniov = 1 + iov_copy(wiov + 1, niov, iov, niov, 0, size);
+
+    ret = qio_channel_writev(ioc->master, wiov, wniov, errp);
+    if (ret == QIO_CHANNEL_ERR_BLOCK) {
+        ret = 0;
+    } else if (ret < 0) {
+        return -1;
+    }
+    done = ret;
+    trace_qio_channel_websock_encode_direct(ioc, header_size + size, done);
+
+    if (done < header_size) {
+        buffer_reserve(&ioc->encoutput, header_size + size - done);
+        buffer_append(&ioc->encoutput, header.buf + done, header_size - done);
+        done = header_size;
+    }
+    done -= header_size;
+    if (done < size) {
+        buffer_reserve(&ioc->encoutput, size - done);
+        ioc->encoutput.offset += iov_to_buf(iov, niov, done,
+                                            buffer_end(&ioc->encoutput),
+                                            size - done);
+    }
+    return 0;
+}
+
+
 static ssize_t qio_channel_websock_write_wire(QIOChannelWebsock *, Error **);
 
 
@@ -788,12 +861,39 @@ static int qio_channel_websock_decode_header(QIOChannelWebsock *ioc,
 }
 
 
+/*
+ * XOR @len bytes of @src with @mask into @dst, which may be the same
+ * buffer.  @src must be at a multiple of 4 bytes into the payload, so
+ * that the mask lines up.
+ */
+static void qio_channel_websock_unmask(uint8_t *dst, const uint8_t *src,
+                                       size_t len, QIOChannelWebsockMask mask)
+{
+    QIOChannelWebsockVec vmask = { mask.u, mask.u, mask.u, mask.u };
+    uint64_t mask64 = ((uint64_t)mask.u << 32) | mask.u;
+    size_t i = 0;
+
+    for (; i + sizeof(vmask) <= len; i += sizeof(vmask)) {
+        QIOChannelWebsockVec v;
+
+        memcpy(&v, src + i, sizeof(v));
+        v ^= vmask;
+        memcpy(dst + i, &v, sizeof(v));
+    }
+    if (i + 8 <= len) {
+        stq_he_p(dst + i, ldq_he_p(src + i) ^ mask64);
+        i += 8;
+    }
+    for (; i < len; i++) {
+        dst[i] = src[i] ^ mask.c[i % 4];
+    }
+}
+
+
 static int qio_channel_websock_decode_payload(QIOChannelWebsock *ioc,
                                               Error **errp)
 {
-    size_t i;
     size_t payload_len = 0;
-    uint32_t *payload32;
 
     if (ioc->payload_remain) {
         /* If we aren't at the end of the payload, then drop
@@ -816,15 +916,11 @@ static int qio_channel_websock_decode_payload(QIOChannelWebsock *ioc,
 
         ioc->payload_remain -= payload_len;
 
-        /* unmask frame */
-        /* process 1 frame (32 bit op) */
-        payload32 = (uint32_t *)ioc->encinput.buffer;
-        for (i = 0; i < payload_len / 4; i++) {
-            payload32[i] ^= ioc->mask.u;
-        }
-        /* process the remaining bytes (if any) */
-        for (i *= 4; i < payload_len; i++) {
-            ioc->encinput.buffer[i] ^= ioc->mask.c[i % 4];
+        /* binary frames are unmasked as they are copied out, below */
+        if (ioc->opcode != QIO_CHANNEL_WEBSOCK_OPCODE_BINARY_FRAME) {
+            qio_channel_websock_unmask(ioc->encinput.buffer,
+                                       ioc->encinput.buffer,
+                                       payload_len, ioc->mask);
         }
     }
 
@@ -835,7 +931,10 @@ static int qio_channel_websock_decode_payload(QIOChannelWebsock *ioc,
         if (payload_len) {
             /* binary frames are passed on */
             buffer_reserve(&ioc->rawinput, payload_len);
-            buffer_append(&ioc->rawinput, ioc->encinput.buffer, payload_len);
+            qio_channel_websock_unmask(buffer_end(&ioc->rawinput),
+                                       ioc->encinput.buffer,
+                                       payload_len, ioc->mask);
+            ioc->rawinput.offset += payload_len;
         }
     } else if (ioc->opcode == QIO_CHANNEL_WEBSOCK_OPCODE_CLOSE) {
         /* close frames are echoed back */
@@ -1152,7 +1251,14 @@ static ssize_t qio_channel_websock_writev(QIOChannel *ioc,
         want = avail;
     }
 
-    if (want) {
+    if (want && wioc->encoutput.offset == 0) {
+        if (qio_channel_websock_encode_direct(
+                wioc, QIO_CHANNEL_WEBSOCK_OPCODE_BINARY_FRAME,
+                iov, niov, want, errp) < 0) {
+            qio_channel_websock_unset_watch(wioc);
+            return -1;
+        }
+    } else if (want) {
         qio_channel_websock_encode(wioc,
                                    QIO_CHANNEL_WEBSOCK_OPCODE_BINARY_FRAME,
                                    iov, niov, want);
@@ -69,6 +69,7 @@ char *exec_path;
 char real_exec_path[PATH_MAX];
 
 static bool opt_one_insn_per_tb;
+static bool opt_atomic_lock;
 static const char *argv0;
 static const char *gdbstub;
 static envlist_t *envlist;
@@ -414,6 +415,11 @@ static void handle_arg_one_insn_per_tb(const char *arg)
     opt_one_insn_per_tb = true;
 }
 
+static void handle_arg_atomic_lock(const char *arg)
+{
+    opt_atomic_lock = true;
+}
+
 static void handle_arg_strace(const char *arg)
 {
     enable_strace = true;
@@ -505,6 +511,9 @@ static const struct qemu_argument arg_table[] = {
      "",           "run with one guest instruction per emulated TB"},
     {"singlestep", "QEMU_SINGLESTEP",  false, handle_arg_one_insn_per_tb,
      "",           "deprecated synonym for -one-insn-per-tb"},
+    {"atomic-lock",
+                   "QEMU_ATOMIC_LOCK", false, handle_arg_atomic_lock,
+     "",           "use address-hashed locks for atomics the host lacks"},
     {"strace",     "QEMU_STRACE",      false, handle_arg_strace,
      "",           "log system calls"},
     {"seed",       "QEMU_RAND_SEED",   true,  handle_arg_seed,
@@ -786,6 +795,8 @@ int main(int argc, char **argv, char **envp)
         accel_init_interfaces(ac);
         object_property_set_bool(OBJECT(accel), "one-insn-per-tb",
                                  opt_one_insn_per_tb, &error_abort);
+        object_property_set_bool(OBJECT(accel), "atomic-lock",
+                                 opt_atomic_lock, &error_abort);
         ac->init_machine(NULL);
     }
     cpu = cpu_create(cpu_type);
@@ -180,6 +180,10 @@ Property migration_properties[] = {
     DEFINE_PROP_MIG_CAP("x-multifd", MIGRATION_CAPABILITY_MULTIFD),
     DEFINE_PROP_MIG_CAP("x-background-snapshot",
             MIGRATION_CAPABILITY_BACKGROUND_SNAPSHOT),
+    DEFINE_PROP_MIG_CAP("x-incremental-snapshot",
+            MIGRATION_CAPABILITY_INCREMENTAL_SNAPSHOT),
+    DEFINE_PROP_MIG_CAP("x-lazy-ram-load",
+            MIGRATION_CAPABILITY_LAZY_RAM_LOAD),
 #ifdef CONFIG_LINUX
     DEFINE_PROP_MIG_CAP("x-zero-copy-send",
             MIGRATION_CAPABILITY_ZERO_COPY_SEND),
@@ -244,6 +248,20 @@ bool migrate_ignore_shared(void)
     return s->capabilities[MIGRATION_CAPABILITY_X_IGNORE_SHARED];
 }
 
+bool migrate_incremental_snapshot(void)
+{
+    MigrationState *s = migrate_get_current();
+
+    return s->capabilities[MIGRATION_CAPABILITY_INCREMENTAL_SNAPSHOT];
+}
+
+bool migrate_lazy_ram_load(void)
+{
+    MigrationState *s = migrate_get_current();
+
+    return s->capabilities[MIGRATION_CAPABILITY_LAZY_RAM_LOAD];
+}
+
 bool migrate_late_block_activate(void)
 {
     MigrationState *s = migrate_get_current();
@@ -546,9 +564,43 @@ bool migrate_caps_check(bool *old_caps, bool *new_caps, Error **errp)
         }
     }
 
+    if (new_caps[MIGRATION_CAPABILITY_LAZY_RAM_LOAD]) {
+        /*
+         * Lazily loaded pages are faulted in with userfaultfd, which
+         * postcopy and write tracking already use.  An incremental
+         * snapshot does not contain all of RAM.
+         */
+        if (new_caps[MIGRATION_CAPABILITY_POSTCOPY_RAM] ||
+            new_caps[MIGRATION_CAPABILITY_BACKGROUND_SNAPSHOT] ||
+            new_caps[MIGRATION_CAPABILITY_INCREMENTAL_SNAPSHOT] ||
+            new_caps[MIGRATION_CAPABILITY_X_COLO]) {
+            error_setg(errp, "Lazy RAM load is not compatible with postcopy,"
+                       " background or incremental snapshots, or COLO");
+            return false;
+        }
+    }
+
+    /* Their records use a RAM flag that does not fit in 1 KiB pages */
+    if ((new_caps[MIGRATION_CAPABILITY_LAZY_RAM_LOAD] ||
+         new_caps[MIGRATION_CAPABILITY_INCREMENTAL_SNAPSHOT]) &&
+        qemu_target_page_bits() <= 10) {
+        error_setg(errp, "Lazy RAM load and incremental snapshots are not "
+                   "supported with target pages of 1 KiB or less");
+        return false;
+    }
+
     return true;
 }
 
+/* Called after the capabilities changed, with the BQL held */
+static void migrate_caps_changed(void)
+{
+    /* RAM writes are only logged for incremental snapshots while enabled */
+    if (!migrate_incremental_snapshot()) {
+        ram_snapshot_track_stop();
+    }
+}
+
 bool migrate_cap_set(int cap, bool value, Error **errp)
 {
     MigrationState *s = migrate_get_current();
@@ -566,6 +618,7 @@ bool migrate_cap_set(int cap, bool value, Error **errp)
         return false;
     }
     s->capabilities[cap] = value;
+    migrate_caps_changed();
     return true;
 }
 
@@ -615,6 +668,7 @@ void qmp_migrate_set_capabilities(MigrationCapabilityStatusList *params,
     for (cap = params; cap; cap = cap->next) {
         s->capabilities[cap->value->capability] = cap->value->state;
     }
+    migrate_caps_changed();
 }
 
 /* parameters */
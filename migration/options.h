@@ -38,7 +38,9 @@ bool migrate_compress(void);
 bool migrate_dirty_bitmaps(void);
 bool migrate_events(void);
 bool migrate_ignore_shared(void);
+bool migrate_incremental_snapshot(void);
 bool migrate_late_block_activate(void);
+bool migrate_lazy_ram_load(void);
 bool migrate_multifd(void);
 bool migrate_pause_before_switchover(void);
 bool migrate_postcopy_blocktime(void);
@@ -18,6 +18,9 @@
 
 #include "qemu/osdep.h"
 #include "qemu/madvise.h"
+#include "qemu/cutils.h"
+#include "qemu/main-loop.h"
+#include "qemu/units.h"
 #include "exec/target_page.h"
 #include "migration.h"
 #include "qemu-file.h"
@@ -1358,6 +1361,530 @@ int postcopy_place_page_zero(MigrationIncomingState *mis, void *host,
     }
 }
 
+/* ------------------------------------------------------------------------- */
+/*
+ * Lazy RAM load: the contents of a RAMBlock sit in chunks at known offsets
+ * of a regular file (see RAM_SAVE_EXT_BLOCK_DATA in ram.c), so instead of
+ * reading them during the load the block is left empty and registered
+ * with userfaultfd, as for postcopy.  Faults are served with pread()
+ * from a thread that, unlike a postcopy page request, needs neither the
+ * BQL nor the migration stream.  When no fault is pending the thread
+ * prefetches the remaining pages in order, and it exits once all of
+ * them are in.
+ */
+typedef struct LazyLoadBlock {
+    char *idstr;
+    /* From the first chunk seen to the end of the RAMBlock */
+    uint8_t *host;
+    ram_addr_t length;
+    size_t pagesize;
+    /*
+     * The chunks come in order, all of @chunk_size bytes but the last.
+     * @offsets has their offsets in the file, for the first @known bytes.
+     */
+    ram_addr_t chunk_size;
+    ram_addr_t known;
+    off_t *offsets;
+    /* UFFDIO_ZEROPAGE works on this block */
+    bool zeroable;
+    /* One bit per host page that is in place */
+    unsigned long *placed;
+    /* Next host page to prefetch */
+    unsigned long next;
+} LazyLoadBlock;
+
+/* Size of the reads done when prefetching */
+#define LAZY_LOAD_PREFETCH_SIZE (1 * MiB)
+
+static struct {
+    QemuThread thread;
+    bool running;
+    bool quit;
+    int userfault_fd;
+    int event_fd;
+    /* A dup of the migration stream fd, which may be closed before us */
+    int fd;
+    uint8_t *buf;
+    size_t buf_size;
+    /* Protects everything below, blocks are added by the main thread */
+    QemuMutex lock;
+    GArray *blocks;
+    uint64_t pages_left;
+    /* Pages that are not in place yet, but whose chunk is known */
+    uint64_t pages_ready;
+    /* The thread has placed every page and exited */
+    bool finished;
+} lazy_load;
+
+/*
+ * The guest cannot run without the pages that are still missing.  As when
+ * postcopy loses the source, whoever faults on them stays blocked; the
+ * error is reported through the incoming migration state instead.
+ */
+static void lazy_load_set_error(Error *err)
+{
+    MigrationIncomingState *mis = migration_incoming_get_current();
+    int state = qatomic_read(&mis->state);
+
+    error_report_err(error_copy(err));
+    migrate_set_error(migrate_get_current(), err);
+    error_free(err);
+    if (state != MIGRATION_STATUS_FAILED) {
+        migrate_set_state(&mis->state, state, MIGRATION_STATUS_FAILED);
+    }
+}
+
+/*
+ * Read @len bytes from @page of @b, which must not cross a chunk boundary.
+ */
+static int lazy_load_read(LazyLoadBlock *b, unsigned long page, size_t len,
+                          Error **errp)
+{
+    ram_addr_t start = (ram_addr_t)page * b->pagesize;
+    off_t offset = b->offsets[start / b->chunk_size] + start % b->chunk_size;
+    size_t done = 0;
+    ssize_t ret;
+
+    while (done < len) {
+        ret = pread(lazy_load.fd, lazy_load.buf + done, len - done,
+                    offset + done);
+        if (ret < 0 && errno == EINTR) {
+            continue;
+        }
+        if (ret <= 0) {
+            error_setg(errp, "Lazy RAM load: cannot read RAM block %s at 0x%"
+                       PRIx64 ": %s", b->idstr, (uint64_t)(offset + done),
+                       ret < 0 ? strerror(errno) : "unexpected end of file");
+            return -1;
+        }
+        done += ret;
+    }
+    return 0;
+}
+
+/*
+ * Place @npages host pages from lazy_load.buf at @page of @b, waking up
+ * whoever faulted on them.  Called with lazy_load.lock held.
+ *
+ * Pages that are not in place yet must be missing: anything that fills
+ * them without faulting would see different contents than the guest.
+ */
+static int lazy_load_place(LazyLoadBlock *b, unsigned long page,
+                           unsigned long npages, Error **errp)
+{
+    unsigned long i;
+    int ret;
+
+    for (i = 0; i < npages; i++) {
+        void *host = b->host + (page + i) * b->pagesize;
+        void *from = lazy_load.buf + i * b->pagesize;
+
+        if (b->zeroable && buffer_is_zero(from, b->pagesize)) {
+            struct uffdio_zeropage zero_struct = {
+                .range.start = (uintptr_t)host,
+                .range.len = b->pagesize,
+            };
+            ret = ioctl(lazy_load.userfault_fd, UFFDIO_ZEROPAGE, &zero_struct);
+        } else {
+            struct uffdio_copy copy_struct = {
+                .dst = (uintptr_t)host,
+                .src = (uintptr_t)from,
+                .len = b->pagesize,
+            };
+            ret = ioctl(lazy_load.userfault_fd, UFFDIO_COPY, &copy_struct);
+        }
+        /* ENOENT: the block has been unplugged under our feet */
+        if (ret && errno != ENOENT) {
+            error_setg_errno(errp, errno, "Lazy RAM load: cannot place page "
+                             "%p of %s", host, b->idstr);
+            return -1;
+        }
+    }
+
+    bitmap_set(b->placed, page, npages);
+    lazy_load.pages_left -= npages;
+    if ((ram_addr_t)page * b->pagesize < b->known) {
+        lazy_load.pages_ready -= npages;
+    }
+    return 0;
+}
+
+static int lazy_load_fault(uint64_t addr, Error **errp)
+{
+    LazyLoadBlock *b = NULL;
+    unsigned long page;
+    int i;
+
+    for (i = 0; i < lazy_load.blocks->len; i++) {
+        b = &g_array_index(lazy_load.blocks, LazyLoadBlock, i);
+        if (addr >= (uintptr_t)b->host &&
+            addr < (uintptr_t)b->host + b->length) {
+            break;
+        }
+    }
+    if (i == lazy_load.blocks->len) {
+        error_setg(errp, "Lazy RAM load: fault outside guest: %" PRIx64, addr);
+        return -1;
+    }
+
+    page = (addr - (uintptr_t)b->host) / b->pagesize;
+    trace_postcopy_lazy_load_fault(addr, b->idstr, page * b->pagesize);
+    if (test_bit(page, b->placed)) {
+        /* Prefetched since, or a second thread faulted on it too */
+        uffd_wakeup(lazy_load.userfault_fd, b->host + page * b->pagesize,
+                    b->pagesize);
+        return 0;
+    }
+
+    if ((ram_addr_t)page * b->pagesize >= b->known) {
+        /*
+         * The source stopped sending chunks and sends the rest of the
+         * block as page records instead, one of which is being loaded.
+         */
+        memset(lazy_load.buf, 0, b->pagesize);
+    } else if (lazy_load_read(b, page, b->pagesize, errp)) {
+        return -1;
+    }
+    return lazy_load_place(b, page, 1, errp);
+}
+
+static int lazy_load_prefetch(Error **errp)
+{
+    unsigned long npages, end = 0, max, chunk_end;
+    LazyLoadBlock *b = NULL;
+    int i;
+
+    for (i = 0; i < lazy_load.blocks->len; i++) {
+        b = &g_array_index(lazy_load.blocks, LazyLoadBlock, i);
+        end = b->known / b->pagesize;
+        b->next = find_next_zero_bit(b->placed, end, b->next);
+        if (b->next < end) {
+            break;
+        }
+    }
+    assert(i < lazy_load.blocks->len);
+
+    max = MAX(lazy_load.buf_size / b->pagesize, 1);
+    chunk_end = QEMU_ALIGN_DOWN((ram_addr_t)b->next * b->pagesize,
+                                b->chunk_size) + b->chunk_size;
+    end = MIN(end, chunk_end / b->pagesize);
+    end = find_next_bit(b->placed, MIN(end, b->next + max), b->next);
+    npages = end - b->next;
+
+    if (lazy_load_read(b, b->next, npages * b->pagesize, errp) ||
+        lazy_load_place(b, b->next, npages, errp)) {
+        return -1;
+    }
+    b->next = end;
+    return 0;
+}
+
+static void postcopy_lazy_load_finish_bh(void *opaque)
+{
+    if (lazy_load.running && qatomic_read(&lazy_load.finished)) {
+        postcopy_lazy_load_stop();
+    }
+}
+
+static void *postcopy_lazy_load_thread(void *opaque)
+{
+    struct pollfd pfd[2] = {
+        { .fd = lazy_load.userfault_fd, .events = POLLIN },
+        { .fd = lazy_load.event_fd, .events = POLLIN },
+    };
+    struct uffd_msg msg;
+    Error *local_err = NULL;
+    bool finished = false;
+    int timeout = 0;
+    int ret;
+
+    trace_postcopy_lazy_load_thread_entry();
+
+    while (!finished && !local_err) {
+        /*
+         * Prefetch until a fault or a quit request comes in, or wait for
+         * them, or for more chunks, if there is nothing to prefetch.
+         */
+        if (poll(pfd, 2, timeout) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            error_setg_errno(&local_err, errno, "Lazy RAM load: userfault "
+                             "poll failed");
+            break;
+        }
+
+        if (pfd[1].revents) {
+            uint64_t tmp64;
+
+            if (read(lazy_load.event_fd, &tmp64, 8) != 8) {
+                error_report("%s: read() failed", __func__);
+            }
+            if (qatomic_read(&lazy_load.quit)) {
+                break;
+            }
+        }
+
+        qemu_mutex_lock(&lazy_load.lock);
+        if (pfd[0].revents) {
+            ret = read(lazy_load.userfault_fd, &msg, sizeof(msg));
+            if (ret == sizeof(msg) && msg.event == UFFD_EVENT_PAGEFAULT) {
+                lazy_load_fault(msg.arg.pagefault.address, &local_err);
+            } else if (ret < 0 && errno != EAGAIN) {
+                error_report("%s: Failed to read userfault message: %s",
+                             __func__, strerror(errno));
+            }
+        } else if (lazy_load.pages_ready) {
+            lazy_load_prefetch(&local_err);
+        }
+        if (!local_err && !lazy_load.pages_left) {
+            qatomic_set(&lazy_load.finished, true);
+            finished = true;
+        }
+        timeout = lazy_load.pages_ready ? 0 : -1;
+        qemu_mutex_unlock(&lazy_load.lock);
+    }
+
+    trace_postcopy_lazy_load_thread_exit(finished);
+    if (local_err) {
+        lazy_load_set_error(local_err);
+    }
+    if (finished) {
+        aio_bh_schedule_oneshot(qemu_get_aio_context(),
+                                postcopy_lazy_load_finish_bh, NULL);
+    }
+    return NULL;
+}
+
+bool postcopy_lazy_load_supported(RAMBlock *rb)
+{
+    MigrationIncomingState *mis = migration_incoming_get_current();
+    Error *local_err = NULL;
+
+    /* Unplugged parts of the block must stay unpopulated */
+    if (memory_region_has_ram_discard_manager(rb->mr)) {
+        trace_postcopy_lazy_load_unsupported(rb->idstr, "discard manager");
+        return false;
+    }
+    /*
+     * Other processes that map shared RAM would not fault through our
+     * userfaultfd, and would read the discarded pages as zero.
+     */
+    if (qemu_ram_is_shared(rb)) {
+        trace_postcopy_lazy_load_unsupported(rb->idstr, "shared memory");
+        return false;
+    }
+    /*
+     * Devices with postcopy notifiers (vhost-user) need the whole postcopy
+     * protocol, ADVISE/LISTEN/END included, which lazy loading does not run.
+     */
+    if (!QLIST_EMPTY(&postcopy_notifier_list.notifiers)) {
+        trace_postcopy_lazy_load_unsupported(rb->idstr, "postcopy notifiers");
+        return false;
+    }
+    if (!postcopy_ram_supported_by_host(mis, &local_err)) {
+        trace_postcopy_lazy_load_unsupported(rb->idstr,
+                                             error_get_pretty(local_err));
+        error_free(local_err);
+        return false;
+    }
+    return true;
+}
+
+static int postcopy_lazy_load_start(int fd)
+{
+    lazy_load.userfault_fd = uffd_create_fd(0, true);
+    if (lazy_load.userfault_fd < 0) {
+        return -1;
+    }
+
+    lazy_load.event_fd = eventfd(0, EFD_CLOEXEC);
+    if (lazy_load.event_fd == -1) {
+        error_report("%s: Opening event fd: %s", __func__, strerror(errno));
+        uffd_close_fd(lazy_load.userfault_fd);
+        return -1;
+    }
+
+    lazy_load.fd = qemu_dup(fd);
+    if (lazy_load.fd == -1) {
+        error_report("%s: dup() failed: %s", __func__, strerror(errno));
+        close(lazy_load.event_fd);
+        uffd_close_fd(lazy_load.userfault_fd);
+        return -1;
+    }
+
+    lazy_load.buf_size = MAX(LAZY_LOAD_PREFETCH_SIZE,
+                             qemu_ram_pagesize_largest());
+    lazy_load.buf = qemu_memalign(qemu_real_host_page_size(),
+                                  lazy_load.buf_size);
+    lazy_load.blocks = g_array_new(false, true, sizeof(LazyLoadBlock));
+    lazy_load.pages_left = 0;
+    lazy_load.pages_ready = 0;
+    lazy_load.quit = false;
+    lazy_load.finished = false;
+    qemu_mutex_init(&lazy_load.lock);
+    lazy_load.running = true;
+    return 0;
+}
+
+static void postcopy_lazy_load_teardown(void)
+{
+    int i;
+
+    /* Pages that are still missing read as zero from now on */
+    for (i = 0; i < lazy_load.blocks->len; i++) {
+        LazyLoadBlock *b = &g_array_index(lazy_load.blocks, LazyLoadBlock, i);
+
+        uffd_unregister_memory(lazy_load.userfault_fd, b->host, b->length);
+        qemu_madvise(b->host, b->length, QEMU_MADV_HUGEPAGE);
+        g_free(b->placed);
+        g_free(b->offsets);
+        g_free(b->idstr);
+    }
+    g_array_free(lazy_load.blocks, true);
+    lazy_load.blocks = NULL;
+
+    qemu_mutex_destroy(&lazy_load.lock);
+    qemu_vfree(lazy_load.buf);
+    lazy_load.buf = NULL;
+    close(lazy_load.fd);
+    close(lazy_load.event_fd);
+    uffd_close_fd(lazy_load.userfault_fd);
+    lazy_load.running = false;
+
+    /* postcopy_ram_supported_by_host() munlock'ed everything */
+    if (enable_mlock && os_mlock() < 0) {
+        error_report("mlock: %s", strerror(errno));
+    }
+}
+
+/*
+ * Leave @rb empty from @start to its end, and register that range.
+ * Called with lazy_load.lock held.
+ */
+static LazyLoadBlock *lazy_load_add_block(RAMBlock *rb, ram_addr_t start,
+                                          ram_addr_t chunk_size)
+{
+    LazyLoadBlock b = {
+        .host = rb->host + start,
+        .length = rb->used_length - start,
+        .pagesize = rb->page_size,
+        .chunk_size = chunk_size,
+    };
+    uint64_t ioctls;
+
+    /* Make sure every page of the block faults, see init_range(). */
+    qemu_madvise(b.host, b.length, QEMU_MADV_NOHUGEPAGE);
+    if (ram_block_discard_range(rb, start, b.length) ||
+        uffd_register_memory(lazy_load.userfault_fd, b.host, b.length,
+                             UFFDIO_REGISTER_MODE_MISSING, &ioctls)) {
+        return NULL;
+    }
+    if (!(ioctls & ((__u64)1 << _UFFDIO_COPY))) {
+        error_report("%s: userfault: Region doesn't support COPY", __func__);
+        uffd_unregister_memory(lazy_load.userfault_fd, b.host, b.length);
+        return NULL;
+    }
+    b.zeroable = ioctls & ((__u64)1 << _UFFDIO_ZEROPAGE);
+    b.idstr = g_strdup(rb->idstr);
+    b.placed = bitmap_new(b.length / b.pagesize);
+    b.offsets = g_new(off_t, DIV_ROUND_UP(b.length, chunk_size));
+
+    g_array_append_val(lazy_load.blocks, b);
+    lazy_load.pages_left += b.length / b.pagesize;
+    return &g_array_index(lazy_load.blocks, LazyLoadBlock,
+                          lazy_load.blocks->len - 1);
+}
+
+int postcopy_lazy_load_block(RAMBlock *rb, ram_addr_t start,
+                             ram_addr_t length, int fd, off_t offset)
+{
+    LazyLoadBlock *b = NULL;
+    unsigned long first, npages;
+    uint64_t tmp64 = 1;
+    bool start_thread;
+    int i;
+
+    trace_postcopy_lazy_load_block(rb->idstr, start, length, offset);
+
+    if (lazy_load.running) {
+        qemu_mutex_lock(&lazy_load.lock);
+        if (lazy_load.finished) {
+            /* The thread is done with the earlier blocks, begin anew */
+            qemu_mutex_unlock(&lazy_load.lock);
+            postcopy_lazy_load_stop();
+        }
+    }
+    start_thread = !lazy_load.running;
+    if (start_thread) {
+        if (postcopy_lazy_load_start(fd)) {
+            return -1;
+        }
+        qemu_mutex_lock(&lazy_load.lock);
+    }
+
+    /*
+     * Holding the lock, the thread cannot finish before the chunk is in.
+     * A chunk continues the entry that ends where it starts, if any.
+     */
+    for (i = 0; i < lazy_load.blocks->len; i++) {
+        b = &g_array_index(lazy_load.blocks, LazyLoadBlock, i);
+        if (b->known < b->length && b->host + b->known == rb->host + start) {
+            break;
+        }
+    }
+    if (i == lazy_load.blocks->len) {
+        b = lazy_load_add_block(rb, start, length);
+    } else if (length != b->chunk_size && start + length != rb->used_length) {
+        error_report("Lazy RAM load: unexpected chunk size 0x%" PRIx64
+                     " for RAM block %s", (uint64_t)length, rb->idstr);
+        b = NULL;
+    }
+    if (!b) {
+        qemu_mutex_unlock(&lazy_load.lock);
+        if (start_thread) {
+            postcopy_lazy_load_teardown();
+        }
+        return -1;
+    }
+
+    b->offsets[b->known / b->chunk_size] = offset;
+    first = b->known / b->pagesize;
+    npages = length / b->pagesize;
+    b->known += length;
+    /* Pages a page record already faulted in are there to stay */
+    lazy_load.pages_ready += npages -
+        bitmap_count_one_with_offset(b->placed, first, npages);
+    qemu_mutex_unlock(&lazy_load.lock);
+
+    /* Otherwise wake up the thread, it may be waiting for more chunks */
+    if (start_thread) {
+        qemu_thread_create(&lazy_load.thread, "mig/dst/lazy",
+                           postcopy_lazy_load_thread, NULL,
+                           QEMU_THREAD_JOINABLE);
+    } else if (write(lazy_load.event_fd, &tmp64, 8) != 8) {
+        error_report("%s: write() failed", __func__);
+    }
+    return 0;
+}
+
+void postcopy_lazy_load_stop(void)
+{
+    uint64_t tmp64 = 1;
+
+    if (!lazy_load.running) {
+        return;
+    }
+
+    qatomic_set(&lazy_load.quit, true);
+    if (write(lazy_load.event_fd, &tmp64, 8) != 8) {
+        error_report("%s: write() failed", __func__);
+    }
+    qemu_thread_join(&lazy_load.thread);
+    trace_postcopy_lazy_load_stop(lazy_load.pages_left);
+    postcopy_lazy_load_teardown();
+}
+
 #else
 /* No target OS support, stubs just fail */
 void fill_destination_postcopy_migration_info(MigrationInfo *info)
@@ -1422,6 +1949,22 @@ int postcopy_wake_shared(struct PostCopyFD *pcfd,
     assert(0);
     return -1;
 }
+
+bool postcopy_lazy_load_supported(RAMBlock *rb)
+{
+    return false;
+}
+
+int postcopy_lazy_load_block(RAMBlock *rb, ram_addr_t start,
+                             ram_addr_t length, int fd, off_t offset)
+{
+    assert(0);
+    return -1;
+}
+
+void postcopy_lazy_load_stop(void)
+{
+}
 #endif
 
 /* ------------------------------------------------------------------------- */
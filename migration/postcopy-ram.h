@@ -35,6 +35,27 @@ int postcopy_ram_incoming_init(MigrationIncomingState *mis);
  */
 int postcopy_ram_incoming_cleanup(MigrationIncomingState *mis);
 
+/*
+ * Lazy RAM load: true if @rb can be filled in on demand, on first access,
+ * instead of during the load.
+ */
+bool postcopy_lazy_load_supported(RAMBlock *rb);
+
+/*
+ * Fill in @length bytes at @start of @rb on demand from @fd, a regular
+ * file that has them at @offset.  The chunks of a block must come in
+ * order and, but the last, have the same size; the block is left empty
+ * from the first of them on.
+ */
+int postcopy_lazy_load_block(RAMBlock *rb, ram_addr_t start,
+                             ram_addr_t length, int fd, off_t offset);
+
+/*
+ * Stop filling in lazily loaded RAM blocks, pages that are still missing
+ * read as zero from now on.
+ */
+void postcopy_lazy_load_stop(void);
+
 /*
  * Userfault requires us to mark RAM as NOHUGEPAGE prior to discard
  * however leaving it until after precopy means that most of the precopy
@@ -564,6 +564,37 @@ void qemu_file_skip(QEMUFile *f, int size)
     }
 }
 
+/*
+ * Skip 'size' bytes of input by seeking the underlying channel, which
+ * must support it.  Returns the channel offset of the first skipped byte,
+ * or -1 on error.
+ */
+off_t qemu_file_seek_input(QEMUFile *f, uint64_t size)
+{
+    size_t pending = f->buf_size - f->buf_index;
+    off_t pos;
+
+    assert(!qemu_file_is_writable(f));
+
+    pos = qio_channel_io_seek(f->ioc, 0, SEEK_CUR, NULL);
+    if (pos < 0) {
+        return -1;
+    }
+    pos -= pending;
+
+    if (size <= pending) {
+        f->buf_index += size;
+        return pos;
+    }
+
+    if (qio_channel_io_seek(f->ioc, size - pending, SEEK_CUR, NULL) < 0) {
+        return -1;
+    }
+    f->buf_index = 0;
+    f->buf_size = 0;
+    return pos;
+}
+
 /*
  * Read 'size' bytes from file (at 'offset') without moving the
  * pointer and set 'buf' to point to that data.
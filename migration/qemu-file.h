@@ -122,6 +122,7 @@ bool qemu_file_buffer_empty(QEMUFile *file);
  */
 int coroutine_mixed_fn qemu_peek_byte(QEMUFile *f, int offset);
 void qemu_file_skip(QEMUFile *f, int size);
+off_t qemu_file_seek_input(QEMUFile *f, uint64_t size);
 /*
  * qemu_file_credit_transfer:
  *
@@ -28,6 +28,7 @@
 
 #include "qemu/osdep.h"
 #include "qemu/cutils.h"
+#include "qemu/units.h"
 #include "qemu/bitops.h"
 #include "qemu/bitmap.h"
 #include "qemu/madvise.h"
@@ -40,6 +41,7 @@
 #include "migration/register.h"
 #include "migration/misc.h"
 #include "qemu-file.h"
+#include "io/channel-file.h"
 #include "postcopy-ram.h"
 #include "page_cache.h"
 #include "qemu/error-report.h"
@@ -54,6 +56,7 @@
 #include "migration/colo.h"
 #include "block.h"
 #include "sysemu/cpu-throttle.h"
+#include "sysemu/cpus.h"
 #include "savevm.h"
 #include "qemu/iov.h"
 #include "multifd.h"
@@ -88,7 +91,21 @@
 /* 0x80 is reserved in qemu-file.h for RAM_SAVE_FLAG_HOOK */
 #define RAM_SAVE_FLAG_COMPRESS_PAGE    0x100
 #define RAM_SAVE_FLAG_MULTIFD_FLUSH    0x200
-/* We can't use any flag that is bigger than 0x200 */
+/*
+ * We can't use any flag that is bigger than 0x200 on all targets.  Flags
+ * above it only fit in the page offset of targets with larger pages, and
+ * may only be sent by features that migrate_caps_check() refuses
+ * otherwise.
+ */
+/* A record that starts with one of the RAM_SAVE_EXT_* type bytes below */
+#define RAM_SAVE_FLAG_EXT              0x400
+
+/* Name of the parent of an incremental snapshot */
+#define RAM_SAVE_EXT_SNAPSHOT_PARENT 1
+/* Contents of a chunk of a RAMBlock, for lazy-ram-load */
+#define RAM_SAVE_EXT_BLOCK_DATA      2
+/* Size of the RAM_SAVE_EXT_BLOCK_DATA chunks, unless pages are larger */
+#define RAM_BLOCK_DATA_CHUNK         (4 * MiB)
 
 int (*xbzrle_encode_buffer_func)(uint8_t *, uint8_t *, int,
      uint8_t *, int) = xbzrle_encode_buffer;
@@ -365,8 +382,46 @@ struct RAMState {
     PageSearchStatus pss[RAM_CHANNEL_MAX];
     /* UFFD file descriptor, used in 'write-tracking' migration */
     int uffdio_fd;
+    /*
+     * Copy-on-write handling of UFFD write faults, used by background
+     * internal snapshots where the saving thread cannot service faults
+     * itself because it may fault on guest RAM too.
+     */
+    bool uffdio_cow;
+    bool uffdio_cow_quit;
+    QemuThread uffdio_cow_thread;
+    /*
+     * Protects:
+     * - uffdio_cow_pages
+     * - uffdio_cow_queue
+     * - uffdio_cow_bytes
+     * - uffdio_cow_throttled
+     */
+    QemuMutex uffdio_cow_mutex;
+    /* Host page address -> copy taken before the first guest write */
+    GHashTable *uffdio_cow_pages;
+    /* Total size of the copies in uffdio_cow_pages */
+    uint64_t uffdio_cow_bytes;
+    /* Host pages copied by the fault thread, to be saved first */
+    GQueue uffdio_cow_queue;
+    /* Bounce buffer for the target page being saved */
+    uint8_t *uffdio_cow_buf;
+    /* Set once the copies exceed RAM_COW_MAX_BYTES, until half are saved */
+    bool uffdio_cow_throttled;
+    /* Pauses the vCPUs from the main loop when throttled */
+    QEMUBH *uffdio_cow_bh;
+    /* Whether uffdio_cow_bh paused the vCPUs; main loop only */
+    bool uffdio_cow_paused;
     /* total ram size in bytes */
     uint64_t ram_bytes_total;
+    /*
+     * lazy-ram-load: RAM_SAVE_EXT_BLOCK_DATA chunks are still to be sent,
+     * the next one at @block_data_offset of @block_data_block (NULL for
+     * the first block).
+     */
+    bool block_data;
+    RAMBlock *block_data_block;
+    ram_addr_t block_data_offset;
     /* Last block that we have visited searching for dirty pages */
     RAMBlock *last_seen_block;
     /* Last dirty target page we have sent */
@@ -1467,6 +1522,63 @@ static RAMBlock *unqueue_page(RAMState *rs, ram_addr_t *offset)
 }
 
 #if defined(__linux__)
+/* Page copies held for copy-on-write before the vCPUs are paused */
+#define RAM_COW_MAX_BYTES       (256 * MiB)
+
+/*
+ * ram_write_tracking_cow_drop: free the copy of a host page, if any, and
+ *   resume the vCPUs once enough copies have been saved
+ *
+ * Called from the main loop with the iothread lock held.
+ */
+static void ram_write_tracking_cow_drop(RAMState *rs, void *host_page,
+                                        size_t page_size)
+{
+    bool resume = false;
+
+    qemu_mutex_lock(&rs->uffdio_cow_mutex);
+    if (g_hash_table_remove(rs->uffdio_cow_pages, host_page)) {
+        rs->uffdio_cow_bytes -= page_size;
+        if (rs->uffdio_cow_throttled &&
+            rs->uffdio_cow_bytes <= RAM_COW_MAX_BYTES / 2) {
+            rs->uffdio_cow_throttled = false;
+            resume = rs->uffdio_cow_paused;
+        }
+    }
+    qemu_mutex_unlock(&rs->uffdio_cow_mutex);
+
+    if (resume) {
+        rs->uffdio_cow_paused = false;
+        if (runstate_is_running()) {
+            resume_all_vcpus();
+        }
+    }
+}
+
+/*
+ * ram_write_tracking_cow_bh: pause the vCPUs while the page copies are
+ *   over RAM_COW_MAX_BYTES, so that the guest cannot dirty memory faster
+ *   than the stream is written
+ *
+ * Only vCPUs are paused: writes from the main loop, I/O threads and
+ * DMA still fault and are still copied, because holding them back could
+ * stall the saver itself.
+ */
+static void ram_write_tracking_cow_bh(void *opaque)
+{
+    RAMState *rs = opaque;
+    bool throttled;
+
+    qemu_mutex_lock(&rs->uffdio_cow_mutex);
+    throttled = rs->uffdio_cow_throttled;
+    qemu_mutex_unlock(&rs->uffdio_cow_mutex);
+
+    if (throttled && !rs->uffdio_cow_paused && runstate_is_running()) {
+        rs->uffdio_cow_paused = true;
+        pause_all_vcpus();
+    }
+}
+
 /**
  * poll_fault_page: try to get next UFFD write fault page and, if pending fault
  *   is found, return RAM block pointer and page offset
@@ -1488,12 +1600,34 @@ static RAMBlock *poll_fault_page(RAMState *rs, ram_addr_t *offset)
         return NULL;
     }
 
-    res = uffd_read_events(rs->uffdio_fd, &uffd_msg, 1);
-    if (res <= 0) {
-        return NULL;
+    if (rs->uffdio_cow) {
+        /* Faults were already resolved; save the copied pages first */
+        for (;;) {
+            qemu_mutex_lock(&rs->uffdio_cow_mutex);
+            page_address = g_queue_pop_head(&rs->uffdio_cow_queue);
+            qemu_mutex_unlock(&rs->uffdio_cow_mutex);
+            if (!page_address) {
+                return NULL;
+            }
+            block = qemu_ram_block_from_host(page_address, false, offset);
+            assert(block && (block->flags & RAM_UF_WRITEPROTECT) != 0);
+            if (test_bit(*offset >> TARGET_PAGE_BITS, block->bmap)) {
+                return block;
+            }
+            /*
+             * Saved from guest RAM before the fault was resolved, the
+             * copy is no longer needed.
+             */
+            ram_write_tracking_cow_drop(rs, page_address, block->page_size);
+        }
+    } else {
+        res = uffd_read_events(rs->uffdio_fd, &uffd_msg, 1);
+        if (res <= 0) {
+            return NULL;
+        }
+        page_address = (void *)(uintptr_t) uffd_msg.arg.pagefault.address;
     }
 
-    page_address = (void *)(uintptr_t) uffd_msg.arg.pagefault.address;
     block = qemu_ram_block_from_host(page_address, false, offset);
     assert(block && (block->flags & RAM_UF_WRITEPROTECT) != 0);
     return block;
@@ -1519,6 +1653,13 @@ static int ram_save_release_protection(RAMState *rs, PageSearchStatus *pss,
         void *page_address = pss->block->host + (start_page << TARGET_PAGE_BITS);
         uint64_t run_length = (pss->page - start_page) << TARGET_PAGE_BITS;
 
+        if (rs->uffdio_cow) {
+            /* The page is in the stream now, its private copy can go */
+            ram_write_tracking_cow_drop(rs,
+                QEMU_ALIGN_PTR_DOWN(page_address, pss->block->page_size),
+                pss->block->page_size);
+        }
+
         /* Flush async buffers before un-protect. */
         qemu_fflush(pss->pss_channel);
         /* Un-protect memory range. */
@@ -1776,6 +1917,116 @@ fail:
     return -1;
 }
 
+/*
+ * ram_write_tracking_cow_fault: resolve one UFFD write fault by copying
+ *   the host page aside and removing its write protection
+ *
+ * Faults are never held back: the writer may be the main loop itself, or
+ * hold the iothread lock it needs, and then only taking the copy lets the
+ * saver make progress.  Instead, once RAM_COW_MAX_BYTES are held in copies,
+ * ram_write_tracking_cow_bh() pauses the vCPUs until the saver has written
+ * half of them out.
+ */
+static void ram_write_tracking_cow_fault(RAMState *rs, void *page_address)
+{
+    RAMBlock *block;
+    ram_addr_t offset;
+    void *host_page;
+    bool throttle = false;
+
+    RCU_READ_LOCK_GUARD();
+
+    block = qemu_ram_block_from_host(page_address, false, &offset);
+    assert(block && (block->flags & RAM_UF_WRITEPROTECT) != 0);
+    host_page = block->host + QEMU_ALIGN_DOWN(offset, block->page_size);
+
+    qemu_mutex_lock(&rs->uffdio_cow_mutex);
+    if (!g_hash_table_contains(rs->uffdio_cow_pages, host_page)) {
+        g_hash_table_insert(rs->uffdio_cow_pages, host_page,
+                            g_memdup2(host_page, block->page_size));
+        g_queue_push_tail(&rs->uffdio_cow_queue, host_page);
+        rs->uffdio_cow_bytes += block->page_size;
+    }
+    if (!rs->uffdio_cow_throttled &&
+        rs->uffdio_cow_bytes > RAM_COW_MAX_BYTES) {
+        rs->uffdio_cow_throttled = throttle = true;
+    }
+    qemu_mutex_unlock(&rs->uffdio_cow_mutex);
+
+    trace_ram_write_tracking_cow_fault(block->idstr, offset);
+
+    /* Un-protect and wake up the faulting thread */
+    uffd_change_protection(rs->uffdio_fd, host_page, block->page_size,
+                           false, false);
+
+    if (throttle) {
+        trace_ram_write_tracking_cow_throttle(block->idstr, offset,
+                                              RAM_COW_MAX_BYTES);
+        qemu_bh_schedule(rs->uffdio_cow_bh);
+    }
+}
+
+static void *ram_write_tracking_cow_thread(void *opaque)
+{
+    RAMState *rs = opaque;
+    struct uffd_msg uffd_msg;
+
+    rcu_register_thread();
+
+    while (!qatomic_read(&rs->uffdio_cow_quit)) {
+        if (!uffd_poll_events(rs->uffdio_fd, 100)) {
+            continue;
+        }
+        while (uffd_read_events(rs->uffdio_fd, &uffd_msg, 1) > 0) {
+            ram_write_tracking_cow_fault(rs,
+                (void *)(uintptr_t) uffd_msg.arg.pagefault.address);
+        }
+    }
+
+    rcu_unregister_thread();
+    return NULL;
+}
+
+/*
+ * ram_write_tracking_start_cow: start UFFD-WP memory tracking, resolving
+ *   write faults from a dedicated thread
+ *
+ * Faulting pages are copied aside and un-protected immediately instead of
+ * waiting for the saving side to write them to the stream, so vCPUs and
+ * the main loop never block on the stream; memory used by the copies is
+ * bounded by pausing the vCPUs instead.  Must be called from the main
+ * loop, which is also where the stream is written, e.g. for background
+ * internal snapshots.
+ *
+ * Returns 0 for success or negative value in case of error
+ */
+int ram_write_tracking_start_cow(void)
+{
+    RAMState *rs = ram_state;
+    int ret;
+
+    ret = ram_write_tracking_start();
+    if (ret) {
+        return ret;
+    }
+
+    qemu_mutex_init(&rs->uffdio_cow_mutex);
+    rs->uffdio_cow_pages = g_hash_table_new_full(NULL, NULL, NULL, g_free);
+    rs->uffdio_cow_bytes = 0;
+    g_queue_init(&rs->uffdio_cow_queue);
+    rs->uffdio_cow_buf = g_malloc(TARGET_PAGE_SIZE);
+    rs->uffdio_cow_throttled = false;
+    rs->uffdio_cow_paused = false;
+    rs->uffdio_cow_bh = qemu_bh_new(ram_write_tracking_cow_bh, rs);
+    rs->uffdio_cow_quit = false;
+    rs->uffdio_cow = true;
+
+    qemu_thread_create(&rs->uffdio_cow_thread, "mig/snap/cow",
+                       ram_write_tracking_cow_thread, rs,
+                       QEMU_THREAD_JOINABLE);
+    return 0;
+}
+
 /**
  * ram_write_tracking_stop: stop UFFD-WP memory tracking and remove protection
  */
@@ -1784,6 +2035,20 @@ void ram_write_tracking_stop(void)
     RAMState *rs = ram_state;
     RAMBlock *block;
 
+    if (rs->uffdio_cow) {
+        qatomic_set(&rs->uffdio_cow_quit, true);
+        qemu_thread_join(&rs->uffdio_cow_thread);
+
+        qemu_bh_delete(rs->uffdio_cow_bh);
+        rs->uffdio_cow_bh = NULL;
+        if (rs->uffdio_cow_paused) {
+            rs->uffdio_cow_paused = false;
+            if (runstate_is_running()) {
+                resume_all_vcpus();
+            }
+        }
+    }
+
     RCU_READ_LOCK_GUARD();
 
     RAMBLOCK_FOREACH_NOT_IGNORED(block) {
@@ -1803,6 +2068,16 @@ void ram_write_tracking_stop(void)
     /* Finally close UFFD file descriptor */
     uffd_close_fd(rs->uffdio_fd);
     rs->uffdio_fd = -1;
+
+    if (rs->uffdio_cow) {
+        rs->uffdio_cow = false;
+        g_queue_clear(&rs->uffdio_cow_queue);
+        g_hash_table_destroy(rs->uffdio_cow_pages);
+        rs->uffdio_cow_pages = NULL;
+        g_free(rs->uffdio_cow_buf);
+        rs->uffdio_cow_buf = NULL;
+        qemu_mutex_destroy(&rs->uffdio_cow_mutex);
+    }
 }
 
 #else
@@ -1843,6 +2118,12 @@ int ram_write_tracking_start(void)
     return -1;
 }
 
+int ram_write_tracking_start_cow(void)
+{
+    assert(0);
+    return -1;
+}
+
 void ram_write_tracking_stop(void)
 {
     assert(0);
@@ -2105,6 +2386,51 @@ static bool save_compress_page(RAMState *rs, PageSearchStatus *pss,
     return false;
 }
 
+/**
+ * ram_save_cow_page: save one target page while copy-on-write fault
+ *   handling is active
+ *
+ * The page is read either from the copy the fault thread took before the
+ * guest wrote to it, or from guest RAM while it is still write-protected.
+ * Either way the data is copied out under uffdio_cow_mutex, so it can't be
+ * modified while it is being written to the stream.
+ *
+ * Returns the number of pages written
+ *
+ * @rs: current RAM state
+ * @pss: data about the page we want to send
+ */
+static int ram_save_cow_page(RAMState *rs, PageSearchStatus *pss)
+{
+    RAMBlock *block = pss->block;
+    ram_addr_t offset = ((ram_addr_t)pss->page) << TARGET_PAGE_BITS;
+    ram_addr_t host_offset = QEMU_ALIGN_DOWN(offset, block->page_size);
+    uint8_t *buf = rs->uffdio_cow_buf;
+    uint8_t *copy;
+    int len;
+
+    qemu_mutex_lock(&rs->uffdio_cow_mutex);
+    copy = g_hash_table_lookup(rs->uffdio_cow_pages, block->host + host_offset);
+    if (copy) {
+        memcpy(buf, copy + (offset - host_offset), TARGET_PAGE_SIZE);
+    } else {
+        memcpy(buf, block->host + offset, TARGET_PAGE_SIZE);
+    }
+    qemu_mutex_unlock(&rs->uffdio_cow_mutex);
+
+    if (buffer_is_zero(buf, TARGET_PAGE_SIZE)) {
+        len = save_page_header(pss, pss->pss_channel, block,
+                               offset | RAM_SAVE_FLAG_ZERO);
+        qemu_put_byte(pss->pss_channel, 0);
+        ram_transferred_add(len + 1);
+        stat64_add(&mig_stats.zero_pages, 1);
+        return 1;
+    }
+
+    /* The bounce buffer is reused for the next page, don't send async */
+    return save_normal_page(pss, block, offset, buf, false);
+}
+
 /**
  * ram_save_target_page_legacy: save one target page
  *
@@ -2119,6 +2445,10 @@ static int ram_save_target_page_legacy(RAMState *rs, PageSearchStatus *pss)
     ram_addr_t offset = ((ram_addr_t)pss->page) << TARGET_PAGE_BITS;
     int res;
 
+    if (rs->uffdio_cow) {
+        return ram_save_cow_page(rs, pss);
+    }
+
     if (control_save_page(pss, block, offset, &res)) {
         return res;
     }
@@ -2514,6 +2844,11 @@ static void ram_state_reset(RAMState *rs)
     rs->last_page = 0;
     rs->last_version = ram_list.version;
     rs->xbzrle_started = false;
+    /*
+     * block_data_block may be gone; what has not been sent in chunks is
+     * still dirty and goes out as ordinary pages.
+     */
+    rs->block_data = false;
 }
 
 #define MAX_WAIT 50 /* ms, half buffered_file limit */
@@ -2802,6 +3137,124 @@ err_out:
     return -ENOMEM;
 }
 
+/*
+ * Incremental snapshots
+ *
+ * With the incremental-snapshot capability, guest RAM writes are logged
+ * from the moment an internal snapshot has been loaded or saved, its
+ * "parent".  The next snapshot saved then only contains the pages that
+ * were dirtied since, plus the identity of the parent: its id, date and
+ * VM clock, so that a later snapshot reusing the name is not mistaken
+ * for it.  The snapshot table records the parent too, which lets
+ * load_snapshot() load it first and delete_snapshot() refuse to remove
+ * it; ram_load() only checks that the right parent is in RAM.
+ *
+ * Any other kind of RAM save consumes the dirty log, so it drops the
+ * tracking and the next snapshot is a full one again.
+ */
+static struct {
+    /* The dirty log is relative to @parent */
+    bool tracking;
+    QEMUSnapshotInfo parent;
+    /* The RAM save being set up is for an incremental snapshot */
+    bool saving;
+    /* RAM holds @loaded, the parent of the snapshot being loaded */
+    bool has_loaded;
+    QEMUSnapshotInfo loaded;
+} ram_snapshot;
+
+static bool ram_snapshot_same(const QEMUSnapshotInfo *a,
+                              const QEMUSnapshotInfo *b)
+{
+    return !strcmp(a->id_str, b->id_str) &&
+           a->date_sec == b->date_sec && a->date_nsec == b->date_nsec &&
+           a->vm_clock_nsec == b->vm_clock_nsec;
+}
+
+/*
+ * ram_snapshot_track_start: (re)start tracking RAM writes relative to the
+ *   snapshot @sn, which has just been loaded or saved with the VM stopped
+ */
+void ram_snapshot_track_start(const QEMUSnapshotInfo *sn)
+{
+    RAMBlock *block;
+
+    if (!ram_snapshot.tracking) {
+        memory_global_dirty_log_start(GLOBAL_DIRTY_SNAPSHOT);
+        ram_snapshot.tracking = true;
+    }
+    ram_snapshot.parent = *sn;
+
+    /* Forget about anything dirtied up to now */
+    memory_global_dirty_log_sync();
+    WITH_RCU_READ_LOCK_GUARD() {
+        RAMBLOCK_FOREACH_NOT_IGNORED(block) {
+            memory_region_clear_dirty_bitmap(block->mr, 0, block->used_length);
+            cpu_physical_memory_test_and_clear_dirty(block->offset,
+                                                     block->used_length,
+                                                     DIRTY_MEMORY_MIGRATION);
+        }
+    }
+    trace_ram_snapshot_track_start(sn->name, sn->id_str);
+}
+
+/*
+ * ram_snapshot_track_stop: stop tracking RAM writes, the next snapshot
+ *   will be a full one
+ */
+void ram_snapshot_track_stop(void)
+{
+    if (!ram_snapshot.tracking) {
+        return;
+    }
+    trace_ram_snapshot_track_stop(ram_snapshot.parent.name);
+    memory_global_dirty_log_stop(GLOBAL_DIRTY_SNAPSHOT);
+    ram_snapshot.tracking = false;
+}
+
+/*
+ * ram_snapshot_get_parent: get the snapshot that the next incremental
+ *   snapshot would be saved on top of
+ *
+ * Returns false if RAM writes are not being tracked
+ */
+bool ram_snapshot_get_parent(QEMUSnapshotInfo *parent)
+{
+    if (!ram_snapshot.tracking) {
+        return false;
+    }
+    *parent = ram_snapshot.parent;
+    return true;
+}
+
+/*
+ * ram_snapshot_save_begin: called before saving the internal snapshot
+ *   @sn, which is incremental if its parent is set.  The caller has
+ *   checked that the parent is the one returned by
+ *   ram_snapshot_get_parent(), and that it still exists.
+ */
+void ram_snapshot_save_begin(const QEMUSnapshotInfo *sn)
+{
+    ram_snapshot.saving = ram_snapshot.tracking && sn->parent_id_str[0];
+}
+
+void ram_snapshot_save_end(void)
+{
+    ram_snapshot.saving = false;
+}
+
+/*
+ * ram_snapshot_set_loaded: tell ram_load() that RAM currently holds the
+ *   contents of snapshot @sn, or nothing known if NULL
+ */
+void ram_snapshot_set_loaded(const QEMUSnapshotInfo *sn)
+{
+    ram_snapshot.has_loaded = sn != NULL;
+    if (sn) {
+        ram_snapshot.loaded = *sn;
+    }
+}
+
 static int ram_state_init(RAMState **rsp)
 {
     *rsp = g_try_new0(RAMState, 1);
@@ -2881,12 +3334,27 @@ static void migration_bitmap_clear_discarded_pages(RAMState *rs)
 
 static void ram_init_bitmaps(RAMState *rs)
 {
+    RAMBlock *block;
+
     /* For memory_global_dirty_log_start below.  */
     qemu_mutex_lock_iothread();
     qemu_mutex_lock_ramlist();
 
     WITH_RCU_READ_LOCK_GUARD() {
         ram_list_init_bitmaps();
+        if (ram_snapshot.saving) {
+            /*
+             * The parent snapshot has everything else, only send what the
+             * dirty log has seen since.
+             */
+            RAMBLOCK_FOREACH_NOT_IGNORED(block) {
+                bitmap_zero(block->bmap, block->max_length >> TARGET_PAGE_BITS);
+            }
+            rs->migration_dirty_pages = 0;
+        } else {
+            /* Whatever this is, it will consume the dirty log */
+            ram_snapshot_track_stop();
+        }
         /* We don't use dirty log with background snapshots */
         if (!migrate_background_snapshot()) {
             memory_global_dirty_log_start(GLOBAL_DIRTY_MIGRATION);
@@ -3007,6 +3475,71 @@ void qemu_guest_free_page_hint(void *addr, size_t len)
  * granularity of these critical sections.
  */
 
+/**
+ * ram_save_block_data: send the next chunk of RAM as a contiguous record
+ *
+ * With lazy-ram-load, RAM is sent in order as RAM_SAVE_EXT_BLOCK_DATA
+ * chunks before any other page, and the destination maps each page to a
+ * fixed offset of the stream instead of reading it.  Pages dirtied after
+ * their chunk was sent are sent again as ordinary pages, which the
+ * destination applies on top.
+ *
+ * Returns the number of pages written, 0 once all chunks have been sent
+ *
+ * Called with rcu_read_lock and bitmap_mutex held.
+ *
+ * @rs: current RAM state
+ * @f: QEMUFile where to send the data
+ */
+static int ram_save_block_data(RAMState *rs, QEMUFile *f)
+{
+    RAMBlock *block = rs->block_data_block;
+    ram_addr_t offset = rs->block_data_offset;
+    ram_addr_t len;
+    unsigned long first, pages;
+
+    if (!rs->block_data) {
+        return 0;
+    }
+
+    if (!block) {
+        block = QLIST_FIRST_RCU(&ram_list.blocks);
+    }
+    while (block && (ramblock_is_ignored(block) ||
+                     offset >= block->used_length)) {
+        block = QLIST_NEXT_RCU(block, next);
+        offset = 0;
+    }
+    if (!block) {
+        rs->block_data = false;
+        return 0;
+    }
+
+    len = MIN(MAX(RAM_BLOCK_DATA_CHUNK, block->page_size),
+              block->used_length - offset);
+    first = offset >> TARGET_PAGE_BITS;
+    pages = len >> TARGET_PAGE_BITS;
+
+    /* Make sure writes from now on show up in the next sync */
+    migration_clear_memory_region_dirty_bitmap_range(block, first, pages);
+    rs->migration_dirty_pages -=
+        bitmap_count_one_with_offset(block->bmap, first, pages);
+    bitmap_clear(block->bmap, first, pages);
+
+    trace_ram_save_block_data(block->idstr, offset, len);
+    qemu_put_be64(f, RAM_SAVE_FLAG_EXT);
+    qemu_put_byte(f, RAM_SAVE_EXT_BLOCK_DATA);
+    qemu_put_counted_string(f, block->idstr);
+    qemu_put_be64(f, offset);
+    qemu_put_be64(f, len);
+    qemu_put_buffer(f, block->host + offset, len);
+    ram_transferred_add(len);
+
+    rs->block_data_block = block;
+    rs->block_data_offset = offset + len;
+    return pages;
+}
+
 /**
  * ram_save_setup: Setup RAM for migration
  *
@@ -3052,6 +3585,23 @@ static int ram_save_setup(QEMUFile *f, void *opaque)
         }
     }
 
+    if (ram_snapshot.saving) {
+        qemu_put_be64(f, RAM_SAVE_FLAG_EXT);
+        qemu_put_byte(f, RAM_SAVE_EXT_SNAPSHOT_PARENT);
+        qemu_put_counted_string(f, ram_snapshot.parent.name);
+        qemu_put_counted_string(f, ram_snapshot.parent.id_str);
+        qemu_put_be32(f, ram_snapshot.parent.date_sec);
+        qemu_put_be32(f, ram_snapshot.parent.date_nsec);
+        qemu_put_be64(f, ram_snapshot.parent.vm_clock_nsec);
+    }
+
+    /* The chunks are sent by the rate-limited iterations */
+    if (migrate_lazy_ram_load()) {
+        (*rsp)->block_data = true;
+        (*rsp)->block_data_block = NULL;
+        (*rsp)->block_data_offset = 0;
+    }
+
     ram_control_before_iterate(f, RAM_CONTROL_SETUP);
     ram_control_after_iterate(f, RAM_CONTROL_SETUP);
 
@@ -3124,7 +3674,10 @@ static int ram_save_iterate(QEMUFile *f, void *opaque)
                 break;
             }
 
-            pages = ram_find_and_save_block(rs);
+            pages = ram_save_block_data(rs, f);
+            if (pages == 0) {
+                pages = ram_find_and_save_block(rs);
+            }
             /* no more pages to sent */
             if (pages == 0) {
                 done = 1;
@@ -3226,7 +3779,10 @@ static int ram_save_complete(QEMUFile *f, void *opaque)
         while (true) {
             int pages;
 
-            pages = ram_find_and_save_block(rs);
+            pages = ram_save_block_data(rs, f);
+            if (pages == 0) {
+                pages = ram_find_and_save_block(rs);
+            }
             /* no more blocks to sent */
             if (pages == 0) {
                 break;
@@ -3559,6 +4115,9 @@ void colo_release_ram_cache(void)
     ram_state_cleanup(&ram_state);
 }
 
+/* A block of the stream being loaded has been mapped for lazy loading */
+static bool ram_lazy_load_begun;
+
 /**
  * ram_load_setup: Setup RAM for migration incoming side
  *
@@ -3571,6 +4130,7 @@ static int ram_load_setup(QEMUFile *f, void *opaque)
 {
     xbzrle_load_setup();
     ramblock_recv_map_init();
+    ram_lazy_load_begun = false;
 
     return 0;
 }
@@ -3853,6 +4413,131 @@ void colo_flush_ram_cache(void)
     trace_colo_flush_ram_cache_end();
 }
 
+/*
+ * Lazy loading reads pages from any thread at any time, which rules out
+ * anything but regular files: no pipes, sockets, or internal snapshots,
+ * which need the block layer.
+ */
+static int ram_lazy_load_fd(QEMUFile *f, RAMBlock *block)
+{
+    QIOChannel *ioc = qemu_file_get_ioc(f);
+    struct stat st;
+    int fd;
+
+    if (!migrate_lazy_ram_load() ||
+        !object_dynamic_cast(OBJECT(ioc), TYPE_QIO_CHANNEL_FILE)) {
+        return -1;
+    }
+    fd = QIO_CHANNEL_FILE(ioc)->fd;
+    if (fstat(fd, &st) < 0 || !S_ISREG(st.st_mode)) {
+        return -1;
+    }
+    return postcopy_lazy_load_supported(block) ? fd : -1;
+}
+
+/*
+ * ram_load_block_data: load a RAM_SAVE_EXT_BLOCK_DATA record, or map
+ *   it for lazy loading
+ *
+ * Returns 0 for success or -errno in case of error
+ *
+ * @f: QEMUFile where to read the data from
+ */
+static int ram_load_block_data(QEMUFile *f)
+{
+    RAMBlock *block;
+    char id[256];
+    uint64_t start, length, done, len;
+    uint8_t *host;
+    off_t offset;
+    int fd;
+
+    qemu_get_counted_string(f, id);
+    start = qemu_get_be64(f);
+    length = qemu_get_be64(f);
+    block = qemu_ram_block_by_name(id);
+    if (!block || ramblock_is_ignored(block) ||
+        start > block->used_length || length > block->used_length - start ||
+        !QEMU_IS_ALIGNED(start | length, block->page_size)) {
+        error_report("Unexpected data for RAM block \"%s\"", id);
+        return -EINVAL;
+    }
+    host = block->host + start;
+
+    fd = ram_lazy_load_fd(f, block);
+    trace_ram_load_block_data(id, start, length, fd >= 0);
+    if (fd >= 0) {
+        if (!ram_lazy_load_begun) {
+            /* Whatever an earlier lazy load left is being replaced */
+            postcopy_lazy_load_stop();
+            ram_lazy_load_begun = true;
+        }
+        offset = qemu_file_seek_input(f, length);
+        if (offset < 0) {
+            error_report("Failed to skip data of RAM block \"%s\"", id);
+            return -EIO;
+        }
+        if (postcopy_lazy_load_block(block, start, length, fd, offset)) {
+            return -EINVAL;
+        }
+        ramblock_recv_bitmap_set_range(block, host,
+                                       length >> TARGET_PAGE_BITS);
+        return 0;
+    }
+
+    for (done = 0; done < length; done += len) {
+        /* Let the main loop run, as the page loop does */
+        if (done && qemu_in_coroutine()) {
+            aio_co_schedule(qemu_get_current_aio_context(),
+                            qemu_coroutine_self());
+            qemu_coroutine_yield();
+        }
+        len = MIN(length - done, 32768 * TARGET_PAGE_SIZE);
+        qemu_get_buffer(f, host + done, len);
+    }
+    ramblock_recv_bitmap_set_range(block, host,
+                                   length >> TARGET_PAGE_BITS);
+    return qemu_file_get_error(f);
+}
+
+/*
+ * ram_load_ext: load a RAM_SAVE_FLAG_EXT record
+ *
+ * Returns 0 for success or -errno in case of error
+ *
+ * @f: QEMUFile where to read the data from
+ */
+static int ram_load_ext(QEMUFile *f)
+{
+    QEMUSnapshotInfo parent = {};
+    char id[256];
+    uint8_t type = qemu_get_byte(f);
+
+    switch (type) {
+    case RAM_SAVE_EXT_SNAPSHOT_PARENT:
+        qemu_get_counted_string(f, parent.name);
+        qemu_get_counted_string(f, id);
+        pstrcpy(parent.id_str, sizeof(parent.id_str), id);
+        parent.date_sec = qemu_get_be32(f);
+        parent.date_nsec = qemu_get_be32(f);
+        parent.vm_clock_nsec = qemu_get_be64(f);
+        trace_ram_load_snapshot_parent(parent.name, parent.id_str);
+        /* load_snapshot() must have loaded the parent first */
+        if (!ram_snapshot.has_loaded ||
+            !ram_snapshot_same(&parent, &ram_snapshot.loaded)) {
+            error_report("Incremental snapshot needs snapshot '%s' (id %s) "
+                         "to be loaded first", parent.name, parent.id_str);
+            return -EINVAL;
+        }
+        return 0;
+    case RAM_SAVE_EXT_BLOCK_DATA:
+        return ram_load_block_data(f);
+    default:
+        error_report("Unknown RAM record type %d", type);
+        return -EINVAL;
+    }
+}
+
 /**
  * ram_load_precopy: load pages in precopy case
  *
@@ -4006,6 +4691,10 @@ static int ram_load_precopy(QEMUFile *f)
             }
             break;
 
+        case RAM_SAVE_FLAG_EXT:
+            ret = ram_load_ext(f);
+            break;
+
         case RAM_SAVE_FLAG_ZERO:
             ch = qemu_get_byte(f);
             ram_handle_compressed(host, ch, TARGET_PAGE_SIZE);
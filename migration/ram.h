@@ -32,6 +32,7 @@
 #include "qapi/qapi-types-migration.h"
 #include "exec/cpu-common.h"
 #include "io/channel.h"
+#include "block/snapshot.h"
 
 extern XBZRLECacheStats xbzrle_counters;
 extern CompressionStats compression_counters;
@@ -89,6 +90,15 @@ bool ram_write_tracking_available(void);
 bool ram_write_tracking_compatible(void);
 void ram_write_tracking_prepare(void);
 int ram_write_tracking_start(void);
+int ram_write_tracking_start_cow(void);
 void ram_write_tracking_stop(void);
 
+/* Incremental snapshots */
+void ram_snapshot_track_start(const QEMUSnapshotInfo *sn);
+void ram_snapshot_track_stop(void);
+bool ram_snapshot_get_parent(QEMUSnapshotInfo *parent);
+void ram_snapshot_save_begin(const QEMUSnapshotInfo *sn);
+void ram_snapshot_save_end(void);
+void ram_snapshot_set_loaded(const QEMUSnapshotInfo *sn);
+
 #endif
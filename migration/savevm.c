@@ -915,13 +915,183 @@ void vmstate_unregister(VMStateIf *obj, const VMStateDescription *vmsd,
     }
 }
 
+/*
+ * post_load_async() handlers are run by a small pool of worker threads
+ * while the main thread carries on loading the rest of the stream.  The
+ * workers are started on demand and stopped by loadvm_async_wait(), which
+ * must run before the VM is allowed to start.  Everything below, including
+ * the threads themselves, is protected by @lock; it is initialized once at
+ * startup and never destroyed.
+ */
+#define LOADVM_ASYNC_MAX_THREADS 4
+
+typedef struct LoadvmAsyncJob {
+    SaveStateEntry *se;
+    int version_id;
+    QSIMPLEQ_ENTRY(LoadvmAsyncJob) next;
+} LoadvmAsyncJob;
+
+static struct {
+    QemuMutex lock;
+    /* Signalled when a job is queued or the workers should quit */
+    QemuCond job_cond;
+    /* Signalled when the last pending job is done */
+    QemuCond done_cond;
+    QSIMPLEQ_HEAD(, LoadvmAsyncJob) jobs;
+    QemuThread threads[LOADVM_ASYNC_MAX_THREADS];
+    /* Number of started workers, not yet joined */
+    int nr_threads;
+    int pending;
+    /* First error returned by a handler */
+    int ret;
+    bool quit;
+} loadvm_async;
+
+static void __attribute__((__constructor__)) loadvm_async_init(void)
+{
+    qemu_mutex_init(&loadvm_async.lock);
+    qemu_cond_init(&loadvm_async.job_cond);
+    qemu_cond_init(&loadvm_async.done_cond);
+    QSIMPLEQ_INIT(&loadvm_async.jobs);
+}
+
+static void *loadvm_async_thread(void *opaque)
+{
+    LoadvmAsyncJob *job;
+    int ret;
+
+    rcu_register_thread();
+
+    qemu_mutex_lock(&loadvm_async.lock);
+    while (true) {
+        while (QSIMPLEQ_EMPTY(&loadvm_async.jobs) && !loadvm_async.quit) {
+            qemu_cond_wait(&loadvm_async.job_cond, &loadvm_async.lock);
+        }
+        job = QSIMPLEQ_FIRST(&loadvm_async.jobs);
+        if (!job) {
+            break;
+        }
+        QSIMPLEQ_REMOVE_HEAD(&loadvm_async.jobs, next);
+        qemu_mutex_unlock(&loadvm_async.lock);
+
+        ret = job->se->vmsd->post_load_async(job->se->opaque,
+                                             job->version_id);
+        trace_loadvm_async_post_load(job->se->idstr, ret);
+        if (ret < 0) {
+            error_report("%s: post_load_async failed: %d",
+                         job->se->idstr, ret);
+        }
+
+        qemu_mutex_lock(&loadvm_async.lock);
+        if (ret < 0 && !loadvm_async.ret) {
+            loadvm_async.ret = ret;
+        }
+        if (--loadvm_async.pending == 0) {
+            qemu_cond_broadcast(&loadvm_async.done_cond);
+        }
+        g_free(job);
+    }
+    qemu_mutex_unlock(&loadvm_async.lock);
+
+    rcu_unregister_thread();
+    return NULL;
+}
+
+static void loadvm_async_submit(SaveStateEntry *se, int version_id)
+{
+    LoadvmAsyncJob *job = g_new0(LoadvmAsyncJob, 1);
+    int nr_threads;
+
+    job->se = se;
+    job->version_id = version_id;
+
+    qemu_mutex_lock(&loadvm_async.lock);
+    QSIMPLEQ_INSERT_TAIL(&loadvm_async.jobs, job, next);
+    loadvm_async.pending++;
+    qemu_cond_signal(&loadvm_async.job_cond);
+
+    /* Start another worker while every existing one may be busy */
+    if (loadvm_async.nr_threads < MIN(loadvm_async.pending,
+                                      LOADVM_ASYNC_MAX_THREADS)) {
+        qemu_thread_create(&loadvm_async.threads[loadvm_async.nr_threads++],
+                           "mig/dst/load", loadvm_async_thread, NULL,
+                           QEMU_THREAD_JOINABLE);
+    }
+    nr_threads = loadvm_async.nr_threads;
+    qemu_mutex_unlock(&loadvm_async.lock);
+
+    trace_loadvm_async_submit(se->idstr, nr_threads);
+}
+
+static bool loadvm_async_running(void)
+{
+    QEMU_LOCK_GUARD(&loadvm_async.lock);
+    return loadvm_async.nr_threads > 0;
+}
+
+/*
+ * Wait for all queued post_load_async() handlers and stop the workers.
+ *
+ * Handlers may take the BQL for the parts of their work that need it, so
+ * it is dropped while waiting if the caller holds it.
+ *
+ * Returns the first error returned by a handler, or 0.
+ */
+static int loadvm_async_wait(void)
+{
+    bool iothread_locked;
+    int i, nr_threads, ret;
+
+    if (!loadvm_async_running()) {
+        return 0;
+    }
+
+    iothread_locked = qemu_mutex_iothread_locked();
+    if (iothread_locked) {
+        qemu_mutex_unlock_iothread();
+    }
+
+    qemu_mutex_lock(&loadvm_async.lock);
+    while (loadvm_async.pending) {
+        qemu_cond_wait(&loadvm_async.done_cond, &loadvm_async.lock);
+    }
+    nr_threads = loadvm_async.nr_threads;
+    loadvm_async.quit = true;
+    qemu_cond_broadcast(&loadvm_async.job_cond);
+    qemu_mutex_unlock(&loadvm_async.lock);
+
+    /* Only the loading thread submits jobs, so no worker can be added */
+    for (i = 0; i < nr_threads; i++) {
+        qemu_thread_join(&loadvm_async.threads[i]);
+    }
+
+    qemu_mutex_lock(&loadvm_async.lock);
+    ret = loadvm_async.ret;
+    loadvm_async.nr_threads = 0;
+    loadvm_async.ret = 0;
+    loadvm_async.quit = false;
+    qemu_mutex_unlock(&loadvm_async.lock);
+
+    if (iothread_locked) {
+        qemu_mutex_lock_iothread();
+    }
+
+    return ret;
+}
+
 static int vmstate_load(QEMUFile *f, SaveStateEntry *se)
 {
+    int ret;
+
     trace_vmstate_load(se->idstr, se->vmsd ? se->vmsd->name : "(old)");
     if (!se->vmsd) {         /* Old style */
         return se->ops->load_state(f, se->opaque, se->load_version_id);
     }
-    return vmstate_load_state(f, se->vmsd, se->opaque, se->load_version_id);
+    ret = vmstate_load_state(f, se->vmsd, se->opaque, se->load_version_id);
+    if (ret == 0 && se->vmsd->post_load_async) {
+        loadvm_async_submit(se, se->load_version_id);
+    }
+    return ret;
 }
 
 static void vmstate_save_old_style(QEMUFile *f, SaveStateEntry *se,
@@ -2069,6 +2239,7 @@ static void loadvm_postcopy_handle_run_bh(void *opaque)
 
     dirty_bitmap_mig_before_vm_start();
 
+    assert(!loadvm_async_running());
     if (autostart) {
         /* Hold onto your hats, starting the CPU */
         vm_start();
@@ -2086,6 +2257,7 @@ static void loadvm_postcopy_handle_run_bh(void *opaque)
 static int loadvm_postcopy_handle_run(MigrationIncomingState *mis)
 {
     PostcopyState ps = postcopy_state_get();
+    int ret;
 
     trace_loadvm_postcopy_handle_run();
     if (ps != POSTCOPY_INCOMING_LISTENING) {
@@ -2093,6 +2265,12 @@ static int loadvm_postcopy_handle_run(MigrationIncomingState *mis)
         return -1;
     }
 
+    /* The bottom half starts the VM, all device state must be in place */
+    ret = loadvm_async_wait();
+    if (ret < 0) {
+        return ret;
+    }
+
     postcopy_state_set(POSTCOPY_INCOMING_RUNNING);
     mis->bh = qemu_bh_new(loadvm_postcopy_handle_run_bh, mis);
     qemu_bh_schedule(mis->bh);
@@ -2697,7 +2875,7 @@ static bool postcopy_pause_incoming(MigrationIncomingState *mis)
 int qemu_loadvm_state_main(QEMUFile *f, MigrationIncomingState *mis)
 {
     uint8_t section_type;
-    int ret = 0;
+    int ret = 0, ret2;
 
 retry:
     while (true) {
@@ -2742,6 +2920,15 @@ retry:
     }
 
 out:
+    /*
+     * Device state must be fully applied before anyone can start the VM,
+     * and no handler may still be running if we bail out.
+     */
+    ret2 = loadvm_async_wait();
+    if (ret >= 0 && ret2 < 0) {
+        ret = ret2;
+    }
+
     if (ret < 0) {
         qemu_file_set_error(f, ret);
 
@@ -2862,19 +3049,126 @@ int qemu_load_device_state(QEMUFile *f)
     return 0;
 }
 
-bool save_snapshot(const char *name, bool overwrite, const char *vmstate,
-                  bool has_devices, strList *devices, Error **errp)
+static bool snapshot_has_parent(const QEMUSnapshotInfo *sn)
+{
+    return sn->parent_id_str[0] != '\0';
+}
+
+static bool snapshot_is_parent_of(const QEMUSnapshotInfo *parent,
+                                  const QEMUSnapshotInfo *sn)
+{
+    return snapshot_has_parent(sn) &&
+           !strcmp(sn->parent_id_str, parent->id_str);
+}
+
+/*
+ * Look for a snapshot on @bs that matches @test and @opaque; on success
+ * it is copied to @found.  Called with the AioContext of @bs held.
+ */
+static bool snapshot_find_match(BlockDriverState *bs,
+                                bool (*test)(const QEMUSnapshotInfo *sn,
+                                             const void *opaque),
+                                const void *opaque, QEMUSnapshotInfo *found)
+{
+    g_autofree QEMUSnapshotInfo *sn_tab = NULL;
+    int nb_sns, i;
+
+    nb_sns = bdrv_snapshot_list(bs, &sn_tab);
+    for (i = 0; i < nb_sns; i++) {
+        if (test(&sn_tab[i], opaque)) {
+            *found = sn_tab[i];
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool snapshot_test_child(const QEMUSnapshotInfo *sn, const void *opaque)
+{
+    return snapshot_is_parent_of(opaque, sn);
+}
+
+static bool snapshot_test_parent(const QEMUSnapshotInfo *sn, const void *opaque)
+{
+    return snapshot_is_parent_of(sn, opaque);
+}
+
+static bool snapshot_test_same(const QEMUSnapshotInfo *sn, const void *opaque)
+{
+    const QEMUSnapshotInfo *other = opaque;
+
+    return !strcmp(sn->id_str, other->id_str) &&
+           sn->date_sec == other->date_sec &&
+           sn->date_nsec == other->date_nsec &&
+           sn->vm_clock_nsec == other->vm_clock_nsec;
+}
+
+/*
+ * Refuse to delete snapshot @name if the VM state of an incremental
+ * snapshot was saved on top of it.  The image holding the VM state
+ * refuses that as well, but only once the snapshot may already have been
+ * deleted from other devices; check up front.
+ */
+static bool snapshot_check_no_children(const char *name, bool has_devices,
+                                       strList *devices, Error **errp)
 {
     BlockDriverState *bs;
-    QEMUSnapshotInfo sn1, *sn = &sn1;
-    int ret = -1, ret2;
-    QEMUFile *f;
-    int saved_vm_running;
-    uint64_t vm_state_size;
-    g_autoptr(GDateTime) now = g_date_time_new_now_local();
+    QEMUSnapshotInfo sn, child;
     AioContext *aio_context;
+    bool found = false;
 
-    GLOBAL_STATE_CODE();
+    bs = bdrv_all_find_vmstate_bs(NULL, has_devices, devices, NULL);
+    if (!bs) {
+        return true;
+    }
+
+    aio_context = bdrv_get_aio_context(bs);
+    aio_context_acquire(aio_context);
+    if (bdrv_snapshot_find(bs, &sn, name) == 0) {
+        found = snapshot_find_match(bs, snapshot_test_child, &sn, &child);
+    }
+    aio_context_release(aio_context);
+
+    if (found) {
+        error_setg(errp, "Snapshot '%s' is the parent of incremental "
+                   "snapshot '%s'", name, child.name);
+        return false;
+    }
+    return true;
+}
+
+/*
+ * With incremental-snapshot, make @sn only hold the RAM dirtied since
+ * the snapshot that was last loaded or saved, as long as that one still
+ * exists on @bs: it may have been deleted, or overwritten by @sn itself.
+ * Otherwise @sn is saved in full.
+ */
+static void save_snapshot_set_parent(BlockDriverState *bs,
+                                     QEMUSnapshotInfo *sn)
+{
+    QEMUSnapshotInfo parent, found;
+
+    if (!migrate_incremental_snapshot() || !ram_snapshot_get_parent(&parent)) {
+        return;
+    }
+    if (!snapshot_find_match(bs, snapshot_test_same, &parent, &found)) {
+        return;
+    }
+
+    pstrcpy(sn->parent_id_str, sizeof(sn->parent_id_str), found.id_str);
+}
+
+/*
+ * Checks common to all ways of saving a snapshot, and removal of an older
+ * snapshot with the same name if @overwrite is set.  On success the node
+ * that will hold the VM state is returned in @bsp.
+ */
+static bool save_snapshot_check(const char *name, bool overwrite,
+                                const char *vmstate, bool has_devices,
+                                strList *devices, BlockDriverState **bsp,
+                                Error **errp)
+{
+    int ret;
 
     if (migration_is_blocked(errp)) {
         return false;
@@ -2893,16 +3187,20 @@ bool save_snapshot(const char *name, bool overwrite, const char *vmstate,
     /* Delete old snapshots of the same name */
     if (name) {
         if (overwrite) {
+            if (!snapshot_check_no_children(name, has_devices, devices,
+                                            errp)) {
+                return false;
+            }
             if (bdrv_all_delete_snapshot(name, has_devices,
                                          devices, errp) < 0) {
                 return false;
             }
         } else {
-            ret2 = bdrv_all_has_snapshot(name, has_devices, devices, errp);
-            if (ret2 < 0) {
+            ret = bdrv_all_has_snapshot(name, has_devices, devices, errp);
+            if (ret < 0) {
                 return false;
             }
-            if (ret2 == 1) {
+            if (ret == 1) {
                 error_setg(errp,
                            "Snapshot '%s' already exists in one or more devices",
                            name);
@@ -2911,24 +3209,13 @@ bool save_snapshot(const char *name, bool overwrite, const char *vmstate,
         }
     }
 
-    bs = bdrv_all_find_vmstate_bs(vmstate, has_devices, devices, errp);
-    if (bs == NULL) {
-        return false;
-    }
-    aio_context = bdrv_get_aio_context(bs);
-
-    saved_vm_running = runstate_is_running();
-
-    ret = global_state_store();
-    if (ret) {
-        error_setg(errp, "Error saving global state");
-        return false;
-    }
-    vm_stop(RUN_STATE_SAVE_VM);
-
-    bdrv_drain_all_begin();
+    *bsp = bdrv_all_find_vmstate_bs(vmstate, has_devices, devices, errp);
+    return *bsp != NULL;
+}
 
-    aio_context_acquire(aio_context);
+static void save_snapshot_fill_info(QEMUSnapshotInfo *sn, const char *name)
+{
+    g_autoptr(GDateTime) now = g_date_time_new_now_local();
 
     memset(sn, 0, sizeof(*sn));
 
@@ -2948,6 +3235,42 @@ bool save_snapshot(const char *name, bool overwrite, const char *vmstate,
         g_autofree char *autoname = g_date_time_format(now,  "vm-%Y%m%d%H%M%S");
         pstrcpy(sn->name, sizeof(sn->name), autoname);
     }
+}
+
+bool save_snapshot(const char *name, bool overwrite, const char *vmstate,
+                  bool has_devices, strList *devices, Error **errp)
+{
+    BlockDriverState *bs;
+    QEMUSnapshotInfo sn1, *sn = &sn1, saved;
+    int ret = -1, ret2;
+    QEMUFile *f;
+    int saved_vm_running;
+    uint64_t vm_state_size;
+    AioContext *aio_context;
+
+    GLOBAL_STATE_CODE();
+
+    if (!save_snapshot_check(name, overwrite, vmstate, has_devices, devices,
+                             &bs, errp)) {
+        return false;
+    }
+    aio_context = bdrv_get_aio_context(bs);
+
+    saved_vm_running = runstate_is_running();
+
+    ret = global_state_store();
+    if (ret) {
+        error_setg(errp, "Error saving global state");
+        return false;
+    }
+    vm_stop(RUN_STATE_SAVE_VM);
+
+    bdrv_drain_all_begin();
+
+    aio_context_acquire(aio_context);
+
+    save_snapshot_fill_info(sn, name);
+    save_snapshot_set_parent(bs, sn);
 
     /* save the VM state */
     f = qemu_fopen_bdrv(bs, 1);
@@ -2955,7 +3278,9 @@ bool save_snapshot(const char *name, bool overwrite, const char *vmstate,
         error_setg(errp, "Could not open VM state file");
         goto the_end;
     }
+    ram_snapshot_save_begin(sn);
     ret = qemu_savevm_state(f, errp);
+    ram_snapshot_save_end();
     vm_state_size = qemu_file_transferred(f);
     ret2 = qemu_fclose(f);
     if (ret < 0) {
@@ -2988,6 +3313,24 @@ bool save_snapshot(const char *name, bool overwrite, const char *vmstate,
         aio_context_release(aio_context);
     }
 
+    /*
+     * The VM is still stopped, so RAM is exactly what was just saved.
+     * Each device assigns its own id, track the entry holding the VM state.
+     */
+    if (ret == 0 && migrate_incremental_snapshot()) {
+        aio_context = bdrv_get_aio_context(bs);
+        aio_context_acquire(aio_context);
+        ret2 = bdrv_snapshot_find(bs, &saved, sn->name);
+        aio_context_release(aio_context);
+    } else {
+        ret2 = -1;
+    }
+    if (ret == 0 && ret2 == 0) {
+        ram_snapshot_track_start(&saved);
+    } else {
+        ram_snapshot_track_stop();
+    }
+
     bdrv_drain_all_end();
 
     if (saved_vm_running) {
@@ -3078,13 +3421,24 @@ void qmp_xen_load_devices_state(const char *filename, Error **errp)
     migration_incoming_state_destroy();
 }
 
-bool load_snapshot(const char *name, const char *vmstate,
-                   bool has_devices, strList *devices, Error **errp)
+/* Bound the chain of parents of an incremental snapshot */
+#define LOAD_SNAPSHOT_MAX_DEPTH 64
+
+/*
+ * Load snapshot @name into @sn.  If @expect is not NULL, the snapshot
+ * must be that one and not just have the same name.  An incremental
+ * snapshot is applied on top of its parent, which is loaded first.
+ */
+static bool load_snapshot_one(const char *name, const char *vmstate,
+                              bool has_devices, strList *devices,
+                              const QEMUSnapshotInfo *expect, int depth,
+                              QEMUSnapshotInfo *sn, Error **errp)
 {
     BlockDriverState *bs_vm_state;
-    QEMUSnapshotInfo sn;
+    QEMUSnapshotInfo parent, loaded;
     QEMUFile *f;
     int ret;
+    bool has_parent = false;
     AioContext *aio_context;
     MigrationIncomingState *mis = migration_incoming_get_current();
 
@@ -3109,14 +3463,42 @@ bool load_snapshot(const char *name, const char *vmstate,
 
     /* Don't even try to load empty VM states */
     aio_context_acquire(aio_context);
-    ret = bdrv_snapshot_find(bs_vm_state, &sn, name);
+    ret = bdrv_snapshot_find(bs_vm_state, sn, name);
+    if (ret == 0 && snapshot_has_parent(sn)) {
+        has_parent = snapshot_find_match(bs_vm_state, snapshot_test_parent,
+                                         sn, &parent);
+    }
     aio_context_release(aio_context);
     if (ret < 0) {
         return false;
-    } else if (sn.vm_state_size == 0) {
+    } else if (sn->vm_state_size == 0) {
         error_setg(errp, "This is a disk-only snapshot. Revert to it "
                    " offline using qemu-img");
         return false;
+    } else if (expect && !snapshot_test_same(sn, expect)) {
+        error_setg(errp, "Snapshot '%s' was replaced after its incremental "
+                   "snapshots were saved", name);
+        return false;
+    }
+
+    if (snapshot_has_parent(sn)) {
+        /* The VM state only holds the RAM changed since the parent */
+        if (!has_parent) {
+            error_setg(errp, "Parent of incremental snapshot '%s' does not "
+                       "exist", name);
+            return false;
+        }
+        if (depth >= LOAD_SNAPSHOT_MAX_DEPTH) {
+            error_setg(errp, "Snapshot '%s' has too many parent snapshots",
+                       name);
+            return false;
+        }
+        if (!load_snapshot_one(parent.name, vmstate, has_devices, devices,
+                               &parent, depth + 1, &loaded, errp)) {
+            error_prepend(errp, "Could not load '%s', parent of snapshot "
+                          "'%s': ", parent.name, name);
+            return false;
+        }
     }
 
     /*
@@ -3140,7 +3522,10 @@ bool load_snapshot(const char *name, const char *vmstate,
         goto err_drain;
     }
 
-    qemu_system_reset(SHUTDOWN_CAUSE_SNAPSHOT_LOAD);
+    /* Keep the RAM of the parent, including RAM-backed ROM blobs */
+    if (!snapshot_has_parent(sn)) {
+        qemu_system_reset(SHUTDOWN_CAUSE_SNAPSHOT_LOAD);
+    }
     mis->from_src_file = f;
 
     if (!yank_register_instance(MIGRATION_YANK_INSTANCE, errp)) {
@@ -3148,7 +3533,9 @@ bool load_snapshot(const char *name, const char *vmstate,
         goto err_drain;
     }
     aio_context_acquire(aio_context);
+    ram_snapshot_set_loaded(snapshot_has_parent(sn) ? &parent : NULL);
     ret = qemu_loadvm_state(f);
+    ram_snapshot_set_loaded(NULL);
     migration_incoming_state_destroy();
     aio_context_release(aio_context);
 
@@ -3166,6 +3553,22 @@ err_drain:
     return false;
 }
 
+bool load_snapshot(const char *name, const char *vmstate,
+                   bool has_devices, strList *devices, Error **errp)
+{
+    QEMUSnapshotInfo sn;
+
+    if (!load_snapshot_one(name, vmstate, has_devices, devices, NULL, 0,
+                           &sn, errp)) {
+        return false;
+    }
+
+    if (migrate_incremental_snapshot()) {
+        ram_snapshot_track_start(&sn);
+    }
+    return true;
+}
+
 bool delete_snapshot(const char *name, bool has_devices,
                      strList *devices, Error **errp)
 {
@@ -3173,6 +3576,10 @@ bool delete_snapshot(const char *name, bool has_devices,
         return false;
     }
 
+    if (!snapshot_check_no_children(name, has_devices, devices, errp)) {
+        return false;
+    }
+
     if (bdrv_all_delete_snapshot(name, has_devices, devices, errp) < 0) {
         return false;
     }
@@ -3216,6 +3623,15 @@ typedef struct SnapshotJob {
     Coroutine *co;
     Error **errp;
     bool ret;
+
+    /* Background save only */
+    BlockDriverState *bs;
+    AioContext *aio_context;
+    QEMUSnapshotInfo sn;
+    QEMUFile *f;
+    /* Device state, stashed while the VM was stopped */
+    QIOChannelBuffer *bioc;
+    QEMUFile *fb;
 } SnapshotJob;
 
 static void qmp_snapshot_job_free(SnapshotJob *s)
@@ -3248,11 +3664,279 @@ static void snapshot_load_job_bh(void *opaque)
     aio_co_wake(s->co);
 }
 
+/*
+ * Background snapshots.
+ *
+ * With the background-snapshot capability set, the VM is only stopped
+ * while device state is saved into a buffer.  RAM is then written to the
+ * vmstate area from the main loop while the guest runs: guest memory is
+ * write-protected with userfaultfd and pages are copied aside on their
+ * first write (see ram_write_tracking_start_cow()), so the snapshot still
+ * reflects the moment the VM was stopped.
+ *
+ * Block devices are only drained while the VM is stopped, and the disk
+ * snapshots are taken there.  The image holding the VM state gets a
+ * disk-only snapshot too; RAM is written to its vmstate area while the
+ * guest keeps using the disk, and the VM state is moved into that same
+ * snapshot at the end with bdrv_snapshot_attach_vmstate().
+ *
+ * The job runs as a migration as far as ms->state is concerned, so that
+ * migrate_cancel and query-migrate work as they do for migrations.
+ *
+ * The stream has the same layout as a background-snapshot migration: RAM
+ * first, then the stashed device state.
+ */
+static void snapshot_save_bg_complete(SnapshotJob *s, int ret)
+{
+    MigrationState *ms = migrate_get_current();
+    uint64_t vm_state_size;
+    int ret2;
+    int new_state;
+
+    /* Un-protect guest RAM and drop the remaining page copies */
+    ram_write_tracking_stop();
+
+    /* migrate_cancel shuts s->f down, don't report that as an I/O error */
+    if (ret < 0 && ms->state == MIGRATION_STATUS_CANCELLING) {
+        ret = -ECANCELED;
+    }
+
+    aio_context_acquire(s->aio_context);
+    if (ret >= 0) {
+        /* RAM is in the stream, now append the stashed device state */
+        qemu_put_buffer(s->f, s->bioc->data, s->bioc->usage);
+        qemu_fflush(s->f);
+        ret = qemu_file_get_error(s->f);
+    }
+    qemu_savevm_state_cleanup();
+    ms->to_dst_file = NULL;
+
+    vm_state_size = qemu_file_transferred(s->f);
+    ret2 = qemu_fclose(s->f);
+    qemu_fclose(s->fb);
+    aio_context_release(s->aio_context);
+
+    if (ret == -ECANCELED) {
+        error_setg(s->errp, "Snapshot was cancelled");
+    } else if (ret < 0) {
+        error_setg_errno(s->errp, -ret, "Error while writing VM state");
+    } else if (ret2 < 0) {
+        ret = ret2;
+        error_setg_errno(s->errp, -ret, "Error while writing VM state");
+    } else {
+        /* Unlike re-creating the snapshot, this keeps its ID */
+        aio_context_acquire(s->aio_context);
+        ret = bdrv_snapshot_attach_vmstate(s->bs, s->sn.id_str,
+                                           vm_state_size, s->errp);
+        aio_context_release(s->aio_context);
+    }
+
+    if (ret == -ECANCELED && ms->state == MIGRATION_STATUS_CANCELLING) {
+        migrate_set_state(&ms->state, MIGRATION_STATUS_CANCELLING,
+                          MIGRATION_STATUS_CANCELLED);
+    } else {
+        if (ret == -ECANCELED) {
+            new_state = MIGRATION_STATUS_CANCELLED;
+        } else if (ret < 0) {
+            new_state = MIGRATION_STATUS_FAILED;
+        } else {
+            new_state = MIGRATION_STATUS_COMPLETED;
+        }
+        migrate_set_state(&ms->state, MIGRATION_STATUS_ACTIVE, new_state);
+    }
+
+    if (ret < 0) {
+        bdrv_all_delete_snapshot(s->sn.name, true, s->devices, NULL);
+    }
+
+    s->ret = ret == 0;
+    qmp_snapshot_job_free(s);
+    aio_co_wake(s->co);
+}
+
+static void snapshot_save_bg_iterate_bh(void *opaque)
+{
+    SnapshotJob *s = opaque;
+    MigrationState *ms = migrate_get_current();
+    uint64_t transferred = qemu_file_transferred(s->f);
+    int ret;
+
+    /* migrate_cancel also stops a background snapshot */
+    if (job_is_cancelled(&s->common) ||
+        qatomic_read(&ms->state) == MIGRATION_STATUS_CANCELLING) {
+        snapshot_save_bg_complete(s, -ECANCELED);
+        return;
+    }
+
+    aio_context_acquire(s->aio_context);
+    ret = qemu_savevm_state_iterate(s->f, false);
+    if (ret >= 0) {
+        ret = qemu_file_get_error(s->f);
+    }
+    aio_context_release(s->aio_context);
+
+    job_progress_update(&s->common, qemu_file_transferred(s->f) - transferred);
+    job_progress_set_remaining(&s->common, ram_bytes_remaining());
+
+    if (ret == 0) {
+        /* Give the rest of the main loop a chance between iterations */
+        aio_bh_schedule_oneshot(qemu_get_aio_context(),
+                                snapshot_save_bg_iterate_bh, s);
+        return;
+    }
+
+    snapshot_save_bg_complete(s, ret);
+}
+
+static bool snapshot_save_bg_start(SnapshotJob *s, Error **errp)
+{
+    MigrationState *ms = migrate_get_current();
+    bool vm_was_running;
+    int ret;
+
+    if (!save_snapshot_check(s->tag, false, s->vmstate, true, s->devices,
+                             &s->bs, errp)) {
+        return false;
+    }
+
+    if (migration_is_running(ms->state)) {
+        error_setg(errp, QERR_MIGRATION_ACTIVE);
+        return false;
+    }
+
+    if (migrate_block()) {
+        error_setg(errp, "Block migration and snapshots are incompatible");
+        return false;
+    }
+
+    /* Memory configuration may have changed since the capability was set */
+    if (!ram_write_tracking_compatible()) {
+        error_setg(errp, "Background snapshot is not supported for the "
+                   "current guest memory configuration");
+        return false;
+    }
+
+    s->aio_context = bdrv_get_aio_context(s->bs);
+    vm_was_running = runstate_is_running();
+
+    if (global_state_store()) {
+        error_setg(errp, "Error saving global state");
+        return false;
+    }
+    vm_stop(RUN_STATE_SAVE_VM);
+
+    bdrv_drain_all_begin();
+
+    save_snapshot_fill_info(&s->sn, s->tag);
+
+    aio_context_acquire(s->aio_context);
+
+    s->f = qemu_fopen_bdrv(s->bs, 1);
+    s->bioc = qio_channel_buffer_new(512 * 1024);
+    qio_channel_set_name(QIO_CHANNEL(s->bioc), "vmstate-buffer");
+    s->fb = qemu_file_new_output(QIO_CHANNEL(s->bioc));
+    object_unref(OBJECT(s->bioc));
+
+    migrate_init(ms);
+    memset(&mig_stats, 0, sizeof(mig_stats));
+    memset(&compression_counters, 0, sizeof(compression_counters));
+    ms->to_dst_file = s->f;
+
+    /*
+     * Populate RAM pages before protecting them, see
+     * ram_write_tracking_prepare().
+     */
+    ram_write_tracking_prepare();
+
+    qemu_mutex_unlock_iothread();
+    qemu_savevm_state_header(s->f);
+    qemu_savevm_state_setup(s->f);
+    qemu_mutex_lock_iothread();
+
+    cpu_synchronize_all_states();
+    ret = qemu_savevm_state_complete_precopy_non_iterable(s->fb, false, false);
+    if (ret == 0) {
+        /* Device state is read back directly from s->bioc->data */
+        qemu_fflush(s->fb);
+        ret = qemu_file_get_error(s->fb) ?: qemu_file_get_error(s->f);
+    }
+    if (ret == 0) {
+        ret = ram_write_tracking_start_cow();
+    }
+
+    aio_context_release(s->aio_context);
+
+    if (ret) {
+        error_setg_errno(errp, -ret, "Error while saving device state");
+        goto fail;
+    }
+
+    /*
+     * Capture the disks now, while they match the stopped VM.  The vmstate
+     * image gets a disk-only snapshot too, which snapshot_save_bg_complete()
+     * gives the VM state once it is written.  Other devices may have used
+     * different IDs, so look up the one the vmstate image has.
+     */
+    ret = bdrv_all_create_snapshot(&s->sn, s->bs, 0, true, s->devices, errp);
+    if (ret == 0) {
+        aio_context_acquire(s->aio_context);
+        if (bdrv_snapshot_find(s->bs, &s->sn, s->tag) < 0) {
+            error_setg(errp, "Could not find snapshot '%s' on '%s'", s->tag,
+                       bdrv_get_device_or_node_name(s->bs));
+            ret = -ENOENT;
+        }
+        aio_context_release(s->aio_context);
+    }
+    if (ret < 0) {
+        bdrv_all_delete_snapshot(s->tag, true, s->devices, NULL);
+        ram_write_tracking_stop();
+        goto fail;
+    }
+    bdrv_drain_all_end();
+
+    /*
+     * Write faults are resolved by the copy-on-write thread, so it is safe
+     * for the VM state change notifiers to touch guest memory here.
+     */
+    if (vm_was_running) {
+        vm_start();
+    }
+    migrate_set_state(&ms->state, MIGRATION_STATUS_SETUP,
+                      MIGRATION_STATUS_ACTIVE);
+    return true;
+
+fail:
+    qemu_savevm_state_cleanup();
+    migrate_set_state(&ms->state, MIGRATION_STATUS_SETUP,
+                      MIGRATION_STATUS_FAILED);
+    ms->to_dst_file = NULL;
+    qemu_fclose(s->f);
+    qemu_fclose(s->fb);
+    bdrv_drain_all_end();
+    if (vm_was_running) {
+        vm_start();
+    }
+    return false;
+}
+
 static void snapshot_save_job_bh(void *opaque)
 {
     Job *job = opaque;
     SnapshotJob *s = container_of(job, SnapshotJob, common);
 
+    if (migrate_background_snapshot()) {
+        if (snapshot_save_bg_start(s, s->errp)) {
+            job_progress_set_remaining(&s->common, ram_bytes_remaining());
+            aio_bh_schedule_oneshot(qemu_get_aio_context(),
+                                    snapshot_save_bg_iterate_bh, s);
+            return;
+        }
+        s->ret = false;
+        qmp_snapshot_job_free(s);
+        aio_co_wake(s->co);
+        return;
+    }
+
     job_progress_set_remaining(&s->common, 1);
     s->ret = save_snapshot(s->tag, false, s->vmstate,
                            true, s->devices, s->errp);
@@ -211,6 +211,88 @@ plugin_register_cb_udata(qemu_plugin_id_t id, enum qemu_plugin_event ev,
     do_plugin_register_cb(id, ev, func, udata);
 }
 
+/*
+ * Reserve the address space of an area and make its current size
+ * accessible.  Fresh anonymous memory is zeroed.
+ */
+static void *plugin_scoreboard_area_new__locked(void)
+{
+    void *area = mmap(NULL, PLUGIN_SCOREBOARD_AREA_MAX, PROT_NONE,
+                      MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+
+    if (area == MAP_FAILED ||
+        mprotect(area, plugin.scoreboard_size, PROT_READ | PROT_WRITE)) {
+        error_report("plugin: failed to allocate a scoreboard area: %s",
+                     strerror(errno));
+        abort();
+    }
+    return area;
+}
+
+/*
+ * Make @size bytes of every area accessible.  Areas do not move, so
+ * translated code and the entries handed out so far stay valid.
+ */
+static bool plugin_scoreboard_grow__locked(size_t size)
+{
+    struct qemu_plugin_scoreboard_areas *areas = plugin.scoreboard_areas;
+    unsigned int i;
+
+    if (size > PLUGIN_SCOREBOARD_AREA_MAX) {
+        return false;
+    }
+    for (i = 0; areas && i < areas->n; i++) {
+        if (areas->area[i] &&
+            mprotect(areas->area[i], size, PROT_READ | PROT_WRITE)) {
+            return false;
+        }
+    }
+    plugin.scoreboard_map =
+        bitmap_zero_extend(plugin.scoreboard_map,
+                           plugin.scoreboard_size / PLUGIN_SCOREBOARD_LINE_SIZE,
+                           size / PLUGIN_SCOREBOARD_LINE_SIZE);
+    plugin.scoreboard_size = size;
+    return true;
+}
+
+/*
+ * Give @cpu its scoreboard area.  The area of a vCPU index is kept
+ * when the vCPU goes away, and is reused if the index is.
+ */
+static void plugin_scoreboard_area_init__locked(CPUState *cpu)
+{
+    struct qemu_plugin_scoreboard_areas *areas = plugin.scoreboard_areas;
+    unsigned int idx = cpu->cpu_index;
+    void *area;
+
+    if (idx >= areas->n) {
+        struct qemu_plugin_scoreboard_areas *new;
+        unsigned int n = MAX(areas->n * 2, idx + 1);
+
+        new = g_malloc0(sizeof(*new) + n * sizeof(new->area[0]));
+        new->n = n;
+        memcpy(new->area, areas->area, areas->n * sizeof(areas->area[0]));
+        qatomic_rcu_set(&plugin.scoreboard_areas, new);
+        g_free_rcu(areas, rcu);
+        areas = new;
+    }
+
+    area = areas->area[idx];
+    if (!area) {
+        area = plugin_scoreboard_area_new__locked();
+        qatomic_set(&areas->area[idx], area);
+    }
+    qatomic_set(&cpu->plugin_scoreboard, area);
+}
+
+static void plugin_scoreboard_area_init_ht(gpointer k, gpointer v,
+                                           gpointer udata)
+{
+    CPUState *cpu = container_of(k, CPUState, cpu_index);
+
+    plugin_scoreboard_area_init__locked(cpu);
+}
+
 void qemu_plugin_vcpu_init_hook(CPUState *cpu)
 {
     bool success;
@@ -220,6 +302,9 @@ void qemu_plugin_vcpu_init_hook(CPUState *cpu)
     success = g_hash_table_insert(plugin.cpu_ht, &cpu->cpu_index,
                                   &cpu->cpu_index);
     g_assert(success);
+    if (plugin.scoreboard_areas) {
+        plugin_scoreboard_area_init__locked(cpu);
+    }
     qemu_rec_mutex_unlock(&plugin.lock);
 
     plugin_vcpu_cb__simple(cpu, QEMU_PLUGIN_EV_VCPU_INIT);
@@ -295,6 +380,23 @@ void plugin_register_inline_op(GArray **arr,
     dyn_cb->inline_insn.imm = imm;
 }
 
+void plugin_register_inline_op_per_vcpu(GArray **arr,
+                                        enum qemu_plugin_mem_rw rw,
+                                        enum qemu_plugin_op op,
+                                        qemu_plugin_u64 entry,
+                                        uint64_t imm)
+{
+    struct qemu_plugin_dyn_cb *dyn_cb;
+
+    dyn_cb = plugin_get_dyn_cb(arr);
+    dyn_cb->userp = NULL;
+    dyn_cb->type = PLUGIN_CB_INLINE_PER_VCPU;
+    dyn_cb->rw = rw;
+    dyn_cb->inline_insn.op = op;
+    dyn_cb->inline_insn.imm = imm;
+    dyn_cb->inline_insn.offset = entry.score->offset + entry.offset;
+}
+
 void plugin_register_dyn_cb__udata(GArray **arr,
                                    qemu_plugin_vcpu_udata_cb_t cb,
                                    enum qemu_plugin_cb_flags flags,
@@ -433,14 +535,22 @@ void qemu_plugin_flush_cb(void)
     plugin_cb__simple(QEMU_PLUGIN_EV_FLUSH);
 }
 
-void exec_inline_op(struct qemu_plugin_dyn_cb *cb)
+void exec_inline_op(struct qemu_plugin_dyn_cb *cb, CPUState *cpu)
 {
     uint64_t *val = cb->userp;
 
+    if (cb->type == PLUGIN_CB_INLINE_PER_VCPU) {
+        val = (uint64_t *)((uint8_t *)cpu->plugin_scoreboard +
+                           cb->inline_insn.offset);
+    }
+
     switch (cb->inline_insn.op) {
     case QEMU_PLUGIN_INLINE_ADD_U64:
         *val += cb->inline_insn.imm;
         break;
+    case QEMU_PLUGIN_INLINE_STORE_U64:
+        *val = cb->inline_insn.imm;
+        break;
     default:
         g_assert_not_reached();
     }
@@ -468,7 +578,8 @@ void qemu_plugin_vcpu_mem_cb(CPUState *cpu, uint64_t vaddr,
                            vaddr, cb->userp);
             break;
         case PLUGIN_CB_INLINE:
-            exec_inline_op(cb);
+        case PLUGIN_CB_INLINE_PER_VCPU:
+            exec_inline_op(cb, cpu);
             break;
         default:
             g_assert_not_reached();
@@ -476,6 +587,112 @@ void qemu_plugin_vcpu_mem_cb(CPUState *cpu, uint64_t vaddr,
     }
 }
 
+struct qemu_plugin_scoreboard *plugin_scoreboard_new(size_t element_size)
+{
+    struct qemu_plugin_scoreboard_areas *areas;
+    struct qemu_plugin_scoreboard *score = NULL;
+    unsigned long lines, start, n_lines;
+    unsigned int i;
+
+    lines = DIV_ROUND_UP(MAX(element_size, 1), PLUGIN_SCOREBOARD_LINE_SIZE);
+
+    qemu_rec_mutex_lock(&plugin.lock);
+    for (;;) {
+        n_lines = plugin.scoreboard_size / PLUGIN_SCOREBOARD_LINE_SIZE;
+        start = bitmap_find_next_zero_area(plugin.scoreboard_map, n_lines,
+                                           0, lines, 0);
+        if (start + lines <= n_lines) {
+            break;
+        }
+        if (!plugin_scoreboard_grow__locked(plugin.scoreboard_size * 2)) {
+            goto out;
+        }
+    }
+    bitmap_set(plugin.scoreboard_map, start, lines);
+
+    score = g_new(struct qemu_plugin_scoreboard, 1);
+    score->offset = start * PLUGIN_SCOREBOARD_LINE_SIZE;
+    score->size = lines * PLUGIN_SCOREBOARD_LINE_SIZE;
+
+    if (!plugin.scoreboard_areas) {
+        /* First scoreboard: from now on vCPUs need an area */
+        plugin.scoreboard_areas = g_new0(struct qemu_plugin_scoreboard_areas,
+                                         1);
+        g_hash_table_foreach(plugin.cpu_ht, plugin_scoreboard_area_init_ht,
+                             NULL);
+    } else {
+        /* The lines may have been used by a freed scoreboard */
+        areas = plugin.scoreboard_areas;
+        for (i = 0; i < areas->n; i++) {
+            if (areas->area[i]) {
+                memset((uint8_t *)areas->area[i] + score->offset, 0,
+                       score->size);
+            }
+        }
+    }
+out:
+    qemu_rec_mutex_unlock(&plugin.lock);
+    return score;
+}
+
+static void plugin_scoreboard_release(struct qemu_plugin_scoreboard *score)
+{
+    qemu_rec_mutex_lock(&plugin.lock);
+    bitmap_clear(plugin.scoreboard_map,
+                 score->offset / PLUGIN_SCOREBOARD_LINE_SIZE,
+                 score->size / PLUGIN_SCOREBOARD_LINE_SIZE);
+    qemu_rec_mutex_unlock(&plugin.lock);
+    g_free(score);
+}
+
+/* Called from a safe work item: no vCPU is running translated code */
+static void plugin_scoreboard_free_safe(CPUState *cpu, run_on_cpu_data arg)
+{
+    tb_flush(cpu);
+    plugin_scoreboard_release(arg.host_ptr);
+}
+
+/*
+ * Translated code may still update the lines of @score, so they can
+ * only be reused once the TBs that refer to them have been flushed.
+ */
+void plugin_scoreboard_free(struct qemu_plugin_scoreboard *score)
+{
+    CPUState *cpu = current_cpu ? current_cpu : first_cpu;
+
+    if (cpu) {
+        async_safe_run_on_cpu(cpu, plugin_scoreboard_free_safe,
+                              RUN_ON_CPU_HOST_PTR(score));
+    } else {
+        plugin_scoreboard_release(score);
+    }
+}
+
+/* Lockless, as it is called from vCPU callbacks. */
+void *plugin_scoreboard_find(struct qemu_plugin_scoreboard *score,
+                             unsigned int vcpu_index)
+{
+    struct qemu_plugin_scoreboard_areas *areas;
+    void *area = NULL;
+
+    WITH_RCU_READ_LOCK_GUARD() {
+        areas = qatomic_rcu_read(&plugin.scoreboard_areas);
+        if (areas && vcpu_index < areas->n) {
+            area = qatomic_read(&areas->area[vcpu_index]);
+        }
+    }
+    return area ? (uint8_t *)area + score->offset : NULL;
+}
+
+unsigned int plugin_scoreboard_n_vcpus(void)
+{
+    struct qemu_plugin_scoreboard_areas *areas;
+
+    RCU_READ_LOCK_GUARD();
+    areas = qatomic_rcu_read(&plugin.scoreboard_areas);
+    return areas ? areas->n : 0;
+}
+
 void qemu_plugin_atexit_cb(void)
 {
     plugin_cb__udata(QEMU_PLUGIN_EV_ATEXIT);
@@ -571,5 +788,8 @@ static void __attribute__((__constructor__)) plugin_init(void)
     QTAILQ_INIT(&plugin.ctxs);
     qht_init(&plugin.dyn_cb_arr_ht, plugin_dyn_cb_arr_cmp, 16,
              QHT_MODE_AUTO_RESIZE);
+    plugin.scoreboard_size = PLUGIN_SCOREBOARD_AREA_MIN;
+    plugin.scoreboard_map =
+        bitmap_new(PLUGIN_SCOREBOARD_AREA_MIN / PLUGIN_SCOREBOARD_LINE_SIZE);
     atexit(qemu_plugin_atexit_cb);
 }
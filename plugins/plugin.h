@@ -13,10 +13,44 @@
 #define PLUGIN_H
 
 #include <gmodule.h>
+#include "qemu/bitmap.h"
 #include "qemu/qht.h"
+#include "qemu/rcu.h"
+#include "qemu/units.h"
 
 #define QEMU_PLUGIN_MIN_VERSION 0
 
+/*
+ * Each vCPU gets an area holding its entries of all the scoreboards; a
+ * scoreboard is an offset within the areas.  Entries are allocated in
+ * units of a cache line.  Address space for the largest area is reserved
+ * up front so that areas never move, and is made accessible as
+ * scoreboards need it, starting from the minimum size.
+ */
+#define PLUGIN_SCOREBOARD_AREA_MIN   (64 * KiB)
+#if HOST_LONG_BITS == 64
+#define PLUGIN_SCOREBOARD_AREA_MAX   (16 * MiB)
+#else
+#define PLUGIN_SCOREBOARD_AREA_MAX   (1 * MiB)
+#endif
+#define PLUGIN_SCOREBOARD_LINE_SIZE  64
+
+struct qemu_plugin_scoreboard {
+    size_t offset;
+    size_t size;
+};
+
+/*
+ * Scoreboard areas indexed by vCPU index.  The areas are never freed,
+ * so that they outlive vCPUs for the atexit callbacks; the array itself
+ * is replaced under RCU when it grows.
+ */
+struct qemu_plugin_scoreboard_areas {
+    struct rcu_head rcu;
+    unsigned int n;
+    void *area[];
+};
+
 /* global state */
 struct qemu_plugin_state {
     QTAILQ_HEAD(, qemu_plugin_ctx) ctxs;
@@ -44,6 +78,15 @@ struct qemu_plugin_state {
      * the code cache is flushed.
      */
     struct qht dyn_cb_arr_ht;
+    /*
+     * Allocated when the first scoreboard is created, which is what
+     * makes vCPUs get a scoreboard area.  @scoreboard_map tracks the
+     * lines of the areas used by scoreboards.
+     */
+    struct qemu_plugin_scoreboard_areas *scoreboard_areas;
+    /* Accessible size of every area, and its lines used by scoreboards */
+    size_t scoreboard_size;
+    unsigned long *scoreboard_map;
 };
 
 
@@ -69,6 +112,12 @@ void plugin_register_inline_op(GArray **arr,
                                enum qemu_plugin_op op, void *ptr,
                                uint64_t imm);
 
+void plugin_register_inline_op_per_vcpu(GArray **arr,
+                                        enum qemu_plugin_mem_rw rw,
+                                        enum qemu_plugin_op op,
+                                        qemu_plugin_u64 entry,
+                                        uint64_t imm);
+
 void plugin_reset_uninstall(qemu_plugin_id_t id,
                             qemu_plugin_simple_cb_t cb,
                             bool reset);
@@ -95,6 +144,12 @@ void plugin_register_vcpu_mem_cb(GArray **arr,
                                  enum qemu_plugin_mem_rw rw,
                                  void *udata);
 
-void exec_inline_op(struct qemu_plugin_dyn_cb *cb);
+void exec_inline_op(struct qemu_plugin_dyn_cb *cb, CPUState *cpu);
+
+struct qemu_plugin_scoreboard *plugin_scoreboard_new(size_t element_size);
+void plugin_scoreboard_free(struct qemu_plugin_scoreboard *score);
+void *plugin_scoreboard_find(struct qemu_plugin_scoreboard *score,
+                             unsigned int vcpu_index);
+unsigned int plugin_scoreboard_n_vcpus(void);
 
 #endif /* PLUGIN_H */
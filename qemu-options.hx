@@ -182,9 +182,12 @@ DEF("accel", HAS_ARG, QEMU_OPTION_accel,
     "                igd-passthru=on|off (enable Xen integrated Intel graphics passthrough, default=off)\n"
     "                kernel-irqchip=on|off|split controls accelerated irqchip support (default=on)\n"
     "                kvm-shadow-mem=size of KVM shadow MMU in bytes\n"
+    "                atomic-lock=on|off (TCG: lock instead of stopping all vCPUs for atomics the host lacks, default=off)\n"
+    "                dirty-granule=n (TCG: granularity of migration dirty tracking, default=target page size)\n"
     "                one-insn-per-tb=on|off (one guest instruction per TCG translation block)\n"
     "                split-wx=on|off (enable TCG split w^x mapping)\n"
     "                tb-size=n (TCG translation block cache size)\n"
+    "                tb-stats=on|off (gather TCG translation block statistics, default=off)\n"
     "                dirty-ring-size=n (KVM dirty ring GFN count, default 0)\n"
     "                notify-vmexit=run|internal-error|disable,notify-window=n (enable notify VM exit and set notify window, x86 only)\n"
     "                thread=single|multi (enable multi-threaded TCG)\n", QEMU_ARCH_ALL)
@@ -196,6 +199,27 @@ SRST
     specified, the next one is used if the previous one fails to
     initialize.
 
+    ``atomic-lock=on|off``
+        When the host cannot perform a guest atomic operation natively,
+        for example a 16-byte compare-and-swap, the TCG accelerator
+        normally stops every other vCPU while the instruction executes.
+        With this option such operations instead take a lock selected
+        by the address they access, so that only vCPUs using the same
+        lock wait. The lock only orders these operations against each
+        other: any concurrent access to the same bytes that does not
+        take the fallback, whether a plain store or a natively supported
+        atomic operation of any size, can be lost or observed torn.
+        Only use it with guests that never mix the two (default=off).
+
+    ``dirty-granule=n``
+        With the TCG accelerator, the first guest write that migration
+        sees in each naturally aligned block of n bytes of RAM marks the
+        whole block dirty, instead of only the page written. This makes
+        guests that write to many neighbouring pages slow down less
+        during live migration, at the cost of sending more unchanged
+        pages. Display dirty tracking is unaffected. The value must be
+        a power of two, for example 2M (default=target page size).
+
     ``igd-passthru=on|off``
         When Xen is in use, this option controls whether Intel
         integrated graphics devices can be passed through to the guest
@@ -226,6 +250,13 @@ SRST
     ``tb-size=n``
         Controls the size (in MiB) of the TCG translation block cache.
 
+    ``tb-stats=on|off``
+        Generate TCG translation blocks that count their executions, and
+        account how often they are retranslated, entered from the main
+        loop and exit to it. The hottest blocks can be listed with the
+        ``info tb-stats`` monitor command. This slows down emulation
+        (default=off).
+
     ``thread=single|multi``
         Controls number of TCG threads. When the TCG is multi-threaded
         there will be one thread per vCPU therefore taking advantage of
@@ -4495,13 +4526,13 @@ SRST
 ERST
 
 DEF("icount", HAS_ARG, QEMU_OPTION_icount, \
-    "-icount [shift=N|auto][,align=on|off][,sleep=on|off][,rr=record|replay,rrfile=<filename>[,rrsnapshot=<snapshot>]]\n" \
+    "-icount [shift=N|auto][,align=on|off][,sleep=on|off][,rr=record|replay,rrfile=<filename>[,rrsnapshot=<snapshot>][,rrcompress=on|off]]\n" \
     "                enable virtual instruction counter with 2^N clock ticks per\n" \
     "                instruction, enable aligning the host and virtual clocks\n" \
     "                or disable real time cpu sleeping, and optionally enable\n" \
     "                record-and-replay mode\n", QEMU_ARCH_ALL)
 SRST
-``-icount [shift=N|auto][,align=on|off][,sleep=on|off][,rr=record|replay,rrfile=filename[,rrsnapshot=snapshot]]``
+``-icount [shift=N|auto][,align=on|off][,sleep=on|off][,rr=record|replay,rrfile=filename[,rrsnapshot=snapshot][,rrcompress=on|off]]``
     Enable virtual instruction counter. The virtual cpu will execute one
     instruction every 2^N ns of virtual time. If ``auto`` is specified
     then the virtual cpu speed will be automatically adjusted to keep
@@ -4543,6 +4574,9 @@ SRST
     name. In record mode, a new VM snapshot with the given name is created
     at the start of execution recording. In replay mode this option
     specifies the snapshot name used to load the initial VM state.
+    ``rrcompress=on`` compresses the replay log with zstd in record
+    mode; replay mode detects compression by itself. The default is
+    ``rrcompress=off``.
 ERST
 
 DEF("watchdog-action", HAS_ARG, QEMU_OPTION_watchdog_action, \
@@ -87,6 +87,9 @@ typedef struct ReplayState {
 } ReplayState;
 extern ReplayState replay_state;
 
+/* Size of replay log header */
+#define REPLAY_LOG_HEADER_SIZE      (sizeof(uint32_t) + sizeof(uint64_t))
+
 /* File for replay writing */
 extern FILE *replay_file;
 /* Instruction count of the replay breakpoint */
@@ -108,6 +111,25 @@ int64_t replay_get_qword(void);
 void replay_get_array(uint8_t *buf, size_t *size);
 void replay_get_array_alloc(uint8_t **buf, size_t *size);
 
+/* Buffered log access, see replay-log.c */
+
+/*! Starts the log writer or reader thread for replay_file, which must be
+    positioned past the header. */
+void replay_log_open(ReplayMode mode, bool compress);
+/*! Writes out buffered data in record mode and stops the thread. */
+void replay_log_close(void);
+void replay_log_write(const void *buf, size_t size);
+/*! Returns false if the end of the log was reached. */
+bool replay_log_read(void *buf, size_t size);
+/*! Offset in the log, not counting the header and compression. */
+uint64_t replay_log_tell(void);
+/*! Moves replay mode to the given replay_log_tell() offset. */
+void replay_log_seek(uint64_t offset);
+/*! Returns true if a read went past the end of the log. */
+bool replay_log_eof(void);
+/*! Returns true if reading or writing the file failed. */
+bool replay_log_error(void);
+
 /* Mutex functions for protecting replay log file and ensuring
  * synchronisation between vCPU and main-loop threads. */
 
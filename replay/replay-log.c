@@ -0,0 +1,523 @@
+/*
+ * replay-log.c
+ *
+ * Buffered, block-structured access to the replay log.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ *
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/bswap.h"
+#include "qemu/error-report.h"
+#include "qemu/thread.h"
+#include "qemu/units.h"
+#include "sysemu/replay.h"
+#include "replay-internal.h"
+#ifdef CONFIG_ZSTD
+#include <zstd.h>
+#endif
+
+/*
+ * After the header, the log is a sequence of blocks.  Each one starts with
+ * the big endian 4-byte size of its data once decompressed and the 4-byte
+ * size of what is stored in the file.  The two are equal if the block is
+ * not compressed; otherwise the block is a zstd frame.
+ *
+ * Events are appended to an in-memory block.  In record mode full blocks
+ * are compressed and written by a thread, so the vCPU never waits for the
+ * disk unless the thread falls REPLAY_LOG_MAX_PENDING blocks behind.  In
+ * replay mode a thread reads and decompresses up to REPLAY_LOG_READAHEAD
+ * blocks ahead.  Offsets returned by replay_log_tell() count the data
+ * before compression.
+ *
+ * The log is complete once replay_log_close() returns.  If QEMU dies
+ * before that, the events in the current block and in the blocks still
+ * queued for the writer are lost: up to REPLAY_LOG_MAX_PENDING + 1 blocks,
+ * i.e. about 16 MiB of events.
+ */
+#define REPLAY_LOG_BLOCK_SIZE   (256 * KiB)
+#define REPLAY_LOG_MAX_PENDING  64
+#define REPLAY_LOG_READAHEAD    4
+#define REPLAY_LOG_ZSTD_LEVEL   1
+
+typedef struct ReplayLogBlock {
+    uint8_t *data;
+    size_t len;
+    /* Offset of data[0] in the log */
+    uint64_t start;
+} ReplayLogBlock;
+
+/* Where replay mode found each block in the file, used for seeking */
+typedef struct ReplayLogIndex {
+    uint64_t start;
+    uint32_t len;
+    off_t file_offset;
+} ReplayLogIndex;
+
+static struct {
+    ReplayMode mode;
+    bool compress;
+    QemuThread thread;
+    bool thread_running;
+    /* Protects the fields below, up to cur */
+    QemuMutex lock;
+    QemuCond cond;
+    GQueue queue;
+    bool quit;
+    bool eof;
+    /* Also read without the lock, use qatomic_set() */
+    bool error;
+    /* Block being filled in record mode, or consumed in replay mode */
+    ReplayLogBlock *cur;
+    size_t pos;
+    /* Replay mode: next block the thread reads */
+    off_t next_file_offset;
+    uint64_t next_start;
+    GArray *index;
+    /* A read went past the end of the log */
+    bool overrun;
+} replay_log;
+
+static ReplayLogBlock *replay_log_block_new(uint64_t start)
+{
+    ReplayLogBlock *blk = g_new0(ReplayLogBlock, 1);
+
+    blk->data = g_malloc(REPLAY_LOG_BLOCK_SIZE);
+    blk->start = start;
+    return blk;
+}
+
+static void replay_log_block_free(ReplayLogBlock *blk)
+{
+    if (blk) {
+        g_free(blk->data);
+        g_free(blk);
+    }
+}
+
+/* Record mode */
+
+static bool replay_log_write_block(ReplayLogBlock *blk, void *zbuf,
+                                   void *zctx)
+{
+    const void *data = blk->data;
+    uint32_t hdr[2];
+    size_t stored = blk->len;
+
+#ifdef CONFIG_ZSTD
+    if (zctx) {
+        size_t ret = ZSTD_compressCCtx(zctx, zbuf,
+                                       ZSTD_compressBound(blk->len),
+                                       blk->data, blk->len,
+                                       REPLAY_LOG_ZSTD_LEVEL);
+        if (!ZSTD_isError(ret) && ret < blk->len) {
+            data = zbuf;
+            stored = ret;
+        }
+    }
+#endif
+
+    hdr[0] = cpu_to_be32(blk->len);
+    hdr[1] = cpu_to_be32(stored);
+    return fwrite(hdr, sizeof(hdr), 1, replay_file) == 1 &&
+           fwrite(data, 1, stored, replay_file) == stored;
+}
+
+static void *replay_log_writer_thread(void *opaque)
+{
+    void *zctx = NULL, *zbuf = NULL;
+    ReplayLogBlock *blk;
+
+#ifdef CONFIG_ZSTD
+    if (replay_log.compress) {
+        zctx = ZSTD_createCCtx();
+        zbuf = g_malloc(ZSTD_compressBound(REPLAY_LOG_BLOCK_SIZE));
+    }
+#endif
+
+    qemu_mutex_lock(&replay_log.lock);
+    while (true) {
+        while (g_queue_is_empty(&replay_log.queue) && !replay_log.quit) {
+            qemu_cond_wait(&replay_log.cond, &replay_log.lock);
+        }
+        blk = g_queue_pop_head(&replay_log.queue);
+        if (!blk) {
+            break;
+        }
+        qemu_cond_broadcast(&replay_log.cond);
+        qemu_mutex_unlock(&replay_log.lock);
+
+        if (!replay_log_write_block(blk, zbuf, zctx) &&
+            !qatomic_read(&replay_log.error)) {
+            error_report("replay write error");
+            qatomic_set(&replay_log.error, true);
+        }
+        replay_log_block_free(blk);
+
+        qemu_mutex_lock(&replay_log.lock);
+    }
+    qemu_mutex_unlock(&replay_log.lock);
+
+#ifdef CONFIG_ZSTD
+    ZSTD_freeCCtx(zctx);
+#endif
+    g_free(zbuf);
+    return NULL;
+}
+
+/* Hand the current block to the writer thread and start a new one */
+static void replay_log_flush(void)
+{
+    ReplayLogBlock *blk = replay_log.cur;
+
+    replay_log.cur = replay_log_block_new(blk->start + blk->len);
+    if (!blk->len) {
+        replay_log_block_free(blk);
+        return;
+    }
+
+    qemu_mutex_lock(&replay_log.lock);
+    while (g_queue_get_length(&replay_log.queue) >= REPLAY_LOG_MAX_PENDING) {
+        qemu_cond_wait(&replay_log.cond, &replay_log.lock);
+    }
+    g_queue_push_tail(&replay_log.queue, blk);
+    qemu_cond_broadcast(&replay_log.cond);
+    qemu_mutex_unlock(&replay_log.lock);
+}
+
+void replay_log_write(const void *data, size_t size)
+{
+    ReplayLogBlock *blk = replay_log.cur;
+    const uint8_t *buf = data;
+    size_t len;
+
+    while (size) {
+        if (blk->len == REPLAY_LOG_BLOCK_SIZE) {
+            replay_log_flush();
+            blk = replay_log.cur;
+        }
+        len = MIN(size, REPLAY_LOG_BLOCK_SIZE - blk->len);
+        memcpy(blk->data + blk->len, buf, len);
+        blk->len += len;
+        buf += len;
+        size -= len;
+    }
+}
+
+/* Replay mode */
+
+/*
+ * Returns 0 on success, -ENODATA at the end of the log, or -EIO.  Runs
+ * without the lock, the caller records the outcome.
+ */
+static int replay_log_read_block(ReplayLogBlock *blk, off_t *file_offset,
+                                 void *zbuf, void *zctx)
+{
+    uint32_t hdr[2];
+    size_t stored;
+
+    if (fread(hdr, sizeof(hdr), 1, replay_file) != 1) {
+        return feof(replay_file) ? -ENODATA : -EIO;
+    }
+    blk->len = be32_to_cpu(hdr[0]);
+    stored = be32_to_cpu(hdr[1]);
+    if (blk->len > REPLAY_LOG_BLOCK_SIZE || stored > blk->len) {
+        error_report("Replay: invalid log block at %" PRId64,
+                     (int64_t)*file_offset);
+        return -EIO;
+    }
+
+    if (stored == blk->len) {
+        if (fread(blk->data, 1, stored, replay_file) != stored) {
+            return -EIO;
+        }
+    } else {
+#ifdef CONFIG_ZSTD
+        size_t ret;
+
+        if (fread(zbuf, 1, stored, replay_file) != stored) {
+            return -EIO;
+        }
+        ret = ZSTD_decompressDCtx(zctx, blk->data, REPLAY_LOG_BLOCK_SIZE,
+                                  zbuf, stored);
+        if (ZSTD_isError(ret) || ret != blk->len) {
+            error_report("Replay: corrupted log block at %" PRId64,
+                         (int64_t)*file_offset);
+            return -EIO;
+        }
+#else
+        error_report("Replay: log is compressed, but QEMU was built "
+                     "without zstd support");
+        return -EIO;
+#endif
+    }
+
+    *file_offset += sizeof(hdr) + stored;
+    return 0;
+}
+
+static void replay_log_index_add(uint64_t start, uint32_t len,
+                                 off_t file_offset)
+{
+    ReplayLogIndex *last = NULL;
+    ReplayLogIndex entry = {
+        .start = start,
+        .len = len,
+        .file_offset = file_offset,
+    };
+
+    if (replay_log.index->len) {
+        last = &g_array_index(replay_log.index, ReplayLogIndex,
+                              replay_log.index->len - 1);
+    }
+    /* Blocks before the last one we know of are read again after a seek */
+    if (!last || last->file_offset < file_offset) {
+        g_array_append_val(replay_log.index, entry);
+    }
+}
+
+static void *replay_log_reader_thread(void *opaque)
+{
+    void *zctx = NULL, *zbuf = NULL;
+    ReplayLogBlock *blk;
+    off_t file_offset;
+    int ret;
+
+#ifdef CONFIG_ZSTD
+    zctx = ZSTD_createDCtx();
+    zbuf = g_malloc(ZSTD_compressBound(REPLAY_LOG_BLOCK_SIZE));
+#endif
+
+    qemu_mutex_lock(&replay_log.lock);
+    while (!replay_log.quit && !replay_log.eof && !replay_log.error) {
+        if (g_queue_get_length(&replay_log.queue) >= REPLAY_LOG_READAHEAD) {
+            qemu_cond_wait(&replay_log.cond, &replay_log.lock);
+            continue;
+        }
+        file_offset = replay_log.next_file_offset;
+        qemu_mutex_unlock(&replay_log.lock);
+
+        blk = replay_log_block_new(0);
+        ret = replay_log_read_block(blk, &file_offset, zbuf, zctx);
+
+        qemu_mutex_lock(&replay_log.lock);
+        if (ret == -ENODATA) {
+            replay_log.eof = true;
+        } else if (ret < 0) {
+            qatomic_set(&replay_log.error, true);
+        }
+        if (ret < 0) {
+            replay_log_block_free(blk);
+        } else {
+            blk->start = replay_log.next_start;
+            replay_log_index_add(blk->start, blk->len,
+                                 replay_log.next_file_offset);
+            replay_log.next_start += blk->len;
+            replay_log.next_file_offset = file_offset;
+            g_queue_push_tail(&replay_log.queue, blk);
+        }
+        qemu_cond_broadcast(&replay_log.cond);
+    }
+    qemu_mutex_unlock(&replay_log.lock);
+
+#ifdef CONFIG_ZSTD
+    ZSTD_freeDCtx(zctx);
+#endif
+    g_free(zbuf);
+    return NULL;
+}
+
+/* Move on to the next block, false at the end of the log */
+static bool replay_log_next_block(void)
+{
+    ReplayLogBlock *blk;
+
+    qemu_mutex_lock(&replay_log.lock);
+    while (g_queue_is_empty(&replay_log.queue) &&
+           !replay_log.eof && !replay_log.error) {
+        qemu_cond_wait(&replay_log.cond, &replay_log.lock);
+    }
+    blk = g_queue_pop_head(&replay_log.queue);
+    if (!blk) {
+        replay_log.overrun = replay_log.eof;
+    }
+    qemu_cond_broadcast(&replay_log.cond);
+    qemu_mutex_unlock(&replay_log.lock);
+
+    if (!blk) {
+        return false;
+    }
+    replay_log_block_free(replay_log.cur);
+    replay_log.cur = blk;
+    replay_log.pos = 0;
+    return true;
+}
+
+bool replay_log_read(void *data, size_t size)
+{
+    ReplayLogBlock *blk = replay_log.cur;
+    uint8_t *buf = data;
+    size_t len;
+
+    while (size) {
+        if (!blk || replay_log.pos == blk->len) {
+            if (!replay_log_next_block()) {
+                return false;
+            }
+            blk = replay_log.cur;
+        }
+        len = MIN(size, blk->len - replay_log.pos);
+        memcpy(buf, blk->data + replay_log.pos, len);
+        replay_log.pos += len;
+        buf += len;
+        size -= len;
+    }
+    return true;
+}
+
+static void replay_log_start_thread(void)
+{
+    replay_log.quit = false;
+    replay_log.thread_running = true;
+    qemu_thread_create(&replay_log.thread,
+                       replay_log.mode == REPLAY_MODE_RECORD ?
+                       "replay-write" : "replay-read",
+                       replay_log.mode == REPLAY_MODE_RECORD ?
+                       replay_log_writer_thread : replay_log_reader_thread,
+                       NULL, QEMU_THREAD_JOINABLE);
+}
+
+static void replay_log_stop_thread(void)
+{
+    if (!replay_log.thread_running) {
+        return;
+    }
+    qemu_mutex_lock(&replay_log.lock);
+    replay_log.quit = true;
+    qemu_cond_broadcast(&replay_log.cond);
+    qemu_mutex_unlock(&replay_log.lock);
+    qemu_thread_join(&replay_log.thread);
+    replay_log.thread_running = false;
+
+    /* The writer has emptied the queue, this drops the read-ahead */
+    g_queue_clear_full(&replay_log.queue,
+                       (GDestroyNotify)replay_log_block_free);
+}
+
+uint64_t replay_log_tell(void)
+{
+    if (replay_log.mode == REPLAY_MODE_RECORD) {
+        return replay_log.cur->start + replay_log.cur->len;
+    }
+    return replay_log.cur ? replay_log.cur->start + replay_log.pos : 0;
+}
+
+void replay_log_seek(uint64_t offset)
+{
+    ReplayLogIndex *entry = NULL;
+    uint64_t start;
+    off_t file_offset;
+    uint32_t hdr[2];
+    int i;
+
+    assert(replay_log.mode == REPLAY_MODE_PLAY);
+    replay_log_stop_thread();
+    replay_log_block_free(replay_log.cur);
+    replay_log.cur = NULL;
+    replay_log.eof = false;
+    replay_log.overrun = false;
+
+    for (i = replay_log.index->len - 1; i >= 0; i--) {
+        entry = &g_array_index(replay_log.index, ReplayLogIndex, i);
+        if (entry->start <= offset) {
+            break;
+        }
+    }
+
+    /* Past what has been read so far, walk the block headers */
+    if (i < 0 || offset >= entry->start + entry->len) {
+        if (i < 0) {
+            start = 0;
+            file_offset = REPLAY_LOG_HEADER_SIZE;
+        } else {
+            start = entry->start;
+            file_offset = entry->file_offset;
+        }
+        while (true) {
+            if (fseeko(replay_file, file_offset, SEEK_SET) ||
+                fread(hdr, sizeof(hdr), 1, replay_file) != 1) {
+                error_report("Replay: cannot seek to offset %" PRIu64,
+                             offset);
+                exit(1);
+            }
+            replay_log_index_add(start, be32_to_cpu(hdr[0]), file_offset);
+            if (offset < start + be32_to_cpu(hdr[0])) {
+                break;
+            }
+            start += be32_to_cpu(hdr[0]);
+            file_offset += sizeof(hdr) + be32_to_cpu(hdr[1]);
+        }
+        entry = &g_array_index(replay_log.index, ReplayLogIndex,
+                               replay_log.index->len - 1);
+    }
+
+    if (fseeko(replay_file, entry->file_offset, SEEK_SET)) {
+        error_report("Replay: cannot seek to offset %" PRIu64, offset);
+        exit(1);
+    }
+    replay_log.next_file_offset = entry->file_offset;
+    replay_log.next_start = entry->start;
+    replay_log_start_thread();
+
+    if (!replay_log_next_block()) {
+        error_report("Replay: cannot seek to offset %" PRIu64, offset);
+        exit(1);
+    }
+    replay_log.pos = offset - replay_log.cur->start;
+}
+
+bool replay_log_eof(void)
+{
+    return replay_log.overrun;
+}
+
+bool replay_log_error(void)
+{
+    return qatomic_read(&replay_log.error);
+}
+
+void replay_log_open(ReplayMode mode, bool compress)
+{
+    replay_log.mode = mode;
+    replay_log.compress = compress;
+    qemu_mutex_init(&replay_log.lock);
+    qemu_cond_init(&replay_log.cond);
+    g_queue_init(&replay_log.queue);
+
+    if (mode == REPLAY_MODE_RECORD) {
+        replay_log.cur = replay_log_block_new(0);
+    } else {
+        replay_log.index = g_array_new(false, false, sizeof(ReplayLogIndex));
+        replay_log.next_file_offset = REPLAY_LOG_HEADER_SIZE;
+        replay_log.next_start = 0;
+    }
+    replay_log_start_thread();
+}
+
+void replay_log_close(void)
+{
+    if (replay_log.mode == REPLAY_MODE_RECORD) {
+        replay_log_flush();
+    }
+    replay_log_stop_thread();
+    replay_log_block_free(replay_log.cur);
+    replay_log.cur = NULL;
+    if (replay_log.index) {
+        g_array_free(replay_log.index, true);
+        replay_log.index = NULL;
+    }
+    qemu_cond_destroy(&replay_log.cond);
+    qemu_mutex_destroy(&replay_log.lock);
+}
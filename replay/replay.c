@@ -11,6 +11,7 @@
 
 #include "qemu/osdep.h"
 #include "qapi/error.h"
+#include "qemu/bswap.h"
 #include "sysemu/cpu-timers.h"
 #include "sysemu/replay.h"
 #include "sysemu/runstate.h"
@@ -22,9 +23,7 @@
 
 /* Current version of the replay mechanism.
    Increase it when file format changes. */
-#define REPLAY_VERSION              0xe0200c
-/* Size of replay log header */
-#define HEADER_SIZE                 (sizeof(uint32_t) + sizeof(uint64_t))
+#define REPLAY_VERSION              0xe0200d
 
 ReplayMode replay_mode = REPLAY_MODE_NONE;
 char *replay_snapshot;
@@ -226,9 +225,10 @@ bool replay_has_event(void)
     return res;
 }
 
-static void replay_enable(const char *fname, int mode)
+static void replay_enable(const char *fname, int mode, bool compress)
 {
     const char *fmode = NULL;
+    uint32_t version;
     assert(!replay_file);
 
     switch (mode) {
@@ -262,15 +262,17 @@ static void replay_enable(const char *fname, int mode)
 
     /* skip file header for RECORD and check it for PLAY */
     if (replay_mode == REPLAY_MODE_RECORD) {
-        fseek(replay_file, HEADER_SIZE, SEEK_SET);
+        fseek(replay_file, REPLAY_LOG_HEADER_SIZE, SEEK_SET);
+        replay_log_open(replay_mode, compress);
     } else if (replay_mode == REPLAY_MODE_PLAY) {
-        unsigned int version = replay_get_dword();
-        if (version != REPLAY_VERSION) {
+        if (fread(&version, sizeof(version), 1, replay_file) != 1 ||
+            be32_to_cpu(version) != REPLAY_VERSION) {
             fprintf(stderr, "Replay: invalid input log file version\n");
             exit(1);
         }
         /* go to the beginning */
-        fseek(replay_file, HEADER_SIZE, SEEK_SET);
+        fseek(replay_file, REPLAY_LOG_HEADER_SIZE, SEEK_SET);
+        replay_log_open(replay_mode, false);
         replay_fetch_data_kind();
     }
 
@@ -282,6 +284,7 @@ void replay_configure(QemuOpts *opts)
     const char *fname;
     const char *rr;
     ReplayMode mode = REPLAY_MODE_NONE;
+    bool compress;
     Location loc;
 
     if (!opts) {
@@ -310,9 +313,18 @@ void replay_configure(QemuOpts *opts)
         exit(1);
     }
 
+    compress = qemu_opt_get_bool(opts, "rrcompress", false);
+#ifndef CONFIG_ZSTD
+    if (compress) {
+        error_report("QEMU was built without zstd support, "
+                     "rrcompress is not available");
+        exit(1);
+    }
+#endif
+
     replay_snapshot = g_strdup(qemu_opt_get(opts, "rrsnapshot"));
     replay_vmstate_register();
-    replay_enable(fname, mode);
+    replay_enable(fname, mode, compress);
 
 out:
     loc_pop(&loc);
@@ -356,10 +368,17 @@ void replay_finish(void)
             replay_shutdown_request(SHUTDOWN_CAUSE_HOST_SIGNAL);
             /* write end event */
             replay_put_event(EVENT_END);
+        }
+
+        replay_log_close();
+        if (replay_mode == REPLAY_MODE_RECORD) {
+            uint32_t version = cpu_to_be32(REPLAY_VERSION);
 
             /* write header */
             fseek(replay_file, 0, SEEK_SET);
-            replay_put_dword(REPLAY_VERSION);
+            if (fwrite(&version, sizeof(version), 1, replay_file) != 1) {
+                error_report("replay write error");
+            }
         }
 
         fclose(replay_file);
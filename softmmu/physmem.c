@@ -889,6 +889,22 @@ bool cpu_physical_memory_test_and_clear_dirty(ram_addr_t start,
     return dirty;
 }
 
+void cpu_physical_memory_set_dirty_granule(ram_addr_t addr,
+                                           ram_addr_t granule,
+                                           uint8_t mask)
+{
+    RAMBlock *ramblock;
+    ram_addr_t start, end;
+
+    WITH_RCU_READ_LOCK_GUARD() {
+        ramblock = qemu_get_ram_block(addr);
+        start = MAX(QEMU_ALIGN_DOWN(addr, granule), ramblock->offset);
+        end = MIN(QEMU_ALIGN_DOWN(addr, granule) + granule,
+                  ramblock->offset + ramblock->used_length);
+        cpu_physical_memory_set_dirty_range(start, end - start, mask);
+    }
+}
+
 DirtyBitmapSnapshot *cpu_physical_memory_snapshot_and_clear_dirty
     (MemoryRegion *mr, hwaddr offset, hwaddr length, unsigned client)
 {
@@ -951,13 +967,7 @@ bool cpu_physical_memory_snapshot_get_dirty(DirtyBitmapSnapshot *snap,
     end = TARGET_PAGE_ALIGN(start + length - snap->start) >> TARGET_PAGE_BITS;
     page = (start - snap->start) >> TARGET_PAGE_BITS;
 
-    while (page < end) {
-        if (test_bit(page, snap->dirty)) {
-            return true;
-        }
-        page++;
-    }
-    return false;
+    return find_next_bit(snap->dirty, end, page) < end;
 }
 
 /* Called from RCU critical section */
@@ -3671,6 +3681,19 @@ int ram_block_coordinated_discard_require(bool state)
     return ret;
 }
 
+int ram_block_discard_range_if_enabled(RAMBlock *rb, uint64_t start,
+                                       size_t length)
+{
+    int ret = -EBUSY;
+
+    ram_block_discard_disable_mutex_lock();
+    if (!ram_block_discard_is_disabled()) {
+        ret = ram_block_discard_range(rb, start, length);
+    }
+    ram_block_discard_disable_mutex_unlock();
+    return ret;
+}
+
 bool ram_block_discard_is_disabled(void)
 {
     return qatomic_read(&ram_block_discard_disabled_cnt) ||
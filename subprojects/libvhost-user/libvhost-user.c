@@ -1238,6 +1238,22 @@ inflight_desc_compare(const void *a, const void *b)
     return -1;
 }
 
+/*
+ * Clear the inflight flag of the @batch descriptors on the last batch list,
+ * which starts at last_batch_head and is linked through desc[].next.
+ */
+static void
+vu_inflight_clear_batch(VuVirtqInflight *inflight, uint16_t batch)
+{
+    uint16_t idx = inflight->last_batch_head;
+
+    batch = MIN(batch, inflight->desc_num);
+    while (batch-- && idx < inflight->desc_num) {
+        inflight->desc[idx].inflight = 0;
+        idx = inflight->desc[idx].next;
+    }
+}
+
 static int
 vu_check_queue_inflights(VuDev *dev, VuVirtq *vq)
 {
@@ -1263,7 +1279,8 @@ vu_check_queue_inflights(VuDev *dev, VuVirtq *vq)
     vq->counter = 0;
 
     if (unlikely(vq->inflight->used_idx != vq->used_idx)) {
-        vq->inflight->desc[vq->inflight->last_batch_head].inflight = 0;
+        vu_inflight_clear_batch(vq->inflight,
+                                vq->used_idx - vq->inflight->used_idx);
 
         barrier();
 
@@ -2024,6 +2041,12 @@ vu_deinit(VuDev *dev)
             vq->resubmit_list = NULL;
         }
 
+        while (vq->elem_pool_num) {
+            free(vq->elem_pool[--vq->elem_pool_num]);
+        }
+        free(vq->elem_pool);
+        vq->elem_pool = NULL;
+
         vq->inflight = NULL;
     }
 
@@ -2558,8 +2581,29 @@ virtqueue_map_desc(VuDev *dev,
     return true;
 }
 
+/* Number of freed elements kept per queue */
+#define VU_ELEM_POOL_SIZE 64
+/* Granularity of element allocations, so that pooled ones fit more pops */
+#define VU_ELEM_ALLOC_ALIGN 256
+
+static VuVirtqElement *
+virtqueue_elem_pool_get(VuVirtq *vq, size_t size)
+{
+    unsigned int i;
+
+    for (i = vq->elem_pool_num; i-- > 0; ) {
+        VuVirtqElement *elem = vq->elem_pool[i];
+
+        if (elem->alloc_size >= size) {
+            vq->elem_pool[i] = vq->elem_pool[--vq->elem_pool_num];
+            return elem;
+        }
+    }
+    return NULL;
+}
+
 static void *
-virtqueue_alloc_element(size_t sz,
+virtqueue_alloc_element(VuVirtq *vq, size_t sz,
                                      unsigned out_num, unsigned in_num)
 {
     VuVirtqElement *elem;
@@ -2568,10 +2612,16 @@ virtqueue_alloc_element(size_t sz,
     size_t out_sg_end = out_sg_ofs + out_num * sizeof(elem->out_sg[0]);
 
     assert(sz >= sizeof(VuVirtqElement));
-    elem = malloc(out_sg_end);
+    elem = virtqueue_elem_pool_get(vq, out_sg_end);
     if (!elem) {
-        DPRINT("%s: failed to malloc virtqueue element\n", __func__);
-        return NULL;
+        size_t alloc_size = ALIGN_UP(out_sg_end, VU_ELEM_ALLOC_ALIGN);
+
+        elem = malloc(alloc_size);
+        if (!elem) {
+            DPRINT("%s: failed to malloc virtqueue element\n", __func__);
+            return NULL;
+        }
+        elem->alloc_size = alloc_size;
     }
     elem->out_num = out_num;
     elem->in_num = in_num;
@@ -2658,7 +2708,7 @@ vu_queue_map_desc(VuDev *dev, VuVirtq *vq, unsigned int idx, size_t sz)
     }
 
     /* Now copy what we have collected and mapped */
-    elem = virtqueue_alloc_element(sz, out_num, in_num);
+    elem = virtqueue_alloc_element(vq, sz, out_num, in_num);
     if (!elem) {
         return NULL;
     }
@@ -2701,13 +2751,15 @@ vu_queue_inflight_pre_put(VuDev *dev, VuVirtq *vq, int desc_idx)
         return -1;
     }
 
+    vq->inflight->desc[desc_idx].next = vq->inflight->last_batch_head;
     vq->inflight->last_batch_head = desc_idx;
 
     return 0;
 }
 
+/* Retire the last @num descriptors passed to vu_queue_inflight_pre_put() */
 static int
-vu_queue_inflight_post_put(VuDev *dev, VuVirtq *vq, int desc_idx)
+vu_queue_inflight_post_put(VuDev *dev, VuVirtq *vq, unsigned int num)
 {
     if (!vu_has_protocol_feature(dev, VHOST_USER_PROTOCOL_F_INFLIGHT_SHMFD)) {
         return 0;
@@ -2719,7 +2771,7 @@ vu_queue_inflight_post_put(VuDev *dev, VuVirtq *vq, int desc_idx)
 
     barrier();
 
-    vq->inflight->desc[desc_idx].inflight = 0;
+    vu_inflight_clear_batch(vq->inflight, num);
 
     barrier();
 
@@ -2787,6 +2839,86 @@ vu_queue_pop(VuDev *dev, VuVirtq *vq, size_t sz)
     return elem;
 }
 
+unsigned int
+vu_queue_pop_batch(VuDev *dev, VuVirtq *vq, size_t sz,
+                   void **elems, unsigned int max)
+{
+    unsigned int head;
+    unsigned int n = 0;
+    uint16_t num_heads;
+
+    if (unlikely(dev->broken) ||
+        unlikely(!vq->vring.avail)) {
+        return 0;
+    }
+
+    /* Inflight descriptors from a previous connection go first */
+    while (n < max && unlikely(vq->resubmit_list && vq->resubmit_num > 0)) {
+        elems[n] = vu_queue_pop(dev, vq, sz);
+        if (!elems[n]) {
+            return n;
+        }
+        n++;
+    }
+
+    num_heads = vq->shadow_avail_idx - vq->last_avail_idx;
+    if (!num_heads) {
+        num_heads = vring_avail_idx(vq) - vq->last_avail_idx;
+        if (!num_heads) {
+            return n;
+        }
+    }
+    if (num_heads > vq->vring.num) {
+        vu_panic(dev, "Guest moved used index from %u to %u",
+                 vq->last_avail_idx, vq->shadow_avail_idx);
+        return n;
+    }
+    /* Same as in vu_queue_pop(), see comment in virtqueue_num_heads() */
+    smp_rmb();
+
+    for (; n < max && num_heads; n++, num_heads--) {
+        VuVirtqElement *elem;
+
+        if (vq->inuse >= vq->vring.num) {
+            vu_panic(dev, "Virtqueue size exceeded");
+            break;
+        }
+        if (!virtqueue_get_head(dev, vq, vq->last_avail_idx, &head)) {
+            break;
+        }
+        elem = vu_queue_map_desc(dev, vq, head, sz);
+        if (!elem) {
+            break;
+        }
+        vq->last_avail_idx++;
+        vq->inuse++;
+        vu_queue_inflight_get(dev, vq, head);
+        elems[n] = elem;
+    }
+
+    if (vu_has_feature(dev, VIRTIO_RING_F_EVENT_IDX)) {
+        vring_set_avail_event(vq, vq->last_avail_idx);
+    }
+
+    return n;
+}
+
+void
+vu_queue_element_free(VuDev *dev, VuVirtq *vq, VuVirtqElement *elem)
+{
+    if (!elem) {
+        return;
+    }
+    if (!vq->elem_pool) {
+        vq->elem_pool = malloc(VU_ELEM_POOL_SIZE * sizeof(vq->elem_pool[0]));
+    }
+    if (vq->elem_pool && vq->elem_pool_num < VU_ELEM_POOL_SIZE) {
+        vq->elem_pool[vq->elem_pool_num++] = elem;
+    } else {
+        free(elem);
+    }
+}
+
 static void
 vu_queue_detach_element(VuDev *dev, VuVirtq *vq, VuVirtqElement *elem,
                         size_t len)
@@ -2947,5 +3079,24 @@ vu_queue_push(VuDev *dev, VuVirtq *vq,
     vu_queue_fill(dev, vq, elem, len, 0);
     vu_queue_inflight_pre_put(dev, vq, elem->index);
     vu_queue_flush(dev, vq, 1);
-    vu_queue_inflight_post_put(dev, vq, elem->index);
+    vu_queue_inflight_post_put(dev, vq, 1);
+}
+
+void
+vu_queue_push_batch(VuDev *dev, VuVirtq *vq,
+                    VuVirtqElement * const *elems,
+                    const unsigned int *len, unsigned int num)
+{
+    unsigned int i;
+
+    if (!num) {
+        return;
+    }
+
+    for (i = 0; i < num; i++) {
+        vu_queue_fill(dev, vq, elems[i], len[i], i);
+        vu_queue_inflight_pre_put(dev, vq, elems[i]->index);
+    }
+    vu_queue_flush(dev, vq, num);
+    vu_queue_inflight_post_put(dev, vq, num);
 }
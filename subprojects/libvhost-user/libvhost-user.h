@@ -345,6 +345,10 @@ typedef struct VuVirtq {
 
     unsigned int inuse;
 
+    /* Elements released with vu_queue_element_free(), for reuse */
+    struct VuVirtqElement **elem_pool;
+    unsigned int elem_pool_num;
+
     vu_queue_handler_cb handler;
 
     int call_fd;
@@ -439,6 +443,8 @@ typedef struct VuVirtqElement {
     unsigned int in_num;
     struct iovec *in_sg;
     struct iovec *out_sg;
+    /* Bytes allocated for the element, used by vu_queue_element_free() */
+    size_t alloc_size;
 } VuVirtqElement;
 
 /**
@@ -608,6 +614,35 @@ void vu_queue_notify_sync(VuDev *dev, VuVirtq *vq);
  */
 void *vu_queue_pop(VuDev *dev, VuVirtq *vq, size_t sz);
 
+/**
+ * vu_queue_pop_batch:
+ * @dev: a VuDev context
+ * @vq: a VuVirtq queue
+ * @sz: the size of struct to return (must be >= VuVirtqElement)
+ * @elems: array filled with the popped elements
+ * @max: size of @elems
+ *
+ * Like vu_queue_pop(), but pops up to @max elements while reading the
+ * available index from guest memory at most once, and updates the
+ * avail event once for the whole batch.
+ *
+ * Returns: the number of elements stored in @elems.  Each of them must
+ * be released with vu_queue_element_free() or free().
+ */
+unsigned int vu_queue_pop_batch(VuDev *dev, VuVirtq *vq, size_t sz,
+                                void **elems, unsigned int max);
+
+/**
+ * vu_queue_element_free:
+ * @dev: a VuDev context
+ * @vq: the VuVirtq queue @elem was popped from
+ * @elem: a VuVirtqElement returned by vu_queue_pop() or vu_queue_pop_batch()
+ *
+ * Release @elem.  Unlike free(), this keeps a few elements around so
+ * that later pops from @vq do not have to go through malloc().
+ */
+void vu_queue_element_free(VuDev *dev, VuVirtq *vq, VuVirtqElement *elem);
+
 
 /**
  * vu_queue_unpop:
@@ -662,6 +697,23 @@ void vu_queue_fill(VuDev *dev, VuVirtq *vq,
 void vu_queue_push(VuDev *dev, VuVirtq *vq,
                    const VuVirtqElement *elem, unsigned int len);
 
+/**
+ * vu_queue_push_batch:
+ * @dev: a VuDev context
+ * @vq: a VuVirtq queue
+ * @elems: array of VuVirtqElement
+ * @len: array of lengths in bytes written to each element
+ * @num: number of elements in @elems and @len
+ *
+ * Fill the used ring with all of @elems and publish them with a single
+ * used index update.  With inflight tracking, the batch is recorded on the
+ * last batch list so that a reconnecting back-end can retire it.  Follow
+ * with one vu_queue_notify() for the batch.
+ */
+void vu_queue_push_batch(VuDev *dev, VuVirtq *vq,
+                         VuVirtqElement * const *elems,
+                         const unsigned int *len, unsigned int num);
+
 /**
  * vu_queue_flush:
  * @dev: a VuDev context
@@ -142,6 +142,7 @@ typedef struct DisasContext {
 #define DISAS_EOB_NEXT         DISAS_TARGET_1
 #define DISAS_EOB_INHIBIT_IRQ  DISAS_TARGET_2
 #define DISAS_JUMP             DISAS_TARGET_3
+#define DISAS_JUMP_NEAR        DISAS_TARGET_4
 
 /* The environment in which user-only runs is constrained. */
 #ifdef CONFIG_USER_ONLY
@@ -230,6 +231,7 @@ STUB_HELPER(wrmsr, TCGv_env env)
 
 static void gen_eob(DisasContext *s);
 static void gen_jr(DisasContext *s);
+static void gen_jr_near(DisasContext *s);
 static void gen_jmp_rel(DisasContext *s, MemOp ot, int diff, int tb_num);
 static void gen_jmp_rel_csize(DisasContext *s, int diff, int tb_num);
 static void gen_op(DisasContext *s1, int op, MemOp ot, int d);
@@ -2834,6 +2836,28 @@ static void gen_jr(DisasContext *s)
     do_gen_eob_worker(s, false, false, true);
 }
 
+/*
+ * Jump to register, for near jumps which change neither CS nor hflags.
+ * Unless ending the block has to update hflags, the target can be looked
+ * up in the jump cache without leaving the generated code.
+ */
+static void gen_jr_near(DisasContext *s)
+{
+    TCGv pc;
+
+    if (s->flags & (HF_INHIBIT_IRQ_MASK | HF_RF_MASK | HF_TF_MASK |
+                    HF_MPX_IU_MASK)) {
+        gen_jr(s);
+        return;
+    }
+
+    gen_update_cc_op(s);
+    pc = tcg_temp_new();
+    tcg_gen_addi_tl(pc, cpu_eip, s->cs_base);
+    translator_lookup_and_goto_ptr(&s->base, pc);
+    s->base.is_jmp = DISAS_NORETURN;
+}
+
 /* Jump to eip+diff, truncating the result to OT. */
 static void gen_jmp_rel(DisasContext *s, MemOp ot, int diff, int tb_num)
 {
@@ -2885,7 +2909,7 @@ static void gen_jmp_rel(DisasContext *s, MemOp ot, int diff, int tb_num)
             tcg_gen_movi_tl(cpu_eip, new_eip);
         }
         if (s->jmp_opt) {
-            gen_jr(s);   /* jump to another page */
+            gen_jr_near(s);   /* jump to another page */
         } else {
             gen_eob(s);  /* exit to main loop */
         }
@@ -3621,7 +3645,7 @@ static bool disas_insn(DisasContext *s, CPUState *cpu)
             gen_push_v(s, eip_next_tl(s));
             gen_op_jmp_v(s, s->T0);
             gen_bnd_jmp(s);
-            s->base.is_jmp = DISAS_JUMP;
+            s->base.is_jmp = DISAS_JUMP_NEAR;
             break;
         case 3: /* lcall Ev */
             if (mod == 3) {
@@ -3651,7 +3675,7 @@ static bool disas_insn(DisasContext *s, CPUState *cpu)
             }
             gen_op_jmp_v(s, s->T0);
             gen_bnd_jmp(s);
-            s->base.is_jmp = DISAS_JUMP;
+            s->base.is_jmp = DISAS_JUMP_NEAR;
             break;
         case 5: /* ljmp Ev */
             if (mod == 3) {
@@ -5077,7 +5101,7 @@ static bool disas_insn(DisasContext *s, CPUState *cpu)
         /* Note that gen_pop_T0 uses a zero-extending load.  */
         gen_op_jmp_v(s, s->T0);
         gen_bnd_jmp(s);
-        s->base.is_jmp = DISAS_JUMP;
+        s->base.is_jmp = DISAS_JUMP_NEAR;
         break;
     case 0xc3: /* ret */
         ot = gen_pop_T0(s);
@@ -5085,7 +5109,7 @@ static bool disas_insn(DisasContext *s, CPUState *cpu)
         /* Note that gen_pop_T0 uses a zero-extending load.  */
         gen_op_jmp_v(s, s->T0);
         gen_bnd_jmp(s);
-        s->base.is_jmp = DISAS_JUMP;
+        s->base.is_jmp = DISAS_JUMP_NEAR;
         break;
     case 0xca: /* lret im */
         val = x86_ldsw_code(env, s);
@@ -7052,6 +7076,9 @@ static void i386_tr_tb_stop(DisasContextBase *dcbase, CPUState *cpu)
     case DISAS_JUMP:
         gen_jr(dc);
         break;
+    case DISAS_JUMP_NEAR:
+        gen_jr_near(dc);
+        break;
     default:
         g_assert_not_reached();
     }
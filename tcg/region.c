@@ -380,13 +380,33 @@ void tcg_region_initial_alloc(TCGContext *s)
     qemu_mutex_unlock(&region.lock);
 }
 
+/*
+ * Perform the first region allocation for a context that is being added
+ * to tcg_ctxs[] after start-up, and add it.  In user-mode this happens
+ * when threads are created, which they can be while another thread is
+ * flushing, so this is atomic with respect to tcg_region_reset_all().
+ */
+void tcg_region_register_ctx(TCGContext *s)
+{
+    unsigned int n;
+
+    qemu_mutex_lock(&region.lock);
+    n = tcg_cur_ctxs;
+    g_assert(n < tcg_max_ctxs);
+    tcg_region_initial_alloc__locked(s);
+    qatomic_set(&tcg_ctxs[n], s);
+    qatomic_store_release(&tcg_cur_ctxs, n + 1);
+    qemu_mutex_unlock(&region.lock);
+}
+
 /* Call from a safe-work context */
 void tcg_region_reset_all(void)
 {
-    unsigned int n_ctxs = qatomic_read(&tcg_cur_ctxs);
+    unsigned int n_ctxs;
     unsigned int i;
 
     qemu_mutex_lock(&region.lock);
+    n_ctxs = qatomic_read(&tcg_cur_ctxs);
     region.current = 0;
     region.agg_size_full = 0;
 
@@ -402,7 +422,17 @@ void tcg_region_reset_all(void)
 static size_t tcg_n_regions(size_t tb_size, unsigned max_cpus)
 {
 #ifdef CONFIG_USER_ONLY
-    return 1;
+    /*
+     * Threads share at most tcg_max_ctxs contexts, each of which needs a
+     * region.  As in softmmu, use regions of at least 2 MB and a few more
+     * of them than contexts; if there is not enough space for that, fall
+     * back to a single context and region.
+     */
+    if (tb_size / tcg_max_ctxs < 2 * MiB) {
+        tcg_max_ctxs = 1;
+        return 1;
+    }
+    return MIN(tb_size / (2 * MiB), tcg_max_ctxs * 8);
 #else
     size_t n_regions;
 
@@ -716,17 +746,14 @@ static int alloc_code_gen_buffer(size_t size, int splitwx, Error **errp)
  * must have been parsed before calling this function, since it calls
  * qemu_tcg_mttcg_enabled().
  *
- * In user-mode we use a single region.  Having multiple regions in user-mode
- * is not supported, because the number of vCPU threads (recall that each thread
- * spawned by the guest corresponds to a vCPU thread) is only bounded by the
- * OS, and usually this number is huge (tens of thousands is not uncommon).
- * Thus, given this large bound on the number of vCPU threads and the fact
- * that code_gen_buffer is allocated at compile-time, we cannot guarantee
- * that the availability of at least one region per vCPU thread.
- *
- * However, this user-mode limitation is unlikely to be a significant problem
- * in practice. Multi-threaded guests share most if not all of their translated
- * code, which makes parallel code generation less appealing than in softmmu.
+ * In user-mode the number of vCPU threads (recall that each thread spawned
+ * by the guest corresponds to a vCPU thread) is only bounded by the OS, and
+ * usually this number is huge (tens of thousands is not uncommon), so we
+ * cannot guarantee one region per vCPU thread.  Instead, threads share a
+ * pool of contexts bounded by the number of host CPUs (see
+ * tcg_register_thread()), and we use at least one region per context.
+ * This lets threads that cold-start on different code, e.g. while a large
+ * multi-threaded guest is starting up, translate in parallel.
  */
 void tcg_region_init(size_t tb_size, int splitwx, unsigned max_cpus)
 {
@@ -830,7 +857,7 @@ void tcg_region_init(size_t tb_size, int splitwx, unsigned max_cpus)
     /*
      * Leave the initial context initialized to the first region.
      * This will be the context into which we generate the prologue.
-     * It is also the only context for CONFIG_USER_ONLY.
+     * For CONFIG_USER_ONLY it is also the first context of the pool.
      */
     tcg_region_initial_alloc__locked(&tcg_init_ctx);
 }
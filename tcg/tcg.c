@@ -738,42 +738,103 @@ static void alloc_tcg_plugin_context(TCGContext *s)
 #endif
 }
 
+#ifdef CONFIG_USER_ONLY
+/* The main thread uses tcg_init_ctx */
+static unsigned int tcg_user_threads = 1;
+static QemuMutex tcg_user_ctxs_lock;
+static __thread bool tcg_gen_locked;
+#endif
+
+static TCGContext *tcg_ctx_clone_init(void)
+{
+    TCGContext *s = g_malloc(sizeof(*s));
+    unsigned int i, n;
+
+    *s = tcg_init_ctx;
+
+    /* Relink mem_base.  */
+    for (i = 0, n = tcg_init_ctx.nb_globals; i < n; ++i) {
+        if (tcg_init_ctx.temps[i].mem_base) {
+            ptrdiff_t b = tcg_init_ctx.temps[i].mem_base - tcg_init_ctx.temps;
+            tcg_debug_assert(b >= 0 && b < n);
+            s->temps[i].mem_base = &s->temps[b];
+        }
+    }
+    return s;
+}
+
 /*
  * All TCG threads except the parent (i.e. the one that called tcg_context_init
  * and registered the target's TCG globals) must register with this function
  * before initiating translation.
  *
- * In user-mode we just point tcg_ctx to tcg_init_ctx. See the documentation
- * of tcg_region_init() for the reasoning behind this.
+ * In user-mode the number of threads is unbounded, so they share a pool of
+ * at most tcg_max_ctxs contexts, assigned round-robin, and serialize their
+ * translations on the context's gen_lock.  tcg_init_ctx, used by the main
+ * thread, is the first entry of the pool.  See also tcg_region_init().
  *
  * In softmmu each caller registers its context in tcg_ctxs[]. Note that in
  * softmmu tcg_ctxs[] does not track tcg_ctx_init, since the initial context
  * is not used anymore for translation once this function is called.
- *
- * Not tracking tcg_init_ctx in tcg_ctxs[] in softmmu keeps code that iterates
- * over the array (e.g. tcg_code_size() the same for both softmmu and user-mode.
  */
 #ifdef CONFIG_USER_ONLY
 void tcg_register_thread(void)
 {
-    tcg_ctx = &tcg_init_ctx;
+    unsigned int n = qatomic_fetch_inc(&tcg_user_threads) % tcg_max_ctxs;
+
+    qemu_mutex_lock(&tcg_user_ctxs_lock);
+    while (qatomic_read(&tcg_cur_ctxs) <= n) {
+        TCGContext *s;
+
+        /*
+         * Unlike in softmmu, tcg_init_ctx may be translating right now:
+         * copy it while it is idle, and do not share its per-translation
+         * allocations.
+         */
+        qemu_mutex_lock(&tcg_init_ctx.gen_lock);
+        s = tcg_ctx_clone_init();
+        qemu_mutex_unlock(&tcg_init_ctx.gen_lock);
+
+        s->pool_first = s->pool_current = s->pool_first_large = NULL;
+        s->pool_cur = s->pool_end = NULL;
+        memset(s->const_table, 0, sizeof(s->const_table));
+        qemu_mutex_init(&s->gen_lock);
+        alloc_tcg_plugin_context(s);
+        tcg_region_register_ctx(s);
+    }
+    qemu_mutex_unlock(&tcg_user_ctxs_lock);
+
+    tcg_ctx = qatomic_read(&tcg_ctxs[n]);
+}
+
+/*
+ * Taken by tb_gen_code() for the whole translation, in place of the
+ * mmap_lock that is only needed to link the new TB.  Like the mmap_lock,
+ * it is released by cpu_exec() if translation longjmps out.
+ */
+void tcg_gen_lock(void)
+{
+    g_assert(!tcg_gen_locked);
+    qemu_mutex_lock(&tcg_ctx->gen_lock);
+    tcg_gen_locked = true;
+}
+
+void tcg_gen_unlock(void)
+{
+    g_assert(tcg_gen_locked);
+    tcg_gen_locked = false;
+    qemu_mutex_unlock(&tcg_ctx->gen_lock);
+}
+
+bool tcg_have_gen_lock(void)
+{
+    return tcg_gen_locked;
 }
 #else
 void tcg_register_thread(void)
 {
-    TCGContext *s = g_malloc(sizeof(*s));
-    unsigned int i, n;
-
-    *s = tcg_init_ctx;
-
-    /* Relink mem_base.  */
-    for (i = 0, n = tcg_init_ctx.nb_globals; i < n; ++i) {
-        if (tcg_init_ctx.temps[i].mem_base) {
-            ptrdiff_t b = tcg_init_ctx.temps[i].mem_base - tcg_init_ctx.temps;
-            tcg_debug_assert(b >= 0 && b < n);
-            s->temps[i].mem_base = &s->temps[b];
-        }
-    }
+    TCGContext *s = tcg_ctx_clone_init();
+    unsigned int n;
 
     /* Claim an entry in tcg_ctxs */
     n = qatomic_fetch_inc(&tcg_cur_ctxs);
@@ -1365,15 +1426,22 @@ static void tcg_context_init(unsigned max_cpus)
 
     tcg_ctx = s;
     /*
-     * In user-mode we simply share the init context among threads, since we
-     * use a single region. See the documentation tcg_region_init() for the
-     * reasoning behind this.
+     * In user-mode threads share a pool of contexts, whose size is capped
+     * by the number of host CPUs; tcg_region_init() may shrink it further.
+     * See tcg_register_thread().
      * In softmmu we will have at most max_cpus TCG threads.
      */
 #ifdef CONFIG_USER_ONLY
-    tcg_ctxs = &tcg_ctx;
+    {
+        long host_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+        tcg_max_ctxs = MIN(MAX(host_cpus, 1), TCG_USER_MAX_CTXS);
+    }
+    tcg_ctxs = g_new0(TCGContext *, tcg_max_ctxs);
+    tcg_ctxs[0] = s;
     tcg_cur_ctxs = 1;
-    tcg_max_ctxs = 1;
+    qemu_mutex_init(&s->gen_lock);
+    qemu_mutex_init(&tcg_user_ctxs_lock);
 #else
     tcg_max_ctxs = max_cpus;
     tcg_ctxs = g_new0(TCGContext *, max_cpus);
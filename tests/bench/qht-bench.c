@@ -21,6 +21,7 @@ struct thread_stats {
     size_t not_rm;
     size_t rz;
     size_t not_rz;
+    size_t gr;
 };
 
 struct thread_info {
@@ -62,6 +63,13 @@ static unsigned int n_rz_threads = 1;
 static QemuThread *rz_threads;
 static bool precompute_hash;
 
+static size_t grow_range;
+static size_t grow_next;
+static long *grow_keys;
+static unsigned int n_gr_threads = 1;
+static QemuThread *gr_threads;
+static struct thread_info *gr_info;
+
 static double update_rate; /* 0.0 to 1.0 */
 static uint64_t update_threshold;
 static uint64_t resize_threshold;
@@ -93,7 +101,11 @@ static const char commands_string[] =
     " -R = enable auto-resize\n"
     " -S = resize rate (0.0 to 100.0)\n"
     " -D = delay (in us) between potential resizes\n"
-    " -N = number of resize threads";
+    " -N = number of resize threads\n"
+    "\n"
+    " -G = insert this many new keys during the test, so that the table\n"
+    "      auto-resizes under load (implies -R)\n"
+    " -I = number of threads inserting the -G keys";
 
 static void usage_complete(int argc, char *argv[])
 {
@@ -156,6 +168,25 @@ static void do_rz(struct thread_info *info)
     g_usleep(resize_delay);
 }
 
+static void do_grow(struct thread_info *info)
+{
+    size_t i;
+    long *p;
+
+    if (qatomic_read(&grow_next) >= grow_range) {
+        g_usleep(1000);
+        return;
+    }
+    i = qatomic_fetch_inc(&grow_next);
+    if (i >= grow_range) {
+        return;
+    }
+    p = &grow_keys[i];
+    if (qht_insert(&ht, p, hfunc(*p), NULL)) {
+        info->stats.gr++;
+    }
+}
+
 static void do_rw(struct thread_info *info)
 {
     struct thread_stats *stats = &info->stats;
@@ -265,6 +296,8 @@ static void create_threads(void)
 {
     th_create_n(&rw_threads, &rw_info, "rw", do_rw, 0, n_rw_threads);
     th_create_n(&rz_threads, &rz_info, "rz", do_rz, n_rw_threads, n_rz_threads);
+    th_create_n(&gr_threads, &gr_info, "grow", do_grow,
+                n_rw_threads + n_rz_threads, n_gr_threads);
 }
 
 static void pr_params(void)
@@ -281,6 +314,10 @@ static void pr_params(void)
         printf(" resize range:      %zu-%zu\n", resize_min, resize_max);
         printf(" # resize threads   %u\n", n_rz_threads);
     }
+    if (grow_range) {
+        printf(" grow by:           %zu keys\n", grow_range);
+        printf(" # grow threads     %u\n", n_gr_threads);
+    }
     printf(" update rate:       %f%%\n", update_rate * 100.0);
     printf(" offset:            %ld\n", populate_offset);
     printf(" initial key range: %zu\n", init_range);
@@ -326,6 +363,16 @@ static void htable_init(void)
 
         keys[i] = precompute_hash ? h(val) : hval(val);
     }
+    /* keys for the grow threads come after the others, so they are all new */
+    grow_keys = g_malloc(sizeof(*grow_keys) * grow_range);
+    for (i = 0; i < grow_range; i++) {
+        long val = populate_offset + n + i;
+
+        grow_keys[i] = precompute_hash ? h(val) : hval(val);
+    }
+    if (grow_range == 0) {
+        n_gr_threads = 0;
+    }
 
     /* some sanity checks */
     g_assert_cmpuint(lookup_range, <=, n);
@@ -384,6 +431,8 @@ static void add_stats(struct thread_stats *s, struct thread_info *info, int n)
 
         s->rz += stats->rz;
         s->not_rz += stats->not_rz;
+
+        s->gr += stats->gr;
     }
 }
 
@@ -394,6 +443,7 @@ static void pr_stats(void)
 
     add_stats(&s, rw_info, n_rw_threads);
     add_stats(&s, rz_info, n_rz_threads);
+    add_stats(&s, gr_info, n_gr_threads);
 
     printf("Results:\n");
 
@@ -401,6 +451,18 @@ static void pr_stats(void)
         printf(" Resizes:           %zu (%.2f%% of %zu)\n",
                s.rz, (double)s.rz / (s.rz + s.not_rz) * 100, s.rz + s.not_rz);
     }
+    if (grow_range) {
+        struct qht_stats hst;
+
+        qht_statistics_init(&ht, &hst);
+        printf(" Grown:             %.2f M (%.2f%% of %.2fM)\n",
+               (double)s.gr / 1e6, (double)s.gr / grow_range * 100,
+               (double)grow_range / 1e6);
+        printf(" Table resizes:     %zu, last took %.1f us%s\n",
+               hst.resizes, hst.resize_ns / 1e3,
+               hst.resize_pending ? " (still in progress)" : "");
+        qht_statistics_destroy(&hst);
+    }
 
     printf(" Read:              %.2f M (%.2f%% of %.2fM)\n",
            (double)s.rd / 1e6,
@@ -424,7 +486,8 @@ static void run_test(void)
 {
     int i;
 
-    while (qatomic_read(&n_ready_threads) != n_rw_threads + n_rz_threads) {
+    while (qatomic_read(&n_ready_threads) !=
+           n_rw_threads + n_rz_threads + n_gr_threads) {
         cpu_relax();
     }
 
@@ -438,6 +501,9 @@ static void run_test(void)
     for (i = 0; i < n_rz_threads; i++) {
         qemu_thread_join(&rz_threads[i]);
     }
+    for (i = 0; i < n_gr_threads; i++) {
+        qemu_thread_join(&gr_threads[i]);
+    }
 }
 
 static void parse_args(int argc, char *argv[])
@@ -445,7 +511,7 @@ static void parse_args(int argc, char *argv[])
     int c;
 
     for (;;) {
-        c = getopt(argc, argv, "d:D:g:k:K:l:hn:N:o:pr:Rs:S:u:");
+        c = getopt(argc, argv, "d:D:g:G:I:k:K:l:hn:N:o:pr:Rs:S:u:");
         if (c < 0) {
             break;
         }
@@ -463,9 +529,16 @@ static void parse_args(int argc, char *argv[])
             qht_n_elems = atol(optarg);
             init_size = atol(optarg);
             break;
+        case 'G':
+            grow_range = atol(optarg);
+            qht_mode |= QHT_MODE_AUTO_RESIZE;
+            break;
         case 'h':
             usage_complete(argc, argv);
             exit(0);
+        case 'I':
+            n_gr_threads = atoi(optarg);
+            break;
         case 'k':
             init_size = atol(optarg);
             break;
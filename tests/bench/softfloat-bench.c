@@ -0,0 +1,252 @@
+/*
+ * softfloat-bench.c - per-op cost of the softfloat API
+ *
+ * Unlike tests/fp/fp-bench.c, which compares softfloat against the host
+ * FPU for one op at a time, this reports the cost of each QEMU softfloat
+ * entry point as emulated code sees it, including which ones manage to
+ * take a hardfloat fast path.  Each op is run with the inexact flag
+ * already set ("sticky", as most targets do) and with the flags cleared
+ * before every op ("clear", as the x87 helpers do).
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+#ifndef HW_POISON_H
+#error Must define HW_POISON_H to work around TARGET_* poisoning
+#endif
+
+#include "qemu/osdep.h"
+#include "qemu/timer.h"
+#include "fpu/softfloat.h"
+
+#define N_OPERANDS      4096
+#define DEFAULT_ITERS   200
+
+enum bench_op {
+    F32_ADD,
+    F32_MUL,
+    F32_DIV,
+    F32_SQRT,
+    F32_MULADD,
+    F32_MULADD_NEG,
+    F32_MULADD_HALVE,
+    F64_ADD,
+    F64_MUL,
+    F64_DIV,
+    F64_SQRT,
+    F64_MULADD,
+    F64_MULADD_NEG,
+    F64_MULADD_HALVE,
+    FX80_ADD,
+    FX80_SUB,
+    FX80_MUL,
+    FX80_DIV,
+    FX80_SQRT,
+    BENCH_OP_NR,
+};
+
+static const char * const op_names[BENCH_OP_NR] = {
+    [F32_ADD] = "float32_add",
+    [F32_MUL] = "float32_mul",
+    [F32_DIV] = "float32_div",
+    [F32_SQRT] = "float32_sqrt",
+    [F32_MULADD] = "float32_muladd",
+    [F32_MULADD_NEG] = "float32_muladd neg_c",
+    [F32_MULADD_HALVE] = "float32_muladd halve",
+    [F64_ADD] = "float64_add",
+    [F64_MUL] = "float64_mul",
+    [F64_DIV] = "float64_div",
+    [F64_SQRT] = "float64_sqrt",
+    [F64_MULADD] = "float64_muladd",
+    [F64_MULADD_NEG] = "float64_muladd neg_c",
+    [F64_MULADD_HALVE] = "float64_muladd halve",
+    [FX80_ADD] = "floatx80_add",
+    [FX80_SUB] = "floatx80_sub",
+    [FX80_MUL] = "floatx80_mul",
+    [FX80_DIV] = "floatx80_div",
+    [FX80_SQRT] = "floatx80_sqrt",
+};
+
+static float32 f32_ops[3][N_OPERANDS];
+static float64 f64_ops[3][N_OPERANDS];
+static floatx80 fx80_ops[2][N_OPERANDS];
+static unsigned int n_iters = DEFAULT_ITERS;
+
+/* disable optimizations with volatile */
+static volatile uint64_t sink;
+
+static uint64_t xorshift64star(uint64_t x)
+{
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    return x * UINT64_C(2685821657736338717);
+}
+
+/* positive normal numbers in [1, 2) * 2^[-32, 31], so that no op overflows */
+static void init_operands(void)
+{
+    float_status st = { .float_rounding_mode = float_round_nearest_even };
+    uint64_t r = 0xdeadfacedeadface;
+    int i, j;
+
+    for (i = 0; i < N_OPERANDS; i++) {
+        for (j = 0; j < 3; j++) {
+            int exp;
+
+            r = xorshift64star(r);
+            exp = (int)(r >> 58) - 32;
+            f64_ops[j][i] = make_float64(((uint64_t)(1023 + exp) << 52) |
+                                         (r & MAKE_64BIT_MASK(0, 52)));
+            f32_ops[j][i] = float64_to_float32(f64_ops[j][i], &st);
+            if (j < 2) {
+                fx80_ops[j][i] = make_floatx80(0x3fff + exp,
+                                               r | (1ull << 63));
+            }
+        }
+    }
+}
+
+static uint64_t run_op(enum bench_op op, float_status *st, bool clear)
+{
+    uint64_t acc = 0;
+    int i;
+
+    for (i = 0; i < N_OPERANDS; i++) {
+        float32 a32 = f32_ops[0][i], b32 = f32_ops[1][i], c32 = f32_ops[2][i];
+        float64 a64 = f64_ops[0][i], b64 = f64_ops[1][i], c64 = f64_ops[2][i];
+        floatx80 a80 = fx80_ops[0][i], b80 = fx80_ops[1][i];
+
+        if (clear) {
+            set_float_exception_flags(0, st);
+        }
+        switch (op) {
+        case F32_ADD:
+            acc += float32_val(float32_add(a32, b32, st));
+            break;
+        case F32_MUL:
+            acc += float32_val(float32_mul(a32, b32, st));
+            break;
+        case F32_DIV:
+            acc += float32_val(float32_div(a32, b32, st));
+            break;
+        case F32_SQRT:
+            acc += float32_val(float32_sqrt(a32, st));
+            break;
+        case F32_MULADD:
+            acc += float32_val(float32_muladd(a32, b32, c32, 0, st));
+            break;
+        case F32_MULADD_NEG:
+            acc += float32_val(float32_muladd(a32, b32, c32,
+                                              float_muladd_negate_c, st));
+            break;
+        case F32_MULADD_HALVE:
+            acc += float32_val(float32_muladd(a32, b32, c32,
+                                              float_muladd_halve_result, st));
+            break;
+        case F64_ADD:
+            acc += float64_val(float64_add(a64, b64, st));
+            break;
+        case F64_MUL:
+            acc += float64_val(float64_mul(a64, b64, st));
+            break;
+        case F64_DIV:
+            acc += float64_val(float64_div(a64, b64, st));
+            break;
+        case F64_SQRT:
+            acc += float64_val(float64_sqrt(a64, st));
+            break;
+        case F64_MULADD:
+            acc += float64_val(float64_muladd(a64, b64, c64, 0, st));
+            break;
+        case F64_MULADD_NEG:
+            acc += float64_val(float64_muladd(a64, b64, c64,
+                                              float_muladd_negate_c, st));
+            break;
+        case F64_MULADD_HALVE:
+            acc += float64_val(float64_muladd(a64, b64, c64,
+                                              float_muladd_halve_result, st));
+            break;
+        case FX80_ADD:
+            acc += floatx80_add(a80, b80, st).low;
+            break;
+        case FX80_SUB:
+            acc += floatx80_sub(a80, b80, st).low;
+            break;
+        case FX80_MUL:
+            acc += floatx80_mul(a80, b80, st).low;
+            break;
+        case FX80_DIV:
+            acc += floatx80_div(a80, b80, st).low;
+            break;
+        case FX80_SQRT:
+            acc += floatx80_sqrt(a80, st).low;
+            break;
+        default:
+            g_assert_not_reached();
+        }
+    }
+    return acc;
+}
+
+static double bench_op(enum bench_op op, bool clear)
+{
+    float_status st = {
+        .float_rounding_mode = float_round_nearest_even,
+        .floatx80_rounding_precision = floatx80_precision_x,
+        .float_exception_flags = clear ? 0 : float_flag_inexact,
+    };
+    int64_t t0;
+    unsigned int i;
+
+    /* warm up */
+    sink += run_op(op, &st, clear);
+
+    t0 = get_clock();
+    for (i = 0; i < n_iters; i++) {
+        sink += run_op(op, &st, clear);
+    }
+    return (double)(get_clock() - t0) / ((double)n_iters * N_OPERANDS);
+}
+
+static void usage_complete(char *argv[])
+{
+    fprintf(stderr, "Usage: %s [options]\n", argv[0]);
+    fprintf(stderr, "options:\n");
+    fprintf(stderr, " -n = number of passes over the operands. "
+            "Default: %d\n", DEFAULT_ITERS);
+    fprintf(stderr, " -h = show this help message.\n");
+}
+
+int main(int argc, char *argv[])
+{
+    int c, i;
+
+    for (;;) {
+        c = getopt(argc, argv, "hn:");
+        if (c < 0) {
+            break;
+        }
+        switch (c) {
+        case 'h':
+            usage_complete(argv);
+            exit(0);
+        case 'n':
+            n_iters = atoi(optarg);
+            break;
+        default:
+            usage_complete(argv);
+            exit(1);
+        }
+    }
+
+    init_operands();
+
+    printf("# %-22s %12s %12s\n", "op", "sticky ns/op", "clear ns/op");
+    for (i = 0; i < BENCH_OP_NR; i++) {
+        double sticky = bench_op(i, false);
+        double clear = bench_op(i, true);
+
+        printf("%-24s %12.2f %12.2f\n", op_names[i], sticky, clear);
+    }
+    return 0;
+}
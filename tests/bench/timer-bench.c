@@ -0,0 +1,129 @@
+/*
+ * timer-bench.c - cost of timer_mod, timer_del and running timers
+ *
+ * Arms a growing number of QEMU_CLOCK_REALTIME timers on the main loop
+ * timer list and reports, per operation, the cost of moving a pending
+ * timer, of arming and deleting one, and of firing them all.  With the
+ * timer list kept as a heap these should grow with log(n).
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+#include "qemu/osdep.h"
+#include "qemu/timer.h"
+
+#define DEFAULT_MAX_TIMERS  (64 * 1024)
+#define OPS_PER_TIMER       8
+
+static unsigned int max_timers = DEFAULT_MAX_TIMERS;
+static uint64_t n_fired;
+static uint64_t rnd = 0xdeadfacedeadface;
+
+static uint64_t xorshift64star(void)
+{
+    rnd ^= rnd >> 12;
+    rnd ^= rnd << 25;
+    rnd ^= rnd >> 27;
+    return rnd * UINT64_C(2685821657736338717);
+}
+
+static void timer_cb(void *opaque)
+{
+    n_fired++;
+}
+
+/* Expire times far enough in the future that nothing fires meanwhile */
+static int64_t future(int64_t now)
+{
+    return now + 3600 * NANOSECONDS_PER_SECOND +
+           (xorshift64star() % NANOSECONDS_PER_SECOND);
+}
+
+static void bench(unsigned int n)
+{
+    QEMUTimer **timers = g_new(QEMUTimer *, n);
+    int64_t now = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
+    uint64_t n_ops = (uint64_t)n * OPS_PER_TIMER;
+    double mod_ns, arm_del_ns, run_ns;
+    int64_t t0;
+    unsigned int i;
+    uint64_t j;
+
+    for (i = 0; i < n; i++) {
+        timers[i] = timer_new_ns(QEMU_CLOCK_REALTIME, timer_cb, NULL);
+        timer_mod_ns(timers[i], future(now));
+    }
+
+    t0 = get_clock();
+    for (j = 0; j < n_ops; j++) {
+        timer_mod_ns(timers[xorshift64star() % n], future(now));
+    }
+    mod_ns = (double)(get_clock() - t0) / n_ops;
+
+    t0 = get_clock();
+    for (j = 0; j < n_ops; j++) {
+        QEMUTimer *ts = timers[xorshift64star() % n];
+
+        timer_del(ts);
+        timer_mod_ns(ts, future(now));
+    }
+    arm_del_ns = (double)(get_clock() - t0) / n_ops;
+
+    /* Move every timer to the past, then fire them all */
+    for (i = 0; i < n; i++) {
+        timer_mod_ns(timers[i], xorshift64star() % NANOSECONDS_PER_SECOND);
+    }
+    n_fired = 0;
+    t0 = get_clock();
+    qemu_clock_run_timers(QEMU_CLOCK_REALTIME);
+    run_ns = (double)(get_clock() - t0) / n;
+    g_assert(n_fired == n);
+
+    printf("%-10u %14.2f %14.2f %14.2f\n", n, mod_ns, arm_del_ns, run_ns);
+
+    for (i = 0; i < n; i++) {
+        timer_free(timers[i]);
+    }
+    g_free(timers);
+}
+
+static void usage_complete(char *argv[])
+{
+    fprintf(stderr, "Usage: %s [options]\n", argv[0]);
+    fprintf(stderr, "options:\n");
+    fprintf(stderr, " -n = maximum number of timers. Default: %d\n",
+            DEFAULT_MAX_TIMERS);
+    fprintf(stderr, " -h = show this help message.\n");
+}
+
+int main(int argc, char *argv[])
+{
+    unsigned int n;
+    int c;
+
+    for (;;) {
+        c = getopt(argc, argv, "hn:");
+        if (c < 0) {
+            break;
+        }
+        switch (c) {
+        case 'h':
+            usage_complete(argv);
+            exit(0);
+        case 'n':
+            max_timers = atoi(optarg);
+            break;
+        default:
+            usage_complete(argv);
+            exit(1);
+        }
+    }
+
+    init_clocks(NULL);
+
+    printf("# %-8s %14s %14s %14s\n", "timers", "mod ns/op",
+           "del+mod ns/op", "run ns/op");
+    for (n = 16; n <= max_timers; n *= 4) {
+        bench(n);
+    }
+    return 0;
+}
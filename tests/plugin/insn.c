@@ -24,7 +24,7 @@ typedef struct {
 } InstructionCount;
 
 static InstructionCount counts[MAX_CPUS];
-static uint64_t inline_insn_count;
+static struct qemu_plugin_scoreboard *inline_insn_count;
 
 static bool do_inline;
 static bool do_size;
@@ -101,8 +101,9 @@ static void vcpu_tb_trans(qemu_plugin_id_t id, struct qemu_plugin_tb *tb)
         struct qemu_plugin_insn *insn = qemu_plugin_tb_get_insn(tb, i);
 
         if (do_inline) {
-            qemu_plugin_register_vcpu_insn_exec_inline(
-                insn, QEMU_PLUGIN_INLINE_ADD_U64, &inline_insn_count, 1);
+            qemu_plugin_register_vcpu_insn_exec_inline_per_vcpu(
+                insn, QEMU_PLUGIN_INLINE_ADD_U64,
+                qemu_plugin_scoreboard_u64(inline_insn_count), 1);
         } else {
             uint64_t vaddr = qemu_plugin_insn_vaddr(insn);
             qemu_plugin_register_vcpu_insn_exec_cb(
@@ -158,7 +159,18 @@ static void plugin_exit(qemu_plugin_id_t id, void *p)
             }
         }
     } else if (do_inline) {
-        g_string_append_printf(out, "insns: %" PRIu64 "\n", inline_insn_count);
+        qemu_plugin_u64 count = qemu_plugin_scoreboard_u64(inline_insn_count);
+
+        for (i = 0; i < MAX_CPUS; i++) {
+            uint64_t n = qemu_plugin_u64_get(count, i);
+            if (n) {
+                g_string_append_printf(out, "cpu %d insns: %" PRIu64 "\n",
+                                       i, n);
+            }
+        }
+        g_string_append_printf(out, "total insns: %" PRIu64 "\n",
+                               qemu_plugin_u64_sum(count));
+        qemu_plugin_scoreboard_free(inline_insn_count);
     } else {
         uint64_t total_insns = 0;
         for (i = 0; i < MAX_CPUS; i++) {
@@ -219,6 +231,14 @@ QEMU_PLUGIN_EXPORT int qemu_plugin_install(qemu_plugin_id_t id,
         sizes = g_array_new(true, true, sizeof(unsigned long));
     }
 
+    if (do_inline) {
+        inline_insn_count = qemu_plugin_scoreboard_new(sizeof(uint64_t));
+        if (!inline_insn_count) {
+            fprintf(stderr, "could not allocate scoreboard\n");
+            return -1;
+        }
+    }
+
     qemu_plugin_register_vcpu_tb_trans_cb(id, vcpu_tb_trans);
     qemu_plugin_register_atexit_cb(id, plugin_exit, NULL);
     return 0;
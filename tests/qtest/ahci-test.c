@@ -1435,6 +1435,36 @@ static void test_ncq_simple(void)
     ahci_shutdown(ahci);
 }
 
+/*
+ * With an iothread, a port moves its drive there after a streak of NCQ
+ * commands, and back to the main loop for any other command.
+ */
+static void test_ncq_iothread(void)
+{
+    AHCIQState *ahci;
+    int i, j;
+
+    ahci = ahci_boot_and_enable("-object iothread,id=iothread0 "
+                                "-global ich9-ahci.iothread=iothread0 "
+                                "-drive if=none,id=drive0,file=%s,"
+                                "cache=writeback,format=%s "
+                                "-M q35 "
+                                "-device ide-hd,drive=drive0 ",
+                                tmp_path, imgfmt);
+
+    for (i = 0; i < 2; i++) {
+        /* Long enough to move to the iothread halfway */
+        for (j = 0; j < 32; j++) {
+            ahci_test_io_rw_simple(ahci, 4096, j * 8,
+                                   READ_FPDMA_QUEUED,
+                                   WRITE_FPDMA_QUEUED);
+        }
+        ahci_test_flush(ahci);
+        ahci_test_io_rw_simple(ahci, 4096, 0, CMD_READ_DMA, CMD_WRITE_DMA);
+    }
+    ahci_shutdown(ahci);
+}
+
 static int prepare_iso(size_t size, unsigned char **buf, char **name)
 {
     g_autofree char *cdrom_path = NULL;
@@ -1948,6 +1978,7 @@ int main(int argc, char **argv)
     qtest_add_func("/ahci/reset", test_reset);
 
     qtest_add_func("/ahci/io/ncq/simple", test_ncq_simple);
+    qtest_add_func("/ahci/io/ncq/iothread", test_ncq_iothread);
     qtest_add_func("/ahci/migrate/ncq/simple", test_migrate_ncq);
     qtest_add_func("/ahci/io/ncq/retry", test_halted_ncq);
     qtest_add_func("/ahci/migrate/ncq/halted", test_migrate_halted_ncq);
@@ -1479,6 +1479,30 @@ static void test_precopy_unix_plain(void)
     test_precopy_common(&args);
 }
 
+/*
+ * virtio-net sets up RSS from post_load_async(); have more such devices
+ * than worker threads so that jobs get queued behind busy workers.
+ */
+#define VIRTIO_NET_ASYNC_OPTS                                           \
+    "-device virtio-net-pci,id=net0 -device virtio-net-pci,id=net1 "   \
+    "-device virtio-net-pci,id=net2 -device virtio-net-pci,id=net3 "   \
+    "-device virtio-net-pci,id=net4 -device virtio-net-pci,id=net5"
+
+static void test_precopy_unix_post_load_async(void)
+{
+    g_autofree char *uri = g_strdup_printf("unix:%s/migsocket", tmpfs);
+    MigrateCommon args = {
+        .start = {
+            .opts_source = VIRTIO_NET_ASYNC_OPTS,
+            .opts_target = VIRTIO_NET_ASYNC_OPTS,
+        },
+        .listen_uri = uri,
+        .connect_uri = uri,
+    };
+
+    test_precopy_common(&args);
+}
+
 
 static void test_precopy_unix_dirty_ring(void)
 {
@@ -1836,6 +1860,78 @@ static void test_migrate_fd_proto(void)
     };
     test_precopy_common(&args);
 }
+
+/*
+ * Save to a regular file, then load it with lazy-ram-load: guest RAM is
+ * read on demand while the destination runs.  Shared memory is loaded
+ * eagerly instead, the result must be the same.
+ */
+static void test_migrate_fd_file_lazy_common(bool use_shmem)
+{
+    g_autofree char *file = g_strdup_printf("%s/migfile", tmpfs);
+    MigrateStart args = {
+        .use_shmem = use_shmem,
+    };
+    QTestState *from, *to;
+    QDict *rsp;
+    int fd;
+
+    if (test_migrate_start(&from, &to, "defer", &args)) {
+        return;
+    }
+
+    migrate_set_capability(from, "lazy-ram-load", true);
+    migrate_set_capability(to, "lazy-ram-load", true);
+
+    /* Wait for the first serial output from the source */
+    wait_for_serial("src_serial");
+
+    fd = open(file, O_CREAT | O_WRONLY | O_TRUNC, 0600);
+    g_assert_cmpint(fd, >=, 0);
+    rsp = wait_command_fd(from, fd,
+                          "{ 'execute': 'getfd',"
+                          "  'arguments': { 'fdname': 'fd-mig' }}");
+    qobject_unref(rsp);
+    close(fd);
+
+    migrate_ensure_converge(from);
+    migrate_qmp(from, "fd:fd-mig", "{}");
+    wait_for_migration_complete(from);
+
+    if (!got_stop) {
+        qtest_qmp_eventwait(from, "STOP");
+    }
+
+    /* The stream is complete, the destination may seek in it now */
+    fd = open(file, O_RDONLY);
+    g_assert_cmpint(fd, >=, 0);
+    rsp = wait_command_fd(to, fd,
+                          "{ 'execute': 'getfd',"
+                          "  'arguments': { 'fdname': 'fd-mig' }}");
+    qobject_unref(rsp);
+    close(fd);
+
+    rsp = wait_command(to, "{ 'execute': 'migrate-incoming',"
+                           "  'arguments': { 'uri': 'fd:fd-mig' }}");
+    qobject_unref(rsp);
+
+    qtest_qmp_eventwait(to, "RESUME");
+    wait_for_serial("dest_serial");
+    wait_for_migration_complete(to);
+
+    test_migrate_end(from, to, true);
+    cleanup("migfile");
+}
+
+static void test_migrate_fd_file_lazy(void)
+{
+    test_migrate_fd_file_lazy_common(false);
+}
+
+static void test_migrate_fd_file_lazy_shmem(void)
+{
+    test_migrate_fd_file_lazy_common(true);
+}
 #endif /* _WIN32 */
 
 static void do_test_validate_uuid(MigrateStart *args, bool should_fail)
@@ -2658,6 +2754,10 @@ int main(int argc, char **argv)
     qtest_add_func("/migration/bad_dest", test_baddest);
     qtest_add_func("/migration/precopy/unix/plain", test_precopy_unix_plain);
     qtest_add_func("/migration/precopy/unix/xbzrle", test_precopy_unix_xbzrle);
+    if (qtest_has_device("virtio-net-pci")) {
+        qtest_add_func("/migration/precopy/unix/post-load-async",
+                       test_precopy_unix_post_load_async);
+    }
     /*
      * Compression fails from time to time.
      * Put test here but don't enable it until everything is fixed.
@@ -2721,6 +2821,9 @@ int main(int argc, char **argv)
     /* qtest_add_func("/migration/ignore_shared", test_ignore_shared); */
 #ifndef _WIN32
     qtest_add_func("/migration/fd_proto", test_migrate_fd_proto);
+    qtest_add_func("/migration/fd_file/lazy", test_migrate_fd_file_lazy);
+    qtest_add_func("/migration/fd_file/lazy/shmem",
+                   test_migrate_fd_file_lazy_shmem);
 #endif
     qtest_add_func("/migration/validate_uuid", test_validate_uuid);
     qtest_add_func("/migration/validate_uuid_error", test_validate_uuid_error);
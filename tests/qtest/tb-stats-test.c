@@ -0,0 +1,164 @@
+/*
+ * QTest testcase for TB statistics (x-query-tb-stats and info tb-stats)
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "libqtest.h"
+#include "qapi/qmp/qdict.h"
+#include "qapi/qmp/qjson.h"
+
+/*
+ * Returns the report, or NULL and the error description in @err.  The
+ * reference to @args is taken over.
+ */
+static char *query_tb_stats(QTestState *qts, QDict *args, char **err)
+{
+    QDict *resp, *ret;
+    char *text = NULL;
+
+    resp = qtest_qmp(qts, "{ 'execute': 'x-query-tb-stats', "
+                     "'arguments': %p }", args);
+    if (qdict_haskey(resp, "error")) {
+        g_assert(err);
+        *err = g_strdup(qdict_get_str(qdict_get_qdict(resp, "error"),
+                                      "desc"));
+    } else {
+        ret = qdict_get_qdict(resp, "return");
+        text = g_strdup(qdict_get_str(ret, "human-readable-text"));
+    }
+    qobject_unref(resp);
+    return text;
+}
+
+static unsigned int report_blocks(const char *text)
+{
+    const char *p = strstr(text, "):\n");
+    unsigned int blocks;
+
+    g_assert(p);
+    g_assert_cmpint(sscanf(p + 3, "%u blocks", &blocks), ==, 1);
+    return blocks;
+}
+
+/* The lines of the report below the column headers */
+static gchar **report_rows(const char *text)
+{
+    const char *p = strstr(text, "symbol\n");
+    g_autofree char *rows = NULL;
+
+    g_assert(p);
+    rows = g_strchomp(g_strdup(p + strlen("symbol\n")));
+    return *rows ? g_strsplit(rows, "\n", -1) : g_new0(gchar *, 1);
+}
+
+static uint64_t row_executions(const char *row)
+{
+    uint64_t pc, phys_pc, executions;
+
+    g_assert_cmpint(sscanf(row, "%" SCNx64 " %" SCNx64 " %" SCNu64,
+                           &pc, &phys_pc, &executions), ==, 3);
+    return executions;
+}
+
+static void test_tb_stats(void)
+{
+    QTestState *qts = qtest_init("-accel tcg,tb-stats=on");
+    g_autofree char *err = NULL;
+    gchar **rows;
+    char *text;
+    int i;
+
+    /* The firmware runs until it finds nothing to boot */
+    for (i = 0; i < 100; i++) {
+        text = query_tb_stats(qts, qdict_new(), NULL);
+        g_assert(g_str_has_prefix(text, "TB statistics (tb-stats=on):\n"));
+        if (report_blocks(text) > 10) {
+            break;
+        }
+        g_free(text);
+        text = NULL;
+        g_usleep(100 * 1000);
+    }
+    g_assert(text);
+
+    /* Ten rows by default, sorted by executions, which add up */
+    rows = report_rows(text);
+    g_assert_cmpint(g_strv_length(rows), ==, 10);
+    g_assert_cmpuint(row_executions(rows[0]), >, 0);
+    for (i = 1; i < 10; i++) {
+        g_assert_cmpuint(row_executions(rows[i - 1]), >=,
+                         row_executions(rows[i]));
+    }
+    g_strfreev(rows);
+    g_free(text);
+
+    text = query_tb_stats(qts, qdict_from_jsonf_nofail(
+                              "{ 'count': 3, 'sort-by': 'translations' }"),
+                          NULL);
+    rows = report_rows(text);
+    g_assert_cmpint(g_strv_length(rows), ==, 3);
+    g_strfreev(rows);
+    g_free(text);
+
+    g_assert_null(query_tb_stats(qts, qdict_from_jsonf_nofail(
+                                  "{ 'count': -1 }"), &err));
+    g_assert_nonnull(strstr(err, "non-negative"));
+
+    /* With the vCPUs stopped, a reset leaves every counter at zero */
+    qtest_qmp_assert_success(qts, "{ 'execute': 'stop' }");
+    g_free(query_tb_stats(qts, qdict_from_jsonf_nofail(
+                              "{ 'reset': true }"), NULL));
+    text = query_tb_stats(qts, qdict_new(), NULL);
+    rows = report_rows(text);
+    g_assert_cmpint(g_strv_length(rows), ==, 10);
+    g_assert_cmpuint(row_executions(rows[0]), ==, 0);
+    g_strfreev(rows);
+    g_free(text);
+
+    /* HMP goes through the same code, and runs after the reset too */
+    qtest_qmp_assert_success(qts, "{ 'execute': 'cont' }");
+    text = qtest_hmp(qts, "info tb-stats 2 entries");
+    g_assert(g_str_has_prefix(text, "TB statistics (tb-stats=on):"));
+    rows = report_rows(text);
+    g_assert_cmpint(g_strv_length(rows), ==, 2);
+    g_strfreev(rows);
+    g_free(text);
+
+    text = qtest_hmp(qts, "info tb-stats 2 bogus");
+    g_assert_null(strstr(text, "TB statistics"));
+    g_free(text);
+
+    qtest_quit(qts);
+}
+
+static void test_tb_stats_no_tcg(void)
+{
+    QTestState *qts = qtest_init("-machine none");
+    g_autofree char *err = NULL;
+    char *text;
+
+    g_assert_null(query_tb_stats(qts, qdict_new(), &err));
+    g_assert_nonnull(strstr(err, "accel=tcg"));
+
+    text = qtest_hmp(qts, "info tb-stats");
+    g_assert_nonnull(strstr(text, "accel=tcg"));
+    g_free(text);
+
+    qtest_quit(qts);
+}
+
+int main(int argc, char **argv)
+{
+    g_test_init(&argc, &argv, NULL);
+
+    /* Without TCG built in, the command does not exist */
+    if (qtest_has_accel("tcg")) {
+        qtest_add_func("/tb-stats/query", test_tb_stats);
+        qtest_add_func("/tb-stats/no-tcg", test_tb_stats_no_tcg);
+    }
+
+    return g_test_run();
+}
@@ -0,0 +1,107 @@
+/*
+ * QTest testcase for VirtIO balloon
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "libqtest-single.h"
+#include "qemu/module.h"
+#include "qapi/qmp/qdict.h"
+#include "libqos/qgraph.h"
+#include "libqos/virtio-balloon.h"
+#include "standard-headers/linux/virtio_balloon.h"
+
+#define QVIRTIO_BALLOON_TIMEOUT_US  (30 * 1000 * 1000)
+
+/* The queue index of the reporting queue without free page hinting */
+#define QVIRTIO_BALLOON_REPORTING_VQ  3
+
+static uint64_t balloon_qom_get(QTestState *qts, const char *property)
+{
+    QDict *resp;
+    uint64_t ret;
+
+    resp = qtest_qmp(qts, "{ 'execute': 'qom-get', 'arguments': "
+                     "{ 'path': '/machine/peripheral/balloon0', "
+                     "'property': %s } }", property);
+    g_assert(qdict_haskey(resp, "return"));
+    ret = qdict_get_int(resp, "return");
+    qobject_unref(resp);
+    return ret;
+}
+
+/*
+ * Report pages 0, 1 and 3 of a buffer in one element, and check that the
+ * two adjacent ranges are discarded together and that page 2 is left alone.
+ */
+static void reporting(void *obj, void *data, QGuestAllocator *t_alloc)
+{
+    QVirtioBalloon *balloon = obj;
+    QVirtioDevice *dev = balloon->vdev;
+    QTestState *qts = global_qtest;
+    size_t page = qemu_real_host_page_size();
+    uint64_t features, buf, addr;
+    uint8_t *data_buf = g_malloc(page);
+    uint32_t free_head;
+    QVirtQueue *vq;
+    int i;
+
+    features = qvirtio_get_features(dev);
+    g_assert(features & (1ull << VIRTIO_BALLOON_F_REPORTING));
+    features &= ~(QVIRTIO_F_BAD_FEATURE |
+                  (1ull << VIRTIO_BALLOON_F_FREE_PAGE_HINT) |
+                  (1ull << VIRTIO_BALLOON_F_PAGE_POISON) |
+                  (1ull << VIRTIO_RING_F_EVENT_IDX));
+    qvirtio_set_features(dev, features);
+
+    vq = qvirtqueue_setup(dev, t_alloc, QVIRTIO_BALLOON_REPORTING_VQ);
+    qvirtio_set_driver_ok(dev);
+
+    /* Only host-page aligned ranges are discarded */
+    buf = guest_alloc(t_alloc, 5 * page);
+    addr = ROUND_UP(buf, page);
+    for (i = 0; i < 4; i++) {
+        qtest_memset(qts, addr + i * page, 0x5a, page);
+    }
+
+    free_head = qvirtqueue_add(qts, vq, addr, page, true, true);
+    qvirtqueue_add(qts, vq, addr + page, page, true, true);
+    qvirtqueue_add(qts, vq, addr + 3 * page, page, true, false);
+    qvirtqueue_kick(qts, dev, vq, free_head);
+    qvirtio_wait_used_elem(qts, dev, vq, free_head, NULL,
+                           QVIRTIO_BALLOON_TIMEOUT_US);
+
+    for (i = 0; i < 4; i++) {
+        qtest_memread(qts, addr + i * page, data_buf, page);
+        g_assert_cmpint(data_buf[0], ==, i == 2 ? 0x5a : 0);
+        g_assert_cmpint(data_buf[page - 1], ==, i == 2 ? 0x5a : 0);
+    }
+
+    g_assert_cmpint(balloon_qom_get(qts, "free-page-reporting-bytes"), ==,
+                    3 * page);
+    g_assert_cmpint(balloon_qom_get(qts, "free-page-reporting-discards"), ==,
+                    2);
+
+    g_free(data_buf);
+    guest_free(t_alloc, buf);
+    qvirtqueue_cleanup(dev->bus, vq, t_alloc);
+}
+
+static void register_virtio_balloon_test(void)
+{
+    QOSGraphTestOptions opts = {
+        .edge.extra_device_opts = "id=balloon0,free-page-reporting=on",
+    };
+
+    qos_add_test("reporting", "virtio-balloon", reporting, &opts);
+
+    /* The discards run in the iothread, the elements are pushed back later */
+    opts.edge.before_cmd_line = "-object iothread,id=iothread0";
+    opts.edge.extra_device_opts = "id=balloon0,free-page-reporting=on,"
+                                  "iothread=iothread0";
+    qos_add_test("reporting/iothread", "virtio-balloon", reporting, &opts);
+}
+
+libqos_init(register_virtio_balloon_test);
@@ -10,6 +10,7 @@
 
 #include "qemu/osdep.h"
 #include "libqtest-single.h"
+#include "qapi/qmp/qdict.h"
 #include "qemu/bswap.h"
 #include "qemu/module.h"
 #include "standard-headers/linux/virtio_blk.h"
@@ -694,6 +695,103 @@ static void idx(void *obj, void *u_data, QGuestAllocator *t_alloc)
     qvirtqueue_cleanup(dev->bus, vq, t_alloc);
 }
 
+typedef struct QueueStats {
+    int64_t kicks;
+    int64_t poll_hits;
+    int64_t notifications;
+} QueueStats;
+
+static void get_queue_stats(QTestState *qts, QueueStats *stats)
+{
+    QDict *resp, *ret;
+
+    resp = qtest_qmp(qts, "{ 'execute': 'x-query-virtio-queue-status', "
+                     " 'arguments': { 'path': %s, 'queue': 0 } }",
+                     "/machine/peripheral/drv0/virtio-backend");
+    g_assert(qdict_haskey(resp, "return"));
+    ret = qdict_get_qdict(resp, "return");
+    stats->kicks = qdict_get_int(ret, "kicks");
+    stats->poll_hits = qdict_get_int(ret, "poll-hits");
+    stats->notifications = qdict_get_int(ret, "notifications");
+    qobject_unref(resp);
+}
+
+/*
+ * Check the kick, poll hit and notification counters of
+ * x-query-virtio-queue-status, and that a burst of requests behind a
+ * single kick all complete, whatever batching does with notifications.
+ */
+static void queue_stats(void *obj, void *data, QGuestAllocator *t_alloc)
+{
+    QVirtioBlk *blk_if = obj;
+    QVirtioDevice *dev = blk_if->vdev;
+    QTestState *qts = global_qtest;
+    QueueStats before, after;
+    QVirtioBlkReq req;
+    uint64_t req_addr[8];
+    uint32_t free_head[8];
+    gint64 start_time;
+    QVirtQueue *vq;
+    int i, done;
+
+    get_queue_stats(qts, &before);
+    g_assert_cmpint(before.kicks, ==, 0);
+    g_assert_cmpint(before.poll_hits, ==, 0);
+    g_assert_cmpint(before.notifications, ==, 0);
+
+    /* A write and a read, each with its own kick and interrupt */
+    vq = test_basic(dev, t_alloc);
+
+    get_queue_stats(qts, &after);
+    g_assert_cmpint(after.kicks, >=, 1);
+    g_assert_cmpint(after.kicks + after.poll_hits, >=, 2);
+    g_assert_cmpint(after.notifications, >=, 2);
+
+    /* Then several requests behind a single kick */
+    before = after;
+    for (i = 0; i < ARRAY_SIZE(req_addr); i++) {
+        req.type = VIRTIO_BLK_T_OUT;
+        req.ioprio = 1;
+        req.sector = i;
+        req.data = g_malloc0(512);
+        strcpy(req.data, "TEST");
+
+        req_addr[i] = virtio_blk_request(t_alloc, dev, &req, 512);
+
+        g_free(req.data);
+
+        free_head[i] = qvirtqueue_add(qts, vq, req_addr[i], 16, false, true);
+        qvirtqueue_add(qts, vq, req_addr[i] + 16, 512, false, true);
+        qvirtqueue_add(qts, vq, req_addr[i] + 528, 1, true, false);
+    }
+    qvirtqueue_kick(qts, dev, vq, free_head[0]);
+
+    /* The requests may complete in any order */
+    start_time = g_get_monotonic_time();
+    for (done = 0; done < ARRAY_SIZE(req_addr); ) {
+        uint32_t desc_idx;
+
+        qtest_clock_step(qts, 100);
+        while (qvirtqueue_get_buf(qts, vq, &desc_idx, NULL)) {
+            done++;
+        }
+        g_assert(g_get_monotonic_time() - start_time <=
+                 QVIRTIO_BLK_TIMEOUT_US);
+    }
+    for (i = 0; i < ARRAY_SIZE(req_addr); i++) {
+        g_assert_cmpint(readb(req_addr[i] + 528), ==, 0);
+        guest_free(t_alloc, req_addr[i]);
+    }
+
+    get_queue_stats(qts, &after);
+    g_assert_cmpint(after.kicks, <=, before.kicks + 1);
+    g_assert_cmpint(after.kicks + after.poll_hits, >,
+                    before.kicks + before.poll_hits);
+    g_assert_cmpint(after.notifications, >, before.notifications);
+
+    qvirtqueue_cleanup(dev->bus, vq, t_alloc);
+}
+
 static void pci_hotplug(void *obj, void *data, QGuestAllocator *t_alloc)
 {
     QVirtioPCIDevice *dev1 = obj;
@@ -799,6 +897,7 @@ static void register_virtio_blk_test(void)
     /* tests just for virtio-blk-pci */
     qos_add_test("msix", "virtio-blk-pci", msix, &opts);
     qos_add_test("idx", "virtio-blk-pci", idx, &opts);
+    qos_add_test("queue-stats", "virtio-blk-pci", queue_stats, &opts);
     qos_add_test("nxvirtq", "virtio-blk-pci",
                       test_nonexistent_virtqueue, &opts);
     qos_add_test("hotplug", "virtio-blk-pci", pci_hotplug, &opts);
@@ -0,0 +1,115 @@
+/*
+ * 16-byte compare-and-swap from several threads
+ *
+ * Most hosts cannot do a 16-byte compare-and-swap natively for every
+ * guest, in which case QEMU falls back to an exclusive section or,
+ * with -atomic-lock, to a lock selected by the address.  Each thread
+ * increments both halves of a shared counter, and of a counter of its
+ * own, in a compare-and-swap loop: a lost update or a torn value shows
+ * up as a wrong total or as halves that differ.
+ *
+ * Every access to the counters while the threads run goes through the
+ * 16-byte compare-and-swap, as the fallback lock requires.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+
+#ifdef __GCC_HAVE_SYNC_COMPARE_AND_SWAP_16
+
+#define NR_THREADS 4
+#define ITERATIONS 100000
+
+typedef unsigned __int128 u128;
+
+typedef struct {
+    u128 val;
+    /* Keep the per-thread counters in separate granules */
+    char pad[48];
+} __attribute__((aligned(64))) Counter;
+
+static Counter shared;
+static Counter own[NR_THREADS];
+
+static u128 make(uint64_t lo, uint64_t hi)
+{
+    return ((u128)hi << 64) | lo;
+}
+
+static void increment(u128 *p)
+{
+    u128 old = __sync_val_compare_and_swap(p, 0, 0);
+
+    for (;;) {
+        uint64_t lo = old, hi = old >> 64;
+        u128 prev = __sync_val_compare_and_swap(p, old, make(lo + 1, hi + 1));
+
+        if (prev == old) {
+            return;
+        }
+        old = prev;
+    }
+}
+
+static void *thread_fn(void *arg)
+{
+    u128 *mine = &own[(intptr_t)arg].val;
+    int i;
+
+    for (i = 0; i < ITERATIONS; i++) {
+        increment(&shared.val);
+        increment(mine);
+    }
+    return NULL;
+}
+
+static int check(const char *name, u128 val, uint64_t expected)
+{
+    uint64_t lo = val, hi = val >> 64;
+
+    if (lo != expected || hi != expected) {
+        fprintf(stderr, "%s: lo=%llu hi=%llu, expected %llu\n", name,
+                (unsigned long long)lo, (unsigned long long)hi,
+                (unsigned long long)expected);
+        return 1;
+    }
+    return 0;
+}
+
+int main(void)
+{
+    pthread_t threads[NR_THREADS];
+    char name[16];
+    int i, err = 0;
+
+    for (i = 0; i < NR_THREADS; i++) {
+        if (pthread_create(&threads[i], NULL, thread_fn, (void *)(intptr_t)i)) {
+            perror("pthread_create");
+            return EXIT_FAILURE;
+        }
+    }
+    for (i = 0; i < NR_THREADS; i++) {
+        pthread_join(threads[i], NULL);
+    }
+
+    err |= check("shared", shared.val, (uint64_t)NR_THREADS * ITERATIONS);
+    for (i = 0; i < NR_THREADS; i++) {
+        snprintf(name, sizeof(name), "thread %d", i);
+        err |= check(name, own[i].val, ITERATIONS);
+    }
+    return err ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+#else
+
+int main(void)
+{
+    printf("SKIP: no 16-byte compare-and-swap for this target\n");
+    return EXIT_SUCCESS;
+}
+
+#endif
@@ -0,0 +1,338 @@
+/*
+ * Concurrent translation exerciser
+ *
+ * Start a number of threads that all run the same large amount of code
+ * that has never been executed before, as a multi-threaded program does
+ * while it starts up.  Each thread walks the code from a different
+ * offset, so that the threads miss in the TB cache at the same time and
+ * translate concurrently.  Report how long it took, and check that every
+ * thread computed the same result.
+ *
+ * Run it with 1 and with N threads to compare, e.g.
+ *   qemu-x86_64 ./tb-gen-threads 1
+ *   qemu-x86_64 ./tb-gen-threads 16
+ *
+ * Where there is a code template for the guest, also race translation
+ * with self-modifying code, and with munmap and mprotect taking away
+ * the code page: a translation that raced with either must not be used.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include <assert.h>
+#include <setjmp.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+
+#define NR_FUNCS 1024
+
+typedef uint64_t (*Func)(uint64_t);
+
+/* NR_FUNCS distinct functions, so that each one is a TB of its own */
+#define F(name, k)                                                      \
+    static __attribute__((noinline)) uint64_t name(uint64_t x)          \
+    {                                                                   \
+        return (x ^ (k)) * 0x9e3779b97f4a7c15ull + (k);                 \
+    }
+#define D4(p, b)    F(p##0, (b) * 4) F(p##1, (b) * 4 + 1)               \
+                    F(p##2, (b) * 4 + 2) F(p##3, (b) * 4 + 3)
+#define D16(p, b)   D4(p##0, (b) * 4) D4(p##1, (b) * 4 + 1)             \
+                    D4(p##2, (b) * 4 + 2) D4(p##3, (b) * 4 + 3)
+#define D64(p, b)   D16(p##0, (b) * 4) D16(p##1, (b) * 4 + 1)           \
+                    D16(p##2, (b) * 4 + 2) D16(p##3, (b) * 4 + 3)
+#define D256(p, b)  D64(p##0, (b) * 4) D64(p##1, (b) * 4 + 1)           \
+                    D64(p##2, (b) * 4 + 2) D64(p##3, (b) * 4 + 3)
+#define D1024(p)    D256(p##0, 0) D256(p##1, 1) D256(p##2, 2) D256(p##3, 3)
+
+#define T4(p)       p##0, p##1, p##2, p##3,
+#define T16(p)      T4(p##0) T4(p##1) T4(p##2) T4(p##3)
+#define T64(p)      T16(p##0) T16(p##1) T16(p##2) T16(p##3)
+#define T256(p)     T64(p##0) T64(p##1) T64(p##2) T64(p##3)
+#define T1024(p)    T256(p##0) T256(p##1) T256(p##2) T256(p##3)
+
+D1024(f_)
+
+static const Func funcs[NR_FUNCS] = { T1024(f_) };
+
+int max_threads = 8;
+
+typedef struct {
+    pthread_t thread;
+    int start;
+    uint64_t result;
+} ThreadArg;
+
+static uint64_t run_all(int start)
+{
+    uint64_t sum = 0;
+    int i;
+
+    for (i = 0; i < NR_FUNCS; i++) {
+        int n = (start + i) % NR_FUNCS;
+        sum += funcs[n](n);
+    }
+    return sum;
+}
+
+static void *thread_fn(void *varg)
+{
+    ThreadArg *arg = varg;
+
+    arg->result = run_all(arg->start);
+    return NULL;
+}
+
+static double now_ms(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+/*
+ * "return VAL" with VAL in an aligned 32-bit word, so that it can be
+ * changed with a single store.  CODE_OFS is the entry point.
+ */
+#if defined(__i386__) || defined(__x86_64__)
+#define CODE_OFS    3
+#define CODE_MAX    0xffffffffu
+static void write_code(uint8_t *p, uint32_t val)
+{
+    p[3] = 0xb8;                            /* mov $val, %eax */
+    __atomic_store_n((uint32_t *)(p + 4), val, __ATOMIC_RELAXED);
+    p[8] = 0xc3;                            /* ret */
+}
+#elif defined(__aarch64__)
+#define CODE_OFS    0
+#define CODE_MAX    0xffffu
+static void write_code(uint8_t *p, uint32_t val)
+{
+    /* movz w0, #val; ret */
+    __atomic_store_n((uint32_t *)p, 0x52800000u | (val << 5),
+                     __ATOMIC_RELAXED);
+    ((uint32_t *)p)[1] = 0xd65f03c0u;
+}
+#endif
+
+#ifdef CODE_OFS
+typedef uint32_t (*CodeFunc)(void);
+
+#define NR_CHANGES  10000
+
+static uint8_t *code_page;
+static size_t code_size;
+static volatile int code_done;
+static uint32_t code_val;       /* last value written, for SMC */
+static unsigned int code_gen;   /* odd while the page is not executable */
+static __thread sigjmp_buf code_jmp;
+
+static void code_sync(void)
+{
+#ifdef __aarch64__
+    asm volatile("isb" : : : "memory");
+#endif
+}
+
+static void *smc_reader(void *arg)
+{
+    long bad = 0;
+
+    while (!code_done) {
+        uint32_t min = __atomic_load_n(&code_val, __ATOMIC_ACQUIRE);
+        uint32_t got;
+
+        code_sync();
+        got = ((CodeFunc)(code_page + CODE_OFS))();
+        if (got < min) {
+            fprintf(stderr, "smc: got %u after %u was written\n", got, min);
+            bad++;
+        }
+    }
+    return (void *)bad;
+}
+
+/* One thread rewrites the code while the others execute it. */
+static int test_smc(void)
+{
+    pthread_t *threads = calloc(max_threads, sizeof(pthread_t));
+    uint32_t val;
+    long bad = 0;
+    int i;
+
+    code_done = 0;
+    code_val = 0;
+    write_code(code_page, 0);
+    __builtin___clear_cache((char *)code_page, (char *)code_page + 16);
+    for (i = 0; i < max_threads; i++) {
+        pthread_create(&threads[i], NULL, smc_reader, NULL);
+    }
+    for (val = 1; val <= NR_CHANGES && val <= CODE_MAX; val++) {
+        write_code(code_page, val);
+        __builtin___clear_cache((char *)code_page, (char *)code_page + 16);
+        __atomic_store_n(&code_val, val, __ATOMIC_RELEASE);
+    }
+    code_done = 1;
+    for (i = 0; i < max_threads; i++) {
+        void *ret;
+
+        pthread_join(threads[i], &ret);
+        bad += (long)ret;
+    }
+    free(threads);
+    printf("smc: %d changes, %ld stale results\n", NR_CHANGES, bad);
+    return bad ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+static void code_segv(int sig, siginfo_t *info, void *uc)
+{
+    siglongjmp(code_jmp, 1);
+}
+
+static void *unmap_reader(void *arg)
+{
+    long bad = 0;
+
+    while (!code_done) {
+        unsigned int gen = __atomic_load_n(&code_gen, __ATOMIC_ACQUIRE);
+
+        if (sigsetjmp(code_jmp, 1) == 0) {
+            code_sync();
+            ((CodeFunc)(code_page + CODE_OFS))();
+            /* Ran although the page was not executable the whole time? */
+            if ((gen & 1) &&
+                __atomic_load_n(&code_gen, __ATOMIC_ACQUIRE) == gen) {
+                fprintf(stderr, "unmap: executed a page taken away "
+                        "(generation %u)\n", gen);
+                bad++;
+            }
+        }
+    }
+    return (void *)bad;
+}
+
+static void map_code(void)
+{
+    void *p = mmap(code_page, code_size, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED, -1, 0);
+
+    assert(p == code_page);
+    write_code(code_page, 0);
+    __builtin___clear_cache((char *)code_page, (char *)code_page + 16);
+    assert(mprotect(code_page, code_size, PROT_READ | PROT_EXEC) == 0);
+}
+
+/*
+ * One thread takes the code page away, alternately with mprotect and
+ * with munmap, while the others execute it.  Code_gen is odd for as
+ * long as the page is not executable: it is bumped after the page is
+ * taken away and before it is given back.
+ */
+static int test_unmap(void)
+{
+    pthread_t *threads = calloc(max_threads, sizeof(pthread_t));
+    struct sigaction sa = { .sa_sigaction = code_segv,
+                            .sa_flags = SA_SIGINFO | SA_NODEFER };
+    long bad = 0;
+    int i;
+
+    assert(sigaction(SIGSEGV, &sa, NULL) == 0);
+    assert(sigaction(SIGBUS, &sa, NULL) == 0);
+    code_done = 0;
+    code_gen = 0;
+    map_code();
+    for (i = 0; i < max_threads; i++) {
+        pthread_create(&threads[i], NULL, unmap_reader, NULL);
+    }
+    for (i = 0; i < NR_CHANGES; i++) {
+        if (i & 1) {
+            assert(munmap(code_page, code_size) == 0);
+        } else {
+            assert(mprotect(code_page, code_size, PROT_READ) == 0);
+        }
+        __atomic_fetch_add(&code_gen, 1, __ATOMIC_RELEASE);
+        usleep(10);
+        __atomic_fetch_add(&code_gen, 1, __ATOMIC_RELEASE);
+        if (i & 1) {
+            map_code();
+        } else {
+            assert(mprotect(code_page, code_size,
+                            PROT_READ | PROT_EXEC) == 0);
+        }
+    }
+    code_done = 1;
+    for (i = 0; i < max_threads; i++) {
+        void *ret;
+
+        pthread_join(threads[i], &ret);
+        bad += (long)ret;
+    }
+    free(threads);
+    printf("unmap: %d changes, %ld stale executions\n", NR_CHANGES, bad);
+    return bad ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+#endif
+
+int main(int argc, char **argv)
+{
+    ThreadArg *args;
+    uint64_t expected;
+    double t0, t1;
+    int i, ret = EXIT_SUCCESS;
+
+    if (argc > 1) {
+        max_threads = atoi(argv[1]);
+    }
+    if (max_threads < 1) {
+        fprintf(stderr, "usage: %s [threads]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    args = calloc(max_threads, sizeof(ThreadArg));
+
+    t0 = now_ms();
+    for (i = 0; i < max_threads; i++) {
+        args[i].start = (int)((long)i * NR_FUNCS / max_threads);
+        pthread_create(&args[i].thread, NULL, thread_fn, &args[i]);
+    }
+    for (i = 0; i < max_threads; i++) {
+        pthread_join(args[i].thread, NULL);
+    }
+    t1 = now_ms();
+
+    /* The sum does not depend on the order, and everything is cached now */
+    expected = run_all(0);
+    for (i = 0; i < max_threads; i++) {
+        if (args[i].result != expected) {
+            fprintf(stderr, "thread %d: got 0x%llx, expected 0x%llx\n", i,
+                    (unsigned long long)args[i].result,
+                    (unsigned long long)expected);
+            ret = EXIT_FAILURE;
+        }
+    }
+
+    printf("%d threads, %d functions: %.3f ms\n",
+           max_threads, NR_FUNCS, t1 - t0);
+    free(args);
+
+#ifdef CODE_OFS
+    code_size = getpagesize();
+    code_page = mmap(NULL, code_size, PROT_READ | PROT_WRITE | PROT_EXEC,
+                     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    assert(code_page != MAP_FAILED);
+    if (test_smc() != EXIT_SUCCESS) {
+        ret = EXIT_FAILURE;
+    }
+    if (test_unmap() != EXIT_SUCCESS) {
+        ret = EXIT_FAILURE;
+    }
+    munmap(code_page, code_size);
+#endif
+    return ret;
+}
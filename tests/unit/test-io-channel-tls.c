@@ -27,6 +27,7 @@
 #include "io/channel-tls.h"
 #include "io/channel-socket.h"
 #include "io-channel-helpers.h"
+#include "socket-helpers.h"
 #include "crypto/init.h"
 #include "crypto/tlscredsx509.h"
 #include "qapi/error.h"
@@ -46,8 +47,12 @@ struct QIOChannelTLSTestData {
     bool expectClientFail;
     const char *hostname;
     const char *const *wildcards;
+    /* Run over TCP instead of AF_UNIX, with kernel TLS enabled */
+    bool kernelTLS;
 };
 
+static bool has_ipv4;
+
 struct QIOChannelTLSHandshakeData {
     bool finished;
     bool failed;
@@ -64,7 +69,8 @@ static void test_tls_handshake_done(QIOTask *task,
 
 
 static QCryptoTLSCreds *test_tls_creds_create(QCryptoTLSCredsEndpoint endpoint,
-                                              const char *certdir)
+                                              const char *certdir,
+                                              bool kernelTLS)
 {
     Object *parent = object_get_objects_root();
     Object *creds = object_new_with_props(
@@ -85,6 +91,7 @@ static QCryptoTLSCreds *test_tls_creds_create(QCryptoTLSCredsEndpoint endpoint,
          * validate the sanity check code.
          */
         "sanity-check", "no",
+        "kernel-tls", kernelTLS ? "yes" : "no",
         NULL
         );
 
@@ -92,6 +99,35 @@ static QCryptoTLSCreds *test_tls_creds_create(QCryptoTLSCredsEndpoint endpoint,
 }
 
 
+/*
+ * Kernel TLS only works on TCP sockets, so get a connected
+ * pair of those over the loopback interface
+ */
+static void test_tls_tcp_pair(int channel[2])
+{
+    struct sockaddr_in addr = {
+        .sin_family = AF_INET,
+        .sin_addr.s_addr = htonl(INADDR_LOOPBACK),
+    };
+    socklen_t addrlen = sizeof(addr);
+    int lfd;
+
+    lfd = qemu_socket(AF_INET, SOCK_STREAM, 0);
+    g_assert(lfd >= 0);
+    g_assert(bind(lfd, (struct sockaddr *)&addr, addrlen) == 0);
+    g_assert(listen(lfd, 1) == 0);
+    g_assert(getsockname(lfd, (struct sockaddr *)&addr, &addrlen) == 0);
+
+    channel[0] = qemu_socket(AF_INET, SOCK_STREAM, 0);
+    g_assert(channel[0] >= 0);
+    g_assert(connect(channel[0], (struct sockaddr *)&addr, addrlen) == 0);
+    channel[1] = qemu_accept(lfd, NULL, NULL);
+    g_assert(channel[1] >= 0);
+
+    close(lfd);
+}
+
+
 /*
  * This tests validation checking of peer certificates
  *
@@ -120,8 +156,17 @@ static void test_io_channel_tls(const void *opaque)
     QIOChannelTest *test;
     GMainContext *mainloop;
 
+    if (data->kernelTLS && !has_ipv4) {
+        g_test_skip("IPv4 is not available");
+        return;
+    }
+
     /* We'll use this for our fake client-server connection */
-    g_assert(qemu_socketpair(AF_UNIX, SOCK_STREAM, 0, channel) == 0);
+    if (data->kernelTLS) {
+        test_tls_tcp_pair(channel);
+    } else {
+        g_assert(qemu_socketpair(AF_UNIX, SOCK_STREAM, 0, channel) == 0);
+    }
 
 #define CLIENT_CERT_DIR "tests/test-io-channel-tls-client/"
 #define SERVER_CERT_DIR "tests/test-io-channel-tls-server/"
@@ -152,12 +197,12 @@ static void test_io_channel_tls(const void *opaque)
 
     clientCreds = test_tls_creds_create(
         QCRYPTO_TLS_CREDS_ENDPOINT_CLIENT,
-        CLIENT_CERT_DIR);
+        CLIENT_CERT_DIR, data->kernelTLS);
     g_assert(clientCreds != NULL);
 
     serverCreds = test_tls_creds_create(
         QCRYPTO_TLS_CREDS_ENDPOINT_SERVER,
-        SERVER_CERT_DIR);
+        SERVER_CERT_DIR, data->kernelTLS);
     g_assert(serverCreds != NULL);
 
     auth = qauthz_list_new("channeltlsacl",
@@ -224,6 +269,17 @@ static void test_io_channel_tls(const void *opaque)
     g_assert(clientHandshake.failed == data->expectClientFail);
     g_assert(serverHandshake.failed == data->expectServerFail);
 
+    /*
+     * Whether the kernel takes over depends on the tls module and the
+     * negotiated cipher; the data must make it across either way.
+     */
+    if (!data->kernelTLS) {
+        g_assert(!clientChanTLS->ktls_send);
+        g_assert(!serverChanTLS->ktls_send);
+    } else if (!clientChanTLS->ktls_send || !serverChanTLS->ktls_send) {
+        g_test_message("kernel TLS not available, testing GnuTLS only");
+    }
+
     test = qio_channel_test_new();
     qio_channel_test_run_threads(test, false,
                                  QIO_CHANNEL(clientChanTLS),
@@ -265,6 +321,7 @@ static void test_io_channel_tls(const void *opaque)
 
 int main(int argc, char **argv)
 {
+    bool has_ipv6;
     int ret;
 
     g_assert(qcrypto_init(NULL) == 0);
@@ -277,14 +334,18 @@ int main(int argc, char **argv)
 
     test_tls_init(KEYFILE);
 
+    if (socket_check_protocol_support(&has_ipv4, &has_ipv6) < 0) {
+        has_ipv4 = false;
+    }
+
 # define TEST_CHANNEL(name, caCrt,                                      \
                       serverCrt, clientCrt,                             \
                       expectServerFail, expectClientFail,               \
-                      hostname, wildcards)                              \
+                      hostname, wildcards, kernelTLS)                   \
     struct QIOChannelTLSTestData name = {                               \
         caCrt, caCrt, serverCrt, clientCrt,                             \
         expectServerFail, expectClientFail,                             \
-        hostname, wildcards                                             \
+        hostname, wildcards, kernelTLS                                  \
     };                                                                  \
     g_test_add_data_func("/qio/channel/tls/" # name,                    \
                          &name, test_io_channel_tls);
@@ -319,7 +380,10 @@ int main(int argc, char **argv)
     };
     TEST_CHANNEL(basic, cacertreq.filename, servercertreq.filename,
                  clientcertreq.filename, false, false,
-                 "qemu.org", wildcards);
+                 "qemu.org", wildcards, false);
+    TEST_CHANNEL(ktls, cacertreq.filename, servercertreq.filename,
+                 clientcertreq.filename, false, false,
+                 "qemu.org", wildcards, true);
 
     ret = g_test_run();
 
@@ -58,22 +58,59 @@
 #endif
 
 #include "qemu/mmap-alloc.h"
+#include "qemu/bitmap.h"
+
+#ifdef CONFIG_NUMA
+#include <numa.h>
+#endif
 
 #define MAX_MEM_PREALLOC_THREAD_COUNT 16
 
+/*
+ * Threads grab work in chunks of (at least) this size, rounded to whole
+ * pages, so that faster threads pick up the slack of slower ones and
+ * progress can be reported while preallocation is running.  With
+ * gigantic pages, a chunk is a single page.
+ */
+#define MEM_PREALLOC_CHUNK_SIZE (64 * MiB)
+
+/* Number of progress trace points emitted over the whole area */
+#define MEM_PREALLOC_PROGRESS_STEPS 10
+
 struct MemsetThread;
 
+/*
+ * A contiguous part of the area, preallocated by the threads that are
+ * assigned to it.  With node-aware preallocation there is one slice per
+ * host node, whose threads only run on the CPUs of that node.
+ */
+typedef struct MemsetSlice {
+    char *addr;
+    size_t numpages;
+    /* Index of the next page to hand out, updated atomically. */
+    size_t next;
+    /* CPUs of the node this slice is faulted from, or NULL. */
+    unsigned long *cpus;
+    int cpus_nbits;
+} MemsetSlice;
+
 typedef struct MemsetContext {
     bool all_threads_created;
     bool any_thread_failed;
     struct MemsetThread *threads;
     int num_threads;
+    MemsetSlice *slices;
+    int num_slices;
+    char *area;
+    size_t numpages;
+    size_t hpagesize;
+    size_t chunkpages;
+    /* Pages preallocated so far, updated atomically. */
+    size_t pages_done;
 } MemsetContext;
 
 struct MemsetThread {
-    char *addr;
-    size_t numpages;
-    size_t hpagesize;
+    MemsetSlice *slice;
     QemuThread pgthread;
     sigjmp_buf env;
     MemsetContext *context;
@@ -327,9 +364,40 @@ static void sigbus_handler(int signal)
     warn_report("qemu_prealloc_mem: unrelated SIGBUS detected and ignored");
 }
 
+/*
+ * Hand out the next chunk of @slice, returning the number of pages in it
+ * (0 once the slice is done) and its start in @addr.
+ */
+static size_t memset_next_chunk(MemsetContext *context, MemsetSlice *slice,
+                                char **addr)
+{
+    size_t start = qatomic_fetch_add(&slice->next, context->chunkpages);
+
+    if (start >= slice->numpages) {
+        return 0;
+    }
+    *addr = slice->addr + start * context->hpagesize;
+    return MIN(context->chunkpages, slice->numpages - start);
+}
+
+static void memset_chunk_done(MemsetContext *context, size_t numpages)
+{
+    size_t done = qatomic_fetch_add(&context->pages_done, numpages) + numpages;
+    size_t before = done - numpages;
+
+    if (before * MEM_PREALLOC_PROGRESS_STEPS / context->numpages !=
+        done * MEM_PREALLOC_PROGRESS_STEPS / context->numpages) {
+        trace_qemu_prealloc_mem_progress(context->area,
+                                         done * context->hpagesize,
+                                         context->numpages *
+                                         context->hpagesize);
+    }
+}
+
 static void *do_touch_pages(void *arg)
 {
     MemsetThread *memset_args = (MemsetThread *)arg;
+    MemsetContext *context = memset_args->context;
     sigset_t set, oldset;
     int ret = 0;
 
@@ -352,21 +420,25 @@ static void *do_touch_pages(void *arg)
     if (sigsetjmp(memset_args->env, 1)) {
         ret = -EFAULT;
     } else {
-        char *addr = memset_args->addr;
-        size_t numpages = memset_args->numpages;
-        size_t hpagesize = memset_args->hpagesize;
-        size_t i;
-        for (i = 0; i < numpages; i++) {
-            /*
-             * Read & write back the same value, so we don't
-             * corrupt existing user/app data that might be
-             * stored.
-             *
-             * 'volatile' to stop compiler optimizing this away
-             * to a no-op
-             */
-            *(volatile char *)addr = *addr;
-            addr += hpagesize;
+        const size_t hpagesize = context->hpagesize;
+        size_t numpages, i;
+        char *addr;
+
+        while ((numpages = memset_next_chunk(context, memset_args->slice,
+                                             &addr))) {
+            for (i = 0; i < numpages; i++) {
+                /*
+                 * Read & write back the same value, so we don't
+                 * corrupt existing user/app data that might be
+                 * stored.
+                 *
+                 * 'volatile' to stop compiler optimizing this away
+                 * to a no-op
+                 */
+                *(volatile char *)addr = *addr;
+                addr += hpagesize;
+            }
+            memset_chunk_done(context, numpages);
         }
     }
     pthread_sigmask(SIG_SETMASK, &oldset, NULL);
@@ -376,8 +448,9 @@ static void *do_touch_pages(void *arg)
 static void *do_madv_populate_write_pages(void *arg)
 {
     MemsetThread *memset_args = (MemsetThread *)arg;
-    const size_t size = memset_args->numpages * memset_args->hpagesize;
-    char * const addr = memset_args->addr;
+    MemsetContext *context = memset_args->context;
+    size_t numpages;
+    char *addr;
     int ret = 0;
 
     /* See do_touch_pages(). */
@@ -387,8 +460,14 @@ static void *do_madv_populate_write_pages(void *arg)
     }
     qemu_mutex_unlock(&page_mutex);
 
-    if (size && qemu_madvise(addr, size, QEMU_MADV_POPULATE_WRITE)) {
-        ret = -errno;
+    while ((numpages = memset_next_chunk(context, memset_args->slice,
+                                         &addr))) {
+        if (qemu_madvise(addr, numpages * context->hpagesize,
+                         QEMU_MADV_POPULATE_WRITE)) {
+            ret = -errno;
+            break;
+        }
+        memset_chunk_done(context, numpages);
     }
     return (void *)(uintptr_t)ret;
 }
@@ -412,17 +491,91 @@ static inline int get_memset_num_threads(size_t hpagesize, size_t numpages,
     return ret;
 }
 
+/*
+ * Create one slice per node in @host_nodes that has CPUs, for the
+ * threads of each slice to run on the CPUs of that node only.  With a
+ * bind or preferred-many policy, the kernel then allocates each slice
+ * from the node that faults it, which spreads the area evenly over the
+ * nodes and avoids zeroing pages over the interconnect; with interleave
+ * it at least spreads the faulting CPUs.  Returns the number of slices,
+ * or 0 to fall back to node-agnostic preallocation.
+ */
+static int memset_init_node_slices(MemsetContext *context,
+                                   const unsigned long *host_nodes,
+                                   unsigned long nbits)
+{
+#ifdef CONFIG_NUMA
+    struct bitmask *tmp_cpus;
+    MemsetSlice *slices;
+    unsigned long node;
+    int ncpus, n = 0, i;
+
+    if (!host_nodes || bitmap_empty(host_nodes, nbits) ||
+        numa_available() < 0) {
+        return 0;
+    }
+
+    ncpus = numa_num_possible_cpus();
+    slices = g_new0(MemsetSlice, bitmap_count_one(host_nodes, nbits));
+    tmp_cpus = numa_allocate_cpumask();
+    for (node = find_first_bit(host_nodes, nbits); node < nbits;
+         node = find_next_bit(host_nodes, nbits, node + 1)) {
+        unsigned long *cpus;
+
+        numa_bitmask_clearall(tmp_cpus);
+        if (numa_node_to_cpus(node, tmp_cpus)) {
+            continue;
+        }
+        cpus = bitmap_new(ncpus);
+        for (i = 0; i < ncpus; i++) {
+            if (numa_bitmask_isbitset(tmp_cpus, i)) {
+                set_bit(i, cpus);
+            }
+        }
+        if (bitmap_empty(cpus, ncpus)) {
+            /* Memory-only node: leave it to the CPUs of the others. */
+            g_free(cpus);
+            continue;
+        }
+        slices[n].cpus = cpus;
+        slices[n].cpus_nbits = ncpus;
+        n++;
+    }
+    numa_free_cpumask(tmp_cpus);
+
+    /* Every slice needs at least one thread. */
+    if (!n || n > context->num_threads || n > context->numpages) {
+        for (i = 0; i < n; i++) {
+            g_free(slices[i].cpus);
+        }
+        g_free(slices);
+        return 0;
+    }
+    context->slices = slices;
+    context->num_slices = n;
+    return n;
+#else
+    return 0;
+#endif
+}
+
 static int touch_all_pages(char *area, size_t hpagesize, size_t numpages,
                            int max_threads, ThreadContext *tc,
+                           const unsigned long *host_nodes,
+                           unsigned long nbits,
                            bool use_madv_populate_write)
 {
     static gsize initialized = 0;
     MemsetContext context = {
         .num_threads = get_memset_num_threads(hpagesize, numpages, max_threads),
+        .area = area,
+        .numpages = numpages,
+        .hpagesize = hpagesize,
+        .chunkpages = MAX(1, MEM_PREALLOC_CHUNK_SIZE / hpagesize),
     };
-    size_t numpages_per_thread, leftover;
+    size_t numpages_per_slice, leftover;
     void *(*touch_fn)(void *);
-    int ret = 0, i = 0;
+    int ret = 0, i = 0, err;
     char *addr = area;
 
     if (g_once_init_enter(&initialized)) {
@@ -431,9 +584,22 @@ static int touch_all_pages(char *area, size_t hpagesize, size_t numpages,
         g_once_init_leave(&initialized, 1);
     }
 
+    /*
+     * Threads created via a thread context inherit its CPU affinity,
+     * which takes precedence over the one derived from the nodes.
+     */
+    if (!tc) {
+        memset_init_node_slices(&context, host_nodes, nbits);
+    }
+    if (!context.num_slices) {
+        context.slices = g_new0(MemsetSlice, 1);
+        context.num_slices = 1;
+    }
+
     if (use_madv_populate_write) {
         /* Avoid creating a single thread for MADV_POPULATE_WRITE */
-        if (context.num_threads == 1) {
+        if (context.num_threads == 1 && !context.slices[0].cpus) {
+            g_free(context.slices);
             if (qemu_madvise(area, hpagesize * numpages,
                              QEMU_MADV_POPULATE_WRITE)) {
                 return -errno;
@@ -445,13 +611,22 @@ static int touch_all_pages(char *area, size_t hpagesize, size_t numpages,
         touch_fn = do_touch_pages;
     }
 
+    /* Slices are made of whole pages and thus hugepage-aligned. */
+    numpages_per_slice = numpages / context.num_slices;
+    leftover = numpages % context.num_slices;
+    for (i = 0; i < context.num_slices; i++) {
+        context.slices[i].addr = addr;
+        context.slices[i].numpages = numpages_per_slice + (i < leftover);
+        addr += context.slices[i].numpages * hpagesize;
+    }
+    trace_qemu_prealloc_mem_start(area, numpages * hpagesize, hpagesize,
+                                  context.num_threads, context.num_slices);
+
     context.threads = g_new0(MemsetThread, context.num_threads);
-    numpages_per_thread = numpages / context.num_threads;
-    leftover = numpages % context.num_threads;
     for (i = 0; i < context.num_threads; i++) {
-        context.threads[i].addr = addr;
-        context.threads[i].numpages = numpages_per_thread + (i < leftover);
-        context.threads[i].hpagesize = hpagesize;
+        MemsetSlice *slice = &context.slices[i % context.num_slices];
+
+        context.threads[i].slice = slice;
         context.threads[i].context = &context;
         if (tc) {
             thread_context_create_thread(tc, &context.threads[i].pgthread,
@@ -463,7 +638,18 @@ static int touch_all_pages(char *area, size_t hpagesize, size_t numpages,
                                touch_fn, &context.threads[i],
                                QEMU_THREAD_JOINABLE);
         }
-        addr += context.threads[i].numpages * hpagesize;
+        /*
+         * The thread does not touch memory before all threads have been
+         * created, so this is in place before its first fault.  Failing
+         * is not fatal, the pages just might end up on another node.
+         */
+        if (slice->cpus) {
+            err = qemu_thread_set_affinity(&context.threads[i].pgthread,
+                                           slice->cpus, slice->cpus_nbits);
+            if (err) {
+                trace_qemu_prealloc_mem_affinity_failed(area, i, err);
+            }
+        }
     }
 
     if (!use_madv_populate_write) {
@@ -486,6 +672,10 @@ static int touch_all_pages(char *area, size_t hpagesize, size_t numpages,
     if (!use_madv_populate_write) {
         sigbus_memset_context = NULL;
     }
+    for (i = 0; i < context.num_slices; i++) {
+        g_free(context.slices[i].cpus);
+    }
+    g_free(context.slices);
     g_free(context.threads);
 
     return ret;
@@ -497,8 +687,10 @@ static bool madv_populate_write_possible(char *area, size_t pagesize)
            errno != EINVAL;
 }
 
-void qemu_prealloc_mem(int fd, char *area, size_t sz, int max_threads,
-                       ThreadContext *tc, Error **errp)
+void qemu_prealloc_mem_nodes(int fd, char *area, size_t sz, int max_threads,
+                             ThreadContext *tc,
+                             const unsigned long *host_nodes,
+                             unsigned long nbits, Error **errp)
 {
     static gsize initialized;
     int ret;
@@ -540,7 +732,7 @@ void qemu_prealloc_mem(int fd, char *area, size_t sz, int max_threads,
 
     /* touch pages simultaneously */
     ret = touch_all_pages(area, hpagesize, numpages, max_threads, tc,
-                          use_madv_populate_write);
+                          host_nodes, nbits, use_madv_populate_write);
     if (ret) {
         error_setg_errno(errp, -ret,
                          "qemu_prealloc_mem: preallocating memory failed");
@@ -557,6 +749,12 @@ void qemu_prealloc_mem(int fd, char *area, size_t sz, int max_threads,
     }
 }
 
+void qemu_prealloc_mem(int fd, char *area, size_t sz, int max_threads,
+                       ThreadContext *tc, Error **errp)
+{
+    qemu_prealloc_mem_nodes(fd, area, sz, max_threads, tc, NULL, 0, errp);
+}
+
 char *qemu_get_pid_name(pid_t pid)
 {
     char *name = NULL;
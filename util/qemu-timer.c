@@ -61,12 +61,22 @@ static QEMUClock qemu_clocks[QEMU_CLOCK_MAX];
  * used by different AioContexts / threads. Each clock also has
  * a list of the QEMUTimerLists associated with it, in order that
  * reenabling the clock can call all the notifiers.
+ *
+ * The pending timers are kept in a binary min-heap, ordered by expire
+ * time and, for equal expire times, by the order in which they were
+ * armed, so that timer_mod and timer_del are O(log n).  active_timers
+ * points to the top of the heap, or is NULL if no timer is pending; it
+ * can be read without the lock to check for pending timers.
  */
 
 struct QEMUTimerList {
     QEMUClock *clock;
     QemuMutex active_timers_lock;
     QEMUTimer *active_timers;
+    QEMUTimer **heap;
+    size_t nr_timers;
+    size_t heap_size;
+    uint64_t seq;
     QLIST_ENTRY(QEMUTimerList) list;
     QEMUTimerListNotifyCB *notify_cb;
     void *notify_opaque;
@@ -117,6 +127,7 @@ void timerlist_free(QEMUTimerList *timer_list)
         QLIST_REMOVE(timer_list, list);
     }
     qemu_mutex_destroy(&timer_list->active_timers_lock);
+    g_free(timer_list->heap);
     g_free(timer_list);
 }
 
@@ -247,12 +258,38 @@ int64_t timerlist_deadline_ns(QEMUTimerList *timer_list)
  * ignore whether or not the clock should be used in deadline
  * calculations.
  */
+/*
+ * Return the earliest expire time of the timers in the subheap rooted
+ * at @i that have no attributes outside @attr_mask, or -1 if there are
+ * none.  Children never expire earlier than their parent, so a subtree
+ * is not visited below the first matching timer.
+ */
+static int64_t timerlist_first_expire_locked(QEMUTimerList *timer_list,
+                                             size_t i, int attr_mask)
+{
+    QEMUTimer *ts;
+    int64_t left, right;
+
+    if (i >= timer_list->nr_timers) {
+        return -1;
+    }
+    ts = timer_list->heap[i];
+    if (!(ts->attributes & ~attr_mask)) {
+        return ts->expire_time;
+    }
+    left = timerlist_first_expire_locked(timer_list, 2 * i + 1, attr_mask);
+    right = timerlist_first_expire_locked(timer_list, 2 * i + 2, attr_mask);
+    if (left == -1 || right == -1) {
+        return MAX(left, right);
+    }
+    return MIN(left, right);
+}
+
 int64_t qemu_clock_deadline_ns_all(QEMUClockType type, int attr_mask)
 {
     int64_t deadline = -1;
     int64_t delta;
     int64_t expire_time;
-    QEMUTimer *ts;
     QEMUTimerList *timer_list;
     QEMUClock *clock = qemu_clock_ptr(type);
 
@@ -265,17 +302,12 @@ int64_t qemu_clock_deadline_ns_all(QEMUClockType type, int attr_mask)
             continue;
         }
         qemu_mutex_lock(&timer_list->active_timers_lock);
-        ts = timer_list->active_timers;
         /* Skip all external timers */
-        while (ts && (ts->attributes & ~attr_mask)) {
-            ts = ts->next;
-        }
-        if (!ts) {
-            qemu_mutex_unlock(&timer_list->active_timers_lock);
+        expire_time = timerlist_first_expire_locked(timer_list, 0, attr_mask);
+        qemu_mutex_unlock(&timer_list->active_timers_lock);
+        if (expire_time == -1) {
             continue;
         }
-        expire_time = ts->expire_time;
-        qemu_mutex_unlock(&timer_list->active_timers_lock);
 
         delta = expire_time - qemu_clock_get_ns(type);
         if (delta <= 0) {
@@ -378,43 +410,122 @@ void timer_deinit(QEMUTimer *ts)
     ts->timer_list = NULL;
 }
 
-static void timer_del_locked(QEMUTimerList *timer_list, QEMUTimer *ts)
+static bool timer_before(const QEMUTimer *a, const QEMUTimer *b)
+{
+    return a->expire_time < b->expire_time ||
+           (a->expire_time == b->expire_time && a->seq < b->seq);
+}
+
+static void timer_heap_set(QEMUTimerList *timer_list, size_t i,
+                           QEMUTimer *ts)
 {
-    QEMUTimer **pt, *t;
+    timer_list->heap[i] = ts;
+    ts->heap_index = i;
+}
 
-    ts->expire_time = -1;
-    pt = &timer_list->active_timers;
-    for(;;) {
-        t = *pt;
-        if (!t)
+static void timer_heap_up(QEMUTimerList *timer_list, size_t i)
+{
+    QEMUTimer *ts = timer_list->heap[i];
+
+    while (i > 0) {
+        size_t parent = (i - 1) / 2;
+
+        if (!timer_before(ts, timer_list->heap[parent])) {
+            break;
+        }
+        timer_heap_set(timer_list, i, timer_list->heap[parent]);
+        i = parent;
+    }
+    timer_heap_set(timer_list, i, ts);
+}
+
+static void timer_heap_down(QEMUTimerList *timer_list, size_t i)
+{
+    QEMUTimer *ts = timer_list->heap[i];
+    size_t n = timer_list->nr_timers;
+
+    for (;;) {
+        size_t child = 2 * i + 1;
+
+        if (child >= n) {
             break;
-        if (t == ts) {
-            qatomic_set(pt, t->next);
+        }
+        if (child + 1 < n &&
+            timer_before(timer_list->heap[child + 1],
+                         timer_list->heap[child])) {
+            child++;
+        }
+        if (!timer_before(timer_list->heap[child], ts)) {
             break;
         }
-        pt = &t->next;
+        timer_heap_set(timer_list, i, timer_list->heap[child]);
+        i = child;
+    }
+    timer_heap_set(timer_list, i, ts);
+}
+
+static void timer_heap_publish(QEMUTimerList *timer_list)
+{
+    qatomic_set(&timer_list->active_timers,
+                timer_list->nr_timers ? timer_list->heap[0] : NULL);
+}
+
+static void timer_del_locked(QEMUTimerList *timer_list, QEMUTimer *ts)
+{
+    QEMUTimer *last;
+    size_t i = ts->heap_index;
+
+    if (ts->expire_time == -1) {
+        return;
+    }
+    ts->expire_time = -1;
+
+    assert(i < timer_list->nr_timers && timer_list->heap[i] == ts);
+    last = timer_list->heap[--timer_list->nr_timers];
+    if (last != ts) {
+        timer_heap_set(timer_list, i, last);
+        if (i > 0 && timer_before(last, timer_list->heap[(i - 1) / 2])) {
+            timer_heap_up(timer_list, i);
+        } else {
+            timer_heap_down(timer_list, i);
+        }
     }
+    timer_heap_publish(timer_list);
 }
 
+/*
+ * Arm @ts, or move it if it is already pending.  Return true if it is
+ * now the first timer to expire.
+ */
 static bool timer_mod_ns_locked(QEMUTimerList *timer_list,
                                 QEMUTimer *ts, int64_t expire_time)
 {
-    QEMUTimer **pt, *t;
+    size_t i;
 
-    /* add the timer in the sorted list */
-    pt = &timer_list->active_timers;
-    for (;;) {
-        t = *pt;
-        if (!timer_expired_ns(t, expire_time)) {
-            break;
+    if (ts->expire_time == -1) {
+        i = timer_list->nr_timers;
+        if (i == timer_list->heap_size) {
+            timer_list->heap_size = MAX(timer_list->heap_size * 2, 16);
+            timer_list->heap = g_renew(QEMUTimer *, timer_list->heap,
+                                       timer_list->heap_size);
         }
-        pt = &t->next;
+        timer_list->nr_timers++;
+        timer_list->heap[i] = ts;
+    } else {
+        i = ts->heap_index;
     }
+
+    /* Equal expire times fire in the order they were armed */
     ts->expire_time = MAX(expire_time, 0);
-    ts->next = *pt;
-    qatomic_set(pt, ts);
+    ts->seq = timer_list->seq++;
+    if (i > 0 && timer_before(ts, timer_list->heap[(i - 1) / 2])) {
+        timer_heap_up(timer_list, i);
+    } else {
+        timer_heap_down(timer_list, i);
+    }
+    timer_heap_publish(timer_list);
 
-    return pt == &timer_list->active_timers;
+    return timer_list->heap[0] == ts;
 }
 
 static void timerlist_rearm(QEMUTimerList *timer_list)
@@ -446,7 +557,6 @@ void timer_mod_ns(QEMUTimer *ts, int64_t expire_time)
     bool rearm;
 
     qemu_mutex_lock(&timer_list->active_timers_lock);
-    timer_del_locked(timer_list, ts);
     rearm = timer_mod_ns_locked(timer_list, ts, expire_time);
     qemu_mutex_unlock(&timer_list->active_timers_lock);
 
@@ -465,9 +575,6 @@ void timer_mod_anticipate_ns(QEMUTimer *ts, int64_t expire_time)
 
     WITH_QEMU_LOCK_GUARD(&timer_list->active_timers_lock) {
         if (ts->expire_time == -1 || ts->expire_time > expire_time) {
-            if (ts->expire_time != -1) {
-                timer_del_locked(timer_list, ts);
-            }
             rearm = timer_mod_ns_locked(timer_list, ts, expire_time);
         } else {
             rearm = false;
@@ -565,9 +672,7 @@ bool timerlist_run_timers(QEMUTimerList *timer_list)
         }
 
         /* remove timer from the list before calling the callback */
-        timer_list->active_timers = ts->next;
-        ts->next = NULL;
-        ts->expire_time = -1;
+        timer_del_locked(timer_list, ts);
         cb = ts->cb;
         opaque = ts->opaque;
 
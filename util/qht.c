@@ -22,8 +22,8 @@
  * - Writes (i.e. insertions/removals) can be concurrent with writes to
  *   different buckets; writes to the same bucket are serialized through a lock.
  * - Optional auto-resizing: the hash table resizes up if the load surpasses
- *   a certain threshold. Resizing is done concurrently with readers; writes
- *   are serialized with the resize operation.
+ *   a certain threshold. Resizing is done concurrently with readers and,
+ *   for auto-resizing, incrementally by the writers that follow it.
  *
  * The key structure is the bucket, which is cacheline-sized. Buckets
  * contain a few hash values and pointers; the u32 hash values are stored in
@@ -43,10 +43,24 @@
  * just-removed entry. This makes lookups slightly faster, since the moment an
  * invalid entry is found, the (failed) lookup is over.
  *
- * Resizing is done by taking all bucket spinlocks (so that no other writers can
- * race with us) and then copying all entries into a new hash map. Then, the
- * ht->map pointer is set, and the old map is freed once no RCU readers can see
- * it anymore.
+ * Explicit resizes (qht_resize() and qht_reset_size()) are done by taking all
+ * bucket spinlocks (so that no other writers can race with us) and then
+ * copying all entries into a new hash map. Then, the ht->map pointer is set,
+ * and the old map is freed once no RCU readers can see it anymore.
+ *
+ * Auto-resizes do not stop the world: a map twice as large is published
+ * right away, with its @old field pointing to the previous map, and the old
+ * head buckets are then moved one by one, under their lock, into the new
+ * map. Every writer first moves the old bucket of the hash it is about to
+ * write, so that a hash is only ever written in the new map once its old
+ * bucket is empty, and then moves a few more buckets so that the resize
+ * completes even if some hashes are never written. The writer that moves the
+ * last bucket clears @old and frees the old map after an RCU grace period.
+ * Lookups check the old bucket before the new one; since a bucket's entries
+ * are copied to the new map before they are cleared from the old one, an
+ * entry is always found in one of the two. Lookups that miss recheck
+ * ht->map, in case they were looking at a map that has since been emptied.
+ * Iterators and explicit resizes complete a pending auto-resize first.
  *
  * Writers check for concurrent resizes by comparing ht->map before and after
  * acquiring their bucket lock. If they don't match, a resize has occurred
@@ -70,6 +84,7 @@
 #include "qemu/atomic.h"
 #include "qemu/rcu.h"
 #include "qemu/memalign.h"
+#include "qemu/timer.h"
 
 //#define QHT_DEBUG
 
@@ -176,6 +191,11 @@ struct qht_tsan_lock {
  * @n_added_buckets: number of added (i.e. "non-head") buckets
  * @n_added_buckets_threshold: threshold to trigger an upward resize once the
  *                             number of added buckets surpasses it.
+ * @old: map whose entries are being moved into this one by an auto-resize,
+ *       or NULL. Set before the map is published, cleared under ht->lock.
+ * @migrate_next: index of the next head bucket of @old to be moved.
+ * @n_migrated: number of head buckets of @old moved via @migrate_next.
+ * @resize_start: get_clock() when the resize to this map started.
  * @tsan_bucket_locks: Array of striped locks to be used only under TSAN.
  *
  * Buckets are tracked in what we call a "map", i.e. this structure.
@@ -186,6 +206,10 @@ struct qht_map {
     size_t n_buckets;
     size_t n_added_buckets;
     size_t n_added_buckets_threshold;
+    struct qht_map *old;
+    size_t migrate_next;
+    size_t n_migrated;
+    int64_t resize_start;
 #ifdef CONFIG_TSAN
     struct qht_tsan_lock tsan_bucket_locks[QHT_TSAN_BUCKET_LOCKS];
 #endif
@@ -194,9 +218,14 @@ struct qht_map {
 /* trigger a resize when n_added_buckets > n_buckets / div */
 #define QHT_NR_ADDED_BUCKETS_THRESHOLD_DIV 8
 
+/* head buckets moved by each write during an auto-resize, on top of its own */
+#define QHT_MIGRATE_STEP 4
+
 static void qht_do_resize_reset(struct qht *ht, struct qht_map *new,
                                 bool reset);
 static void qht_grow_maybe(struct qht *ht);
+static void qht_map_migrate_hash(struct qht *ht, struct qht_map *map,
+                                 uint32_t hash);
 
 #ifdef QHT_DEBUG
 
@@ -342,36 +371,8 @@ static inline bool qht_map_is_stale__locked(const struct qht *ht,
 }
 
 /*
- * Grab all bucket locks, and set @pmap after making sure the map isn't stale.
- *
- * Pairs with qht_map_unlock_buckets(), hence the pass-by-reference.
- *
- * Note: callers cannot have ht->lock held.
- */
-static inline
-void qht_map_lock_buckets__no_stale(struct qht *ht, struct qht_map **pmap)
-{
-    struct qht_map *map;
-
-    map = qatomic_rcu_read(&ht->map);
-    qht_map_lock_buckets(map);
-    if (likely(!qht_map_is_stale__locked(ht, map))) {
-        *pmap = map;
-        return;
-    }
-    qht_map_unlock_buckets(map);
-
-    /* we raced with a resize; acquire ht->lock to see the updated ht->map */
-    qht_lock(ht);
-    map = ht->map;
-    qht_map_lock_buckets(map);
-    qht_unlock(ht);
-    *pmap = map;
-    return;
-}
-
-/*
- * Get a head bucket and lock it, making sure its parent map is not stale.
+ * Get a head bucket and lock it, making sure its parent map is not stale,
+ * and that no entries for @hash are left in a map being resized away from.
  * @pmap is filled with a pointer to the bucket's parent map.
  *
  * Unlock with qht_bucket_unlock.
@@ -386,6 +387,7 @@ struct qht_bucket *qht_bucket_lock__no_stale(struct qht *ht, uint32_t hash,
     struct qht_map *map;
 
     map = qatomic_rcu_read(&ht->map);
+    qht_map_migrate_hash(ht, map, hash);
     b = qht_map_to_bucket(map, hash);
 
     qht_bucket_lock(map, b);
@@ -398,6 +400,7 @@ struct qht_bucket *qht_bucket_lock__no_stale(struct qht *ht, uint32_t hash,
     /* we raced with a resize; acquire ht->lock to see the updated ht->map */
     qht_lock(ht);
     map = ht->map;
+    qht_map_migrate_hash(ht, map, hash);
     b = qht_map_to_bucket(map, hash);
     qht_bucket_lock(map, b);
     qht_unlock(ht);
@@ -444,6 +447,10 @@ static struct qht_map *qht_map_create(size_t n_buckets)
 
     map = g_malloc(sizeof(*map));
     map->n_buckets = n_buckets;
+    map->old = NULL;
+    map->migrate_next = 0;
+    map->n_migrated = 0;
+    map->resize_start = 0;
 
     map->n_added_buckets = 0;
     map->n_added_buckets_threshold = n_buckets /
@@ -471,6 +478,8 @@ void qht_init(struct qht *ht, qht_cmp_func_t cmp, size_t n_elems,
     g_assert(cmp);
     ht->cmp = cmp;
     ht->mode = mode;
+    ht->n_resizes = 0;
+    stat64_init(&ht->resize_ns, 0);
     qemu_mutex_init(&ht->lock);
     map = qht_map_create(n_buckets);
     qatomic_rcu_set(&ht->map, map);
@@ -479,6 +488,9 @@ void qht_init(struct qht *ht, qht_cmp_func_t cmp, size_t n_elems,
 /* call only when there are no readers/writers left */
 void qht_destroy(struct qht *ht)
 {
+    if (ht->map->old) {
+        qht_map_destroy(ht->map->old);
+    }
     qht_map_destroy(ht->map);
     memset(ht, 0, sizeof(*ht));
 }
@@ -514,15 +526,6 @@ static void qht_map_reset__all_locked(struct qht_map *map)
     qht_map_debug__all_locked(map);
 }
 
-void qht_reset(struct qht *ht)
-{
-    struct qht_map *map;
-
-    qht_map_lock_buckets__no_stale(ht, &map);
-    qht_map_reset__all_locked(map);
-    qht_map_unlock_buckets(map);
-}
-
 static inline void qht_do_resize(struct qht *ht, struct qht_map *new)
 {
     qht_do_resize_reset(ht, new, false);
@@ -533,6 +536,13 @@ static inline void qht_do_resize_and_reset(struct qht *ht, struct qht_map *new)
     qht_do_resize_reset(ht, new, true);
 }
 
+void qht_reset(struct qht *ht)
+{
+    qht_lock(ht);
+    qht_do_resize_and_reset(ht, NULL);
+    qht_unlock(ht);
+}
+
 bool qht_reset_size(struct qht *ht, size_t n_elems)
 {
     struct qht_map *new = NULL;
@@ -579,9 +589,9 @@ void *qht_do_lookup(const struct qht_bucket *head, qht_lookup_func_t func,
     return NULL;
 }
 
-static __attribute__((noinline))
-void *qht_lookup__slowpath(const struct qht_bucket *b, qht_lookup_func_t func,
-                           const void *userp, uint32_t hash)
+static void *qht_bucket_lookup(const struct qht_bucket *b,
+                               qht_lookup_func_t func,
+                               const void *userp, uint32_t hash)
 {
     unsigned int version;
     void *ret;
@@ -593,6 +603,48 @@ void *qht_lookup__slowpath(const struct qht_bucket *b, qht_lookup_func_t func,
     return ret;
 }
 
+static __attribute__((noinline))
+void *qht_lookup__slowpath(const struct qht *ht, const struct qht_map *map,
+                           qht_lookup_func_t func, const void *userp,
+                           uint32_t hash)
+{
+    const struct qht_map *next;
+    void *ret;
+
+    for (;;) {
+        const struct qht_map *old = qatomic_rcu_read(&map->old);
+
+        /*
+         * Entries are copied from @old to @map before being cleared from
+         * @old, so look in @old first: if they are gone from there, they
+         * are already in @map.
+         */
+        if (old) {
+            ret = qht_bucket_lookup(qht_map_to_bucket(old, hash), func, userp,
+                                    hash);
+            if (ret) {
+                return ret;
+            }
+        }
+        ret = qht_bucket_lookup(qht_map_to_bucket(map, hash), func, userp,
+                                hash);
+        if (ret) {
+            return ret;
+        }
+
+        /*
+         * @map may have been emptied into a newer map since we read it.
+         * The smp_rmb() in seqlock_read_retry orders this read after the
+         * bucket's.
+         */
+        next = qatomic_rcu_read(&ht->map);
+        if (next == map) {
+            return NULL;
+        }
+        map = next;
+    }
+}
+
 void *qht_lookup_custom(const struct qht *ht, const void *userp, uint32_t hash,
                         qht_lookup_func_t func)
 {
@@ -602,18 +654,21 @@ void *qht_lookup_custom(const struct qht *ht, const void *userp, uint32_t hash,
     void *ret;
 
     map = qatomic_rcu_read(&ht->map);
-    b = qht_map_to_bucket(map, hash);
+    if (likely(qatomic_read(&map->old) == NULL)) {
+        b = qht_map_to_bucket(map, hash);
 
-    version = seqlock_read_begin(&b->sequence);
-    ret = qht_do_lookup(b, func, userp, hash);
-    if (likely(!seqlock_read_retry(&b->sequence, version))) {
-        return ret;
+        version = seqlock_read_begin(&b->sequence);
+        ret = qht_do_lookup(b, func, userp, hash);
+        if (likely(!seqlock_read_retry(&b->sequence, version)) &&
+            likely(ret || map == qatomic_read(&ht->map))) {
+            return ret;
+        }
     }
     /*
      * Removing the do/while from the fastpath gives a 4% perf. increase when
      * running a 100%-lookup microbenchmark.
      */
-    return qht_lookup__slowpath(b, func, userp, hash);
+    return qht_lookup__slowpath(ht, map, func, userp, hash);
 }
 
 void *qht_lookup(const struct qht *ht, const void *userp, uint32_t hash)
@@ -671,6 +726,127 @@ static void *qht_insert__locked(const struct qht *ht, struct qht_map *map,
     return NULL;
 }
 
+/*
+ * Move the entries of @old's head bucket @idx into @map.
+ * Call with the RCU read lock held, or with ht->lock held.
+ *
+ * The old bucket's lock is taken before those of @map; nothing else takes
+ * bucket locks of two maps at once, except with ht->lock held and in the
+ * same order.
+ */
+static void qht_map_migrate_bucket(const struct qht *ht, struct qht_map *map,
+                                   struct qht_map *old, size_t idx)
+{
+    struct qht_bucket *head = &old->buckets[idx];
+    struct qht_bucket *b;
+    int i;
+
+    qht_bucket_lock(old, head);
+    if (head->pointers[0] == NULL) {
+        goto out;
+    }
+    for (b = head; b; b = b->next) {
+        for (i = 0; i < QHT_BUCKET_ENTRIES; i++) {
+            struct qht_bucket *to;
+
+            if (b->pointers[i] == NULL) {
+                goto done;
+            }
+            to = qht_map_to_bucket(map, b->hashes[i]);
+            qht_bucket_lock(map, to);
+            qht_insert__locked(ht, map, to, b->pointers[i], b->hashes[i],
+                               NULL);
+            qht_bucket_debug__locked(to);
+            qht_bucket_unlock(map, to);
+        }
+    }
+ done:
+    /* only now, so that lookups find every entry in one of the two maps */
+    qht_bucket_reset__locked(head);
+ out:
+    qht_bucket_unlock(old, head);
+}
+
+/* call with ht->lock held, once all of @old has been moved into @map */
+static void qht_map_end_resize(struct qht *ht, struct qht_map *map,
+                               struct qht_map *old)
+{
+    qatomic_set(&map->old, NULL);
+    stat64_set(&ht->resize_ns, get_clock() - map->resize_start);
+    qatomic_set(&ht->n_resizes, ht->n_resizes + 1);
+    call_rcu(old, qht_map_destroy, rcu);
+}
+
+/* call with ht->lock held; completes an ongoing auto-resize, if any */
+static void qht_finish_resize__locked(struct qht *ht)
+{
+    struct qht_map *map = ht->map;
+    struct qht_map *old = map->old;
+    size_t i;
+
+    if (old == NULL) {
+        return;
+    }
+    for (i = 0; i < old->n_buckets; i++) {
+        qht_map_migrate_bucket(ht, map, old, i);
+    }
+    qht_map_end_resize(ht, map, old);
+}
+
+/*
+ * Writers call this before locking @hash's bucket in @map, so that they
+ * never modify a hash that still has entries in the old map.
+ */
+static void qht_map_migrate_hash(struct qht *ht, struct qht_map *map,
+                                 uint32_t hash)
+{
+    struct qht_map *old;
+
+    if (likely(qatomic_read(&map->old) == NULL)) {
+        return;
+    }
+
+    RCU_READ_LOCK_GUARD();
+    old = qatomic_rcu_read(&map->old);
+    if (old) {
+        qht_map_migrate_bucket(ht, map, old, hash & (old->n_buckets - 1));
+    }
+}
+
+/*
+ * Move a few more buckets of an ongoing auto-resize, and end it if we
+ * moved the last one. Call without any lock held.
+ */
+static __attribute__((noinline))
+void qht_map_migrate_step(struct qht *ht, struct qht_map *map)
+{
+    struct qht_map *old;
+    int i;
+
+    RCU_READ_LOCK_GUARD();
+    old = qatomic_rcu_read(&map->old);
+    if (old == NULL) {
+        return;
+    }
+    for (i = 0; i < QHT_MIGRATE_STEP; i++) {
+        size_t idx = qatomic_fetch_inc(&map->migrate_next);
+
+        if (idx >= old->n_buckets) {
+            return;
+        }
+        qht_map_migrate_bucket(ht, map, old, idx);
+        if (qatomic_fetch_inc(&map->n_migrated) + 1 == old->n_buckets) {
+            qht_lock(ht);
+            /* qht_finish_resize__locked() might have beaten us to it */
+            if (map->old == old) {
+                qht_map_end_resize(ht, map, old);
+            }
+            qht_unlock(ht);
+            return;
+        }
+    }
+}
+
 static __attribute__((noinline)) void qht_grow_maybe(struct qht *ht)
 {
     struct qht_map *map;
@@ -683,11 +859,17 @@ static __attribute__((noinline)) void qht_grow_maybe(struct qht *ht)
         return;
     }
     map = ht->map;
-    /* another thread might have just performed the resize we were after */
-    if (qht_map_needs_resize(map)) {
+    /*
+     * Another thread might have just performed the resize we were after,
+     * or it might still be in progress.
+     */
+    if (qht_map_needs_resize(map) && map->old == NULL) {
         struct qht_map *new = qht_map_create(map->n_buckets * 2);
 
-        qht_do_resize(ht, new);
+        /* the buckets of @map are moved by the writers that follow */
+        new->old = map;
+        new->resize_start = get_clock();
+        qatomic_rcu_set(&ht->map, new);
     }
     qht_unlock(ht);
 }
@@ -707,7 +889,9 @@ bool qht_insert(struct qht *ht, void *p, uint32_t hash, void **existing)
     qht_bucket_debug__locked(b);
     qht_bucket_unlock(map, b);
 
-    if (unlikely(needs_resize) && ht->mode & QHT_MODE_AUTO_RESIZE) {
+    if (unlikely(qatomic_read(&map->old))) {
+        qht_map_migrate_step(ht, map);
+    } else if (unlikely(needs_resize) && ht->mode & QHT_MODE_AUTO_RESIZE) {
         qht_grow_maybe(ht);
     }
     if (likely(prev == NULL)) {
@@ -817,6 +1001,10 @@ bool qht_remove(struct qht *ht, const void *p, uint32_t hash)
     ret = qht_remove__locked(b, p, hash);
     qht_bucket_debug__locked(b);
     qht_bucket_unlock(map, b);
+
+    if (unlikely(qatomic_read(&map->old))) {
+        qht_map_migrate_step(ht, map);
+    }
     return ret;
 }
 
@@ -872,8 +1060,17 @@ do_qht_iter(struct qht *ht, const struct qht_iter *iter, void *userp)
 {
     struct qht_map *map;
 
-    map = qatomic_rcu_read(&ht->map);
+    /*
+     * Holding ht->lock until all bucket locks are taken makes sure that
+     * no auto-resize is pending: one that starts afterwards cannot move
+     * any entry until we are done.
+     */
+    qht_lock(ht);
+    qht_finish_resize__locked(ht);
+    map = ht->map;
     qht_map_lock_buckets(map);
+    qht_unlock(ht);
+
     qht_map_iter__all_locked(map, iter, userp);
     qht_map_unlock_buckets(map);
 }
@@ -926,7 +1123,9 @@ static void qht_do_resize_reset(struct qht *ht, struct qht_map *new, bool reset)
         .type = QHT_ITER_VOID,
     };
     struct qht_map_copy_data data;
+    int64_t t0 = get_clock();
 
+    qht_finish_resize__locked(ht);
     old = ht->map;
     qht_map_lock_buckets(old);
 
@@ -948,6 +1147,9 @@ static void qht_do_resize_reset(struct qht *ht, struct qht_map *new, bool reset)
     qatomic_rcu_set(&ht->map, new);
     qht_map_unlock_buckets(old);
     call_rcu(old, qht_map_destroy, rcu);
+
+    stat64_set(&ht->resize_ns, get_clock() - t0);
+    qatomic_set(&ht->n_resizes, ht->n_resizes + 1);
 }
 
 bool qht_resize(struct qht *ht, size_t n_elems)
@@ -968,25 +1170,12 @@ bool qht_resize(struct qht *ht, size_t n_elems)
     return ret;
 }
 
-/* pass @stats to qht_statistics_destroy() when done */
-void qht_statistics_init(const struct qht *ht, struct qht_stats *stats)
+/* count the entries in @map's chains; add to the histograms if @hist */
+static void qht_map_statistics(const struct qht_map *map,
+                               struct qht_stats *stats, bool hist)
 {
-    const struct qht_map *map;
     int i;
 
-    map = qatomic_rcu_read(&ht->map);
-
-    stats->used_head_buckets = 0;
-    stats->entries = 0;
-    qdist_init(&stats->chain);
-    qdist_init(&stats->occupancy);
-    /* bail out if the qht has not yet been initialized */
-    if (unlikely(map == NULL)) {
-        stats->head_buckets = 0;
-        return;
-    }
-    stats->head_buckets = map->n_buckets;
-
     for (i = 0; i < map->n_buckets; i++) {
         const struct qht_bucket *head = &map->buckets[i];
         const struct qht_bucket *b;
@@ -1012,18 +1201,58 @@ void qht_statistics_init(const struct qht *ht, struct qht_stats *stats)
             } while (b);
         } while (seqlock_read_retry(&head->sequence, version));
 
+        stats->entries += entries;
+        if (!hist) {
+            continue;
+        }
         if (entries) {
             qdist_inc(&stats->chain, buckets);
             qdist_inc(&stats->occupancy,
                       (double)entries / QHT_BUCKET_ENTRIES / buckets);
             stats->used_head_buckets++;
-            stats->entries += entries;
         } else {
             qdist_inc(&stats->occupancy, 0);
         }
     }
 }
 
+/* pass @stats to qht_statistics_destroy() when done */
+void qht_statistics_init(const struct qht *ht, struct qht_stats *stats)
+{
+    const struct qht_map *map;
+    const struct qht_map *old;
+
+    /* the old map of an auto-resize may go away while we look at it */
+    RCU_READ_LOCK_GUARD();
+    map = qatomic_rcu_read(&ht->map);
+
+    stats->used_head_buckets = 0;
+    stats->entries = 0;
+    stats->load = 0;
+    stats->resizes = qatomic_read(&ht->n_resizes);
+    stats->resize_ns = stat64_get(&ht->resize_ns);
+    stats->resize_pending = 0;
+    qdist_init(&stats->chain);
+    qdist_init(&stats->occupancy);
+    /* bail out if the qht has not yet been initialized */
+    if (unlikely(map == NULL)) {
+        stats->head_buckets = 0;
+        return;
+    }
+    stats->head_buckets = map->n_buckets;
+
+    /* an entry being moved may be seen twice or not at all */
+    old = qatomic_rcu_read(&map->old);
+    if (old) {
+        size_t done = MIN(qatomic_read(&map->n_migrated), old->n_buckets);
+
+        qht_map_statistics(old, stats, false);
+        stats->resize_pending = old->n_buckets - done;
+    }
+    qht_map_statistics(map, stats, true);
+    stats->load = (double)stats->entries / QHT_BUCKET_ENTRIES / map->n_buckets;
+}
+
 void qht_statistics_destroy(struct qht_stats *stats)
 {
     qdist_destroy(&stats->occupancy);